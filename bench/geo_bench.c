@@ -0,0 +1,231 @@
+/*===--------------------------------------------------------------------------------------------===
+ * geo_bench.c
+ *
+ * Times the geo_batch kernels on every instruction set this CPU has, against the double-precision
+ * geo.h helpers, and reports the worst error seen for each.
+ *
+ *     geo_bench [points] [repeats]
+ *===--------------------------------------------------------------------------------------------===
+*/
+#include "geo.h"
+#include "geo_batch.h"
+#include "clock.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef enum {
+    K_DISTANCE,
+    K_BEARING,
+    K_AZEQ,
+    K_MERCATOR,
+    K_INTERPOLATE,
+    K_COUNT
+} kernel_t;
+
+static const char *kernel_names[K_COUNT] = {
+    "distance", "bearing", "azeq", "mercator", "interpolate"
+};
+
+// Reference and test inputs. Points are spread over the whole globe so the wrap-around and polar
+// cases get exercised, not just the easy mid-latitudes.
+static size_t count;
+static float *lat, *lon, *t;
+static float *out_a, *out_b;
+static double *ref_a, *ref_b;
+
+static const double lat0 = 47.4647, lon0 = -122.3088;
+static const double lat2 = 51.4700, lon2 = -0.4543;
+
+static double frand(double lo, double hi)
+{
+    return lo + (hi - lo) * ((double)rand() / (double)RAND_MAX);
+}
+
+static void ref_azeq(double lat_deg, double lon_deg, double *x, double *y)
+{
+    double phi0 = lat0 * DEG2RAD, phi = lat_deg * DEG2RAD;
+    double dl = (lon_deg - lon0) * DEG2RAD;
+    double cos_c = sin(phi0) * sin(phi) + cos(phi0) * cos(phi) * cos(dl);
+    double xp = cos(phi) * sin(dl);
+    double yp = cos(phi0) * sin(phi) - sin(phi0) * cos(phi) * cos(dl);
+    double c = atan2(sqrt(xp * xp + yp * yp), cos_c);
+    double k = c < 1e-12 ? 1.0 : c / sin(c);
+    *x = EARTH_RADIUS_NM * k * xp;
+    *y = EARTH_RADIUS_NM * k * yp;
+}
+
+static double merc_y(double lat_deg)
+{
+    lat_deg = fmax(fmin(lat_deg, 85.05113), -85.05113);
+    return EARTH_RADIUS_NM * atanh(sin(lat_deg * DEG2RAD));
+}
+
+static void ref_mercator(double lat_deg, double lon_deg, double *x, double *y)
+{
+    *x = geo_wrap_lon(lon_deg - lon0) * DEG2RAD * EARTH_RADIUS_NM;
+    *y = merc_y(lat_deg) - merc_y(lat0);
+}
+
+static void ref_interpolate(double f, double *out_lat, double *out_lon)
+{
+    double phi1 = lat0 * DEG2RAD, lambda1 = lon0 * DEG2RAD;
+    double phi2 = lat2 * DEG2RAD, lambda2 = lon2 * DEG2RAD;
+    double d = geo_distance_nm(lat0, lon0, lat2, lon2) / EARTH_RADIUS_NM;
+    double a = sin((1.0 - f) * d) / sin(d);
+    double b = sin(f * d) / sin(d);
+    double x = a * cos(phi1) * cos(lambda1) + b * cos(phi2) * cos(lambda2);
+    double y = a * cos(phi1) * sin(lambda1) + b * cos(phi2) * sin(lambda2);
+    double z = a * sin(phi1) + b * sin(phi2);
+    *out_lat = atan2(z, sqrt(x * x + y * y)) * RAD2DEG;
+    *out_lon = atan2(y, x) * RAD2DEG;
+}
+
+static void run_reference(kernel_t k)
+{
+    for(size_t i = 0; i < count; ++i)
+    {
+        switch(k)
+        {
+        case K_DISTANCE:
+            ref_a[i] = geo_distance_nm(lat0, lon0, lat[i], lon[i]);
+            break;
+        case K_BEARING:
+            ref_a[i] = geo_bearing(lat0, lon0, lat[i], lon[i]);
+            break;
+        case K_AZEQ:
+            ref_azeq(lat[i], lon[i], &ref_a[i], &ref_b[i]);
+            break;
+        case K_MERCATOR:
+            ref_mercator(lat[i], lon[i], &ref_a[i], &ref_b[i]);
+            break;
+        case K_INTERPOLATE:
+            ref_interpolate(t[i], &ref_a[i], &ref_b[i]);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+static void run_batch(kernel_t k)
+{
+    switch(k)
+    {
+    case K_DISTANCE:
+        geo_batch_distance_nm(lat0, lon0, lat, lon, out_a, count);
+        break;
+    case K_BEARING:
+        geo_batch_bearing(lat0, lon0, lat, lon, out_a, count);
+        break;
+    case K_AZEQ:
+        geo_batch_project_azeq(lat0, lon0, lat, lon, out_a, out_b, count);
+        break;
+    case K_MERCATOR:
+        geo_batch_project_mercator(lat0, lon0, lat, lon, out_a, out_b, count);
+        break;
+    case K_INTERPOLATE:
+        geo_batch_interpolate(lat0, lon0, lat2, lon2, t, out_a, out_b, count);
+        break;
+    default:
+        break;
+    }
+}
+
+// Worst error against the reference, in the kernel's own units (nm or degrees).
+static double max_error(kernel_t k)
+{
+    double worst = 0.0;
+    for(size_t i = 0; i < count; ++i)
+    {
+        double err = fabs(out_a[i] - ref_a[i]);
+        if(k == K_BEARING || k == K_INTERPOLATE)
+            err = fabs(geo_wrap_lon(out_a[i] - ref_a[i]));
+        if(k == K_AZEQ || k == K_MERCATOR)
+            err = hypot(out_a[i] - ref_a[i], out_b[i] - ref_b[i]);
+        if(k == K_INTERPOLATE)
+            err = fmax(fabs(out_a[i] - ref_a[i]), fabs(geo_wrap_lon(out_b[i] - ref_b[i])));
+        if(err > worst)
+            worst = err;
+    }
+    return worst;
+}
+
+static double best_ns_per_point(void (*fn)(kernel_t), kernel_t k, int repeats)
+{
+    uint64_t best = UINT64_MAX;
+    for(int r = 0; r < repeats; ++r)
+    {
+        uint64_t start = clock_now_ns();
+        fn(k);
+        uint64_t elapsed = clock_now_ns() - start;
+        if(elapsed < best)
+            best = elapsed;
+    }
+    return (double)best / (double)count;
+}
+
+int main(int argc, char **argv)
+{
+    count = argc > 1 ? (size_t)strtoul(argv[1], NULL, 10) : 100000;
+    int repeats = argc > 2 ? atoi(argv[2]) : 20;
+    if(!count || repeats <= 0)
+    {
+        fprintf(stderr, "usage: %s [points] [repeats]\n", argv[0]);
+        return 1;
+    }
+
+    lat = malloc(sizeof(float) * count);
+    lon = malloc(sizeof(float) * count);
+    t = malloc(sizeof(float) * count);
+    out_a = malloc(sizeof(float) * count);
+    out_b = malloc(sizeof(float) * count);
+    ref_a = malloc(sizeof(double) * count);
+    ref_b = malloc(sizeof(double) * count);
+    if(!lat || !lon || !t || !out_a || !out_b || !ref_a || !ref_b)
+    {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    srand(1234);
+    for(size_t i = 0; i < count; ++i)
+    {
+        // Kept short of the antipode, where azimuthal equidistant is undefined.
+        do {
+            lat[i] = (float)frand(-89.9, 89.9);
+            lon[i] = (float)frand(-180.0, 180.0);
+        } while(geo_distance_nm(lat0, lon0, lat[i], lon[i]) > 10000.0);
+        t[i] = (float)frand(0.0, 1.0);
+    }
+
+    geo_batch_init();
+    geo_isa_t best_isa = geo_batch_isa();
+    printf("%zu points, best of %d runs, auto-selected %s\n\n", count, repeats,
+           geo_batch_isa_name(best_isa));
+    printf("%-12s %-8s %10s %9s %12s\n", "kernel", "isa", "ns/point", "speedup", "max error");
+
+    for(kernel_t k = 0; k < K_COUNT; ++k)
+    {
+        double ref_ns = best_ns_per_point(run_reference, k, repeats);
+        printf("%-12s %-8s %10.2f %9s %12s\n", kernel_names[k], "double", ref_ns, "1.0x", "-");
+
+        for(geo_isa_t isa = 0; isa < GEO_ISA_COUNT; ++isa)
+        {
+            if(!geo_batch_use_isa(isa))
+                continue;
+            double ns = best_ns_per_point(run_batch, k, repeats);
+            printf("%-12s %-8s %10.2f %8.1fx %12.3g\n", kernel_names[k], geo_batch_isa_name(isa),
+                   ns, ref_ns / ns, max_error(k));
+        }
+    }
+    geo_batch_use_isa(best_isa);
+
+    free(lat);
+    free(lon);
+    free(t);
+    free(out_a);
+    free(out_b);
+    free(ref_a);
+    free(ref_b);
+    return 0;
+}
@@ -0,0 +1,317 @@
+/*===--------------------------------------------------------------------------------------------===
+ * navsearch_bench.c
+ *
+ * Times CDU type-ahead searches (navsearch.h) against a synthetic navaid database, put through
+ * the plugin's own scan, index build and cache, with the few XPLM calls involved stubbed out.
+ * Searches are timed right after the index is built, right after it is mapped back in from the
+ * cache (the first keystroke of a session: page faults and cold caches), and warm.
+ *
+ *     navsearch_bench [navaids] [queries]
+ *===--------------------------------------------------------------------------------------------===
+*/
+#include "navdata.h"
+#include "navsearch.h"
+#include "clock.h"
+#include <XPLMProcessing.h>
+#include <XPLMUtilities.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define COLD_RUNS       (20)
+#define MAX_LEN         (5)
+
+typedef struct {
+    float lat, lon;
+    XPLMNavType type;
+    char id[8];
+} fake_nav_t;
+
+static fake_nav_t *navaids;
+static int navaid_count;
+static char root[256];
+static XPLMFlightLoop_f scan_loop;
+
+/*
+ * The XPLM calls navdata and navcache make, answered from the synthetic database.
+ */
+
+void log_msg(const char *fmt, ...)
+{
+    (void)fmt;
+}
+
+XPLMNavRef XPLMGetFirstNavAid(void)
+{
+    return navaid_count ? 0 : XPLM_NAV_NOT_FOUND;
+}
+
+XPLMNavRef XPLMGetNextNavAid(XPLMNavRef ref)
+{
+    return ref >= 0 && ref + 1 < navaid_count ? ref + 1 : XPLM_NAV_NOT_FOUND;
+}
+
+void XPLMGetNavAidInfo(XPLMNavRef ref, XPLMNavType *type, float *lat, float *lon, float *height,
+                       int *freq, float *heading, char *id, char *name, char *reg)
+{
+    (void)heading;
+    (void)name;
+    (void)reg;
+    const fake_nav_t *nav = &navaids[ref];
+    if(type)
+        *type = nav->type;
+    if(lat)
+        *lat = nav->lat;
+    if(lon)
+        *lon = nav->lon;
+    if(height)
+        *height = 0.f;
+    if(freq)
+        *freq = 0;
+    if(id)
+        strcpy(id, nav->id);
+}
+
+void XPLMGetSystemPath(char *path)
+{
+    strcpy(path, root);
+}
+
+const char *XPLMGetDirectorySeparator(void)
+{
+    return "/";
+}
+
+void XPLMGetVersions(int *xp, int *xplm, XPLMHostApplicationID *host)
+{
+    *xp = 12000;
+    *xplm = 411;
+    if(host)
+        *host = xplm_Host_XPlane;
+}
+
+XPLMFlightLoopID XPLMCreateFlightLoop(XPLMCreateFlightLoop_t *params)
+{
+    scan_loop = params->callbackFunc;
+    return (XPLMFlightLoopID)&scan_loop;
+}
+
+void XPLMScheduleFlightLoop(XPLMFlightLoopID id, float interval, int relative)
+{
+    (void)id;
+    (void)interval;
+    (void)relative;
+}
+
+void XPLMDestroyFlightLoop(XPLMFlightLoopID id)
+{
+    (void)id;
+    scan_loop = NULL;
+}
+
+/*
+ * The synthetic database: roughly the mix of a real one, mostly five-letter fixes, with ICAO
+ * airport codes clustered on a few first letters like the real ones are.
+ */
+
+static double frand(double lo, double hi)
+{
+    return lo + (hi - lo) * ((double)rand() / (double)RAND_MAX);
+}
+
+static void random_id(char *out, int len, const char *alphabet)
+{
+    size_t n = strlen(alphabet);
+    for(int i = 0; i < len; ++i)
+        out[i] = alphabet[rand() % n];
+    out[len] = '\0';
+}
+
+static void make_navaids(int count)
+{
+    static const char letters[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    static const char alnum[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+    static const char icao_first[] = "KKKKKKEELLCYSRUZ";
+    for(int i = 0; i < count; ++i)
+    {
+        fake_nav_t *nav = &navaids[i];
+        nav->lat = (float)frand(-60.0, 75.0);
+        nav->lon = (float)frand(-180.0, 180.0);
+        int kind = rand() % 100;
+        if(kind < 16)
+        {
+            nav->type = xplm_Nav_Airport;
+            nav->id[0] = icao_first[rand() % (sizeof(icao_first) - 1)];
+            random_id(nav->id + 1, 3, kind < 12 ? letters : alnum);
+        }
+        else if(kind < 18)
+        {
+            nav->type = xplm_Nav_VOR;
+            random_id(nav->id, 3, letters);
+        }
+        else if(kind < 20)
+        {
+            nav->type = xplm_Nav_NDB;
+            random_id(nav->id, 2 + rand() % 2, letters);
+        }
+        else
+        {
+            nav->type = xplm_Nav_Fix;
+            random_id(nav->id, 5, letters);
+        }
+    }
+}
+
+// Runs navdata's flight loop until the index is published and the builder is done with it.
+static const navdata_t *load_index(void)
+{
+    navdata_init();
+    while(scan_loop && scan_loop(0.f, 0.f, 0, NULL) != 0.f)
+        ;
+    return navdata_get();
+}
+
+/*
+ * Queries: prefixes of real identifiers, one to five characters, and typos (one character of a
+ * four or five character identifier replaced).
+ */
+
+typedef struct {
+    char text[NAVSEARCH_MAX_QUERY + 1];
+    double lat, lon;
+} query_t;
+
+static void make_query(query_t *q, int len, bool typo)
+{
+    const fake_nav_t *nav;
+    do {
+        nav = &navaids[rand() % navaid_count];
+    } while((int)strlen(nav->id) < len);
+    memcpy(q->text, nav->id, (size_t)len);
+    q->text[len] = '\0';
+    if(typo)
+        q->text[rand() % len] = (char)('A' + rand() % 26);
+    q->lat = frand(-60.0, 75.0);
+    q->lon = frand(-180.0, 180.0);
+}
+
+static double time_query(const navdata_t *nd, const query_t *q)
+{
+    nav_match_t out[NAVSEARCH_MAX_RESULTS];
+    uint64_t start = clock_now_ns();
+    navsearch_find(nd, q->text, q->lat, q->lon,
+                   xplm_Nav_Airport | xplm_Nav_NDB | xplm_Nav_VOR | xplm_Nav_Fix, out, 8);
+    return (double)(clock_now_ns() - start) / 1e3;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void report(const char *label, double *us, int count)
+{
+    qsort(us, (size_t)count, sizeof(double), compare_doubles);
+    printf("%-14s %10.1f %10.1f %10.1f\n", label, us[count / 2], us[count * 9 / 10],
+           us[count - 1]);
+}
+
+int main(int argc, char **argv)
+{
+    navaid_count = argc > 1 ? atoi(argv[1]) : 250000;
+    int queries = argc > 2 ? atoi(argv[2]) : 1000;
+    if(navaid_count <= 0 || queries <= 0)
+    {
+        fprintf(stderr, "usage: %s [navaids] [queries]\n", argv[0]);
+        return 1;
+    }
+
+    // An empty "X-Plane folder" with just an Output folder, for the cache.
+    char output[300];
+    snprintf(root, sizeof(root), "/tmp/navsearch_bench.%d/", (int)getpid());
+    snprintf(output, sizeof(output), "%sOutput", root);
+    if(mkdir(root, 0755) != 0 || mkdir(output, 0755) != 0)
+    {
+        fprintf(stderr, "cannot create %s\n", output);
+        return 1;
+    }
+
+    navaids = malloc(sizeof(fake_nav_t) * (size_t)navaid_count);
+    double *us = malloc(sizeof(double) * (size_t)(queries > COLD_RUNS ? queries : COLD_RUNS));
+    if(!navaids || !us)
+    {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    srand(1234);
+    make_navaids(navaid_count);
+
+    uint64_t start = clock_now_ns();
+    const navdata_t *nd = load_index();
+    if(!nd)
+    {
+        fprintf(stderr, "cannot build the index\n");
+        return 1;
+    }
+    printf("%u navaids, indexed in %.0f ms\n\n", nd->count,
+           (double)(clock_now_ns() - start) / 1e6);
+    printf("%-14s %10s %10s %10s\n", "us/search", "median", "p90", "max");
+
+    query_t q;
+    make_query(&q, 3, false);
+    us[0] = time_query(nd, &q);
+    printf("%-14s %10.1f\n", "after build", us[0]);
+
+    // First search after each fresh mapping of the cache, as on the first keystroke of a session.
+    // The file itself stays in the OS page cache: a read from disk adds to this.
+    for(int r = 0; r < COLD_RUNS; ++r)
+    {
+        navdata_fini();
+        nd = load_index();
+        if(!nd || !nd->mapped)
+        {
+            fprintf(stderr, "cannot map the cache back in\n");
+            return 1;
+        }
+        make_query(&q, 1 + r % 4, false);
+        us[r] = time_query(nd, &q);
+    }
+    report("first, mapped", us, COLD_RUNS);
+
+    for(int len = 1; len <= MAX_LEN; ++len)
+    {
+        for(int i = 0; i < queries; ++i)
+        {
+            make_query(&q, len, false);
+            us[i] = time_query(nd, &q);
+        }
+        char label[32];
+        snprintf(label, sizeof(label), "prefix %d", len);
+        report(label, us, queries);
+    }
+    for(int len = 4; len <= MAX_LEN; ++len)
+    {
+        for(int i = 0; i < queries; ++i)
+        {
+            make_query(&q, len, true);
+            us[i] = time_query(nd, &q);
+        }
+        char label[32];
+        snprintf(label, sizeof(label), "typo %d", len);
+        report(label, us, queries);
+    }
+
+    navdata_fini();
+    char cache[400];
+    snprintf(cache, sizeof(cache), "%s/avionics_navdata.bin", output);
+    remove(cache);
+    rmdir(output);
+    rmdir(root);
+    free(navaids);
+    free(us);
+    return 0;
+}
@@ -0,0 +1,308 @@
+/*===--------------------------------------------------------------------------------------------===
+ * render_bench.c
+ *
+ * Draws the device screens with the software gfx back end, with no X-Plane and no GPU. Writes each
+ * one as a PPM image into `out_dir` if given (golden images to diff against), then times the
+ * screens and the rasteriser's primitives. With `export_seconds`, it then publishes the screen,
+ * cursor moving, as device RENDER_BENCH at 60 Hz, both to shared memory and as a socket tile
+ * stream, for testing viewers (tools/export_view.c, tools/stream_view.c) without the sim.
+ *
+ *     render_bench [repeats] [out_dir|-] [export_seconds]
+ *===--------------------------------------------------------------------------------------------===
+*/
+#include "gfx.h"
+#include "screens.h"
+#include "layout.h"
+#include "clock.h"
+#include "export.h"
+#include "stream.h"
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Same geometry as custom_device.c.
+#define WIDTH           (480)
+#define HEIGHT          (360)
+#define BEZEL_SIZE      (50)
+#define DEV_WIDTH       (2 * BEZEL_SIZE + WIDTH)
+#define DEV_HEIGHT      (2 * BEZEL_SIZE + HEIGHT)
+#define OVERLAY_SIZE    (320)
+
+#define TEXT_LINE       "THE QUICK BROWN FOX JUMPS OVER THE LAZY DOG 0123456789"
+#define TEXT_ROWS       (HEIGHT / 9)
+
+void log_msg(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+    fputc('\n', stderr);
+}
+
+typedef struct {
+    const char *name;
+    int width, height;
+    void (*draw)(void);
+} scene_t;
+
+static void draw_bezel(void)
+{
+    static const float light[3] = {0.6f, 0.55f, 0.5f};
+    screen_bezel(DEV_WIDTH, DEV_HEIGHT, BEZEL_SIZE);
+    gfx_modulate(light);
+}
+
+static layout_t layout;
+static layout_rect_t rects[SCREEN_NODE_COUNT];
+
+// The custom device's screen, in a fixed state: one button hovered, the other pressed, the cursor
+// down, and the text panels filled in. Laid out as custom_device.c does, at `scale`.
+static void draw_screen_at(float scale)
+{
+    static const float black[4] = {0.f, 0.f, 0.f, 1.f};
+    static const float magenta[4] = {1.f, 0.f, 1.f, 1.f};
+    static const float green[4] = {0.f, 1.f, 0.f, 1.f}, cyan[4] = {0.f, 1.f, 1.f, 1.f};
+    layout_update(&layout, WIDTH, HEIGHT, scale);
+    screen_button_t buttons[2];
+    for(int i = 0; i < 2; ++i)
+    {
+        const layout_rect_t *r = layout_rect(&layout, SCREEN_BUTTON_1 + i);
+        buttons[i] = (screen_button_t){r->x, r->y, r->w, r->h, i == 1, i == 1};
+    }
+    const layout_rect_t *touch = layout_rect(&layout, SCREEN_TOUCH);
+    const layout_rect_t *progress = layout_rect(&layout, SCREEN_PROGRESS);
+    const layout_rect_t *nearest = layout_rect(&layout, SCREEN_NEAREST);
+
+    gfx_rect(0.f, 0.f, WIDTH, HEIGHT, black);
+    screen_button(&buttons[0], true);
+    screen_button(&buttons[1], false);
+    int cx = buttons[1].x + buttons[1].w / 2, cy = buttons[1].y + buttons[1].h / 2;
+    screen_cursor(cx, cy, magenta);
+    char line[48];
+    snprintf(line, sizeof(line), "left touch location: %d,%d", cx, cy);
+    gfx_text(touch->x, screen_line(touch, 1), line, magenta, GFX_FONT_PROPORTIONAL);
+    gfx_text(progress->x, screen_line(progress, 0), "FPL 4 WPTS 212 NM", green, GFX_FONT_BASIC);
+    gfx_text(progress->x, screen_line(progress, 1), "TO SEA 12.4 NM CRS 161", green,
+             GFX_FONT_BASIC);
+    for(int i = 0; i < 25 && i < screen_lines(nearest); ++i)
+    {
+        snprintf(line, sizeof(line), "%-3s K%03d %5.1f", i % 3 ? "APT" : "VOR", i * 7, i * 2.5);
+        gfx_text(nearest->x, screen_line(nearest, i), line, cyan, GFX_FONT_BASIC);
+    }
+}
+
+static void draw_screen(void)
+{
+    draw_screen_at(1.f);
+}
+
+// As shown in a popup half the device's size.
+static void draw_screen_2x(void)
+{
+    draw_screen_at(2.f);
+}
+
+// Rheostat down, under red cockpit lighting: the post-pass over the whole screen.
+static void draw_screen_dim(void)
+{
+    static const float red_light[3] = {0.8f, 0.2f, 0.15f};
+    draw_screen_at(1.f);
+    screen_dim(0.4f, red_light);
+}
+
+static int cursor_x = 175, cursor_y = 40;
+
+static void draw_screen_cursor(void)
+{
+    static const float white[4] = {1.f, 1.f, 1.f, 1.f};
+    draw_screen();
+    screen_cursor(cursor_x, cursor_y, white);
+}
+
+static void draw_overlay(void)
+{
+    static const float magenta[4] = {1.f, 0.f, 1.f, 1.f};
+    screen_overlay(true);
+    screen_overlay(false);
+    gfx_text(0, 300, "touch location: 10,20", magenta, GFX_FONT_PROPORTIONAL);
+}
+
+static const scene_t scenes[] = {
+    {"bezel", DEV_WIDTH, DEV_HEIGHT, draw_bezel},
+    {"screen", WIDTH, HEIGHT, draw_screen},
+    {"screen_2x", WIDTH, HEIGHT, draw_screen_2x},
+    {"screen_dim", WIDTH, HEIGHT, draw_screen_dim},
+    {"overlay", OVERLAY_SIZE, OVERLAY_SIZE, draw_overlay},
+};
+#define SCENE_COUNT     ((int)(sizeof(scenes) / sizeof(scenes[0])))
+
+// Primitive workloads, each one frame of WIDTH x HEIGHT.
+static void prim_fill_opaque(void)
+{
+    static const float grey[4] = {0.4f, 0.4f, 0.4f, 1.f};
+    for(int i = 0; i < 16; ++i)
+        gfx_rect(0.f, 0.f, WIDTH, HEIGHT, grey);
+}
+
+static void prim_fill_blend(void)
+{
+    static const float tint[4] = {0.2f, 0.6f, 1.f, 0.3f};
+    for(int i = 0; i < 16; ++i)
+        gfx_rect(0.5f, 0.5f, WIDTH - 1, HEIGHT - 1, tint);
+}
+
+static void prim_lines(void)
+{
+    static const float white[4] = {1.f, 1.f, 1.f, 1.f};
+    for(int i = 0; i < 256; ++i)
+    {
+        float a = (float)i * 0.0245f;
+        gfx_line(WIDTH / 2, HEIGHT / 2, WIDTH / 2 + 170.f * cosf(a), HEIGHT / 2 + 170.f * sinf(a),
+                 1.5f, white);
+    }
+}
+
+static void prim_text(void)
+{
+    static const float green[4] = {0.f, 1.f, 0.f, 1.f};
+    for(int row = 0; row < TEXT_ROWS; ++row)
+        gfx_text(0, row * 9, TEXT_LINE, green, GFX_FONT_BASIC);
+}
+
+typedef struct {
+    const char *name;
+    const char *unit;
+    double per_frame;       // Units drawn per frame.
+    void (*draw)(void);
+} prim_t;
+
+static const prim_t prims[] = {
+    {"fill opaque", "px/s", 16.0 * WIDTH * HEIGHT, prim_fill_opaque},
+    {"fill blend", "px/s", 16.0 * WIDTH * HEIGHT, prim_fill_blend},
+    {"lines 1.5px", "lines/s", 256.0, prim_lines},
+    {"text 5x7", "chars/s", (double)(sizeof(TEXT_LINE) - 1) * TEXT_ROWS, prim_text},
+};
+#define PRIM_COUNT      ((int)(sizeof(prims) / sizeof(prims[0])))
+
+static double best_us(int width, int height, void (*draw)(void), int repeats)
+{
+    uint64_t best = UINT64_MAX;
+    for(int r = 0; r < repeats; ++r)
+    {
+        uint64_t start = clock_now_ns();
+        gfx_begin(width, height);
+        draw();
+        gfx_end();
+        uint64_t elapsed = clock_now_ns() - start;
+        if(elapsed < best)
+            best = elapsed;
+    }
+    return (double)best / 1e3;
+}
+
+// Frames drawn on the CPU go straight to the exports, with no readback.
+static int publish(double seconds)
+{
+    export_t *ex = export_open("RENDER_BENCH", WIDTH, HEIGHT);
+    stream_t *st = stream_open("RENDER_BENCH", WIDTH, HEIGHT);
+    if(!ex || !st)
+    {
+        export_close(ex);
+        stream_close(st);
+        return 1;
+    }
+    printf("\npublishing RENDER_BENCH for %.0f s\n", seconds);
+    int count = (int)(seconds * 60.0);
+    for(int i = 0; i < count; ++i)
+    {
+        cursor_x = 20 + (i * 3) % (WIDTH - 40);
+        cursor_y = 20 + (i * 2) % (HEIGHT - 40);
+        gfx_begin(WIDTH, HEIGHT);
+        draw_screen_cursor();
+        gfx_end();
+        const raster_t *frame = gfx_soft_frame();
+        uint64_t now = clock_now_ns();
+        export_submit(ex, frame->pixels, frame->width, frame->height, frame->width * 4, now);
+        stream_submit(st, frame->pixels, frame->width, frame->height, frame->width * 4, now);
+#if IBM
+        Sleep(16);
+#else
+        nanosleep(&(struct timespec){0, 1000000000 / 60}, NULL);
+#endif
+    }
+    export_stats_t stats;
+    export_get_stats(ex, &stats);
+    printf("%llu frames, %.1f us per copy\n", (unsigned long long)stats.frames, stats.copy_us);
+    stream_stats_t sstats;
+    stream_get_stats(st, &sstats);
+    printf("stream: %.1f tiles changed per frame, %.1f us per diff, %llu KiB sent\n",
+           sstats.frames ? (double)sstats.tiles_changed / (double)sstats.frames : 0.0,
+           sstats.diff_us, (unsigned long long)(sstats.bytes_sent / 1024));
+    export_close(ex);
+    stream_close(st);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int repeats = argc > 1 ? atoi(argv[1]) : 200;
+    const char *out_dir = argc > 2 && strcmp(argv[2], "-") ? argv[2] : NULL;
+    double export_seconds = argc > 3 ? atof(argv[3]) : 0.0;
+    if(repeats <= 0)
+    {
+        fprintf(stderr, "usage: %s [repeats] [out_dir|-] [export_seconds]\n", argv[0]);
+        return 1;
+    }
+
+    layout_init(&layout, screen_layout_nodes, rects, SCREEN_NODE_COUNT);
+    int status = 0;
+    if(out_dir)
+    {
+        for(int i = 0; i < SCENE_COUNT; ++i)
+        {
+            char path[1024];
+            snprintf(path, sizeof(path), "%s/%s.ppm", out_dir, scenes[i].name);
+            gfx_begin(scenes[i].width, scenes[i].height);
+            scenes[i].draw();
+            gfx_end();
+            if(raster_write_ppm(gfx_soft_frame(), path))
+            {
+                printf("wrote %s\n", path);
+            }
+            else
+            {
+                fprintf(stderr, "cannot write %s\n", path);
+                status = 1;
+            }
+        }
+        printf("\n");
+    }
+
+    printf("best of %d runs\n\n", repeats);
+    printf("%-12s %9s %10s\n", "screen", "size", "us/frame");
+    for(int i = 0; i < SCENE_COUNT; ++i)
+    {
+        double us = best_us(scenes[i].width, scenes[i].height, scenes[i].draw, repeats);
+        char size[16];
+        snprintf(size, sizeof(size), "%dx%d", scenes[i].width, scenes[i].height);
+        printf("%-12s %9s %10.1f\n", scenes[i].name, size, us);
+    }
+
+    printf("\n%-12s %10s %12s\n", "primitive", "us/frame", "throughput");
+    for(int i = 0; i < PRIM_COUNT; ++i)
+    {
+        double us = best_us(WIDTH, HEIGHT, prims[i].draw, repeats);
+        printf("%-12s %10.1f %10.3g %s\n", prims[i].name, us, prims[i].per_frame / us * 1e6,
+               prims[i].unit);
+    }
+
+    if(export_seconds > 0.0)
+        status |= publish(export_seconds);
+
+    gfx_fini();
+    return status;
+}
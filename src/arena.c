@@ -0,0 +1,263 @@
+/*===--------------------------------------------------------------------------------------------===
+ * arena.c
+ *
+ * Frame arena, per-device pools, and the registry that reports their usage.
+ *===--------------------------------------------------------------------------------------------===
+ */
+#include "arena.h"
+#include <XPLMProcessing.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void log_msg(const char *fmt, ...);
+
+#define FRAME_ARENA_SIZE    (512 * 1024)
+#define MIN_CLASS_SHIFT     (5)
+#define MAX_REGISTERED      (16)
+
+struct pool_block_s {
+    pool_block_t *next;
+};
+
+typedef struct {
+    arena_t *arena;
+    pool_t *pool;
+} registered_t;
+
+static registered_t registry[MAX_REGISTERED];
+static arena_t frame;
+static XPLMFlightLoopID flight_loop = NULL;
+
+static void register_allocator(arena_t *arena, pool_t *pool)
+{
+    for(int i = 0; i < MAX_REGISTERED; ++i)
+    {
+        if(registry[i].arena || registry[i].pool)
+            continue;
+        registry[i].arena = arena;
+        registry[i].pool = pool;
+        return;
+    }
+}
+
+static void unregister_allocator(const void *allocator)
+{
+    for(int i = 0; i < MAX_REGISTERED; ++i)
+    {
+        if((const void *)registry[i].arena == allocator || (const void *)registry[i].pool == allocator)
+            registry[i] = (registered_t){NULL, NULL};
+    }
+}
+
+static bool arena_setup(arena_t *arena, const char *name, size_t size)
+{
+    memset(arena, 0, sizeof(*arena));
+    arena->name = name;
+    arena->base = malloc(size);
+    if(!arena->base)
+    {
+        log_msg("cannot allocate %zu bytes for %s", size, name);
+        return false;
+    }
+    arena->size = size;
+    return true;
+}
+
+bool arena_create(arena_t *arena, const char *name, size_t size)
+{
+    if(!arena_setup(arena, name, size))
+        return false;
+    register_allocator(arena, NULL);
+    return true;
+}
+
+void arena_destroy(arena_t *arena)
+{
+    unregister_allocator(arena);
+    free(arena->base);
+    memset(arena, 0, sizeof(*arena));
+}
+
+void *arena_alloc(arena_t *arena, size_t size, size_t align)
+{
+    if(!arena->base)
+        return NULL;
+    uintptr_t start = ((uintptr_t)arena->base + arena->used + (align - 1)) & ~(uintptr_t)(align - 1);
+    size_t offset = start - (uintptr_t)arena->base;
+    if(offset + size > arena->size)
+    {
+        arena->failures += 1;
+        return NULL;
+    }
+    arena->used = offset + size;
+    if(arena->used > arena->peak)
+        arena->peak = arena->used;
+    return (void *)start;
+}
+
+void arena_reset(arena_t *arena)
+{
+    arena->used = 0;
+}
+
+char *arena_vprintf(arena_t *arena, const char *fmt, va_list args)
+{
+    // Format straight into the free space, and only commit what was used.
+    static char empty[1] = "";
+    size_t avail = arena->base ? arena->size - arena->used : 0;
+    char *out = (char *)arena->base + arena->used;
+
+    va_list copy;
+    va_copy(copy, args);
+    int len = avail ? vsnprintf(out, avail, fmt, copy) : -1;
+    va_end(copy);
+
+    if(len < 0 || (size_t)len >= avail)
+    {
+        arena->failures += 1;
+        return empty;
+    }
+    return arena_alloc(arena, (size_t)len + 1, 1);
+}
+
+char *arena_printf(arena_t *arena, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    char *str = arena_vprintf(arena, fmt, args);
+    va_end(args);
+    return str;
+}
+
+static int size_class(size_t size)
+{
+    size_t block = (size_t)1 << MIN_CLASS_SHIFT;
+    for(int i = 0; i < POOL_CLASSES; ++i, block <<= 1)
+    {
+        if(size <= block)
+            return i;
+    }
+    return -1;
+}
+
+bool pool_create(pool_t *pool, const char *name, size_t size)
+{
+    memset(pool, 0, sizeof(*pool));
+    pool->name = name;
+    if(!arena_setup(&pool->backing, name, size))
+        return false;
+    register_allocator(NULL, pool);
+    return true;
+}
+
+void pool_destroy(pool_t *pool)
+{
+    unregister_allocator(pool);
+    free(pool->backing.base);
+    memset(pool, 0, sizeof(*pool));
+}
+
+void *pool_alloc(pool_t *pool, size_t size)
+{
+    int cls = size_class(size);
+    if(cls < 0)
+    {
+        pool->failures += 1;
+        return NULL;
+    }
+
+    size_t block_size = (size_t)1 << (cls + MIN_CLASS_SHIFT);
+    pool_block_t *block = pool->free_lists[cls];
+    if(block)
+    {
+        pool->free_lists[cls] = block->next;
+    }
+    else
+    {
+        block = arena_alloc(&pool->backing, block_size, _Alignof(max_align_t));
+        if(!block)
+        {
+            pool->failures += 1;
+            return NULL;
+        }
+    }
+    pool->used += block_size;
+    if(pool->used > pool->peak)
+        pool->peak = pool->used;
+    return block;
+}
+
+void pool_free(pool_t *pool, void *ptr, size_t size)
+{
+    int cls = size_class(size);
+    if(!ptr || cls < 0)
+        return;
+    pool_block_t *block = ptr;
+    block->next = pool->free_lists[cls];
+    pool->free_lists[cls] = block;
+    pool->used -= (size_t)1 << (cls + MIN_CLASS_SHIFT);
+}
+
+arena_t *frame_arena(void)
+{
+    return &frame;
+}
+
+int alloc_stats_count(void)
+{
+    return MAX_REGISTERED;
+}
+
+bool alloc_stats(int index, alloc_stats_t *out)
+{
+    if(index < 0 || index >= MAX_REGISTERED)
+        return false;
+    const registered_t *r = &registry[index];
+    if(r->arena)
+    {
+        *out = (alloc_stats_t){r->arena->name, r->arena->size, r->arena->used, r->arena->peak, r->arena->failures};
+        return true;
+    }
+    if(r->pool)
+    {
+        *out = (alloc_stats_t){r->pool->name, r->pool->backing.size, r->pool->used, r->pool->peak, r->pool->failures};
+        return true;
+    }
+    return false;
+}
+
+static float frame_flight_loop(float since_call, float since_loop, int counter, void *refcon)
+{
+    (void)since_call;
+    (void)since_loop;
+    (void)counter;
+    (void)refcon;
+
+    arena_reset(&frame);
+    return -1.f;
+}
+
+void frame_arena_init(void)
+{
+    arena_create(&frame, "frame arena", FRAME_ARENA_SIZE);
+
+    // Reset before anything else runs in the frame; everything allocated during the previous
+    // frame's callbacks is dead by then.
+    XPLMCreateFlightLoop_t fl = (XPLMCreateFlightLoop_t){
+        .structSize = sizeof(XPLMCreateFlightLoop_t),
+        .phase = xplm_FlightLoop_Phase_BeforeFlightModel,
+        .callbackFunc = frame_flight_loop,
+        .refcon = NULL
+    };
+    flight_loop = XPLMCreateFlightLoop(&fl);
+    XPLMScheduleFlightLoop(flight_loop, -1.f, 1);
+}
+
+void frame_arena_fini(void)
+{
+    if(flight_loop)
+        XPLMDestroyFlightLoop(flight_loop);
+    flight_loop = NULL;
+    arena_destroy(&frame);
+}
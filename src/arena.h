@@ -0,0 +1,80 @@
+/*===--------------------------------------------------------------------------------------------===
+ * arena.h
+ *
+ * Allocators for draw-time code, so the render thread never calls malloc/free.
+ *
+ * - The frame arena is a bump allocator that is reset at the start of every sim frame. Anything
+ *   that only needs to live until the end of the current callback (formatted strings, vertex
+ *   lists, layout scratch) goes there. It's main-thread only.
+ * - A pool is a fixed region owned by one device, split into power-of-two size classes with a free
+ *   list each, for data that outlives a frame but is created and freed as pages change.
+ *
+ * Both are fixed-size: when they run out, allocations fail (and the failure is counted) rather
+ * than growing. Their usage is visible in the profiler window.
+ *===--------------------------------------------------------------------------------------------===
+*/
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    const char *name;
+    uint8_t *base;
+    size_t size;
+    size_t used;
+    size_t peak;
+    unsigned failures;
+} arena_t;
+
+#define POOL_CLASSES    (8)     // 32 bytes to 4kB blocks.
+
+typedef struct pool_block_s pool_block_t;
+
+typedef struct {
+    const char *name;
+    arena_t backing;
+    pool_block_t *free_lists[POOL_CLASSES];
+    size_t used;
+    size_t peak;
+    unsigned failures;
+} pool_t;
+
+typedef struct {
+    const char *name;
+    size_t size;
+    size_t used;
+    size_t peak;
+    unsigned failures;
+} alloc_stats_t;
+
+bool arena_create(arena_t *arena, const char *name, size_t size);
+void arena_destroy(arena_t *arena);
+void *arena_alloc(arena_t *arena, size_t size, size_t align);
+void arena_reset(arena_t *arena);
+// Returns an empty string, never NULL, if the arena is full.
+char *arena_printf(arena_t *arena, const char *fmt, ...);
+char *arena_vprintf(arena_t *arena, const char *fmt, va_list args);
+
+#define ARENA_NEW_ARRAY(arena, type, count) \
+    ((type *)arena_alloc((arena), sizeof(type) * (count), _Alignof(type)))
+
+bool pool_create(pool_t *pool, const char *name, size_t size);
+void pool_destroy(pool_t *pool);
+// Blocks larger than the biggest size class are refused.
+void *pool_alloc(pool_t *pool, size_t size);
+void pool_free(pool_t *pool, void *ptr, size_t size);
+
+// The frame arena for the main thread.
+arena_t *frame_arena(void);
+
+int alloc_stats_count(void);
+bool alloc_stats(int index, alloc_stats_t *out);
+
+void frame_arena_init(void);
+void frame_arena_fini(void);
+
+#endif /* ifndef _ARENA_H_ */
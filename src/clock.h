@@ -0,0 +1,40 @@
+/*===--------------------------------------------------------------------------------------------===
+ * clock.h
+ *
+ * Monotonic, high-resolution clock used to time callbacks and enforce per-frame budgets.
+ * XPLMGetElapsedTime() is too coarse for this, and isn't safe to call off the main thread.
+ *===--------------------------------------------------------------------------------------------===
+*/
+#ifndef _CLOCK_H_
+#define _CLOCK_H_
+
+#include <stdint.h>
+
+#if IBM
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+static inline uint64_t clock_now_ns(void)
+{
+#if IBM
+    static LARGE_INTEGER freq = {0};
+    LARGE_INTEGER now;
+    if(!freq.QuadPart)
+        QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (uint64_t)((double)now.QuadPart * 1e9 / (double)freq.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+static inline uint64_t clock_now_us(void)
+{
+    return clock_now_ns() / 1000ull;
+}
+
+#endif /* ifndef _CLOCK_H_ */
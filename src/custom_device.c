@@ -11,10 +11,33 @@
 #include <XPLMGraphics.h>
 #include <XPLMUtilities.h>
 #include <XPLMMenus.h>
+#include <XPLMProcessing.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include "SystemGL.h"
+#include "draw_sched.h"
+#include "profiler.h"
+#include "arena.h"
+#include "navdata.h"
+#include "ownship.h"
+#include "fms_mirror.h"
+#include "geo.h"
+#include "moving_map.h"
+#include "terrain.h"
+#include "weather.h"
+#include "winds.h"
+#include "gfx.h"
+#include "export.h"
+#include "export_gl.h"
+#include "stream.h"
+#include "render_list.h"
+#include "screens.h"
+#include "layout.h"
+#include "pages.h"
+#include "power.h"
 
 void log_msg(const char *fmt, ...);
 const char *click_type(int mouse);
@@ -26,6 +49,16 @@ const char *click_type(int mouse);
 #define DEV_WIDTH	(2*BEZEL_SIZE + WIDTH)
 #define DEV_HEIGHT	(2*BEZEL_SIZE + HEIGHT)
 
+// Widgets are scaled up by as much as this to stay usable when the device is shown smaller than
+// its native size.
+#define MAX_UI_SCALE    (2.f)
+
+// Hidden pages are brought up to date this often, so flipping to one is a blit.
+#define PAGE_BACKGROUND_HZ  (2.f)
+
+// The device is drawn on demand; this is the rate we refresh it at when nothing else asked for it.
+#define MIN_REFRESH_HZ  (10.f)
+
 // Used to keep track of mouse down, drag, and up positions so we can show it on
 // the cockpit display.
 static int pos_x = 0, pos_y = 0;
@@ -35,84 +68,223 @@ static int right_clicked = false;
 static XPLMAvionicsID device = NULL;
 static XPLMCommandRef show_popup = NULL;
 static XPLMCommandRef show_popout = NULL;
+static int sched_slot = -1;
+static int screen_list = RLIST_NONE;
 
-typedef struct {
-    int x, y, w, h;
-    bool clicked;
-    bool right_clicked;
-} ui_btn_t;
+// What's under the buttons and cursor: one of these, cached as a texture (pages.h). The buttons
+// flip through them.
+typedef enum {
+    PAGE_MAP,
+    PAGE_FPL,
+    PAGE_SYS,
+    PAGE_COUNT
+} page_id_t;
 
-static ui_btn_t btns[] = {
-    { 20, 20, 100, 40, false },
-    { 130, 20, 100, 40, false },
+static pages_t *pages = NULL;
+
+// An LCD on a 28 V bus, with a photocell: in the dark it dims to a third of what the rheostat
+// asks for.
+static const power_profile_t screen_power = {
+    .bus_on = 19.f / 28.f,
+    .bus_off = 17.f / 28.f,
+    .warmup_s = 2.f,
+    .rheo = {0.f, 0.25f, 0.5f, 0.75f, 1.f},
+    .cell = {0.35f, 0.6f, 0.85f, 1.f, 1.f},
+};
+static int power_slot = -1;
+// Colour of the light falling on the device, from the bezel callback.
+static float ambient[3] = {1.f, 1.f, 1.f};
+
+// Memory for anything the device keeps across frames. Draw code allocates from here or from the
+// frame arena, never from the heap.
+#define DEVICE_POOL_SIZE    (256 * 1024)
+static pool_t device_pool;
+
+// Nearest airports and VORs, refreshed once a second from the navdata index.
+#define NEAREST_COUNT       (25)
+#define NEAREST_TYPES       (xplm_Nav_Airport | xplm_Nav_VOR)
+#define NEAREST_MAX_NM      (500.f)
+static nav_hit_t *nearest = NULL;
+static int nearest_count = 0;
+static XPLMFlightLoopID nearest_loop = NULL;
+
+// The map page is rendered again only when what the map shows changes (map_generation()).
+static XPLMFlightLoopID map_loop = NULL;
+static unsigned map_seen = 0;
+
+// Screen export for external viewers: to shared memory, toggled with 'X', and as a tile stream on a
+// Unix socket, toggled with 'S'. Both are fed from the one readback.
+#define DEVICE_ID           "TEST_AVIONICS"
+static export_t *exporter = NULL;
+static stream_t *streamer = NULL;
+static export_gl_t *export_capture = NULL;
+static XPLMFlightLoopID stream_loop = NULL;
+
+typedef enum {
+    CB_SCREEN,
+    CB_BEZEL,
+    CB_BRIGHTNESS,
+    CB_KEYBOARD,
+    CB_BEZEL_CLICK,
+    CB_BEZEL_RIGHT_CLICK,
+    CB_BEZEL_SCROLL,
+    CB_SCREEN_CLICK,
+    CB_SCREEN_RIGHT_CLICK,
+    CB_SCREEN_SCROLL,
+    CB_SCREEN_CURSOR,
+    CB_CMD_POPUP,
+    CB_CMD_POPOUT,
+    CB_COUNT
+} custom_cb_t;
+
+static const char *cb_names[CB_COUNT] = {
+    "Test Avionics/screen",
+    "Test Avionics/bezel",
+    "Test Avionics/brightness",
+    "Test Avionics/keyboard",
+    "Test Avionics/bezel click",
+    "Test Avionics/bezel right click",
+    "Test Avionics/bezel scroll",
+    "Test Avionics/screen click",
+    "Test Avionics/screen right click",
+    "Test Avionics/screen scroll",
+    "Test Avionics/screen cursor",
+    "command/show_popup",
+    "command/show_popout",
+};
+
+static prof_probe_t probes[CB_COUNT];
+
+// Where the buttons are comes from the layout.
+static screen_button_t btns[] = {
+    { 0, 0, 0, 0, false },
+    { 0, 0, 0, 0, false },
 };
 
 #define BTN_COUNT   (2)
 
-static bool in_button(const ui_btn_t *btn, int x, int y) {
-    return x >= btn->x && x < (btn->x + btn->w)
-        && y >= btn->y && y < (btn->y + btn->h);
+static layout_t screen_layout;
+static layout_rect_t screen_rects[SCREEN_NODE_COUNT];
+
+// The button under x, y in the cached layout, or -1.
+static int button_at(int x, int y)
+{
+    int node = layout_hit(&screen_layout, x, y);
+    return node >= SCREEN_BUTTON_1 && node < SCREEN_BUTTON_1 + BTN_COUNT
+        ? node - SCREEN_BUTTON_1 : -1;
 }
 
-static void draw_button(const ui_btn_t *btn, bool hover) {
+// The screen texture is always WIDTH x HEIGHT, but a popup or popped-out window can show it much
+// smaller than that; widgets are scaled up to make up for it, in quarter steps so that resizing a
+// window doesn't lay the screen out again on every frame of the drag. Layout only runs when the
+// scale changes; drawing and hit-testing use the rectangles it leaves.
+static void update_layout(void)
+{
+    int top = 0, bottom = 0;
+    if(device && XPLMIsAvionicsPoppedOut(device))
+        XPLMGetAvionicsGeometryOS(device, NULL, &top, NULL, &bottom);
+    else if(device && XPLMIsAvionicsPopupVisible(device))
+        XPLMGetAvionicsGeometry(device, NULL, &top, NULL, &bottom);
+    float shown = (float)abs(top - bottom) / (float)DEV_HEIGHT;
+    float scale = shown > 0.f && shown < 1.f ? fminf(1.f / shown, MAX_UI_SCALE) : 1.f;
+    scale = roundf(scale * 4.f) / 4.f;
 
-    glBegin(GL_QUADS);
-    if(btn->right_clicked) {
-        glColor3f(0.4, 0.6, 0.6);
-    } else {
-        glColor3f(0.4, 0.4, 0.4);
-    }
-    glVertex2f(btn->x, btn->y);
-    glVertex2f(btn->x, btn->y + btn->h);
-    glVertex2f(btn->x + btn->w, btn->y + btn->h);
-    glVertex2f(btn->x + btn->w, btn->y);
-    glEnd();
-    
-    
-    if(!btn->clicked && !hover)
+    if(!layout_update(&screen_layout, WIDTH, HEIGHT, scale))
         return;
-    
+    for(int i = 0; i < BTN_COUNT; ++i)
+    {
+        const layout_rect_t *r = layout_rect(&screen_layout, SCREEN_BUTTON_1 + i);
+        btns[i].x = r->x;
+        btns[i].y = r->y;
+        btns[i].w = r->w;
+        btns[i].h = r->h;
+    }
+    if(screen_layout.passes > 1)
+        log_msg("device %p: laid out at %.2fx", device, scale);
+    pages_invalidate_all(pages);
+    draw_sched_invalidate(sched_slot);
+}
 
-    glLineWidth(2);
-    glBegin(GL_LINE_LOOP);
-    if(btn->clicked) {
-        glColor4f(1, 0, 1, 1);
-    } else {
-        glColor4f(1, 1, 1, 1);
+static void export_frame(const uint8_t *pixels, int width, int height, int stride,
+                         uint64_t time_ns, void *refcon)
+{
+    (void)refcon;
+    if(exporter)
+        export_submit(exporter, pixels, width, height, stride, time_ns);
+    if(streamer)
+        stream_submit(streamer, pixels, width, height, stride, time_ns);
+}
+
+// The readback runs while anything wants frames.
+static void update_capture(void)
+{
+    if((exporter || streamer) && !export_capture)
+    {
+        export_capture = export_gl_create(export_frame, NULL);
+    }
+    else if(!exporter && !streamer && export_capture)
+    {
+        log_msg("export: %u captures dropped", export_gl_dropped(export_capture));
+        export_gl_destroy(export_capture);
+        export_capture = NULL;
     }
-    
-    glVertex2f(btn->x, btn->y);
-    glVertex2f(btn->x, btn->y + btn->h);
-    glVertex2f(btn->x + btn->w, btn->y + btn->h);
-    glVertex2f(btn->x + btn->w, btn->y);
-    glEnd();
 }
 
-static void draw_cursor(int x, int y, float r, float g, float b) {
-    glBegin(GL_LINE_LOOP);
-    glColor4f(r, g, b, 1);
-    
-    glVertex2f(x - 3, y - 3);
-    glVertex2f(x - 3, y + 3);
-    glVertex2f(x + 3, y + 3);
-    glVertex2f(x + 3, y - 3);
-    glEnd();
-    
-    glBegin(GL_LINES);
-    glColor4f(r, g, b, 1);
-    
-    glVertex2f(x, y - 12);
-    glVertex2f(x, y - 3);
-    
-    glVertex2f(x, y + 12);
-    glVertex2f(x, y + 3);
-    
-    glVertex2f(x - 15, y);
-    glVertex2f(x - 3, y);
-    
-    glVertex2f(x + 15, y);
-    glVertex2f(x + 3, y);
-    glEnd();
+static void set_export(bool enabled)
+{
+    if(enabled && !exporter)
+    {
+        exporter = export_open(DEVICE_ID, WIDTH, HEIGHT);
+    }
+    else if(!enabled && exporter)
+    {
+        export_stats_t stats;
+        export_get_stats(exporter, &stats);
+        log_msg("export: %llu frames, %.1f us per copy", (unsigned long long)stats.frames,
+                stats.copy_us);
+        export_close(exporter);
+        exporter = NULL;
+    }
+    update_capture();
+}
+
+// Subscribers are accepted, and slow ones caught up, between frames too: the screen is only drawn
+// when it changes.
+static float stream_poll_loop(float since_call, float since_loop, int counter, void *refcon)
+{
+    (void)since_call;
+    (void)since_loop;
+    (void)counter;
+    (void)refcon;
+    stream_poll(streamer);
+    return streamer ? -1.f : 0.f;
+}
+
+static void set_stream(bool enabled)
+{
+    if(enabled && !streamer)
+    {
+        streamer = stream_open(DEVICE_ID, WIDTH, HEIGHT);
+        if(streamer)
+        {
+            XPLMScheduleFlightLoop(stream_loop, -1.f, 1);
+            // Subscribers need a first frame even if nothing is about to change.
+            draw_sched_invalidate(sched_slot);
+        }
+    }
+    else if(!enabled && streamer)
+    {
+        stream_stats_t stats;
+        stream_get_stats(streamer, &stats);
+        log_msg("stream: %llu frames, %.1f tiles changed per frame, %llu KiB sent, "
+                "%.1f us per diff", (unsigned long long)stats.frames,
+                stats.frames ? (double)stats.tiles_changed / (double)stats.frames : 0.0,
+                (unsigned long long)(stats.bytes_sent / 1024), stats.diff_us);
+        stream_close(streamer);
+        streamer = NULL;
+        XPLMScheduleFlightLoop(stream_loop, 0.f, 1);
+    }
+    update_capture();
 }
 
 static int custom_keyboard(
@@ -123,12 +295,22 @@ static int custom_keyboard(
 	int losing
 )
 {
-	(void)flags;
 	(void)vkey;
 	(void)refcon;
 	(void)losing;
+	PROF_SCOPE(probes[CB_KEYBOARD]);
 
 	log_msg("device %p: key %c (0x%02x) pressed", device, key, (int)key);
+	if((key == 'T' || key == 't') && (flags & xplm_DownFlag))
+		terrain_set_enabled(!terrain_enabled());
+	if((key == 'W' || key == 'w') && (flags & xplm_DownFlag))
+		weather_set_enabled(!weather_enabled());
+	if((key == 'X' || key == 'x') && (flags & xplm_DownFlag))
+		set_export(!exporter);
+	if((key == 'S' || key == 's') && (flags & xplm_DownFlag))
+		set_stream(!streamer);
+	pages_invalidate(pages, PAGE_SYS);
+	draw_sched_invalidate(sched_slot);
 	
 	// Return 1 only if you want to intercept the key press, and don't want X-Plane's device
 	// to receive it.
@@ -137,41 +319,59 @@ static int custom_keyboard(
 
 static int custom_bezel_click(int x, int y, int mouse, void *refcon)
 {
+	PROF_SCOPE(probes[CB_BEZEL_CLICK]);
 	log_msg("device %p: bezel click %s at (%d, %d)", device, click_type(mouse), x, y);
+	// Any bezel click cycles the map declutter level.
+	if(mouse == xplm_MouseDown)
+		map_set_style((map_style() + 1) % MAP_STYLE_COUNT);
 	return 0;
 }
 
 static int custom_bezel_right_click(int x, int y, int mouse, void *refcon)
 {
-    if(mouse != xplm_MouseUp)
-    {
-        float brt = (float)y / (float)DEV_HEIGHT;
-        XPLMSetAvionicsBrightnessRheo(device, brt);
-        log_msg("brightness: %.2f", XPLMGetAvionicsBrightnessRheo(device));
-    }
+	PROF_SCOPE(probes[CB_BEZEL_RIGHT_CLICK]);
+	if(mouse != xplm_MouseUp)
+		power_set_rheo(power_slot, (float)y / (float)DEV_HEIGHT);
 	log_msg("device %p: bezel right click %s at (%d, %d)", device, click_type(mouse), x, y);
-    return 1;
+	return 1;
 }
 
 static int custom_bezel_scroll(int x, int y, int wheel, int clicks, void *refcon)
 {
+	PROF_SCOPE(probes[CB_BEZEL_SCROLL]);
 	log_msg("device %p: bezel scroll %d (%d) at (%d, %d)", device, wheel, clicks, x, y);
 	return 1;
 }
 
+static void flip_page(int step)
+{
+    int count = pages_count(pages);
+    if(!count)
+        return;
+    int page = (pages_shown(pages) + step + count) % count;
+    pages_show(pages, page);
+    pages_stats_t stats;
+    pages_get_stats(pages, &stats);
+    log_msg("device %p: page %s (%u refreshed shown, %u in the background, %.0f us per page)",
+            device, pages_name(pages, page), stats.refreshes, stats.background, stats.refresh_us);
+}
+
 static int custom_screen_click(int x, int y, XPLMMouseStatus mouse, void *refcon)
 {
+	PROF_SCOPE(probes[CB_SCREEN_CLICK]);
 	log_msg("device %p: screen touch %s at (%d, %d)", device, click_type(mouse), x, y);
+	draw_sched_invalidate(sched_slot);
 	clicked = mouse != xplm_MouseUp;
 	pos_x = x;
 	pos_y = y;
     
+    int btn = button_at(x, y);
     switch(mouse) {
     case xplm_MouseDown:
-        for(int i = 0; i < BTN_COUNT; ++i) {
-            if(in_button(&btns[i], x, y)) {
-                btns[i].clicked = true;
-            }
+        if(btn >= 0)
+        {
+            btns[btn].clicked = true;
+            flip_page(btn == 0 ? -1 : 1);
         }
         break;
     case xplm_MouseUp:
@@ -188,18 +388,18 @@ static int custom_screen_click(int x, int y, XPLMMouseStatus mouse, void *refcon
 
 static int custom_screen_right_click(int x, int y, XPLMMouseStatus mouse, void *refcon)
 {
+	PROF_SCOPE(probes[CB_SCREEN_RIGHT_CLICK]);
 	log_msg("device %p: screen touch %s at (%d, %d)", device, click_type(mouse), x, y);
+	draw_sched_invalidate(sched_slot);
 	right_clicked = mouse != xplm_MouseUp;
 	right_pos_x = x;
 	right_pos_y = y;
     
+    int btn = button_at(x, y);
     switch(mouse) {
     case xplm_MouseDown:
-        for(int i = 0; i < BTN_COUNT; ++i) {
-            if(in_button(&btns[i], x, y)) {
-                btns[i].right_clicked = true;
-            }
-        }
+        if(btn >= 0)
+            btns[btn].right_clicked = true;
         break;
     case xplm_MouseUp:
         for(int i = 0; i < BTN_COUNT; ++i) {
@@ -214,93 +414,310 @@ static int custom_screen_right_click(int x, int y, XPLMMouseStatus mouse, void *
 
 static int custom_screen_scroll(int x, int y, int wheel, int clicks, void *refcon)
 {
+	PROF_SCOPE(probes[CB_SCREEN_SCROLL]);
 	log_msg("device %p: screen scroll %d (%d) at (%d, %d)", device, wheel, clicks, x, y);
+	// Scrolling up zooms in.
+	map_zoom(-clicks);
 	return 1;
 }
 
 static int custom_screen_cursor(int x, int y, void *refcon)
 {
+    PROF_SCOPE(probes[CB_SCREEN_CURSOR]);
+    // We draw our own cursor, so it needs to follow the mouse.
+    draw_sched_invalidate(sched_slot);
     return xplm_CursorHidden;
 }
 
-static void custom_bezel(float r, float b, float g, void *refcon)
+static void custom_bezel(float r, float g, float b, void *refcon)
 {
+	PROF_SCOPE(probes[CB_BEZEL]);
+	ambient[0] = r;
+	ambient[1] = g;
+	ambient[2] = b;
 	XPLMSetGraphicsState(0, 0, 0, 0, 1, 1, 0);
-    glBegin(GL_QUADS);
-    glColor4f(0.8 * r, 0.8 * b, 0.8 * g, 1.f);
-    glVertex2f(0, 0);
-    glVertex2f(0, DEV_HEIGHT);
-    glVertex2f(DEV_WIDTH, DEV_HEIGHT);
-    glVertex2f(DEV_WIDTH, 0);
-
-    glColor3f(0, 0, 0);
-    glVertex2f(BEZEL_SIZE, BEZEL_SIZE);
-    glVertex2f(BEZEL_SIZE, BEZEL_SIZE+HEIGHT);
-    glVertex2f(BEZEL_SIZE+WIDTH, BEZEL_SIZE+HEIGHT);
-    glVertex2f(BEZEL_SIZE+WIDTH, BEZEL_SIZE);
-    glEnd();
+    gfx_begin(DEV_WIDTH, DEV_HEIGHT);
+    screen_bezel(DEV_WIDTH, DEV_HEIGHT, BEZEL_SIZE);
+    gfx_modulate(ambient);
+    gfx_end();
 }
 
 static float custom_brightness(float rheo, float cell, float bus, void *refcon)
 {
+    PROF_SCOPE(probes[CB_BRIGHTNESS]);
     (void)refcon;
-    (void)cell;
-    if(bus >= 0 && bus * 28 < 19)
-        return 0.f;
-    return rheo;
+    // The screen's own post-pass (draw_screen()) dims it, in the cockpit, popups and exports
+    // alike, so X-Plane mustn't do it again.
+    power_brightness_callback(power_slot, rheo, cell, bus);
+    return power_on(power_slot) ? 1.f : 0.f;
 }
 
-static void custom_screen(void *refcon)
+static float update_nearest(float since_call, float since_loop, int counter, void *refcon)
+{
+    (void)since_call;
+    (void)since_loop;
+    (void)counter;
+    (void)refcon;
+
+    // The systems page is counters, which once a second is plenty for.
+    pages_invalidate(pages, PAGE_SYS);
+
+    const navdata_t *nd = navdata_get();
+    const ownship_t *own = ownship_get();
+    if(!nd || !own->valid || !nearest)
+        return 1.f;
+
+    nearest_count = navdata_nearest(nd, own->lat, own->lon, NEAREST_TYPES, NEAREST_COUNT,
+                                    NEAREST_MAX_NM, nearest);
+    pages_invalidate(pages, PAGE_MAP);
+    return 1.f;
+}
+
+static float watch_map(float since_call, float since_loop, int counter, void *refcon)
+{
+    (void)since_call;
+    (void)since_loop;
+    (void)counter;
+    (void)refcon;
+
+    unsigned gen = map_generation();
+    if(gen != map_seen)
+    {
+        map_seen = gen;
+        pages_invalidate(pages, PAGE_MAP);
+    }
+    return -1.f;
+}
+
+static void fms_changed(XPLMNavFlightPlan plan, fms_event_t event, int index, void *refcon)
+{
+    (void)event;
+    (void)index;
+    (void)refcon;
+    if(plan == xplm_Fpl_Pilot_Primary)
+    {
+        pages_invalidate(pages, PAGE_FPL);
+        pages_invalidate(pages, PAGE_MAP);
+    }
+}
+
+// Progress summary for the pilot's flight plan, straight from the mirror's leg geometry.
+static void draw_progress(void)
+{
+    const fms_plan_t *plan = fms_mirror_plan(xplm_Fpl_Pilot_Primary);
+    const layout_rect_t *panel = layout_rect(&screen_layout, SCREEN_PROGRESS);
+    const float color[4] = {0.f, 1.f, 0.f, 1.f};
+    const int x = panel->x;
+    if(!plan->count)
+    {
+        gfx_text(x, screen_line(panel, 0), "NO FLIGHT PLAN", color, GFX_FONT_BASIC);
+        return;
+    }
+
+    const fms_entry_t *last = &plan->entries[plan->count - 1];
+    char *text = arena_printf(frame_arena(), "FPL %d WPTS %.0f NM", plan->count, last->cum_nm);
+    gfx_text(x, screen_line(panel, 0), text, color, GFX_FONT_BASIC);
+
+    int active = plan->displayed;
+    if(active < 0 || active >= plan->count)
+        return;
+    const fms_entry_t *to = &plan->entries[active];
+    const ownship_t *own = ownship_get();
+    float to_nm = (float)geo_distance_nm(own->lat, own->lon, to->lat, to->lon);
+    float remaining_nm = to_nm + (last->cum_nm - to->cum_nm);
+    text = arena_printf(frame_arena(), "TO %s %.1f NM CRS %03.0f", to->id, to_nm, to->course);
+    gfx_text(x, screen_line(panel, 1), text, color, GFX_FONT_BASIC);
+
+    if(own->groundspeed_kts < 30.f)
+        return;
+    int ete_min = (int)(remaining_nm / own->groundspeed_kts * 60.f);
+    text = arena_printf(frame_arena(), "DEST %.0f NM ETE %d:%02d", remaining_nm, ete_min / 60,
+                        ete_min % 60);
+    gfx_text(x, screen_line(panel, 2), text, color, GFX_FONT_BASIC);
+
+    // The same, flown at the current altitude and true airspeed through the forecast winds.
+    float wind_ete_s = winds_ete_s(to->cum_nm - to_nm, last->cum_nm,
+                                   (float)(own->elev_m * M_TO_FT), own->tas_kts);
+    if(isnan(wind_ete_s))
+        return;
+    ete_min = (int)(wind_ete_s / 60.f);
+    text = arena_printf(frame_arena(), "WIND ETE %d:%02d", ete_min / 60, ete_min % 60);
+    gfx_text(x, screen_line(panel, 3), text, color, GFX_FONT_BASIC);
+}
+
+static void draw_nearest(void)
+{
+    const navdata_t *nd = navdata_get();
+    const layout_rect_t *panel = layout_rect(&screen_layout, SCREEN_NEAREST);
+    const float color[4] = {0.f, 1.f, 1.f, 1.f};
+    if(!nd)
+    {
+        gfx_text(panel->x, screen_line(panel, 0), "NAVDATA LOADING", color, GFX_FONT_BASIC);
+        return;
+    }
+
+    // As many as fit: fewer when the layout is scaled up.
+    int rows = screen_lines(panel);
+    for(int i = 0; i < nearest_count && i < rows; ++i)
+    {
+        uint32_t index = nearest[i].index;
+        char *text = arena_printf(frame_arena(), "%-3s %-6s %5.1f",
+                                  nd->type[index] == xplm_Nav_Airport ? "APT" : "VOR",
+                                  navdata_id(nd, index), nearest[i].dist_nm);
+        gfx_text(panel->x, screen_line(panel, i), text, color, GFX_FONT_BASIC);
+    }
+}
+
+// The pilot's flight plan legs, down the right.
+static void draw_legs(void)
+{
+    const fms_plan_t *plan = fms_mirror_plan(xplm_Fpl_Pilot_Primary);
+    const layout_rect_t *panel = layout_rect(&screen_layout, SCREEN_NEAREST);
+    const float white[4] = {1.f, 1.f, 1.f, 1.f}, magenta[4] = {1.f, 0.f, 1.f, 1.f};
+    int rows = screen_lines(panel);
+    for(int i = 0; i < plan->count && i < rows; ++i)
+    {
+        const fms_entry_t *e = &plan->entries[i];
+        char *text = i ? arena_printf(frame_arena(), "%-6s %03.0f %5.1f", e->id, e->course,
+                                      e->leg_nm)
+                       : arena_printf(frame_arena(), "%-6s", e->id);
+        gfx_text(panel->x, screen_line(panel, i), text, i == plan->displayed ? magenta : white,
+                 GFX_FONT_BASIC);
+    }
+}
+
+static void draw_page_map(int width, int height, void *refcon)
+{
+    (void)refcon;
+    map_draw(width, height);
+    XPLMSetGraphicsState(0, 0, 0, 0, 1, 1, 0);
+    gfx_begin(width, height);
+    draw_nearest();
+    draw_progress();
+    gfx_end();
+}
+
+static void draw_page_fpl(int width, int height, void *refcon)
+{
+    (void)refcon;
+    const fms_plan_t *plan = fms_mirror_plan(xplm_Fpl_Pilot_Primary);
+    const layout_rect_t *panel = layout_rect(&screen_layout, SCREEN_PROGRESS);
+    const float green[4] = {0.f, 1.f, 0.f, 1.f};
+    gfx_begin(width, height);
+    char *text = plan->count
+        ? arena_printf(frame_arena(), "FLIGHT PLAN %d WPTS %.0f NM", plan->count,
+                       plan->entries[plan->count - 1].cum_nm)
+        : "NO FLIGHT PLAN";
+    gfx_text(panel->x, screen_line(panel, 0), text, green, GFX_FONT_BASIC);
+    draw_legs();
+    gfx_end();
+}
+
+static void draw_page_sys(int width, int height, void *refcon)
+{
+    (void)refcon;
+    const layout_rect_t *panel = layout_rect(&screen_layout, SCREEN_PROGRESS);
+    const float cyan[4] = {0.f, 1.f, 1.f, 1.f};
+    map_stats_t map;
+    map_get_stats(&map);
+    pages_stats_t pg;
+    pages_get_stats(pages, &pg);
+    const char *lines[] = {
+        arena_printf(frame_arena(), "TERRAIN %s  WX %s", terrain_enabled() ? "ON" : "OFF",
+                     weather_enabled() ? "ON" : "OFF"),
+        arena_printf(frame_arena(), "EXPORT %s  STREAM %s", exporter ? "ON" : "OFF",
+                     streamer ? "ON" : "OFF"),
+        arena_printf(frame_arena(), "MAP TILES %d PENDING %d BUILT %u", map.resident, map.pending,
+                     map.built),
+        arena_printf(frame_arena(), "PAGE FLIPS %u  %.0f US/PAGE", pg.flips, pg.refresh_us),
+    };
+    gfx_begin(width, height);
+    for(int i = 0; i < (int)(sizeof(lines) / sizeof(lines[0])); ++i)
+        gfx_text(panel->x, screen_line(panel, i), lines[i], cyan, GFX_FONT_BASIC);
+    gfx_end();
+}
+
+static void draw_screen(void)
 {
-	(void)refcon;
-	
 	XPLMSetGraphicsState(0, 0, 0, 0, 1, 1, 0);
     glClearColor(0, 0, 0, 1);
     glPolygonMode(GL_FRONT, GL_FILL);
     glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
-    
+    if(!power_on(power_slot))
+        return;
+
+    pages_draw(pages);
+    XPLMSetGraphicsState(0, 0, 0, 0, 1, 1, 0);
+    rlist_draw(screen_list);
+
+    // Pages and overlay are drawn at full brightness, and cached that way: brightness, tint and
+    // power fade are one pass over the finished screen.
+    gfx_begin(WIDTH, HEIGHT);
+    screen_dim(power_brightness(power_slot), ambient);
+    gfx_end();
+}
+
+// Everything over the page, prepared with the other devices' drawing (render_list.h).
+static void prepare_screen(void *refcon)
+{
+    (void)refcon;
     int x = 0, y = 0;
     int hover = XPLMIsCursorOverAvionics(device, &x, &y);
+    update_layout();
+    int hover_btn = hover ? button_at(x, y) : -1;
     
-    
+    gfx_begin(WIDTH, HEIGHT);
     for(int i = 0; i < BTN_COUNT; ++i) {
-        bool btn_hover = hover && in_button(&btns[i], x, y);
-        draw_button(&btns[i], btn_hover);
+        screen_button(&btns[i], i == hover_btn);
     }
     
     
     if(clicked)
     {
-        draw_cursor(pos_x, pos_y, 1, 0, 1);
+        screen_cursor(pos_x, pos_y, (const float[4]){1, 0, 1, 1});
         float volts = XPLMGetAvionicsBusVoltsRatio(device);
         log_msg("device %p: %.f volts", device, volts);
         
     }
     else if(hover)
     {
-        draw_cursor(x, y, 1, 1, 1);
+        screen_cursor(x, y, (const float[4]){1, 1, 1, 1});
     }
 	
+	const layout_rect_t *touch = layout_rect(&screen_layout, SCREEN_TOUCH);
 	if(clicked)
 	{
-		char buffer[128];
-		snprintf(buffer, sizeof(buffer), "left touch location: %d,%d", pos_x, pos_y);
-		float color[3] = {1.f, 0.f, 1.f};
-		XPLMDrawString(color, 50, 200, buffer, NULL, xplmFont_Proportional);
+		char *text = arena_printf(frame_arena(), "left touch location: %d,%d", pos_x, pos_y);
+		const float color[4] = {1.f, 0.f, 1.f, 1.f};
+		gfx_text(touch->x, screen_line(touch, 1), text, color, GFX_FONT_PROPORTIONAL);
 	}
     
     if(right_clicked)
     {
-        char buffer[128];
-        snprintf(buffer, sizeof(buffer), "right touch location: %d,%d", right_pos_x, right_pos_y);
-        float color[3] = {1.f, 0.f, 1.f};
-        XPLMDrawString(color, 50, 250, buffer, NULL, xplmFont_Proportional);
+        char *text = arena_printf(frame_arena(), "right touch location: %d,%d", right_pos_x, right_pos_y);
+        const float color[4] = {1.f, 0.f, 1.f, 1.f};
+        gfx_text(touch->x, screen_line(touch, 0), text, color, GFX_FONT_PROPORTIONAL);
     }
+
+    gfx_end();
+}
+
+static void custom_screen(void *refcon)
+{
+	(void)refcon;
+	PROF_SCOPE(probes[CB_SCREEN]);
+	
+	uint64_t start = draw_sched_begin(sched_slot);
+	draw_screen();
+	if(export_capture)
+		export_gl_capture(export_capture);
+	draw_sched_end(sched_slot, start);
 }
 
 static int handle_popup(XPLMCommandRef cmd, XPLMCommandPhase phase, void *refcon)
 {
 	(void)cmd;
+	PROF_SCOPE(probes[CB_CMD_POPUP]);
 	
     if(phase != xplm_CommandBegin) return 1;
     XPLMAvionicsID id = refcon;
@@ -311,6 +728,7 @@ static int handle_popup(XPLMCommandRef cmd, XPLMCommandPhase phase, void *refcon
 static int handle_popout(XPLMCommandRef cmd, XPLMCommandPhase phase, void *refcon)
 {
 	(void)cmd;
+	PROF_SCOPE(probes[CB_CMD_POPOUT]);
 	
     if(phase != xplm_CommandBegin)
         return 1;
@@ -321,6 +739,13 @@ static int handle_popout(XPLMCommandRef cmd, XPLMCommandPhase phase, void *refco
 
 void custom_device_init(XPLMMenuID menu)
 {
+	for(int i = 0; i < CB_COUNT; ++i)
+		probes[i] = profiler_probe(cb_names[i]);
+	pool_create(&device_pool, "Test Avionics pool", DEVICE_POOL_SIZE);
+	nearest = pool_alloc(&device_pool, sizeof(nav_hit_t) * NEAREST_COUNT);
+	nearest_count = 0;
+	layout_init(&screen_layout, screen_layout_nodes, screen_rects, SCREEN_NODE_COUNT);
+	
 	XPLMCreateAvionics_t av = (XPLMCreateAvionics_t){
 		.structSize = sizeof(XPLMCreateAvionics_t),
 		.screenWidth = WIDTH,
@@ -329,7 +754,7 @@ void custom_device_init(XPLMMenuID menu)
 		.bezelHeight = DEV_HEIGHT,
 		.screenOffsetX = BEZEL_SIZE,
 		.screenOffsetY = BEZEL_SIZE,
-        .drawOnDemand = false,
+        .drawOnDemand = true,
 		.bezelDrawCallback = custom_bezel,
 		.drawCallback = custom_screen,
 		.screenTouchCallback = custom_screen_click,
@@ -341,7 +766,7 @@ void custom_device_init(XPLMMenuID menu)
         .bezelScrollCallback = custom_bezel_scroll,
         .brightnessCallback = custom_brightness,
 		.keyboardCallback = custom_keyboard,
-		.deviceID = "TEST_AVIONICS",
+		.deviceID = DEVICE_ID,
         .deviceName = "Test Avionics 9000"
 	};
 	device = XPLMCreateAvionicsEx(&av);
@@ -350,7 +775,16 @@ void custom_device_init(XPLMMenuID menu)
         log_msg("cannot create custom avionics device");
     } else {
         log_msg("Custom device %s", av.deviceID);
+        sched_slot = draw_sched_add(av.deviceName, device, DRAW_PRIO_HIGH, MIN_REFRESH_HZ, true);
+        screen_list = rlist_add(cb_names[CB_SCREEN], sched_slot, prepare_screen, NULL);
+        pages = pages_create(av.deviceName, WIDTH, HEIGHT, sched_slot, PAGE_BACKGROUND_HZ);
+        pages_add(pages, "MAP", draw_page_map, NULL);
+        pages_add(pages, "FPL", draw_page_fpl, NULL);
+        pages_add(pages, "SYS", draw_page_sys, NULL);
+        power_slot = power_add(av.deviceName, device, sched_slot, &screen_power);
     }
+    update_layout();
+    map_init(sched_slot);
 	
 	show_popup = XPLMCreateCommand("laminar/avionics_test/show_popup", "Show Test Avionics Popup");
 	XPLMRegisterCommandHandler(show_popup, handle_popup, 1, device);
@@ -363,12 +797,53 @@ void custom_device_init(XPLMMenuID menu)
         XPLMAppendMenuItemWithCommand(menu, "Open Test Device Popup", show_popup);
         XPLMAppendMenuItemWithCommand(menu, "Open Test Device Popout", show_popout);
     }
+    
+    XPLMCreateFlightLoop_t fl = (XPLMCreateFlightLoop_t){
+        .structSize = sizeof(XPLMCreateFlightLoop_t),
+        .phase = xplm_FlightLoop_Phase_AfterFlightModel,
+        .callbackFunc = update_nearest,
+        .refcon = NULL
+    };
+    nearest_loop = XPLMCreateFlightLoop(&fl);
+    XPLMScheduleFlightLoop(nearest_loop, 1.f, 1);
+    fl.callbackFunc = stream_poll_loop;
+    stream_loop = XPLMCreateFlightLoop(&fl);
+    fl.callbackFunc = watch_map;
+    map_loop = XPLMCreateFlightLoop(&fl);
+    map_seen = 0;
+    XPLMScheduleFlightLoop(map_loop, -1.f, 1);
+    fms_mirror_listen(fms_changed, NULL);
 		
 }
 
 void custom_device_fini()
 {
+	fms_mirror_unlisten(fms_changed, NULL);
+	set_export(false);
+	set_stream(false);
+	if(stream_loop)
+		XPLMDestroyFlightLoop(stream_loop);
+	stream_loop = NULL;
+	if(nearest_loop)
+		XPLMDestroyFlightLoop(nearest_loop);
+	nearest_loop = NULL;
+	if(map_loop)
+		XPLMDestroyFlightLoop(map_loop);
+	map_loop = NULL;
 	XPLMUnregisterCommandHandler(show_popup, handle_popup, 1, device);
 	XPLMUnregisterCommandHandler(show_popout, handle_popout, 1, device);
+	map_fini();
+	pages_destroy(pages);
+	pages = NULL;
+	power_remove(power_slot);
+	power_slot = -1;
+	rlist_remove(screen_list);
+	screen_list = RLIST_NONE;
+	draw_sched_remove(sched_slot);
+	sched_slot = -1;
 	XPLMDestroyAvionics(device);
+	pool_free(&device_pool, nearest, sizeof(nav_hit_t) * NEAREST_COUNT);
+	nearest = NULL;
+	nearest_count = 0;
+	pool_destroy(&device_pool);
 }
@@ -0,0 +1,264 @@
+/*===--------------------------------------------------------------------------------------------===
+ * draw_sched.c
+ *
+ * Frame-time budget scheduler for avionics draw callbacks.
+ *===--------------------------------------------------------------------------------------------===
+ */
+#include "draw_sched.h"
+#include "clock.h"
+#include <XPLMProcessing.h>
+#include <stdio.h>
+#include <string.h>
+
+void log_msg(const char *fmt, ...);
+
+#define MAX_SLOTS           (32)
+#define DEFAULT_BUDGET_US   (2000)
+// Weight of the newest sample in the cost estimate.
+#define COST_SMOOTHING      (0.2f)
+
+typedef struct {
+    bool used;
+    char name[64];
+    XPLMAvionicsID handle;
+    draw_prio_t prio;
+    bool on_demand;
+    uint64_t period_ns;         // 0 if the device has no minimum refresh rate.
+
+    bool dirty;
+    bool drawn;                 // Set by draw_sched_end() until the next flight loop.
+    bool drawn_last;            // Whether it was, last frame.
+    bool requested;             // Asked to draw this frame.
+    uint64_t frame_ns;
+    uint64_t last_draw_ns;
+    uint64_t next_due_ns;       // When the minimum refresh rate next forces a draw.
+
+    float cost_us;
+    float max_us;
+    unsigned draws;
+    unsigned deferred;
+} slot_t;
+
+static slot_t slots[MAX_SLOTS];
+static unsigned budget_us = DEFAULT_BUDGET_US;
+static XPLMFlightLoopID flight_loop = NULL;
+
+static void request_draw(slot_t *slot)
+{
+    slot->dirty = false;
+    slot->requested = true;
+    XPLMAvionicsNeedsDrawing(slot->handle);
+}
+
+// Folds the cost of last frame's callbacks into each slot's estimate. Returns the cost of the
+// devices we can't defer.
+static float account_last_frame(void)
+{
+    float fixed_us = 0.f;
+    for(int i = 0; i < MAX_SLOTS; ++i)
+    {
+        slot_t *slot = &slots[i];
+        if(!slot->used)
+            continue;
+        slot->drawn_last = slot->drawn;
+        slot->requested = false;
+        if(slot->drawn)
+        {
+            float us = (float)slot->frame_ns / 1000.f;
+            slot->cost_us = slot->draws ? slot->cost_us + COST_SMOOTHING * (us - slot->cost_us) : us;
+            if(us > slot->max_us)
+                slot->max_us = us;
+            slot->draws += 1;
+            slot->drawn = false;
+            slot->frame_ns = 0;
+        }
+        if(!slot->on_demand)
+            fixed_us += slot->cost_us;
+    }
+    return fixed_us;
+}
+
+static float sched_flight_loop(float since_call, float since_loop, int counter, void *refcon)
+{
+    (void)since_call;
+    (void)since_loop;
+    (void)counter;
+    (void)refcon;
+
+    uint64_t now = clock_now_ns();
+    float remaining = (float)budget_us - account_last_frame();
+
+    // Anything that is past its minimum refresh period, and critical devices that were
+    // invalidated, are drawn no matter what. Everything else that is dirty competes for what's
+    // left of the budget, by priority and then by how long it's been waiting.
+    int pending[MAX_SLOTS];
+    int pending_count = 0;
+    for(int i = 0; i < MAX_SLOTS; ++i)
+    {
+        slot_t *slot = &slots[i];
+        if(!slot->used || !slot->on_demand)
+            continue;
+        bool overdue = slot->period_ns && now >= slot->next_due_ns;
+        if(overdue || (slot->dirty && slot->prio == DRAW_PRIO_CRITICAL))
+        {
+            // X-Plane may not get to the draw this frame; don't ask again until the next tick.
+            if(overdue)
+                slot->next_due_ns = now + slot->period_ns;
+            remaining -= slot->cost_us;
+            request_draw(slot);
+        }
+        else if(slot->dirty)
+        {
+            int j = pending_count++;
+            while(j > 0)
+            {
+                const slot_t *other = &slots[pending[j-1]];
+                if(other->prio < slot->prio
+                   || (other->prio == slot->prio && other->last_draw_ns <= slot->last_draw_ns))
+                    break;
+                pending[j] = pending[j-1];
+                j -= 1;
+            }
+            pending[j] = i;
+        }
+    }
+
+    for(int i = 0; i < pending_count; ++i)
+    {
+        slot_t *slot = &slots[pending[i]];
+        if(slot->cost_us <= remaining)
+        {
+            remaining -= slot->cost_us;
+            request_draw(slot);
+        }
+        else
+        {
+            slot->deferred += 1;
+        }
+    }
+    return -1.f;
+}
+
+int draw_sched_add(const char *name, XPLMAvionicsID handle, draw_prio_t prio, float min_hz,
+                   bool on_demand)
+{
+    for(int i = 0; i < MAX_SLOTS; ++i)
+    {
+        slot_t *slot = &slots[i];
+        if(slot->used)
+            continue;
+        memset(slot, 0, sizeof(*slot));
+        slot->used = true;
+        snprintf(slot->name, sizeof(slot->name), "%s", name);
+        slot->handle = handle;
+        slot->prio = prio;
+        slot->on_demand = on_demand;
+        slot->period_ns = min_hz > 0.f ? (uint64_t)(1e9f / min_hz) : 0;
+        slot->dirty = true;
+        return i;
+    }
+    log_msg("draw scheduler: no slot left for %s", name);
+    return -1;
+}
+
+void draw_sched_remove(int slot)
+{
+    if(slot < 0 || slot >= MAX_SLOTS)
+        return;
+    slots[slot].used = false;
+}
+
+void draw_sched_invalidate(int slot)
+{
+    if(slot < 0 || slot >= MAX_SLOTS)
+        return;
+    slots[slot].dirty = true;
+}
+
+bool draw_sched_expected(int slot)
+{
+    if(slot < 0 || slot >= MAX_SLOTS || !slots[slot].used)
+        return false;
+    const slot_t *s = &slots[slot];
+    return s->on_demand ? s->requested : s->drawn_last;
+}
+
+uint64_t draw_sched_begin(int slot)
+{
+    (void)slot;
+    return clock_now_ns();
+}
+
+void draw_sched_end(int slot, uint64_t start)
+{
+    if(slot < 0 || slot >= MAX_SLOTS)
+        return;
+    uint64_t now = clock_now_ns();
+    slots[slot].frame_ns += now - start;
+    slots[slot].last_draw_ns = now;
+    slots[slot].next_due_ns = now + slots[slot].period_ns;
+    slots[slot].drawn = true;
+}
+
+void draw_sched_set_budget_us(unsigned budget)
+{
+    budget_us = budget;
+}
+
+unsigned draw_sched_budget_us(void)
+{
+    return budget_us;
+}
+
+int draw_sched_count(void)
+{
+    int count = 0;
+    for(int i = 0; i < MAX_SLOTS; ++i)
+        count += slots[i].used;
+    return count;
+}
+
+bool draw_sched_stats(int index, draw_sched_stats_t *out)
+{
+    const slot_t *s = NULL;
+    for(int i = 0; i < MAX_SLOTS && !s; ++i)
+    {
+        if(slots[i].used && index-- == 0)
+            s = &slots[i];
+    }
+    if(!s)
+        return false;
+    *out = (draw_sched_stats_t){
+        .name = s->name,
+        .prio = s->prio,
+        .cost_us = s->cost_us,
+        .max_us = s->max_us,
+        .draws = s->draws,
+        .deferred = s->deferred,
+    };
+    return true;
+}
+
+void draw_sched_init(void)
+{
+    memset(slots, 0, sizeof(slots));
+
+    // Run after the flight model, as close as we can get to the start of rendering, so the
+    // decisions are made with last frame's costs and the requests apply to this frame.
+    XPLMCreateFlightLoop_t fl = (XPLMCreateFlightLoop_t){
+        .structSize = sizeof(XPLMCreateFlightLoop_t),
+        .phase = xplm_FlightLoop_Phase_AfterFlightModel,
+        .callbackFunc = sched_flight_loop,
+        .refcon = NULL
+    };
+    flight_loop = XPLMCreateFlightLoop(&fl);
+    XPLMScheduleFlightLoop(flight_loop, -1.f, 1);
+}
+
+void draw_sched_fini(void)
+{
+    if(flight_loop)
+        XPLMDestroyFlightLoop(flight_loop);
+    flight_loop = NULL;
+    memset(slots, 0, sizeof(slots));
+}
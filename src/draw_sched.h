@@ -0,0 +1,69 @@
+/*===--------------------------------------------------------------------------------------------===
+ * draw_sched.h
+ *
+ * Frame-time budget scheduler for avionics draw callbacks.
+ *
+ * Every device whose draw callbacks we own registers a slot with a priority and a minimum refresh
+ * rate. Draw callbacks bracket their work with draw_sched_begin()/draw_sched_end() so we keep a
+ * running estimate of what each device costs. Once per frame, before X-Plane renders, the
+ * scheduler decides which on-demand devices get redrawn (XPLMAvionicsNeedsDrawing) so the total
+ * stays under the per-frame budget: high-priority devices go first, and low-priority ones are
+ * pushed to a later frame once the budget is spent, as long as they still meet their minimum rate.
+ *
+ * Devices that X-Plane draws every frame (stock device overlays) can't be deferred, but their cost
+ * is still measured and taken out of the budget before on-demand devices are considered.
+ *===--------------------------------------------------------------------------------------------===
+*/
+#ifndef _DRAW_SCHED_H_
+#define _DRAW_SCHED_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <XPLMDisplay.h>
+
+typedef enum {
+    DRAW_PRIO_CRITICAL,     // Primary flight displays: drawn every time they're invalidated.
+    DRAW_PRIO_HIGH,
+    DRAW_PRIO_NORMAL,
+    DRAW_PRIO_LOW,          // RMUs, secondary MFD pages: first to be deferred.
+} draw_prio_t;
+
+typedef struct {
+    const char *name;
+    draw_prio_t prio;
+    float cost_us;          // Smoothed cost of one frame's worth of draw callbacks.
+    float max_us;           // Worst frame seen since the last reset.
+    unsigned draws;
+    unsigned deferred;      // Frames where a redraw was due but didn't fit the budget.
+} draw_sched_stats_t;
+
+// Registers a device. `on_demand` must match the drawOnDemand flag the device was created with.
+// `min_hz` is the rate below which the device is redrawn even if nothing invalidated it, and
+// regardless of the budget. Returns a slot, or -1 if there is no room left.
+int draw_sched_add(const char *name, XPLMAvionicsID handle, draw_prio_t prio, float min_hz,
+                   bool on_demand);
+void draw_sched_remove(int slot);
+
+// Asks for the device to be redrawn as soon as the budget allows. Safe from any callback.
+void draw_sched_invalidate(int slot);
+
+// Whether the device is expected to draw this frame: asked to by the scheduler (on-demand
+// devices) or drawn last frame (the others). A guess, for work prepared ahead of the callbacks.
+bool draw_sched_expected(int slot);
+
+// Bracket a draw callback. Nesting is not supported; before/after callbacks of stock devices are
+// summed into the same frame.
+uint64_t draw_sched_begin(int slot);
+void draw_sched_end(int slot, uint64_t start);
+
+void draw_sched_set_budget_us(unsigned budget_us);
+unsigned draw_sched_budget_us(void);
+
+// Number of registered devices, and the stats of the `index`th of them (not a slot number).
+int draw_sched_count(void);
+bool draw_sched_stats(int index, draw_sched_stats_t *out);
+
+void draw_sched_init(void);
+void draw_sched_fini(void);
+
+#endif /* ifndef _DRAW_SCHED_H_ */
@@ -0,0 +1,163 @@
+/*===--------------------------------------------------------------------------------------------===
+ * export.c
+ *
+ * Shared memory frame ring, writer side.
+ *===--------------------------------------------------------------------------------------------===
+ */
+#include "export.h"
+#include "clock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if !IBM
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+void log_msg(const char *fmt, ...);
+
+// Each slot's pixels start on a page boundary.
+#define PIXELS_ALIGN        (4096)
+
+struct export_s {
+    char name[EXPORT_NAME_MAX + 1];
+    export_header_t *hdr;
+    size_t size;
+    uint64_t frames;
+    uint64_t copy_ns;
+};
+
+static size_t align_up(size_t v, size_t a)
+{
+    return (v + a - 1) / a * a;
+}
+
+export_t *export_open(const char *device_id, int max_width, int max_height)
+{
+#if IBM
+    (void)device_id;
+    (void)max_width;
+    (void)max_height;
+    log_msg("export: shared memory export is not available on Windows");
+    return NULL;
+#else
+    if(max_width <= 0 || max_height <= 0)
+        return NULL;
+    export_t *ex = calloc(1, sizeof(*ex));
+    if(!ex)
+        return NULL;
+    snprintf(ex->name, sizeof(ex->name), "/xpav-%s", device_id);
+
+    size_t slot_bytes = align_up((size_t)max_width * (size_t)max_height * 4, PIXELS_ALIGN);
+    size_t pixels_offset = align_up(sizeof(export_header_t), PIXELS_ALIGN);
+    ex->size = pixels_offset + slot_bytes * EXPORT_SLOTS;
+
+    // A segment left behind by a crash would have the wrong size, or a dead header.
+    shm_unlink(ex->name);
+    int fd = shm_open(ex->name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if(fd < 0)
+    {
+        log_msg("export: cannot create %s", ex->name);
+        free(ex);
+        return NULL;
+    }
+    if(ftruncate(fd, (off_t)ex->size) != 0)
+    {
+        log_msg("export: cannot size %s to %zu bytes", ex->name, ex->size);
+        close(fd);
+        shm_unlink(ex->name);
+        free(ex);
+        return NULL;
+    }
+    void *mem = mmap(NULL, ex->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mem == MAP_FAILED)
+    {
+        log_msg("export: cannot map %s", ex->name);
+        shm_unlink(ex->name);
+        free(ex);
+        return NULL;
+    }
+
+    // ftruncate() zero-fills, so every slot starts out even (complete) and empty.
+    export_header_t *hdr = mem;
+    hdr->version = EXPORT_VERSION;
+    hdr->max_width = (uint32_t)max_width;
+    hdr->max_height = (uint32_t)max_height;
+    hdr->slot_count = EXPORT_SLOTS;
+    hdr->pixels_offset = (uint32_t)pixels_offset;
+    hdr->slot_bytes = slot_bytes;
+    atomic_store_explicit(&hdr->latest, 0, memory_order_relaxed);
+    atomic_store_explicit(&hdr->alive, 1, memory_order_relaxed);
+    // Viewers wait for the magic, so it goes in once everything else is there.
+    atomic_thread_fence(memory_order_release);
+    hdr->magic = EXPORT_MAGIC;
+
+    ex->hdr = hdr;
+    log_msg("export: %s, %dx%d, %zu KiB", ex->name, max_width, max_height, ex->size / 1024);
+    return ex;
+#endif
+}
+
+void export_close(export_t *ex)
+{
+    if(!ex)
+        return;
+#if !IBM
+    atomic_store_explicit(&ex->hdr->alive, 0, memory_order_release);
+    munmap(ex->hdr, ex->size);
+    shm_unlink(ex->name);
+#endif
+    free(ex);
+}
+
+void export_submit(export_t *ex, const uint8_t *pixels, int width, int height, int stride,
+                   uint64_t time_ns)
+{
+    if(!ex || width <= 0 || height <= 0)
+        return;
+    uint64_t start = clock_now_ns();
+    export_header_t *hdr = ex->hdr;
+    uint32_t w = (uint32_t)width < hdr->max_width ? (uint32_t)width : hdr->max_width;
+    uint32_t h = (uint32_t)height < hdr->max_height ? (uint32_t)height : hdr->max_height;
+
+    uint64_t frame = ex->frames + 1;
+    uint32_t index = (uint32_t)(frame % EXPORT_SLOTS);
+    export_slot_t *slot = &hdr->slots[index];
+    uint8_t *dst = (uint8_t *)export_pixels(hdr, index);
+
+    uint32_t seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+    atomic_store_explicit(&slot->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    size_t row = (size_t)w * 4;
+    if((size_t)stride == row)
+    {
+        memcpy(dst, pixels, row * h);
+    }
+    else
+    {
+        for(uint32_t y = 0; y < h; ++y)
+            memcpy(dst + y * row, pixels + (size_t)y * (size_t)stride, row);
+    }
+    slot->width = w;
+    slot->height = h;
+    slot->frame = frame;
+    slot->time_ns = time_ns;
+
+    atomic_store_explicit(&slot->seq, seq + 2, memory_order_release);
+    atomic_store_explicit(&hdr->latest, frame, memory_order_release);
+    ex->frames = frame;
+    ex->copy_ns += clock_now_ns() - start;
+}
+
+void export_get_stats(const export_t *ex, export_stats_t *out)
+{
+    memset(out, 0, sizeof(*out));
+    if(!ex)
+        return;
+    out->frames = ex->frames;
+    out->copy_us = ex->frames ? (float)((double)ex->copy_ns / (double)ex->frames / 1e3) : 0.f;
+}
@@ -0,0 +1,87 @@
+/*===--------------------------------------------------------------------------------------------===
+ * export.h
+ *
+ * Device screens published to POSIX shared memory, for external viewers on the same machine.
+ *
+ * Each exported device gets a segment named "/xpav-<device ID>" holding an export_header_t and a
+ * ring of EXPORT_SLOTS frame buffers. The plugin writes each new frame into the slot after the last
+ * one, so a viewer reading the newest frame is never the one being overwritten unless it falls two
+ * frames behind. Every slot has a sequence counter (a seqlock): odd while the plugin is writing the
+ * slot, bumped to the next even value when the frame is complete. A viewer maps the segment
+ * read-only and, per frame, without copies or system calls:
+ *
+ *      uint64_t frame = atomic_load_explicit(&hdr->latest, memory_order_acquire);
+ *      const export_slot_t *slot = &hdr->slots[frame % hdr->slot_count];
+ *      uint32_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+ *      if(seq & 1) -> being written, try again
+ *      ... use slot->width, slot->height and the pixels at export_pixels(hdr, index) ...
+ *      atomic_thread_fence(memory_order_acquire);
+ *      if(atomic_load_explicit(&slot->seq, memory_order_relaxed) != seq) -> torn, discard
+ *
+ * Pixels are 8-bit RGBA, width * 4 bytes a row, bottom row first (OpenGL's order). This header is
+ * all a viewer needs; see tools/export_view.c. Frames come from export_gl.h in the plugin. The
+ * writer side is main thread only. Not available on Windows, where export_open() logs and returns
+ * NULL.
+ *===--------------------------------------------------------------------------------------------===
+*/
+#ifndef _EXPORT_H_
+#define _EXPORT_H_
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define EXPORT_MAGIC        (0x56415058u)   // "XPAV", little-endian.
+#define EXPORT_VERSION      (1)
+#define EXPORT_SLOTS        (3)
+#define EXPORT_NAME_MAX     (31)            // macOS's limit on shared memory names.
+
+typedef struct {
+    _Atomic uint32_t seq;       // Odd while being written.
+    uint32_t width, height;     // This frame's size, at most the header's max.
+    uint32_t reserved;
+    uint64_t frame;             // Frame number, from 1.
+    uint64_t time_ns;           // CLOCK_MONOTONIC when the frame was captured.
+} export_slot_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t max_width, max_height;
+    uint32_t slot_count;
+    uint32_t pixels_offset;     // From the start of the segment to slot 0's pixels.
+    uint64_t slot_bytes;        // Between one slot's pixels and the next.
+    _Atomic uint64_t latest;    // Newest complete frame; 0 until there's one.
+    _Atomic uint32_t alive;     // Cleared when the plugin stops exporting.
+    uint32_t reserved;
+    export_slot_t slots[EXPORT_SLOTS];
+} export_header_t;
+
+static inline const uint8_t *export_pixels(const export_header_t *hdr, uint32_t slot)
+{
+    return (const uint8_t *)hdr + hdr->pixels_offset + slot * hdr->slot_bytes;
+}
+
+/*
+ * Writer side, for the plugin.
+ */
+
+typedef struct export_s export_t;
+
+typedef struct {
+    uint64_t frames;            // Published.
+    float copy_us;              // Average time to copy a frame into the segment.
+} export_stats_t;
+
+// Creates the segment for frames up to max_width x max_height. Returns NULL (and logs) on failure.
+export_t *export_open(const char *device_id, int max_width, int max_height);
+// Marks the segment dead and unlinks it. Viewers keep their mapping until they let go.
+void export_close(export_t *ex);
+
+// Copies in a frame already in memory: `stride` bytes between rows, bottom row first. Frames
+// larger than the segment are cropped.
+void export_submit(export_t *ex, const uint8_t *pixels, int width, int height, int stride,
+                   uint64_t time_ns);
+
+void export_get_stats(const export_t *ex, export_stats_t *out);
+
+#endif /* ifndef _EXPORT_H_ */
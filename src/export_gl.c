@@ -0,0 +1,154 @@
+/*===--------------------------------------------------------------------------------------------===
+ * export_gl.c
+ *
+ * Pixel buffer object readback ring.
+ *===--------------------------------------------------------------------------------------------===
+ */
+#include "export_gl.h"
+#include "clock.h"
+#include "gl_procs.h"
+#include <stdbool.h>
+#include <stdlib.h>
+
+void log_msg(const char *fmt, ...);
+
+#define READBACK_BUFFERS    (3)
+
+typedef struct {
+    GLuint pbo;
+    gl_sync_t fence;
+    int width, height;
+    size_t allocated;
+    uint64_t time_ns;
+} readback_t;
+
+struct export_gl_s {
+    export_sink_f sink;
+    void *refcon;
+    unsigned dropped;
+    readback_t buffers[READBACK_BUFFERS];
+    int head;               // Oldest capture in flight.
+    int in_flight;
+    bool ok;
+};
+
+export_gl_t *export_gl_create(export_sink_f sink, void *refcon)
+{
+    export_gl_t *cap = calloc(1, sizeof(*cap));
+    if(!cap)
+        return NULL;
+    cap->sink = sink;
+    cap->refcon = refcon;
+    return cap;
+}
+
+static bool setup(export_gl_t *cap)
+{
+    if(cap->ok)
+        return true;
+    if(!gl_procs_load())
+        return false;
+    for(int i = 0; i < READBACK_BUFFERS; ++i)
+        gl_procs.GenBuffers(1, &cap->buffers[i].pbo);
+    if(!gl_procs_sync())
+        log_msg("export: no fence syncs, reading back a full ring behind");
+    cap->ok = true;
+    return true;
+}
+
+// Hands the oldest capture to the sink, if the GPU is done with it. With `force`, it's
+// copied regardless (waiting, if need be), which is only done once the ring is full.
+static bool collect_oldest(export_gl_t *cap, bool force)
+{
+    readback_t *rb = &cap->buffers[cap->head];
+    if(rb->fence)
+    {
+        GLenum status = gl_procs.ClientWaitSync(rb->fence, 0, 0);
+        if(status == GL_TIMEOUT_EXPIRED && !force)
+            return false;
+        gl_procs.DeleteSync(rb->fence);
+        rb->fence = NULL;
+    }
+    else if(!force)
+    {
+        return false;
+    }
+
+    gl_procs.BindBuffer(GL_PIXEL_PACK_BUFFER, rb->pbo);
+    const uint8_t *pixels = gl_procs.MapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+    if(pixels)
+    {
+        cap->sink(pixels, rb->width, rb->height, rb->width * 4, rb->time_ns, cap->refcon);
+        gl_procs.UnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    gl_procs.BindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    cap->head = (cap->head + 1) % READBACK_BUFFERS;
+    cap->in_flight -= 1;
+    return true;
+}
+
+void export_gl_capture(export_gl_t *cap)
+{
+    if(!cap || !setup(cap))
+        return;
+
+    // Everything the GPU has finished goes out first, oldest first.
+    while(cap->in_flight && collect_oldest(cap, false))
+        ;
+    if(cap->in_flight == READBACK_BUFFERS)
+    {
+        // Without fences there's no asking, and three frames on the oldest is surely done.
+        if(gl_procs_sync() || !collect_oldest(cap, true))
+        {
+            cap->dropped += 1;
+            return;
+        }
+    }
+
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    if(viewport[2] <= 0 || viewport[3] <= 0)
+        return;
+
+    int index = (cap->head + cap->in_flight) % READBACK_BUFFERS;
+    readback_t *rb = &cap->buffers[index];
+    size_t bytes = (size_t)viewport[2] * (size_t)viewport[3] * 4;
+    gl_procs.BindBuffer(GL_PIXEL_PACK_BUFFER, rb->pbo);
+    if(bytes > rb->allocated)
+    {
+        gl_procs.BufferData(GL_PIXEL_PACK_BUFFER, (ptrdiff_t)bytes, NULL, GL_STREAM_READ);
+        rb->allocated = bytes;
+    }
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    // With a pack buffer bound, the pointer is an offset into it and this returns at once.
+    glReadPixels(viewport[0], viewport[1], viewport[2], viewport[3], GL_RGBA, GL_UNSIGNED_BYTE,
+                 NULL);
+    gl_procs.BindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    if(gl_procs_sync())
+        rb->fence = gl_procs.FenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    rb->width = viewport[2];
+    rb->height = viewport[3];
+    rb->time_ns = clock_now_ns();
+    cap->in_flight += 1;
+}
+
+unsigned export_gl_dropped(const export_gl_t *cap)
+{
+    return cap ? cap->dropped : 0;
+}
+
+void export_gl_destroy(export_gl_t *cap)
+{
+    if(!cap)
+        return;
+    for(int i = 0; i < READBACK_BUFFERS; ++i)
+    {
+        readback_t *rb = &cap->buffers[i];
+        if(rb->fence)
+            gl_procs.DeleteSync(rb->fence);
+        if(rb->pbo)
+            gl_procs.DeleteBuffers(1, &rb->pbo);
+    }
+    free(cap);
+}
@@ -0,0 +1,35 @@
+/*===--------------------------------------------------------------------------------------------===
+ * export_gl.h
+ *
+ * Asynchronous readback of what was just drawn, for the screen exports (export.h, stream.h).
+ *
+ * glReadPixels into client memory waits for the GPU to finish the frame, which stalls the whole
+ * pipeline. Instead each capture reads into one of a small ring of pixel buffer objects, which
+ * returns at once, and puts a fence after it. A buffer is only mapped and handed to the sink on a
+ * later capture, once its fence says the GPU is done with it (or, without fences,
+ * once it's the oldest of the ring). If every buffer is still in flight the capture is skipped
+ * rather than waited for. Frames reach viewers a capture or two late, or three without fences.
+ *
+ * Call with the GL context current, from the draw callback. Main thread only.
+ *===--------------------------------------------------------------------------------------------===
+*/
+#ifndef _EXPORT_GL_H_
+#define _EXPORT_GL_H_
+
+#include <stdint.h>
+
+typedef struct export_gl_s export_gl_t;
+
+// Receives each frame read back: `stride` bytes between rows, bottom row first, valid only for
+// the duration of the call.
+typedef void (*export_sink_f)(const uint8_t *pixels, int width, int height, int stride,
+                              uint64_t time_ns, void *refcon);
+
+export_gl_t *export_gl_create(export_sink_f sink, void *refcon);
+// Reads back the current viewport.
+void export_gl_capture(export_gl_t *cap);
+// Captures skipped because the GPU hadn't finished the earlier ones.
+unsigned export_gl_dropped(const export_gl_t *cap);
+void export_gl_destroy(export_gl_t *cap);
+
+#endif /* ifndef _EXPORT_GL_H_ */
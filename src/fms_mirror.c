@@ -0,0 +1,242 @@
+/*===--------------------------------------------------------------------------------------------===
+ * fms_mirror.c
+ *
+ * FMS flight plan polling, diffing and leg geometry.
+ *===--------------------------------------------------------------------------------------------===
+ */
+#include "fms_mirror.h"
+#include "geo.h"
+#include "ownship.h"
+#include "profiler.h"
+#include <XPLMProcessing.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+void log_msg(const char *fmt, ...);
+
+// One plan is read per poll, so each is refreshed every FMS_PLAN_COUNT * FMS_POLL_INTERVAL.
+#define FMS_POLL_INTERVAL   (0.2f)
+#define FMS_MAX_LISTENERS   (8)
+// Below this, ETEs are meaningless; above it, they're refreshed when speed changes by this much.
+#define FMS_MIN_GS_KTS      (30.f)
+#define FMS_GS_TOLERANCE    (0.05f)
+
+typedef struct {
+    fms_listener_f fn;
+    void *refcon;
+} listener_t;
+
+static fms_plan_t plans[FMS_PLAN_COUNT];
+static float plan_gs[FMS_PLAN_COUNT];
+static fms_entry_t fresh[FMS_MAX_ENTRIES];
+static listener_t listeners[FMS_MAX_LISTENERS];
+static int next_plan = 0;
+static XPLMFlightLoopID flight_loop = NULL;
+static prof_probe_t poll_probe = PROF_NO_PROBE;
+
+static bool same_entry(const fms_entry_t *a, const fms_entry_t *b)
+{
+    return a->type == b->type
+        && a->ref == b->ref
+        && a->altitude == b->altitude
+        && a->lat == b->lat
+        && a->lon == b->lon
+        && !strcmp(a->id, b->id);
+}
+
+static void notify(XPLMNavFlightPlan plan, fms_event_t event, int index)
+{
+    for(int i = 0; i < FMS_MAX_LISTENERS; ++i)
+    {
+        if(listeners[i].fn)
+            listeners[i].fn(plan, event, index, listeners[i].refcon);
+    }
+}
+
+static void update_leg(fms_plan_t *p, int i)
+{
+    fms_entry_t *to = &p->entries[i];
+    if(i == 0)
+    {
+        to->leg_nm = 0.f;
+        to->course = 0.f;
+        return;
+    }
+    const fms_entry_t *from = &p->entries[i - 1];
+    to->leg_nm = (float)geo_distance_nm(from->lat, from->lon, to->lat, to->lon);
+    to->course = (float)geo_bearing(from->lat, from->lon, to->lat, to->lon);
+}
+
+// Recomputes ETEs and re-sums cumulative figures from entry `first` on.
+static void update_totals(fms_plan_t *p, int first, float gs_kts)
+{
+    float cum_nm = first > 0 ? p->entries[first - 1].cum_nm : 0.f;
+    float cum_ete = first > 0 ? p->entries[first - 1].cum_ete_s : 0.f;
+    for(int i = first; i < p->count; ++i)
+    {
+        fms_entry_t *e = &p->entries[i];
+        e->leg_ete_s = gs_kts >= FMS_MIN_GS_KTS ? e->leg_nm / gs_kts * 3600.f : 0.f;
+        cum_nm += e->leg_nm;
+        cum_ete += e->leg_ete_s;
+        e->cum_nm = cum_nm;
+        e->cum_ete_s = cum_ete;
+    }
+}
+
+static int read_plan(XPLMNavFlightPlan plan)
+{
+    int count = XPLMCountFMSFlightPlanEntries(plan);
+    if(count > FMS_MAX_ENTRIES)
+        count = FMS_MAX_ENTRIES;
+
+    char id[256];
+    for(int i = 0; i < count; ++i)
+    {
+        fms_entry_t *e = &fresh[i];
+        e->type = xplm_Nav_Unknown;
+        e->ref = XPLM_NAV_NOT_FOUND;
+        e->altitude = 0;
+        e->lat = e->lon = 0.f;
+        id[0] = '\0';
+        XPLMGetFMSFlightPlanEntryInfo(plan, i, &e->type, id, &e->ref, &e->altitude, &e->lat,
+                                      &e->lon);
+        snprintf(e->id, sizeof(e->id), "%s", id);
+    }
+    return count;
+}
+
+static void poll_plan(XPLMNavFlightPlan plan)
+{
+    fms_plan_t *p = &plans[plan];
+    int new_count = read_plan(plan);
+    int old_count = p->count;
+
+    // Whatever matches at both ends is untouched; everything in between changed.
+    int min_count = old_count < new_count ? old_count : new_count;
+    int prefix = 0;
+    while(prefix < min_count && same_entry(&p->entries[prefix], &fresh[prefix]))
+        prefix += 1;
+    int suffix = 0;
+    while(suffix < min_count - prefix
+          && same_entry(&p->entries[old_count - 1 - suffix], &fresh[new_count - 1 - suffix]))
+        suffix += 1;
+    int old_mid = old_count - prefix - suffix;
+    int new_mid = new_count - prefix - suffix;
+
+    const ownship_t *own = ownship_get();
+    float gs = own->valid ? own->groundspeed_kts : 0.f;
+    bool gs_changed = fabsf(gs - plan_gs[plan])
+        > FMS_GS_TOLERANCE * fmaxf(plan_gs[plan], FMS_MIN_GS_KTS);
+
+    if(old_mid || new_mid)
+    {
+        memmove(&p->entries[prefix + new_mid], &p->entries[prefix + old_mid],
+                sizeof(fms_entry_t) * (size_t)suffix);
+        memcpy(&p->entries[prefix], &fresh[prefix], sizeof(fms_entry_t) * (size_t)new_mid);
+        p->count = new_count;
+
+        // The leg after the last changed entry starts somewhere new too.
+        int last = prefix + new_mid + 1;
+        for(int i = prefix; i < last && i < new_count; ++i)
+            update_leg(p, i);
+        update_totals(p, gs_changed ? 0 : prefix, gs);
+        if(gs_changed)
+            plan_gs[plan] = gs;
+        p->version += 1;
+
+        int modified = old_mid < new_mid ? old_mid : new_mid;
+        for(int i = 0; i < modified; ++i)
+            notify(plan, FMS_EVENT_MODIFY, prefix + i);
+        for(int i = modified; i < new_mid; ++i)
+            notify(plan, FMS_EVENT_INSERT, prefix + i);
+        for(int i = modified; i < old_mid; ++i)
+            notify(plan, FMS_EVENT_DELETE, prefix + modified);
+    }
+    else if(gs_changed)
+    {
+        // Only the ETEs are stale.
+        update_totals(p, 0, gs);
+        plan_gs[plan] = gs;
+    }
+
+    int displayed = XPLMGetDisplayedFMSFlightPlanEntry(plan);
+    int destination = XPLMGetDestinationFMSFlightPlanEntry(plan);
+    if(displayed != p->displayed || destination != p->destination)
+    {
+        p->displayed = displayed;
+        p->destination = destination;
+        p->version += 1;
+        notify(plan, FMS_EVENT_ACTIVE, displayed);
+    }
+}
+
+static float fms_flight_loop(float since_call, float since_loop, int counter, void *refcon)
+{
+    (void)since_call;
+    (void)since_loop;
+    (void)counter;
+    (void)refcon;
+    PROF_SCOPE(poll_probe);
+
+    poll_plan(next_plan);
+    next_plan = (next_plan + 1) % FMS_PLAN_COUNT;
+    return FMS_POLL_INTERVAL;
+}
+
+const fms_plan_t *fms_mirror_plan(XPLMNavFlightPlan plan)
+{
+    if(plan < 0 || plan >= FMS_PLAN_COUNT)
+        return NULL;
+    return &plans[plan];
+}
+
+bool fms_mirror_listen(fms_listener_f fn, void *refcon)
+{
+    for(int i = 0; i < FMS_MAX_LISTENERS; ++i)
+    {
+        if(!listeners[i].fn)
+        {
+            listeners[i] = (listener_t){fn, refcon};
+            return true;
+        }
+    }
+    log_msg("fms_mirror: too many listeners");
+    return false;
+}
+
+void fms_mirror_unlisten(fms_listener_f fn, void *refcon)
+{
+    for(int i = 0; i < FMS_MAX_LISTENERS; ++i)
+    {
+        if(listeners[i].fn == fn && listeners[i].refcon == refcon)
+            listeners[i] = (listener_t){NULL, NULL};
+    }
+}
+
+void fms_mirror_init(void)
+{
+    memset(plans, 0, sizeof(plans));
+    memset(plan_gs, 0, sizeof(plan_gs));
+    for(int i = 0; i < FMS_PLAN_COUNT; ++i)
+        plans[i].displayed = plans[i].destination = -1;
+    next_plan = 0;
+    poll_probe = profiler_probe("fms mirror/poll");
+
+    XPLMCreateFlightLoop_t fl = (XPLMCreateFlightLoop_t){
+        .structSize = sizeof(XPLMCreateFlightLoop_t),
+        .phase = xplm_FlightLoop_Phase_AfterFlightModel,
+        .callbackFunc = fms_flight_loop,
+        .refcon = NULL
+    };
+    flight_loop = XPLMCreateFlightLoop(&fl);
+    XPLMScheduleFlightLoop(flight_loop, FMS_POLL_INTERVAL, 1);
+}
+
+void fms_mirror_fini(void)
+{
+    if(flight_loop)
+        XPLMDestroyFlightLoop(flight_loop);
+    flight_loop = NULL;
+    memset(listeners, 0, sizeof(listeners));
+}
@@ -0,0 +1,70 @@
+/*===--------------------------------------------------------------------------------------------===
+ * fms_mirror.h
+ *
+ * Local copy of the sim's FMS flight plans, with leg geometry.
+ *
+ * The XPLM has no way to tell us a flight plan changed, and reading one back entry by entry is
+ * too slow to do every frame. Instead, a flight loop reads one plan every 0.2 s, going round
+ * all of them in turn, and diffs it against the copy we keep here. Only the entries that changed are copied in and only the legs
+ * touching them have their distance and course recomputed; cumulative figures are re-summed from
+ * the first change onwards. Listeners are told what changed, so pages can redraw (or rebuild
+ * their own caches) only when they have to.
+ *
+ * Everything here is main-thread only.
+ *===--------------------------------------------------------------------------------------------===
+*/
+#ifndef _FMS_MIRROR_H_
+#define _FMS_MIRROR_H_
+
+#include <stdbool.h>
+#include <XPLMNavigation.h>
+
+#define FMS_MAX_ENTRIES     (100)
+#define FMS_PLAN_COUNT      (xplm_Fpl_CoPilot_Temporary + 1)
+#define FMS_ID_LEN          (32)
+
+typedef struct {
+    XPLMNavType type;
+    char id[FMS_ID_LEN];
+    XPLMNavRef ref;
+    int altitude;
+    float lat;
+    float lon;
+
+    // The leg ending at this entry. All zero for the first entry.
+    float leg_nm;
+    float course;           // Initial true course.
+    float leg_ete_s;        // At the current ground speed, or 0 when stopped.
+    // From the first entry to this one.
+    float cum_nm;
+    float cum_ete_s;
+} fms_entry_t;
+
+typedef struct {
+    int count;
+    int displayed;
+    int destination;
+    unsigned version;       // Bumped on every change, for readers that poll.
+    fms_entry_t entries[FMS_MAX_ENTRIES];
+} fms_plan_t;
+
+typedef enum {
+    FMS_EVENT_INSERT,
+    FMS_EVENT_DELETE,
+    FMS_EVENT_MODIFY,
+    FMS_EVENT_ACTIVE,       // Displayed or destination entry changed.
+} fms_event_t;
+
+// Events from one poll come in an order that, applied one after the other, turns the previous
+// copy of the plan into the new one: `index` is valid against the list as it stands at that point.
+typedef void (*fms_listener_f)(XPLMNavFlightPlan plan, fms_event_t event, int index, void *refcon);
+
+const fms_plan_t *fms_mirror_plan(XPLMNavFlightPlan plan);
+
+bool fms_mirror_listen(fms_listener_f fn, void *refcon);
+void fms_mirror_unlisten(fms_listener_f fn, void *refcon);
+
+void fms_mirror_init(void);
+void fms_mirror_fini(void);
+
+#endif /* ifndef _FMS_MIRROR_H_ */
@@ -0,0 +1,72 @@
+/*===--------------------------------------------------------------------------------------------===
+ * geo.h
+ *
+ * Spherical-earth helpers shared by the navigation code. Distances are in nautical miles, angles
+ * in degrees unless a name says otherwise.
+ *===--------------------------------------------------------------------------------------------===
+*/
+#ifndef _GEO_H_
+#define _GEO_H_
+
+#define _USE_MATH_DEFINES
+#include <math.h>
+
+#define EARTH_RADIUS_NM     (3440.065)
+#define NM_PER_DEG_LAT      (60.0)
+#define DEG2RAD             (M_PI / 180.0)
+#define RAD2DEG             (180.0 / M_PI)
+#define M_TO_FT             (3.28084)
+#define MS_TO_KTS           (1.943844)
+
+static inline double geo_wrap_lon(double lon)
+{
+    while(lon >= 180.0)
+        lon -= 360.0;
+    while(lon < -180.0)
+        lon += 360.0;
+    return lon;
+}
+
+static inline double geo_wrap_360(double deg)
+{
+    deg = fmod(deg, 360.0);
+    return deg < 0.0 ? deg + 360.0 : deg;
+}
+
+// Great-circle distance (haversine).
+static inline double geo_distance_nm(double lat1, double lon1, double lat2, double lon2)
+{
+    double dlat = (lat2 - lat1) * DEG2RAD;
+    double dlon = (lon2 - lon1) * DEG2RAD;
+    double s_lat = sin(dlat * 0.5);
+    double s_lon = sin(dlon * 0.5);
+    double a = s_lat * s_lat + cos(lat1 * DEG2RAD) * cos(lat2 * DEG2RAD) * s_lon * s_lon;
+    return 2.0 * EARTH_RADIUS_NM * asin(sqrt(a < 1.0 ? a : 1.0));
+}
+
+// Initial true course from point 1 to point 2, in [0, 360).
+static inline double geo_bearing(double lat1, double lon1, double lat2, double lon2)
+{
+    double phi1 = lat1 * DEG2RAD;
+    double phi2 = lat2 * DEG2RAD;
+    double dlon = (lon2 - lon1) * DEG2RAD;
+    double y = sin(dlon) * cos(phi2);
+    double x = cos(phi1) * sin(phi2) - sin(phi1) * cos(phi2) * cos(dlon);
+    return geo_wrap_360(atan2(y, x) * RAD2DEG);
+}
+
+// Point at `dist_nm` along true course `crs` from (lat, lon).
+static inline void geo_destination(double lat, double lon, double crs, double dist_nm,
+                                   double *out_lat, double *out_lon)
+{
+    double phi = lat * DEG2RAD;
+    double d = dist_nm / EARTH_RADIUS_NM;
+    double theta = crs * DEG2RAD;
+    double phi2 = asin(sin(phi) * cos(d) + cos(phi) * sin(d) * cos(theta));
+    double lambda2 = lon * DEG2RAD
+        + atan2(sin(theta) * sin(d) * cos(phi), cos(d) - sin(phi) * sin(phi2));
+    *out_lat = phi2 * RAD2DEG;
+    *out_lon = geo_wrap_lon(lambda2 * RAD2DEG);
+}
+
+#endif /* ifndef _GEO_H_ */
@@ -0,0 +1,355 @@
+/*===--------------------------------------------------------------------------------------------===
+ * geo_batch.c
+ *
+ * Batch great-circle and projection kernels, with runtime instruction set selection.
+ *===--------------------------------------------------------------------------------------------===
+ */
+#include "geo_batch.h"
+#include "geo.h"
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GEO_HAVE_X86 1
+#include <immintrin.h>
+#else
+#define GEO_HAVE_X86 0
+#endif
+
+#define GEO_DEG2RAD             (0.0174532925f)
+#define GEO_RAD2DEG             (57.2957795f)
+#define GEO_EARTH_RADIUS_NM     ((float)EARTH_RADIUS_NM)
+#define GEO_MERCATOR_MAX_LAT    (85.05113f)
+
+// Per-call constants, worked out once in double precision.
+typedef struct {
+    float lat0, lon0;
+    float sin_lat0, cos_lat0;
+    float merc_y0;
+    // Great-circle interpolation: angular length, 1/sin of it, and both ends as unit vectors.
+    float d, inv_sin_d;
+    float p1[3], p2[3];
+} geo_ctx_t;
+
+typedef struct {
+    void (*distance)(const geo_ctx_t *, const float *, const float *, float *, size_t);
+    void (*bearing)(const geo_ctx_t *, const float *, const float *, float *, size_t);
+    void (*azeq)(const geo_ctx_t *, const float *, const float *, float *, float *, size_t);
+    void (*mercator)(const geo_ctx_t *, const float *, const float *, float *, float *, size_t);
+    void (*interpolate)(const geo_ctx_t *, const float *, float *, float *, size_t);
+} geo_ops_t;
+
+/*
+ * Scalar: what non-x86 builds and x86 CPUs without SSE4.1 run. The vector kernels one lane at a
+ * time are slower than libm, so these are the geo.h formulas in plain loops, in double precision,
+ * with the reference point's trigonometry from the context rather than worked out per point.
+ */
+static void geo_distance_scalar(const geo_ctx_t *ctx, const float *lat, const float *lon,
+                                float *out, size_t count)
+{
+    for(size_t i = 0; i < count; ++i)
+    {
+        double s_dlat = sin(((double)lat[i] - ctx->lat0) * (0.5 * DEG2RAD));
+        double s_dlon = sin(((double)lon[i] - ctx->lon0) * (0.5 * DEG2RAD));
+        double a = s_dlat * s_dlat + ctx->cos_lat0 * cos(lat[i] * DEG2RAD) * s_dlon * s_dlon;
+        out[i] = (float)(2.0 * EARTH_RADIUS_NM * asin(sqrt(a < 1.0 ? a : 1.0)));
+    }
+}
+
+static void geo_bearing_scalar(const geo_ctx_t *ctx, const float *lat, const float *lon,
+                               float *out, size_t count)
+{
+    for(size_t i = 0; i < count; ++i)
+    {
+        double phi = lat[i] * DEG2RAD, dlon = ((double)lon[i] - ctx->lon0) * DEG2RAD;
+        double c_lat = cos(phi);
+        double y = sin(dlon) * c_lat;
+        double x = ctx->cos_lat0 * sin(phi) - ctx->sin_lat0 * c_lat * cos(dlon);
+        out[i] = (float)geo_wrap_360(atan2(y, x) * RAD2DEG);
+    }
+}
+
+static void geo_azeq_scalar(const geo_ctx_t *ctx, const float *lat, const float *lon,
+                            float *out_x, float *out_y, size_t count)
+{
+    for(size_t i = 0; i < count; ++i)
+    {
+        double phi = lat[i] * DEG2RAD, dlon = ((double)lon[i] - ctx->lon0) * DEG2RAD;
+        double s_lat = sin(phi), c_lat = cos(phi), c_dlon = cos(dlon);
+        double xp = c_lat * sin(dlon);
+        double yp = ctx->cos_lat0 * s_lat - ctx->sin_lat0 * c_lat * c_dlon;
+        double sin_c = sqrt(xp * xp + yp * yp);
+        double c = atan2(sin_c, ctx->sin_lat0 * s_lat + ctx->cos_lat0 * c_lat * c_dlon);
+        double k = sin_c < 1e-12 ? EARTH_RADIUS_NM : EARTH_RADIUS_NM * c / sin_c;
+        out_x[i] = (float)(k * xp);
+        out_y[i] = (float)(k * yp);
+    }
+}
+
+static void geo_mercator_scalar(const geo_ctx_t *ctx, const float *lat, const float *lon,
+                                float *out_x, float *out_y, size_t count)
+{
+    for(size_t i = 0; i < count; ++i)
+    {
+        double clamped = fmax(fmin(lat[i], GEO_MERCATOR_MAX_LAT), -GEO_MERCATOR_MAX_LAT);
+        out_x[i] = (float)(geo_wrap_lon((double)lon[i] - ctx->lon0) * DEG2RAD * EARTH_RADIUS_NM);
+        out_y[i] = (float)(atanh(sin(clamped * DEG2RAD)) * EARTH_RADIUS_NM - ctx->merc_y0);
+    }
+}
+
+static void geo_interpolate_scalar(const geo_ctx_t *ctx, const float *t, float *out_lat,
+                                   float *out_lon, size_t count)
+{
+    for(size_t i = 0; i < count; ++i)
+    {
+        double a = sin((1.0 - t[i]) * ctx->d) * ctx->inv_sin_d;
+        double b = sin(t[i] * ctx->d) * ctx->inv_sin_d;
+        double x = a * ctx->p1[0] + b * ctx->p2[0];
+        double y = a * ctx->p1[1] + b * ctx->p2[1];
+        double z = a * ctx->p1[2] + b * ctx->p2[2];
+        out_lat[i] = (float)(atan2(z, sqrt(x * x + y * y)) * RAD2DEG);
+        out_lon[i] = (float)(atan2(y, x) * RAD2DEG);
+    }
+}
+
+static const geo_ops_t geo_ops_scalar = {
+    .distance = geo_distance_scalar,
+    .bearing = geo_bearing_scalar,
+    .azeq = geo_azeq_scalar,
+    .mercator = geo_mercator_scalar,
+    .interpolate = geo_interpolate_scalar,
+};
+
+#if GEO_HAVE_X86
+
+/*
+ * SSE4.1: four lanes. No FMA, so V_FMA is a multiply and an add.
+ */
+#define V                       __m128
+#define V_MASK                  __m128
+#define VW                      (4)
+#define V_LOAD(p)               _mm_loadu_ps(p)
+#define V_STORE(p, v)           _mm_storeu_ps(p, v)
+#define V_SET1(f)               _mm_set1_ps(f)
+#define V_ADD(a, b)             _mm_add_ps(a, b)
+#define V_SUB(a, b)             _mm_sub_ps(a, b)
+#define V_MUL(a, b)             _mm_mul_ps(a, b)
+#define V_DIV(a, b)             _mm_div_ps(a, b)
+#define V_FMA(a, b, c)          _mm_add_ps(_mm_mul_ps(a, b), c)
+#define V_SQRT(a)               _mm_sqrt_ps(a)
+#define V_FLOOR(a)              _mm_floor_ps(a)
+#define V_ABS(a)                _mm_andnot_ps(_mm_set1_ps(-0.f), a)
+#define V_NEG(a)                _mm_xor_ps(a, _mm_set1_ps(-0.f))
+#define V_MIN(a, b)             _mm_min_ps(a, b)
+#define V_MAX(a, b)             _mm_max_ps(a, b)
+#define V_LT(a, b)              _mm_cmplt_ps(a, b)
+#define V_GT(a, b)              _mm_cmpgt_ps(a, b)
+#define V_AND(a, b)             _mm_and_ps(a, b)
+#define V_SEL(m, a, b)          _mm_blendv_ps(b, a, m)
+#define V_SPLIT_EXP(x, m, e)    do { \
+        __m128i bits_ = _mm_castps_si128(x); \
+        e = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits_, 23), _mm_set1_epi32(127))); \
+        m = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits_, _mm_set1_epi32(0x007fffff)), \
+                                          _mm_set1_epi32(0x3f800000))); \
+    } while(0)
+#define GEO_FN(name)            geo_##name##_sse4
+#define GEO_TARGET              __attribute__((target("sse4.1")))
+#include "geo_batch_impl.h"
+#undef V
+#undef V_MASK
+#undef VW
+#undef V_LOAD
+#undef V_STORE
+#undef V_SET1
+#undef V_ADD
+#undef V_SUB
+#undef V_MUL
+#undef V_DIV
+#undef V_FMA
+#undef V_SQRT
+#undef V_FLOOR
+#undef V_ABS
+#undef V_NEG
+#undef V_MIN
+#undef V_MAX
+#undef V_LT
+#undef V_GT
+#undef V_AND
+#undef V_SEL
+#undef V_SPLIT_EXP
+#undef GEO_FN
+#undef GEO_TARGET
+
+/*
+ * AVX2 + FMA: eight lanes.
+ */
+#define V                       __m256
+#define V_MASK                  __m256
+#define VW                      (8)
+#define V_LOAD(p)               _mm256_loadu_ps(p)
+#define V_STORE(p, v)           _mm256_storeu_ps(p, v)
+#define V_SET1(f)               _mm256_set1_ps(f)
+#define V_ADD(a, b)             _mm256_add_ps(a, b)
+#define V_SUB(a, b)             _mm256_sub_ps(a, b)
+#define V_MUL(a, b)             _mm256_mul_ps(a, b)
+#define V_DIV(a, b)             _mm256_div_ps(a, b)
+#define V_FMA(a, b, c)          _mm256_fmadd_ps(a, b, c)
+#define V_SQRT(a)               _mm256_sqrt_ps(a)
+#define V_FLOOR(a)              _mm256_floor_ps(a)
+#define V_ABS(a)                _mm256_andnot_ps(_mm256_set1_ps(-0.f), a)
+#define V_NEG(a)                _mm256_xor_ps(a, _mm256_set1_ps(-0.f))
+#define V_MIN(a, b)             _mm256_min_ps(a, b)
+#define V_MAX(a, b)             _mm256_max_ps(a, b)
+#define V_LT(a, b)              _mm256_cmp_ps(a, b, _CMP_LT_OQ)
+#define V_GT(a, b)              _mm256_cmp_ps(a, b, _CMP_GT_OQ)
+#define V_AND(a, b)             _mm256_and_ps(a, b)
+#define V_SEL(m, a, b)          _mm256_blendv_ps(b, a, m)
+#define V_SPLIT_EXP(x, m, e)    do { \
+        __m256i bits_ = _mm256_castps_si256(x); \
+        e = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits_, 23), \
+                                                _mm256_set1_epi32(127))); \
+        m = _mm256_castsi256_ps(_mm256_or_si256( \
+            _mm256_and_si256(bits_, _mm256_set1_epi32(0x007fffff)), \
+            _mm256_set1_epi32(0x3f800000))); \
+    } while(0)
+#define GEO_FN(name)            geo_##name##_avx2
+#define GEO_TARGET              __attribute__((target("avx2,fma")))
+#include "geo_batch_impl.h"
+
+#endif /* GEO_HAVE_X86 */
+
+static const geo_ops_t *all_ops[GEO_ISA_COUNT] = {
+    [GEO_ISA_SCALAR] = &geo_ops_scalar,
+#if GEO_HAVE_X86
+    [GEO_ISA_SSE4] = &geo_ops_sse4,
+    [GEO_ISA_AVX2] = &geo_ops_avx2,
+#endif
+};
+
+static const char *isa_names[GEO_ISA_COUNT] = {
+    [GEO_ISA_SCALAR] = "scalar",
+    [GEO_ISA_SSE4] = "SSE4.1",
+    [GEO_ISA_AVX2] = "AVX2",
+};
+
+static const geo_ops_t *ops = &geo_ops_scalar;
+static geo_isa_t current_isa = GEO_ISA_SCALAR;
+
+static bool isa_supported(geo_isa_t isa)
+{
+    switch(isa) {
+    case GEO_ISA_SCALAR:
+        return true;
+#if GEO_HAVE_X86
+    case GEO_ISA_SSE4:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("sse4.1");
+    case GEO_ISA_AVX2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+    default:
+        return false;
+    }
+}
+
+static geo_ctx_t make_ctx(double lat0, double lon0)
+{
+    lon0 = geo_wrap_lon(lon0);
+    double phi = lat0 * DEG2RAD;
+    double merc_lat = fmax(fmin(lat0, GEO_MERCATOR_MAX_LAT), -GEO_MERCATOR_MAX_LAT) * DEG2RAD;
+    return (geo_ctx_t){
+        .lat0 = (float)lat0,
+        .lon0 = (float)lon0,
+        .sin_lat0 = (float)sin(phi),
+        .cos_lat0 = (float)cos(phi),
+        .merc_y0 = (float)(atanh(sin(merc_lat)) * EARTH_RADIUS_NM),
+    };
+}
+
+void geo_batch_distance_nm(double lat0, double lon0, const float *lat, const float *lon,
+                           float *out_nm, size_t count)
+{
+    geo_ctx_t ctx = make_ctx(lat0, lon0);
+    ops->distance(&ctx, lat, lon, out_nm, count);
+}
+
+void geo_batch_bearing(double lat0, double lon0, const float *lat, const float *lon,
+                       float *out_deg, size_t count)
+{
+    geo_ctx_t ctx = make_ctx(lat0, lon0);
+    ops->bearing(&ctx, lat, lon, out_deg, count);
+}
+
+void geo_batch_interpolate(double lat1, double lon1, double lat2, double lon2, const float *t,
+                           float *out_lat, float *out_lon, size_t count)
+{
+    double d = geo_distance_nm(lat1, lon1, lat2, lon2) / EARTH_RADIUS_NM;
+    if(d < 1e-6)
+    {
+        // Same point, near enough: nothing to interpolate along.
+        for(size_t i = 0; i < count; ++i)
+        {
+            out_lat[i] = (float)lat1;
+            out_lon[i] = (float)lon1;
+        }
+        return;
+    }
+
+    double phi1 = lat1 * DEG2RAD, lambda1 = lon1 * DEG2RAD;
+    double phi2 = lat2 * DEG2RAD, lambda2 = lon2 * DEG2RAD;
+    geo_ctx_t ctx = {
+        .d = (float)d,
+        .inv_sin_d = (float)(1.0 / sin(d)),
+        .p1 = {
+            (float)(cos(phi1) * cos(lambda1)),
+            (float)(cos(phi1) * sin(lambda1)),
+            (float)sin(phi1)
+        },
+        .p2 = {
+            (float)(cos(phi2) * cos(lambda2)),
+            (float)(cos(phi2) * sin(lambda2)),
+            (float)sin(phi2)
+        },
+    };
+    ops->interpolate(&ctx, t, out_lat, out_lon, count);
+}
+
+void geo_batch_project_azeq(double lat0, double lon0, const float *lat, const float *lon,
+                            float *out_x, float *out_y, size_t count)
+{
+    geo_ctx_t ctx = make_ctx(lat0, lon0);
+    ops->azeq(&ctx, lat, lon, out_x, out_y, count);
+}
+
+void geo_batch_project_mercator(double lat0, double lon0, const float *lat, const float *lon,
+                                float *out_x, float *out_y, size_t count)
+{
+    geo_ctx_t ctx = make_ctx(lat0, lon0);
+    ops->mercator(&ctx, lat, lon, out_x, out_y, count);
+}
+
+void geo_batch_init(void)
+{
+    if(!geo_batch_use_isa(GEO_ISA_AVX2) && !geo_batch_use_isa(GEO_ISA_SSE4))
+        geo_batch_use_isa(GEO_ISA_SCALAR);
+}
+
+bool geo_batch_use_isa(geo_isa_t isa)
+{
+    if(isa < 0 || isa >= GEO_ISA_COUNT || !all_ops[isa] || !isa_supported(isa))
+        return false;
+    ops = all_ops[isa];
+    current_isa = isa;
+    return true;
+}
+
+geo_isa_t geo_batch_isa(void)
+{
+    return current_isa;
+}
+
+const char *geo_batch_isa_name(geo_isa_t isa)
+{
+    return isa >= 0 && isa < GEO_ISA_COUNT ? isa_names[isa] : "?";
+}
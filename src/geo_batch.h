@@ -0,0 +1,56 @@
+/*===--------------------------------------------------------------------------------------------===
+ * geo_batch.h
+ *
+ * Batch versions of the geo.h helpers, for passes over many points at once: nearest lists, map
+ * symbol projection, leg tessellation and range rings.
+ *
+ * Inputs and outputs are structure-of-arrays floats (degrees, nautical miles). Results are within
+ * about 1e-5 (relative) of the double-precision helpers in geo.h, which is far below a pixel at
+ * any map range. Each kernel is compiled for AVX2+FMA and SSE4.1, and geo_batch_init() picks the
+ * best the CPU supports. Elsewhere (other architectures, or older x86 CPUs), the scalar set is
+ * the geo.h formulas in plain loops, so it's never slower than calling them one by one.
+ *
+ * The kernels are pure functions, safe to call from any thread.
+ *===--------------------------------------------------------------------------------------------===
+*/
+#ifndef _GEO_BATCH_H_
+#define _GEO_BATCH_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef enum {
+    GEO_ISA_SCALAR,
+    GEO_ISA_SSE4,
+    GEO_ISA_AVX2,
+    GEO_ISA_COUNT
+} geo_isa_t;
+
+// Great-circle distance from (lat0, lon0) to each point.
+void geo_batch_distance_nm(double lat0, double lon0, const float *lat, const float *lon,
+                           float *out_nm, size_t count);
+
+// Initial true course from (lat0, lon0) to each point, in [0, 360).
+void geo_batch_bearing(double lat0, double lon0, const float *lat, const float *lon,
+                       float *out_deg, size_t count);
+
+// Points at fractions `t` (0 to 1) of the great circle from (lat1, lon1) to (lat2, lon2).
+void geo_batch_interpolate(double lat1, double lon1, double lat2, double lon2, const float *t,
+                           float *out_lat, float *out_lon, size_t count);
+
+// Azimuthal equidistant projection centred on (lat0, lon0): x east and y north, in nm.
+void geo_batch_project_azeq(double lat0, double lon0, const float *lat, const float *lon,
+                            float *out_x, float *out_y, size_t count);
+
+// Mercator projection relative to (lat0, lon0): x east and y north, in nm at the equator.
+void geo_batch_project_mercator(double lat0, double lon0, const float *lat, const float *lon,
+                                float *out_x, float *out_y, size_t count);
+
+// Picks the kernels for this CPU. Until it's called, the scalar ones are used.
+void geo_batch_init(void);
+// Forces a given instruction set, if the CPU has it. Returns false (and changes nothing) if not.
+bool geo_batch_use_isa(geo_isa_t isa);
+geo_isa_t geo_batch_isa(void);
+const char *geo_batch_isa_name(geo_isa_t isa);
+
+#endif /* ifndef _GEO_BATCH_H_ */
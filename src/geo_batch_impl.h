@@ -0,0 +1,269 @@
+/*===--------------------------------------------------------------------------------------------===
+ * geo_batch_impl.h
+ *
+ * Kernel bodies for geo_batch.c, written once against the V_* vector macros and included once per
+ * instruction set. Not a public header: the includer defines V, VW, the V_* operations, GEO_FN()
+ * to decorate names and GEO_TARGET for the function attributes.
+ *===--------------------------------------------------------------------------------------------===
+*/
+
+// Sine and cosine of x, in radians. Cody-Waite reduction to [-pi/4, pi/4], then the Cephes
+// single-precision polynomials. Good to a few ulp for |x| up to a few hundred.
+static inline GEO_TARGET void GEO_FN(sincos)(V x, V *out_sin, V *out_cos)
+{
+    V k = V_FLOOR(V_FMA(x, V_SET1(0.636619772f), V_SET1(0.5f)));
+    V r = V_FMA(k, V_SET1(-1.57079637f), x);
+    r = V_FMA(k, V_SET1(4.37113900e-8f), r);
+    V r2 = V_MUL(r, r);
+
+    V s = V_FMA(r2, V_SET1(-1.9515295891e-4f), V_SET1(8.3321608736e-3f));
+    s = V_FMA(r2, s, V_SET1(-1.6666654611e-1f));
+    s = V_FMA(V_MUL(r, r2), s, r);
+
+    V c = V_FMA(r2, V_SET1(2.443315711809948e-5f), V_SET1(-1.388731625493765e-3f));
+    c = V_FMA(r2, c, V_SET1(4.166664568298827e-2f));
+    c = V_FMA(V_MUL(r2, r2), c, V_FMA(r2, V_SET1(-0.5f), V_SET1(1.f)));
+
+    // Quadrant, k mod 4, worked out in floats so no integer vector ops are needed.
+    V q = V_SUB(k, V_MUL(V_SET1(4.f), V_FLOOR(V_MUL(k, V_SET1(0.25f)))));
+    V odd = V_SUB(q, V_MUL(V_SET1(2.f), V_FLOOR(V_MUL(q, V_SET1(0.5f)))));
+    V_MASK swap = V_GT(odd, V_SET1(0.5f));
+    V sin_r = V_SEL(swap, c, s);
+    V cos_r = V_SEL(swap, s, c);
+    *out_sin = V_SEL(V_GT(q, V_SET1(1.5f)), V_NEG(sin_r), sin_r);
+    *out_cos = V_SEL(V_AND(V_GT(q, V_SET1(0.5f)), V_LT(q, V_SET1(2.5f))), V_NEG(cos_r), cos_r);
+}
+
+// Full-quadrant arctangent of y/x, in radians. Cephes atanf on the reduced ratio.
+static inline GEO_TARGET V GEO_FN(atan2)(V y, V x)
+{
+    V ax = V_ABS(x);
+    V ay = V_ABS(y);
+    V hi = V_MAX(V_MAX(ax, ay), V_SET1(1e-30f));
+    V lo = V_MIN(ax, ay);
+    V a = V_DIV(lo, hi);
+
+    V_MASK big = V_GT(a, V_SET1(0.414213562f));
+    V t = V_SEL(big, V_DIV(V_SUB(a, V_SET1(1.f)), V_ADD(a, V_SET1(1.f))), a);
+    V z = V_MUL(t, t);
+    V p = V_FMA(z, V_SET1(8.05374449538e-2f), V_SET1(-1.38776856032e-1f));
+    p = V_FMA(z, p, V_SET1(1.99777106478e-1f));
+    p = V_FMA(z, p, V_SET1(-3.33329491539e-1f));
+    p = V_FMA(V_MUL(z, t), p, t);
+    V r = V_ADD(p, V_SEL(big, V_SET1(0.785398163f), V_SET1(0.f)));
+
+    r = V_SEL(V_GT(ay, ax), V_SUB(V_SET1(1.570796327f), r), r);
+    r = V_SEL(V_LT(x, V_SET1(0.f)), V_SUB(V_SET1(3.141592654f), r), r);
+    return V_SEL(V_LT(y, V_SET1(0.f)), V_NEG(r), r);
+}
+
+// Natural log, for x > 0.
+static inline GEO_TARGET V GEO_FN(log)(V x)
+{
+    V m, e;
+    V_SPLIT_EXP(x, m, e);
+    V_MASK high = V_GT(m, V_SET1(1.414213562f));
+    m = V_SEL(high, V_MUL(m, V_SET1(0.5f)), m);
+    e = V_SEL(high, V_ADD(e, V_SET1(1.f)), e);
+
+    V t = V_DIV(V_SUB(m, V_SET1(1.f)), V_ADD(m, V_SET1(1.f)));
+    V t2 = V_MUL(t, t);
+    V p = V_FMA(t2, V_SET1(1.f / 9.f), V_SET1(1.f / 7.f));
+    p = V_FMA(t2, p, V_SET1(1.f / 5.f));
+    p = V_FMA(t2, p, V_SET1(1.f / 3.f));
+    p = V_FMA(t2, p, V_SET1(1.f));
+    return V_FMA(e, V_SET1(0.693147181f), V_MUL(V_MUL(V_SET1(2.f), t), p));
+}
+
+static inline GEO_TARGET V GEO_FN(distance_lane)(const geo_ctx_t *ctx, V lat, V lon)
+{
+    V half = V_SET1(0.5f * GEO_DEG2RAD);
+    V s_dlat, c_dlat, s_dlon, c_dlon, s_lat, c_lat;
+    GEO_FN(sincos)(V_MUL(V_SUB(lat, V_SET1(ctx->lat0)), half), &s_dlat, &c_dlat);
+    GEO_FN(sincos)(V_MUL(V_SUB(lon, V_SET1(ctx->lon0)), half), &s_dlon, &c_dlon);
+    GEO_FN(sincos)(V_MUL(lat, V_SET1(GEO_DEG2RAD)), &s_lat, &c_lat);
+
+    V a = V_FMA(V_MUL(V_SET1(ctx->cos_lat0), c_lat), V_MUL(s_dlon, s_dlon), V_MUL(s_dlat, s_dlat));
+    a = V_MIN(V_MAX(a, V_SET1(0.f)), V_SET1(1.f));
+    V c = GEO_FN(atan2)(V_SQRT(a), V_SQRT(V_SUB(V_SET1(1.f), a)));
+    return V_MUL(c, V_SET1(2.f * GEO_EARTH_RADIUS_NM));
+}
+
+static inline GEO_TARGET V GEO_FN(bearing_lane)(const geo_ctx_t *ctx, V lat, V lon)
+{
+    V s_dlon, c_dlon, s_lat, c_lat;
+    GEO_FN(sincos)(V_MUL(V_SUB(lon, V_SET1(ctx->lon0)), V_SET1(GEO_DEG2RAD)), &s_dlon, &c_dlon);
+    GEO_FN(sincos)(V_MUL(lat, V_SET1(GEO_DEG2RAD)), &s_lat, &c_lat);
+
+    V y = V_MUL(s_dlon, c_lat);
+    V x = V_SUB(V_MUL(V_SET1(ctx->cos_lat0), s_lat),
+                V_MUL(V_MUL(V_SET1(ctx->sin_lat0), c_lat), c_dlon));
+    V deg = V_MUL(GEO_FN(atan2)(y, x), V_SET1(GEO_RAD2DEG));
+    return V_SEL(V_LT(deg, V_SET1(0.f)), V_ADD(deg, V_SET1(360.f)), deg);
+}
+
+static inline GEO_TARGET void GEO_FN(azeq_lane)(const geo_ctx_t *ctx, V lat, V lon, V *x, V *y)
+{
+    V s_dlon, c_dlon, s_lat, c_lat;
+    GEO_FN(sincos)(V_MUL(V_SUB(lon, V_SET1(ctx->lon0)), V_SET1(GEO_DEG2RAD)), &s_dlon, &c_dlon);
+    GEO_FN(sincos)(V_MUL(lat, V_SET1(GEO_DEG2RAD)), &s_lat, &c_lat);
+
+    V c_lat_c_dlon = V_MUL(c_lat, c_dlon);
+    V xp = V_MUL(c_lat, s_dlon);
+    V yp = V_SUB(V_MUL(V_SET1(ctx->cos_lat0), s_lat), V_MUL(V_SET1(ctx->sin_lat0), c_lat_c_dlon));
+    V cos_c = V_FMA(V_SET1(ctx->cos_lat0), c_lat_c_dlon, V_MUL(V_SET1(ctx->sin_lat0), s_lat));
+    V sin_c = V_SQRT(V_FMA(xp, xp, V_MUL(yp, yp)));
+
+    // k = c / sin(c), which tends to 1 at the centre.
+    V c = GEO_FN(atan2)(sin_c, cos_c);
+    V_MASK centre = V_LT(sin_c, V_SET1(1e-7f));
+    V k = V_SEL(centre, V_SET1(1.f), V_DIV(c, V_MAX(sin_c, V_SET1(1e-7f))));
+    k = V_MUL(k, V_SET1(GEO_EARTH_RADIUS_NM));
+    *x = V_MUL(k, xp);
+    *y = V_MUL(k, yp);
+}
+
+static inline GEO_TARGET void GEO_FN(mercator_lane)(const geo_ctx_t *ctx, V lat, V lon, V *x,
+                                                    V *y)
+{
+    V dlon = V_SUB(lon, V_SET1(ctx->lon0));
+    dlon = V_SUB(dlon, V_MUL(V_SET1(360.f),
+                             V_FLOOR(V_FMA(dlon, V_SET1(1.f / 360.f), V_SET1(0.5f)))));
+    *x = V_MUL(dlon, V_SET1(GEO_DEG2RAD * GEO_EARTH_RADIUS_NM));
+
+    V clamped = V_MIN(V_MAX(lat, V_SET1(-GEO_MERCATOR_MAX_LAT)), V_SET1(GEO_MERCATOR_MAX_LAT));
+    V s, c;
+    GEO_FN(sincos)(V_MUL(clamped, V_SET1(GEO_DEG2RAD)), &s, &c);
+    V ratio = V_DIV(V_ADD(V_SET1(1.f), s), V_SUB(V_SET1(1.f), s));
+    *y = V_FMA(GEO_FN(log)(ratio), V_SET1(0.5f * GEO_EARTH_RADIUS_NM), V_SET1(-ctx->merc_y0));
+}
+
+static inline GEO_TARGET void GEO_FN(interpolate_lane)(const geo_ctx_t *ctx, V t, V *lat, V *lon)
+{
+    V s_a, c_a, s_b, c_b;
+    V d = V_SET1(ctx->d);
+    GEO_FN(sincos)(V_MUL(V_SUB(V_SET1(1.f), t), d), &s_a, &c_a);
+    GEO_FN(sincos)(V_MUL(t, d), &s_b, &c_b);
+    V a = V_MUL(s_a, V_SET1(ctx->inv_sin_d));
+    V b = V_MUL(s_b, V_SET1(ctx->inv_sin_d));
+
+    V x = V_FMA(a, V_SET1(ctx->p1[0]), V_MUL(b, V_SET1(ctx->p2[0])));
+    V y = V_FMA(a, V_SET1(ctx->p1[1]), V_MUL(b, V_SET1(ctx->p2[1])));
+    V z = V_FMA(a, V_SET1(ctx->p1[2]), V_MUL(b, V_SET1(ctx->p2[2])));
+    *lat = V_MUL(GEO_FN(atan2)(z, V_SQRT(V_FMA(x, x, V_MUL(y, y)))), V_SET1(GEO_RAD2DEG));
+    *lon = V_MUL(GEO_FN(atan2)(y, x), V_SET1(GEO_RAD2DEG));
+}
+
+// The loops below run whole vectors, then push the last partial one through a padded copy so
+// there is only one code path to get right.
+
+static GEO_TARGET void GEO_FN(distance)(const geo_ctx_t *ctx, const float *lat, const float *lon,
+                                        float *out, size_t count)
+{
+    size_t i = 0;
+    for(; i + VW <= count; i += VW)
+        V_STORE(out + i, GEO_FN(distance_lane)(ctx, V_LOAD(lat + i), V_LOAD(lon + i)));
+    if(i < count)
+    {
+        float t_lat[VW] = {0}, t_lon[VW] = {0}, t_out[VW];
+        memcpy(t_lat, lat + i, sizeof(float) * (count - i));
+        memcpy(t_lon, lon + i, sizeof(float) * (count - i));
+        V_STORE(t_out, GEO_FN(distance_lane)(ctx, V_LOAD(t_lat), V_LOAD(t_lon)));
+        memcpy(out + i, t_out, sizeof(float) * (count - i));
+    }
+}
+
+static GEO_TARGET void GEO_FN(bearing)(const geo_ctx_t *ctx, const float *lat, const float *lon,
+                                       float *out, size_t count)
+{
+    size_t i = 0;
+    for(; i + VW <= count; i += VW)
+        V_STORE(out + i, GEO_FN(bearing_lane)(ctx, V_LOAD(lat + i), V_LOAD(lon + i)));
+    if(i < count)
+    {
+        float t_lat[VW] = {0}, t_lon[VW] = {0}, t_out[VW];
+        memcpy(t_lat, lat + i, sizeof(float) * (count - i));
+        memcpy(t_lon, lon + i, sizeof(float) * (count - i));
+        V_STORE(t_out, GEO_FN(bearing_lane)(ctx, V_LOAD(t_lat), V_LOAD(t_lon)));
+        memcpy(out + i, t_out, sizeof(float) * (count - i));
+    }
+}
+
+static GEO_TARGET void GEO_FN(azeq)(const geo_ctx_t *ctx, const float *lat, const float *lon,
+                                    float *out_x, float *out_y, size_t count)
+{
+    size_t i = 0;
+    V x, y;
+    for(; i + VW <= count; i += VW)
+    {
+        GEO_FN(azeq_lane)(ctx, V_LOAD(lat + i), V_LOAD(lon + i), &x, &y);
+        V_STORE(out_x + i, x);
+        V_STORE(out_y + i, y);
+    }
+    if(i < count)
+    {
+        float t_lat[VW] = {0}, t_lon[VW] = {0}, t_x[VW], t_y[VW];
+        memcpy(t_lat, lat + i, sizeof(float) * (count - i));
+        memcpy(t_lon, lon + i, sizeof(float) * (count - i));
+        GEO_FN(azeq_lane)(ctx, V_LOAD(t_lat), V_LOAD(t_lon), &x, &y);
+        V_STORE(t_x, x);
+        V_STORE(t_y, y);
+        memcpy(out_x + i, t_x, sizeof(float) * (count - i));
+        memcpy(out_y + i, t_y, sizeof(float) * (count - i));
+    }
+}
+
+static GEO_TARGET void GEO_FN(mercator)(const geo_ctx_t *ctx, const float *lat, const float *lon,
+                                        float *out_x, float *out_y, size_t count)
+{
+    size_t i = 0;
+    V x, y;
+    for(; i + VW <= count; i += VW)
+    {
+        GEO_FN(mercator_lane)(ctx, V_LOAD(lat + i), V_LOAD(lon + i), &x, &y);
+        V_STORE(out_x + i, x);
+        V_STORE(out_y + i, y);
+    }
+    if(i < count)
+    {
+        float t_lat[VW] = {0}, t_lon[VW] = {0}, t_x[VW], t_y[VW];
+        memcpy(t_lat, lat + i, sizeof(float) * (count - i));
+        memcpy(t_lon, lon + i, sizeof(float) * (count - i));
+        GEO_FN(mercator_lane)(ctx, V_LOAD(t_lat), V_LOAD(t_lon), &x, &y);
+        V_STORE(t_x, x);
+        V_STORE(t_y, y);
+        memcpy(out_x + i, t_x, sizeof(float) * (count - i));
+        memcpy(out_y + i, t_y, sizeof(float) * (count - i));
+    }
+}
+
+static GEO_TARGET void GEO_FN(interpolate)(const geo_ctx_t *ctx, const float *t, float *out_lat,
+                                           float *out_lon, size_t count)
+{
+    size_t i = 0;
+    V lat, lon;
+    for(; i + VW <= count; i += VW)
+    {
+        GEO_FN(interpolate_lane)(ctx, V_LOAD(t + i), &lat, &lon);
+        V_STORE(out_lat + i, lat);
+        V_STORE(out_lon + i, lon);
+    }
+    if(i < count)
+    {
+        float t_t[VW] = {0}, t_lat[VW], t_lon[VW];
+        memcpy(t_t, t + i, sizeof(float) * (count - i));
+        GEO_FN(interpolate_lane)(ctx, V_LOAD(t_t), &lat, &lon);
+        V_STORE(t_lat, lat);
+        V_STORE(t_lon, lon);
+        memcpy(out_lat + i, t_lat, sizeof(float) * (count - i));
+        memcpy(out_lon + i, t_lon, sizeof(float) * (count - i));
+    }
+}
+
+static const geo_ops_t GEO_FN(ops) = {
+    .distance = GEO_FN(distance),
+    .bearing = GEO_FN(bearing),
+    .azeq = GEO_FN(azeq),
+    .mercator = GEO_FN(mercator),
+    .interpolate = GEO_FN(interpolate),
+};
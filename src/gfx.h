@@ -0,0 +1,52 @@
+/*===--------------------------------------------------------------------------------------------===
+ * gfx.h
+ *
+ * The flat 2D primitives device screens and bezels are made of (filled rectangles, strokes and
+ * text), behind one interface with two back ends, picked at build time (AVIONICS_RENDERER):
+ *
+ *  - gfx_gl.c draws them with OpenGL, rectangles and strokes through vector.h and text with
+ *    XPLMDrawString. Its calls can also be recorded and replayed later (render_list.h).
+ *  - gfx_soft.c rasterises them on the CPU with raster.h into an RGBA frame. In the plugin the
+ *    frame is uploaded and drawn as one texture at gfx_end(); built with GFX_HEADLESS it needs
+ *    neither X-Plane nor a GPU, which is what render_bench uses to dump frames and time them.
+ *
+ * Primitives land in the order they're issued, in both back ends. Coordinates are in pixels, y up,
+ * as in avionics draw callbacks. Colours are straight RGBA, 0-1. Main thread only in the plugin.
+ *===--------------------------------------------------------------------------------------------===
+*/
+#ifndef _GFX_H_
+#define _GFX_H_
+
+#include "raster.h"
+#include <stdbool.h>
+
+typedef enum {
+    GFX_FONT_BASIC,
+    GFX_FONT_PROPORTIONAL,
+} gfx_font_t;
+
+// Starts drawing a width x height surface. 0, 0 means the current GL viewport (plugin only).
+void gfx_begin(int width, int height);
+void gfx_rect(float x, float y, float w, float h, const float color[4]);
+void gfx_line(float x0, float y0, float x1, float y1, float width, const float color[4]);
+// `xy` holds `count` points as x, y pairs. `closed` joins the last point back to the first.
+void gfx_polyline(const float *xy, int count, bool closed, float width, const float color[4]);
+// `y` is the text's baseline.
+void gfx_text(int x, int y, const char *text, const float color[4], gfx_font_t font);
+// Multiplies everything on the surface so far by `rgb`, including what was drawn without gfx: one
+// pass for brightness, tint and fades, so what's drawn (or cached) needn't know about them. Not
+// recorded by render_list.h: call it from the draw callback itself, not a list's prepare.
+void gfx_modulate(const float rgb[3]);
+// Finishes the surface started by gfx_begin().
+void gfx_end(void);
+
+// Whether render_list.h can record this back end's calls. Only the GL one's.
+bool gfx_can_record(void);
+
+// Software back end only: the frame drawn since the last gfx_begin(), premultiplied, row 0 at the
+// bottom.
+const raster_t *gfx_soft_frame(void);
+
+void gfx_fini(void);
+
+#endif /* ifndef _GFX_H_ */
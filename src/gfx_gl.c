@@ -0,0 +1,83 @@
+/*===--------------------------------------------------------------------------------------------===
+ * gfx_gl.c
+ *
+ * OpenGL back end for gfx.h.
+ *===--------------------------------------------------------------------------------------------===
+ */
+#include "gfx.h"
+#include "SystemGL.h"
+#include "gl_procs.h"
+#include "render_list.h"
+#include "vector.h"
+#include <XPLMGraphics.h>
+#include <stddef.h>
+
+void log_msg(const char *fmt, ...);
+
+void gfx_begin(int width, int height)
+{
+    (void)width;
+    (void)height;
+}
+
+// Rectangles and strokes are batched together by vector.c. Text is drawn directly, so the batch
+// is flushed before it to keep the order primitives were issued in. While render_list.c records,
+// nothing is drawn: the batch is its geometry, and text goes into its command list.
+void gfx_rect(float x, float y, float w, float h, const float color[4])
+{
+    vec_rect(x, y, w, h, color);
+}
+
+void gfx_line(float x0, float y0, float x1, float y1, float width, const float color[4])
+{
+    vec_line(x0, y0, x1, y1, width, color);
+}
+
+void gfx_polyline(const float *xy, int count, bool closed, float width, const float color[4])
+{
+    vec_polyline(xy, count, closed, width, color);
+}
+
+void gfx_text(int x, int y, const char *text, const float color[4], gfx_font_t font)
+{
+    if(rlist_recording())
+    {
+        rlist_text(x, y, text, color, font);
+        return;
+    }
+    vec_flush();
+    float rgb[3] = {color[0], color[1], color[2]};
+    XPLMDrawString(rgb, x, y, (char *)text, NULL,
+                   font == GFX_FONT_PROPORTIONAL ? xplmFont_Proportional : xplmFont_Basic);
+}
+
+void gfx_modulate(const float rgb[3])
+{
+    if(rlist_recording())
+    {
+        log_msg("gfx: gfx_modulate() can't be recorded");
+        return;
+    }
+    vec_flush();
+    gl_procs_modulate(rgb);
+}
+
+void gfx_end(void)
+{
+    if(!rlist_recording())
+        vec_flush();
+}
+
+bool gfx_can_record(void)
+{
+    return true;
+}
+
+const raster_t *gfx_soft_frame(void)
+{
+    return NULL;
+}
+
+void gfx_fini(void)
+{
+}
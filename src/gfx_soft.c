@@ -0,0 +1,182 @@
+/*===--------------------------------------------------------------------------------------------===
+ * gfx_soft.c
+ *
+ * Software back end for gfx.h: everything is rasterised into one RGBA frame on the CPU.
+ *===--------------------------------------------------------------------------------------------===
+ */
+#include "gfx.h"
+#include <stdlib.h>
+#include <string.h>
+#ifndef GFX_HEADLESS
+#include "SystemGL.h"
+#include "gl_procs.h"
+#include <XPLMGraphics.h>
+#endif
+
+void log_msg(const char *fmt, ...);
+
+static raster_t frame = {0, 0, NULL};
+static size_t frame_capacity = 0;
+
+#ifndef GFX_HEADLESS
+static int texture = 0;
+static int texture_w = 0, texture_h = 0;
+#endif
+
+static inline raster_color_t to_raster(const float color[4])
+{
+    return (raster_color_t){color[0], color[1], color[2], color[3]};
+}
+
+void gfx_begin(int width, int height)
+{
+#ifndef GFX_HEADLESS
+    if(width <= 0 || height <= 0)
+    {
+        GLint viewport[4];
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        width = viewport[2];
+        height = viewport[3];
+    }
+#endif
+    frame.width = frame.height = 0;
+    if(width <= 0 || height <= 0)
+        return;
+
+    size_t bytes = (size_t)width * (size_t)height * 4;
+    if(bytes > frame_capacity)
+    {
+        uint8_t *pixels = realloc(frame.pixels, bytes);
+        if(!pixels)
+        {
+            log_msg("gfx: out of memory for a %dx%d frame", width, height);
+            return;
+        }
+        frame.pixels = pixels;
+        frame_capacity = bytes;
+    }
+    frame.width = width;
+    frame.height = height;
+    memset(frame.pixels, 0, bytes);
+}
+
+void gfx_rect(float x, float y, float w, float h, const float color[4])
+{
+    if(frame.width)
+        raster_rect(&frame, x, y, x + w, y + h, to_raster(color));
+}
+
+void gfx_line(float x0, float y0, float x1, float y1, float width, const float color[4])
+{
+    if(frame.width)
+        raster_line(&frame, x0, y0, x1, y1, width, to_raster(color));
+}
+
+void gfx_polyline(const float *xy, int count, bool closed, float width, const float color[4])
+{
+    if(!frame.width || count < 2)
+        return;
+    raster_color_t c = to_raster(color);
+    for(int i = 1; i < count; ++i)
+        raster_line(&frame, xy[2 * i - 2], xy[2 * i - 1], xy[2 * i], xy[2 * i + 1], width, c);
+    if(closed && count > 2)
+        raster_line(&frame, xy[2 * count - 2], xy[2 * count - 1], xy[0], xy[1], width, c);
+}
+
+void gfx_text(int x, int y, const char *text, const float color[4], gfx_font_t font)
+{
+    (void)font;
+    if(frame.width)
+        raster_text(&frame, x, y, text, to_raster(color));
+}
+
+// The frame's own pixels are scaled here; in the plugin, what's already under it in the GL
+// framebuffer is scaled with a blended quad, and the frame is drawn over that at gfx_end().
+void gfx_modulate(const float rgb[3])
+{
+    if(frame.width)
+    {
+        // Premultiplied, so alpha stays as it is.
+        uint32_t scale[3];
+        for(int c = 0; c < 3; ++c)
+        {
+            float v = rgb[c] < 0.f ? 0.f : rgb[c] > 1.f ? 1.f : rgb[c];
+            scale[c] = (uint32_t)(v * 256.f + 0.5f);
+        }
+        uint8_t *p = frame.pixels;
+        for(size_t i = 0, n = (size_t)frame.width * (size_t)frame.height; i < n; ++i, p += 4)
+        {
+            p[0] = (uint8_t)((p[0] * scale[0]) >> 8);
+            p[1] = (uint8_t)((p[1] * scale[1]) >> 8);
+            p[2] = (uint8_t)((p[2] * scale[2]) >> 8);
+        }
+    }
+#ifndef GFX_HEADLESS
+    gl_procs_modulate(rgb);
+#endif
+}
+
+void gfx_end(void)
+{
+#ifndef GFX_HEADLESS
+    if(!frame.width)
+        return;
+    if(!texture)
+        XPLMGenerateTextureNumbers(&texture, 1);
+    XPLMSetGraphicsState(0, 1, 0, 0, 1, 0, 0);
+    XPLMBindTexture2d(texture, 0);
+    if(frame.width != texture_w || frame.height != texture_h)
+    {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, frame.width, frame.height, 0, GL_RGBA,
+                     GL_UNSIGNED_BYTE, frame.pixels);
+        texture_w = frame.width;
+        texture_h = frame.height;
+    }
+    else
+    {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, frame.width, frame.height, GL_RGBA,
+                        GL_UNSIGNED_BYTE, frame.pixels);
+    }
+
+    // The frame is premultiplied.
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    glColor4f(1.f, 1.f, 1.f, 1.f);
+    glBegin(GL_QUADS);
+    glTexCoord2f(0.f, 0.f); glVertex2f(0.f, 0.f);
+    glTexCoord2f(0.f, 1.f); glVertex2f(0.f, (float)frame.height);
+    glTexCoord2f(1.f, 1.f); glVertex2f((float)frame.width, (float)frame.height);
+    glTexCoord2f(1.f, 0.f); glVertex2f((float)frame.width, 0.f);
+    glEnd();
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+#endif
+}
+
+// Every surface is one texture drawn at gfx_end(), so there's nothing to record.
+bool gfx_can_record(void)
+{
+    return false;
+}
+
+const raster_t *gfx_soft_frame(void)
+{
+    return &frame;
+}
+
+void gfx_fini(void)
+{
+#ifndef GFX_HEADLESS
+    if(texture)
+    {
+        GLuint tex = (GLuint)texture;
+        glDeleteTextures(1, &tex);
+    }
+    texture = 0;
+    texture_w = texture_h = 0;
+#endif
+    free(frame.pixels);
+    frame.pixels = NULL;
+    frame.width = frame.height = 0;
+    frame_capacity = 0;
+}
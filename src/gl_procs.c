@@ -0,0 +1,206 @@
+/*===--------------------------------------------------------------------------------------------===
+ * gl_procs.c
+ *
+ * Runtime lookup of OpenGL 2.x entry points, a shader program helper, and the modulate quad.
+ *===--------------------------------------------------------------------------------------------===
+ */
+#if LIN
+#define _GNU_SOURCE         // RTLD_DEFAULT
+#endif
+#if IBM
+#include <windows.h>
+#endif
+#include "gl_procs.h"
+#include <XPLMGraphics.h>
+#include <stdint.h>
+#include <stdlib.h>
+#if !IBM
+#include <dlfcn.h>
+#endif
+
+void log_msg(const char *fmt, ...);
+
+gl_procs_t gl_procs;
+
+static enum { NOT_LOADED, LOADED, MISSING } state = NOT_LOADED;
+
+static void *lookup(const char *name)
+{
+#if IBM
+    void *proc = (void *)wglGetProcAddress(name);
+    // Some drivers return small integers rather than NULL for failure.
+    if((uintptr_t)proc <= 3 || (intptr_t)proc == -1)
+        proc = (void *)GetProcAddress(GetModuleHandleA("opengl32.dll"), name);
+    return proc;
+#else
+    // Linux's libGL and macOS's OpenGL framework export everything up to 2.1, already loaded into
+    // the process by X-Plane.
+    void *proc = dlsym(RTLD_DEFAULT, name);
+#if LIN
+    if(!proc)
+    {
+        typedef void *(*get_proc_f)(const unsigned char *);
+        get_proc_f get_proc = (get_proc_f)dlsym(RTLD_DEFAULT, "glXGetProcAddressARB");
+        if(get_proc)
+            proc = get_proc((const unsigned char *)name);
+    }
+#endif
+    return proc;
+#endif
+}
+
+#define LOAD(field, name) do {                                                                  \
+        *(void **)&gl_procs.field = lookup(name);                                               \
+        if(!gl_procs.field) {                                                                   \
+            log_msg("gl_procs: %s is not available", name);                                     \
+            ok = false;                                                                         \
+        }                                                                                       \
+    } while(0)
+
+bool gl_procs_load(void)
+{
+    if(state != NOT_LOADED)
+        return state == LOADED;
+
+    bool ok = true;
+    LOAD(CreateShader, "glCreateShader");
+    LOAD(ShaderSource, "glShaderSource");
+    LOAD(CompileShader, "glCompileShader");
+    LOAD(GetShaderiv, "glGetShaderiv");
+    LOAD(GetShaderInfoLog, "glGetShaderInfoLog");
+    LOAD(DeleteShader, "glDeleteShader");
+    LOAD(CreateProgram, "glCreateProgram");
+    LOAD(AttachShader, "glAttachShader");
+    LOAD(BindAttribLocation, "glBindAttribLocation");
+    LOAD(LinkProgram, "glLinkProgram");
+    LOAD(GetProgramiv, "glGetProgramiv");
+    LOAD(GetProgramInfoLog, "glGetProgramInfoLog");
+    LOAD(DeleteProgram, "glDeleteProgram");
+    LOAD(UseProgram, "glUseProgram");
+    LOAD(GetUniformLocation, "glGetUniformLocation");
+    LOAD(Uniform1i, "glUniform1i");
+    LOAD(Uniform2f, "glUniform2f");
+    LOAD(GenBuffers, "glGenBuffers");
+    LOAD(DeleteBuffers, "glDeleteBuffers");
+    LOAD(BindBuffer, "glBindBuffer");
+    LOAD(BufferData, "glBufferData");
+    LOAD(BufferSubData, "glBufferSubData");
+    LOAD(MapBuffer, "glMapBuffer");
+    LOAD(UnmapBuffer, "glUnmapBuffer");
+    LOAD(EnableVertexAttribArray, "glEnableVertexAttribArray");
+    LOAD(DisableVertexAttribArray, "glDisableVertexAttribArray");
+    LOAD(VertexAttribPointer, "glVertexAttribPointer");
+
+    *(void **)&gl_procs.VertexAttribDivisor = lookup("glVertexAttribDivisor");
+    if(!gl_procs.VertexAttribDivisor)
+        *(void **)&gl_procs.VertexAttribDivisor = lookup("glVertexAttribDivisorARB");
+    *(void **)&gl_procs.DrawArraysInstanced = lookup("glDrawArraysInstanced");
+    if(!gl_procs.DrawArraysInstanced)
+        *(void **)&gl_procs.DrawArraysInstanced = lookup("glDrawArraysInstancedARB");
+    // ARB_sync uses the same names as core.
+    *(void **)&gl_procs.FenceSync = lookup("glFenceSync");
+    *(void **)&gl_procs.ClientWaitSync = lookup("glClientWaitSync");
+    *(void **)&gl_procs.DeleteSync = lookup("glDeleteSync");
+    // So does ARB_framebuffer_object, which unlike EXT_framebuffer_object has separate read and
+    // draw bindings; the EXT names aren't used.
+    *(void **)&gl_procs.GenFramebuffers = lookup("glGenFramebuffers");
+    *(void **)&gl_procs.DeleteFramebuffers = lookup("glDeleteFramebuffers");
+    *(void **)&gl_procs.BindFramebuffer = lookup("glBindFramebuffer");
+    *(void **)&gl_procs.FramebufferTexture2D = lookup("glFramebufferTexture2D");
+    *(void **)&gl_procs.CheckFramebufferStatus = lookup("glCheckFramebufferStatus");
+
+    state = ok ? LOADED : MISSING;
+    return ok;
+}
+
+bool gl_procs_instancing(void)
+{
+    return gl_procs_load() && gl_procs.VertexAttribDivisor && gl_procs.DrawArraysInstanced;
+}
+
+bool gl_procs_sync(void)
+{
+    return gl_procs_load() && gl_procs.FenceSync && gl_procs.ClientWaitSync && gl_procs.DeleteSync;
+}
+
+bool gl_procs_framebuffer(void)
+{
+    return gl_procs_load() && gl_procs.GenFramebuffers && gl_procs.DeleteFramebuffers
+        && gl_procs.BindFramebuffer && gl_procs.FramebufferTexture2D
+        && gl_procs.CheckFramebufferStatus;
+}
+
+static GLuint compile(const char *name, GLenum type, const char *src)
+{
+    GLuint shader = gl_procs.CreateShader(type);
+    gl_procs.ShaderSource(shader, 1, &src, NULL);
+    gl_procs.CompileShader(shader);
+
+    GLint status = GL_FALSE;
+    gl_procs.GetShaderiv(shader, GL_COMPILE_STATUS, &status);
+    if(status == GL_TRUE)
+        return shader;
+
+    char log[512];
+    gl_procs.GetShaderInfoLog(shader, sizeof(log), NULL, log);
+    log_msg("gl_procs: %s %s shader: %s", name,
+            type == GL_VERTEX_SHADER ? "vertex" : "fragment", log);
+    gl_procs.DeleteShader(shader);
+    return 0;
+}
+
+GLuint gl_procs_program(const char *name, const char *vertex_src, const char *fragment_src,
+                        const char *const *attribs)
+{
+    if(!gl_procs_load())
+        return 0;
+    GLuint vs = compile(name, GL_VERTEX_SHADER, vertex_src);
+    GLuint fs = compile(name, GL_FRAGMENT_SHADER, fragment_src);
+    if(!vs || !fs)
+    {
+        if(vs)
+            gl_procs.DeleteShader(vs);
+        if(fs)
+            gl_procs.DeleteShader(fs);
+        return 0;
+    }
+
+    GLuint prog = gl_procs.CreateProgram();
+    gl_procs.AttachShader(prog, vs);
+    gl_procs.AttachShader(prog, fs);
+    for(GLuint i = 0; attribs && attribs[i]; ++i)
+        gl_procs.BindAttribLocation(prog, i, attribs[i]);
+    gl_procs.LinkProgram(prog);
+    // The program keeps what it needs.
+    gl_procs.DeleteShader(vs);
+    gl_procs.DeleteShader(fs);
+
+    GLint status = GL_FALSE;
+    gl_procs.GetProgramiv(prog, GL_LINK_STATUS, &status);
+    if(status == GL_TRUE)
+        return prog;
+
+    char log[512];
+    gl_procs.GetProgramInfoLog(prog, sizeof(log), NULL, log);
+    log_msg("gl_procs: %s link: %s", name, log);
+    gl_procs.DeleteProgram(prog);
+    return 0;
+}
+
+void gl_procs_modulate(const float rgb[3])
+{
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    float w = (float)viewport[2], h = (float)viewport[3];
+    // What's there times the quad's colour.
+    XPLMSetGraphicsState(0, 0, 0, 0, 1, 0, 0);
+    glBlendFunc(GL_ZERO, GL_SRC_COLOR);
+    glColor4f(rgb[0], rgb[1], rgb[2], 1.f);
+    glBegin(GL_QUADS);
+    glVertex2f(0.f, 0.f);
+    glVertex2f(0.f, h);
+    glVertex2f(w, h);
+    glVertex2f(w, 0.f);
+    glEnd();
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+}
@@ -0,0 +1,138 @@
+/*===--------------------------------------------------------------------------------------------===
+ * gl_procs.h
+ *
+ * The OpenGL 2.x entry points the plugin uses beyond OpenGL 1.1, which isn't all that Windows'
+ * headers and libraries export. They're looked up at runtime, once, with the platform's
+ * GetProcAddress. Call them through `gl_procs`, e.g. gl_procs.UseProgram(prog), and only after
+ * gl_procs_load() has returned true. Instancing and fence syncs are optional (core in 3.3 and 3.2,
+ * extensions on macOS's 2.1 context): check gl_procs_instancing() and gl_procs_sync() first. So
+ * are framebuffer objects (core in 3.0, ARB_framebuffer_object on 2.1): gl_procs_framebuffer().
+ *===--------------------------------------------------------------------------------------------===
+*/
+#ifndef _GL_PROCS_H_
+#define _GL_PROCS_H_
+
+#include "SystemGL.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef APIENTRY
+#define APIENTRY
+#endif
+
+#ifndef GL_ARRAY_BUFFER
+#define GL_ARRAY_BUFFER         (0x8892)
+#define GL_STREAM_DRAW          (0x88E0)
+#define GL_STATIC_DRAW          (0x88E4)
+#define GL_DYNAMIC_DRAW         (0x88E8)
+#endif
+#ifndef GL_PIXEL_PACK_BUFFER
+#define GL_PIXEL_PACK_BUFFER    (0x88EB)
+#endif
+#ifndef GL_READ_ONLY
+#define GL_READ_ONLY            (0x88B8)
+#define GL_STREAM_READ          (0x88E1)
+#endif
+#ifndef GL_SYNC_GPU_COMMANDS_COMPLETE
+#define GL_SYNC_GPU_COMMANDS_COMPLETE   (0x9117)
+#define GL_ALREADY_SIGNALED             (0x911A)
+#define GL_TIMEOUT_EXPIRED              (0x911B)
+#define GL_CONDITION_SATISFIED          (0x911C)
+#define GL_WAIT_FAILED                  (0x911D)
+#endif
+#ifndef GL_FRAGMENT_SHADER
+#define GL_FRAGMENT_SHADER      (0x8B30)
+#define GL_VERTEX_SHADER        (0x8B31)
+#define GL_COMPILE_STATUS       (0x8B81)
+#define GL_LINK_STATUS          (0x8B82)
+#define GL_INFO_LOG_LENGTH      (0x8B84)
+#endif
+#ifndef GL_FRAMEBUFFER
+#define GL_FRAMEBUFFER                  (0x8D40)
+#define GL_READ_FRAMEBUFFER             (0x8CA8)
+#define GL_DRAW_FRAMEBUFFER             (0x8CA9)
+#define GL_DRAW_FRAMEBUFFER_BINDING     (0x8CA6)
+#define GL_READ_FRAMEBUFFER_BINDING     (0x8CAA)
+#define GL_COLOR_ATTACHMENT0            (0x8CE0)
+#define GL_FRAMEBUFFER_COMPLETE         (0x8CD5)
+#endif
+
+// GLsync, which older headers don't have.
+typedef struct gl_sync_s *gl_sync_t;
+
+typedef struct {
+    GLuint (APIENTRY *CreateShader)(GLenum type);
+    void (APIENTRY *ShaderSource)(GLuint shader, GLsizei count, const char *const *string,
+                                  const GLint *length);
+    void (APIENTRY *CompileShader)(GLuint shader);
+    void (APIENTRY *GetShaderiv)(GLuint shader, GLenum pname, GLint *params);
+    void (APIENTRY *GetShaderInfoLog)(GLuint shader, GLsizei size, GLsizei *length, char *log);
+    void (APIENTRY *DeleteShader)(GLuint shader);
+
+    GLuint (APIENTRY *CreateProgram)(void);
+    void (APIENTRY *AttachShader)(GLuint program, GLuint shader);
+    void (APIENTRY *BindAttribLocation)(GLuint program, GLuint index, const char *name);
+    void (APIENTRY *LinkProgram)(GLuint program);
+    void (APIENTRY *GetProgramiv)(GLuint program, GLenum pname, GLint *params);
+    void (APIENTRY *GetProgramInfoLog)(GLuint program, GLsizei size, GLsizei *length, char *log);
+    void (APIENTRY *DeleteProgram)(GLuint program);
+    void (APIENTRY *UseProgram)(GLuint program);
+    GLint (APIENTRY *GetUniformLocation)(GLuint program, const char *name);
+    void (APIENTRY *Uniform1i)(GLint location, GLint v0);
+    void (APIENTRY *Uniform2f)(GLint location, GLfloat v0, GLfloat v1);
+
+    void (APIENTRY *GenBuffers)(GLsizei n, GLuint *buffers);
+    void (APIENTRY *DeleteBuffers)(GLsizei n, const GLuint *buffers);
+    void (APIENTRY *BindBuffer)(GLenum target, GLuint buffer);
+    void (APIENTRY *BufferData)(GLenum target, ptrdiff_t size, const void *data, GLenum usage);
+    void (APIENTRY *BufferSubData)(GLenum target, ptrdiff_t offset, ptrdiff_t size,
+                                   const void *data);
+    void *(APIENTRY *MapBuffer)(GLenum target, GLenum access);
+    GLboolean (APIENTRY *UnmapBuffer)(GLenum target);
+
+    void (APIENTRY *EnableVertexAttribArray)(GLuint index);
+    void (APIENTRY *DisableVertexAttribArray)(GLuint index);
+    void (APIENTRY *VertexAttribPointer)(GLuint index, GLint size, GLenum type,
+                                         GLboolean normalized, GLsizei stride, const void *pointer);
+
+    // Optional, NULL if the context doesn't have them.
+    void (APIENTRY *VertexAttribDivisor)(GLuint index, GLuint divisor);
+    void (APIENTRY *DrawArraysInstanced)(GLenum mode, GLint first, GLsizei count,
+                                         GLsizei instances);
+    gl_sync_t (APIENTRY *FenceSync)(GLenum condition, GLbitfield flags);
+    GLenum (APIENTRY *ClientWaitSync)(gl_sync_t sync, GLbitfield flags, uint64_t timeout_ns);
+    void (APIENTRY *DeleteSync)(gl_sync_t sync);
+    void (APIENTRY *GenFramebuffers)(GLsizei n, GLuint *framebuffers);
+    void (APIENTRY *DeleteFramebuffers)(GLsizei n, const GLuint *framebuffers);
+    void (APIENTRY *BindFramebuffer)(GLenum target, GLuint framebuffer);
+    void (APIENTRY *FramebufferTexture2D)(GLenum target, GLenum attachment, GLenum textarget,
+                                          GLuint texture, GLint level);
+    GLenum (APIENTRY *CheckFramebufferStatus)(GLenum target);
+} gl_procs_t;
+
+extern gl_procs_t gl_procs;
+
+// Looks everything up the first time, with the plugin's GL context current. Returns false (and
+// logs what's missing) if anything isn't available; later calls return the same answer.
+bool gl_procs_load(void);
+
+// Whether VertexAttribDivisor and DrawArraysInstanced are there. Implies gl_procs_load().
+bool gl_procs_instancing(void);
+
+// Whether FenceSync, ClientWaitSync and DeleteSync are there. Implies gl_procs_load().
+bool gl_procs_sync(void);
+
+// Whether the framebuffer object entry points are there. Implies gl_procs_load().
+bool gl_procs_framebuffer(void);
+
+// Compiles and links a program from GLSL source, binding `attribs` (NULL-terminated) to locations
+// 0, 1, 2... in order. Returns 0 and logs the compiler's output on failure. `name` is for the log.
+GLuint gl_procs_program(const char *name, const char *vertex_src, const char *fragment_src,
+                        const char *const *attribs);
+
+// Multiplies what's already in the viewport by `rgb`, with a blended full-screen quad. Leaves the
+// usual GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA blending on. Plain OpenGL 1.1, no need to load.
+void gl_procs_modulate(const float rgb[3]);
+
+#endif /* ifndef _GL_PROCS_H_ */
@@ -0,0 +1,191 @@
+/*===--------------------------------------------------------------------------------------------===
+ * layout.c
+ *
+ * Anchor and flex layout passes, and the rectangle cache.
+ *===--------------------------------------------------------------------------------------------===
+ */
+#include "layout.h"
+#include <math.h>
+#include <string.h>
+
+void log_msg(const char *fmt, ...);
+
+#define MAX_NODES           (64)
+
+typedef struct {
+    float x, y, w, h;
+} frect_t;
+
+// Places a span of `size` (0 to fill) in [start, start + extent], kept `margin` from the ends
+// it's anchored to.
+static void place_span(bool lo, bool hi, float start, float extent, float size, float margin,
+                       float *pos, float *len)
+{
+    if(size <= 0.f || (lo && hi))
+    {
+        *pos = start + margin;
+        *len = extent - 2.f * margin;
+    }
+    else if(lo)
+    {
+        *pos = start + margin;
+        *len = size;
+    }
+    else if(hi)
+    {
+        *pos = start + extent - margin - size;
+        *len = size;
+    }
+    else
+    {
+        *pos = start + (extent - size) * 0.5f;
+        *len = size;
+    }
+    if(*len < 0.f)
+        *len = 0.f;
+}
+
+static void place_anchored(const layout_node_t *node, const frect_t *box, float scale,
+                           frect_t *out)
+{
+    float m = node->margin * scale;
+    place_span(node->anchors & LAYOUT_LEFT, node->anchors & LAYOUT_RIGHT, box->x, box->w,
+               node->width * scale, m, &out->x, &out->w);
+    place_span(node->anchors & LAYOUT_BOTTOM, node->anchors & LAYOUT_TOP, box->y, box->h,
+               node->height * scale, m, &out->y, &out->h);
+}
+
+static void place_flex(const layout_t *layout, int parent, const frect_t *box, frect_t *rects)
+{
+    const layout_node_t *p = &layout->nodes[parent];
+    const float scale = layout->scale;
+    const bool row = p->kind == LAYOUT_ROW;
+
+    float fixed = 0.f, flex = 0.f;
+    int children = 0;
+    for(int i = parent + 1; i < layout->count; ++i)
+    {
+        const layout_node_t *n = &layout->nodes[i];
+        if(n->parent != parent)
+            continue;
+        if(n->flex > 0.f)
+            flex += n->flex;
+        else
+            fixed += (row ? n->width : n->height) * scale;
+        children += 1;
+    }
+    if(!children)
+        return;
+    float gap = p->gap * scale;
+    float free = (row ? box->w : box->h) - fixed - gap * (float)(children - 1);
+    if(free < 0.f)
+        free = 0.f;
+
+    // Rows run left to right; columns top to bottom, which is down in y.
+    float cursor = row ? box->x : box->y + box->h;
+    for(int i = parent + 1; i < layout->count; ++i)
+    {
+        const layout_node_t *n = &layout->nodes[i];
+        if(n->parent != parent)
+            continue;
+        float size = n->flex > 0.f ? free * n->flex / flex : (row ? n->width : n->height) * scale;
+        frect_t *r = &rects[i];
+        if(row)
+        {
+            r->x = cursor;
+            r->w = size;
+            place_span(n->anchors & LAYOUT_BOTTOM, n->anchors & LAYOUT_TOP, box->y, box->h,
+                       n->height * scale, n->margin * scale, &r->y, &r->h);
+            cursor += size + gap;
+        }
+        else
+        {
+            r->y = cursor - size;
+            r->h = size;
+            place_span(n->anchors & LAYOUT_LEFT, n->anchors & LAYOUT_RIGHT, box->x, box->w,
+                       n->width * scale, n->margin * scale, &r->x, &r->w);
+            cursor -= size + gap;
+        }
+    }
+}
+
+void layout_init(layout_t *layout, const layout_node_t *nodes, layout_rect_t *rects, int count)
+{
+    memset(layout, 0, sizeof(*layout));
+    layout->nodes = nodes;
+    layout->rects = rects;
+    layout->count = count;
+    for(int i = 1; i < count; ++i)
+    {
+        if(nodes[i].parent < 0 || nodes[i].parent >= i)
+        {
+            log_msg("layout: node %d must come after its parent", i);
+            layout->count = i;
+            break;
+        }
+    }
+    if(layout->count > MAX_NODES)
+    {
+        log_msg("layout: %d nodes, at most %d are laid out", layout->count, MAX_NODES);
+        layout->count = MAX_NODES;
+    }
+    memset(rects, 0, sizeof(layout_rect_t) * (size_t)count);
+}
+
+bool layout_update(layout_t *layout, int width, int height, float scale)
+{
+    if(scale <= 0.f)
+        scale = 1.f;
+    if(layout->passes && width == layout->width && height == layout->height
+       && scale == layout->scale)
+        return false;
+    layout->width = width;
+    layout->height = height;
+    layout->scale = scale;
+    layout->passes += 1;
+    if(!layout->count)
+        return true;
+
+    // Parents come first, so each node's box is known by the time its children are placed.
+    frect_t rects[MAX_NODES];
+    rects[0] = (frect_t){0.f, 0.f, (float)width, (float)height};
+    for(int i = 0; i < layout->count; ++i)
+    {
+        const layout_node_t *node = &layout->nodes[i];
+        float pad = node->padding * scale;
+        frect_t box = {
+            rects[i].x + pad, rects[i].y + pad, rects[i].w - 2.f * pad, rects[i].h - 2.f * pad
+        };
+        if(node->kind == LAYOUT_ANCHOR)
+        {
+            for(int j = i + 1; j < layout->count; ++j)
+            {
+                if(layout->nodes[j].parent == i)
+                    place_anchored(&layout->nodes[j], &box, scale, &rects[j]);
+            }
+        }
+        else
+        {
+            place_flex(layout, i, &box, rects);
+        }
+    }
+
+    // Edges are rounded rather than sizes, so neighbours stay flush.
+    for(int i = 0; i < layout->count; ++i)
+    {
+        int x0 = (int)lroundf(rects[i].x), y0 = (int)lroundf(rects[i].y);
+        int x1 = (int)lroundf(rects[i].x + rects[i].w), y1 = (int)lroundf(rects[i].y + rects[i].h);
+        layout->rects[i] = (layout_rect_t){x0, y0, x1 - x0, y1 - y0};
+    }
+    return true;
+}
+
+int layout_hit(const layout_t *layout, int x, int y)
+{
+    for(int i = layout->count; i-- > 0;)
+    {
+        if(layout->nodes[i].hit && layout_contains(&layout->rects[i], x, y))
+            return i;
+    }
+    return -1;
+}
@@ -0,0 +1,84 @@
+/*===--------------------------------------------------------------------------------------------===
+ * layout.h
+ *
+ * Resolution-independent widget layout for device screens, computed once per size change.
+ *
+ * A screen is described by a static table of nodes, each parent before its children, node 0 the
+ * whole surface. Sizes, margins, padding and gaps are in dp, scaled by the layout's scale factor
+ * to pixels. How a node's children are placed depends on the node's kind:
+ *
+ *  - LAYOUT_ANCHOR: each child is kept `margin` from the parent edges in its `anchors`. A child
+ *    anchored to both edges on an axis, or sized 0 on it, fills that axis; one anchored to
+ *    neither is centred.
+ *  - LAYOUT_ROW, LAYOUT_COLUMN: children are placed side by side, left to right or top to
+ *    bottom, `gap` apart. Fixed-size children get their size; what's left is shared between
+ *    the others by `flex`. Across, they fill the parent if sized 0, else sit at the edge in their
+ *    anchors (centred if none).
+ *
+ * layout_update() recomputes every node's rectangle only when the surface size or scale changed,
+ * and keeps them, snapped to whole pixels, for drawing and hit-testing until the next change.
+ * Coordinates are pixels, y up, like avionics callbacks. No X-Plane dependencies.
+ *===--------------------------------------------------------------------------------------------===
+*/
+#ifndef _LAYOUT_H_
+#define _LAYOUT_H_
+
+#include <stdbool.h>
+
+typedef enum {
+    LAYOUT_ANCHOR,
+    LAYOUT_ROW,
+    LAYOUT_COLUMN,
+} layout_kind_t;
+
+enum {
+    LAYOUT_LEFT     = 1 << 0,
+    LAYOUT_RIGHT    = 1 << 1,
+    LAYOUT_TOP      = 1 << 2,
+    LAYOUT_BOTTOM   = 1 << 3,
+};
+
+typedef struct {
+    int parent;                 // Index of the parent node; -1 for node 0 only.
+    layout_kind_t kind;         // How this node's children are placed.
+    float width, height;        // dp; 0 fills (see above).
+    float flex;                 // Share of a row or column's free space, instead of a fixed size.
+    unsigned anchors;           // LAYOUT_LEFT | ...
+    float margin;               // dp, from the anchored edges.
+    float padding;              // dp, inside this node, around its children.
+    float gap;                  // dp, between this node's children in a row or column.
+    bool hit;                   // Found by layout_hit().
+} layout_node_t;
+
+typedef struct {
+    int x, y, w, h;
+} layout_rect_t;
+
+typedef struct {
+    const layout_node_t *nodes;
+    layout_rect_t *rects;       // One per node, owned by the caller.
+    int count;
+    int width, height;          // What the rectangles are for.
+    float scale;
+    unsigned passes;            // Times the layout was actually computed.
+} layout_t;
+
+void layout_init(layout_t *layout, const layout_node_t *nodes, layout_rect_t *rects, int count);
+// Lays out a width x height pixel surface at `scale` pixels per dp, unless that's what the
+// rectangles are already for. Returns whether they changed.
+bool layout_update(layout_t *layout, int width, int height, float scale);
+
+static inline const layout_rect_t *layout_rect(const layout_t *layout, int node)
+{
+    return &layout->rects[node];
+}
+
+static inline bool layout_contains(const layout_rect_t *r, int x, int y)
+{
+    return x >= r->x && x < r->x + r->w && y >= r->y && y < r->y + r->h;
+}
+
+// The last node marked `hit` whose rectangle holds x, y, or -1.
+int layout_hit(const layout_t *layout, int x, int y);
+
+#endif /* ifndef _LAYOUT_H_ */
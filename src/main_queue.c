@@ -0,0 +1,295 @@
+/*===--------------------------------------------------------------------------------------------===
+ * main_queue.c
+ *
+ * Bounded multi-producer/single-consumer command queue drained by a flight loop.
+ *
+ * This is the classic sequence-numbered ring: each slot carries a sequence number that tells
+ * producers whether the slot is free for the lap they are on, and tells the consumer whether the
+ * slot has been published yet. Producers only contend on a single atomic index.
+ *===--------------------------------------------------------------------------------------------===
+ */
+#include "main_queue.h"
+#include "clock.h"
+#include <XPLMProcessing.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+
+void log_msg(const char *fmt, ...);
+
+#define QUEUE_CAPACITY      (1024)
+#define QUEUE_MASK          (QUEUE_CAPACITY - 1)
+#define DEFAULT_BUDGET_US   (500)
+// How many commands we run between two clock reads when draining.
+#define CLOCK_STRIDE        (8)
+
+typedef enum {
+    CMD_CALL,
+    CMD_SET_BRIGHTNESS,
+    CMD_POP_OUT,
+    CMD_SET_POPUP_VISIBLE,
+    CMD_NEEDS_DRAWING,
+    CMD_FMS_SET_ENTRY,
+    CMD_FMS_SET_LAT_LON,
+    CMD_FMS_CLEAR_ENTRY,
+    CMD_FMS_SET_DESTINATION,
+} cmd_type_t;
+
+typedef struct {
+    cmd_type_t type;
+    union {
+        struct {
+            main_queue_fn fn;
+            _Alignas(max_align_t) unsigned char payload[MAIN_QUEUE_PAYLOAD_SIZE];
+        } call;
+        struct {
+            XPLMAvionicsID handle;
+            float value;
+        } device;
+        struct {
+            XPLMNavFlightPlan plan;
+            int index;
+            XPLMNavRef ref;
+            int altitude;
+            float lat, lon;
+        } fms;
+    };
+} cmd_t;
+
+typedef struct {
+    atomic_size_t seq;
+    cmd_t cmd;
+} slot_t;
+
+static slot_t slots[QUEUE_CAPACITY];
+static _Alignas(64) atomic_size_t enqueue_pos;
+static _Alignas(64) size_t dequeue_pos;
+static atomic_uint dropped;
+static unsigned dropped_reported = 0;
+static unsigned budget_us = DEFAULT_BUDGET_US;
+static XPLMFlightLoopID flight_loop = NULL;
+
+static bool enqueue(const cmd_t *cmd)
+{
+    size_t pos = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+    slot_t *slot;
+    for(;;)
+    {
+        slot = &slots[pos & QUEUE_MASK];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if(diff == 0)
+        {
+            if(atomic_compare_exchange_weak_explicit(&enqueue_pos, &pos, pos + 1,
+                                                     memory_order_relaxed, memory_order_relaxed))
+                break;
+        }
+        else if(diff < 0)
+        {
+            atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+            return false;
+        }
+        else
+        {
+            pos = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+        }
+    }
+    slot->cmd = *cmd;
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+    return true;
+}
+
+static bool dequeue(cmd_t *cmd)
+{
+    slot_t *slot = &slots[dequeue_pos & QUEUE_MASK];
+    size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    if((intptr_t)seq - (intptr_t)(dequeue_pos + 1) < 0)
+        return false;
+    *cmd = slot->cmd;
+    atomic_store_explicit(&slot->seq, dequeue_pos + QUEUE_CAPACITY, memory_order_release);
+    dequeue_pos += 1;
+    return true;
+}
+
+static void run(cmd_t *cmd)
+{
+    switch(cmd->type) {
+    case CMD_CALL:
+        cmd->call.fn(cmd->call.payload);
+        break;
+    case CMD_SET_BRIGHTNESS:
+        XPLMSetAvionicsBrightnessRheo(cmd->device.handle, cmd->device.value);
+        break;
+    case CMD_POP_OUT:
+        XPLMPopOutAvionics(cmd->device.handle);
+        break;
+    case CMD_SET_POPUP_VISIBLE:
+        XPLMSetAvionicsPopupVisible(cmd->device.handle, cmd->device.value != 0.f);
+        break;
+    case CMD_NEEDS_DRAWING:
+        XPLMAvionicsNeedsDrawing(cmd->device.handle);
+        break;
+    case CMD_FMS_SET_ENTRY:
+        XPLMSetFMSFlightPlanEntryInfo(cmd->fms.plan, cmd->fms.index, cmd->fms.ref, cmd->fms.altitude);
+        break;
+    case CMD_FMS_SET_LAT_LON:
+        XPLMSetFMSFlightPlanEntryLatLon(cmd->fms.plan, cmd->fms.index,
+                                        cmd->fms.lat, cmd->fms.lon, cmd->fms.altitude);
+        break;
+    case CMD_FMS_CLEAR_ENTRY:
+        XPLMClearFMSFlightPlanEntry(cmd->fms.plan, cmd->fms.index);
+        break;
+    case CMD_FMS_SET_DESTINATION:
+        XPLMSetDestinationFMSFlightPlanEntry(cmd->fms.plan, cmd->fms.index);
+        break;
+    }
+}
+
+static void drain(uint64_t deadline_ns)
+{
+    cmd_t cmd;
+    int count = 0;
+    while(dequeue(&cmd))
+    {
+        run(&cmd);
+        if(deadline_ns && (++count % CLOCK_STRIDE) == 0 && clock_now_ns() >= deadline_ns)
+            break;
+    }
+
+    unsigned drops = atomic_load_explicit(&dropped, memory_order_relaxed);
+    if(drops != dropped_reported)
+    {
+        log_msg("main queue full, dropped %u commands", drops - dropped_reported);
+        dropped_reported = drops;
+    }
+}
+
+static float queue_flight_loop(float since_call, float since_loop, int counter, void *refcon)
+{
+    (void)since_call;
+    (void)since_loop;
+    (void)counter;
+    (void)refcon;
+
+    drain(clock_now_ns() + (uint64_t)budget_us * 1000ull);
+    return -1.f;
+}
+
+bool main_queue_post(main_queue_fn fn, const void *payload, size_t size)
+{
+    if(!fn || size > MAIN_QUEUE_PAYLOAD_SIZE)
+        return false;
+    cmd_t cmd = {.type = CMD_CALL};
+    cmd.call.fn = fn;
+    if(payload && size)
+        memcpy(cmd.call.payload, payload, size);
+    return enqueue(&cmd);
+}
+
+static bool post_device(cmd_type_t type, XPLMAvionicsID handle, float value)
+{
+    cmd_t cmd = {.type = type};
+    cmd.device.handle = handle;
+    cmd.device.value = value;
+    return enqueue(&cmd);
+}
+
+static bool post_fms(cmd_type_t type, XPLMNavFlightPlan plan, int index)
+{
+    cmd_t cmd = {.type = type};
+    cmd.fms.plan = plan;
+    cmd.fms.index = index;
+    cmd.fms.ref = XPLM_NAV_NOT_FOUND;
+    return enqueue(&cmd);
+}
+
+bool main_queue_set_brightness(XPLMAvionicsID handle, float brightness)
+{
+    return post_device(CMD_SET_BRIGHTNESS, handle, brightness);
+}
+
+bool main_queue_pop_out(XPLMAvionicsID handle)
+{
+    return post_device(CMD_POP_OUT, handle, 0.f);
+}
+
+bool main_queue_set_popup_visible(XPLMAvionicsID handle, bool visible)
+{
+    return post_device(CMD_SET_POPUP_VISIBLE, handle, visible ? 1.f : 0.f);
+}
+
+bool main_queue_needs_drawing(XPLMAvionicsID handle)
+{
+    return post_device(CMD_NEEDS_DRAWING, handle, 0.f);
+}
+
+bool main_queue_fms_set_entry(XPLMNavFlightPlan plan, int index, XPLMNavRef ref, int altitude)
+{
+    cmd_t cmd = {.type = CMD_FMS_SET_ENTRY};
+    cmd.fms.plan = plan;
+    cmd.fms.index = index;
+    cmd.fms.ref = ref;
+    cmd.fms.altitude = altitude;
+    return enqueue(&cmd);
+}
+
+bool main_queue_fms_set_lat_lon(XPLMNavFlightPlan plan, int index, float lat, float lon, int alt)
+{
+    cmd_t cmd = {.type = CMD_FMS_SET_LAT_LON};
+    cmd.fms.plan = plan;
+    cmd.fms.index = index;
+    cmd.fms.lat = lat;
+    cmd.fms.lon = lon;
+    cmd.fms.altitude = alt;
+    return enqueue(&cmd);
+}
+
+bool main_queue_fms_clear_entry(XPLMNavFlightPlan plan, int index)
+{
+    return post_fms(CMD_FMS_CLEAR_ENTRY, plan, index);
+}
+
+bool main_queue_fms_set_destination(XPLMNavFlightPlan plan, int index)
+{
+    return post_fms(CMD_FMS_SET_DESTINATION, plan, index);
+}
+
+void main_queue_set_budget_us(unsigned budget)
+{
+    budget_us = budget;
+}
+
+void main_queue_flush(void)
+{
+    drain(0);
+}
+
+void main_queue_init(void)
+{
+    for(size_t i = 0; i < QUEUE_CAPACITY; ++i)
+        atomic_init(&slots[i].seq, i);
+    atomic_init(&enqueue_pos, 0);
+    atomic_init(&dropped, 0);
+    dequeue_pos = 0;
+    dropped_reported = 0;
+
+    XPLMCreateFlightLoop_t fl = (XPLMCreateFlightLoop_t){
+        .structSize = sizeof(XPLMCreateFlightLoop_t),
+        .phase = xplm_FlightLoop_Phase_BeforeFlightModel,
+        .callbackFunc = queue_flight_loop,
+        .refcon = NULL
+    };
+    flight_loop = XPLMCreateFlightLoop(&fl);
+    XPLMScheduleFlightLoop(flight_loop, -1.f, 1);
+}
+
+void main_queue_fini(void)
+{
+    // This runs before the other modules are torn down, so every handle a pending command refers
+    // to is still alive. Modules that own worker threads call main_queue_flush() themselves once
+    // their workers are joined to pick up anything posted after this point.
+    main_queue_flush();
+    if(flight_loop)
+        XPLMDestroyFlightLoop(flight_loop);
+    flight_loop = NULL;
+}
@@ -0,0 +1,50 @@
+/*===--------------------------------------------------------------------------------------------===
+ * main_queue.h
+ *
+ * Marshals XPLM calls from worker threads onto the sim's main thread.
+ *
+ * The XPLM API may only be called from the main thread. Any thread can post either a typed
+ * command or a closure (a function plus a small payload copied into the queue) with the
+ * functions below. The queue is a bounded, lock-free multi-producer/single-consumer ring, so
+ * posting never blocks and never allocates. A flight loop drains it every frame, running as
+ * many commands as fit in the per-frame time budget.
+ *===--------------------------------------------------------------------------------------------===
+*/
+#ifndef _MAIN_QUEUE_H_
+#define _MAIN_QUEUE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <XPLMDisplay.h>
+#include <XPLMNavigation.h>
+
+// Maximum size of the payload a closure can carry. Anything bigger should be passed by pointer.
+#define MAIN_QUEUE_PAYLOAD_SIZE (48)
+
+typedef void (*main_queue_fn)(void *payload);
+
+// Posts a closure that will be called on the main thread with a pointer to a copy of `payload`.
+// Returns false if the queue is full or size is larger than MAIN_QUEUE_PAYLOAD_SIZE.
+bool main_queue_post(main_queue_fn fn, const void *payload, size_t size);
+
+// Typed commands for the XPLM calls background features need most.
+bool main_queue_set_brightness(XPLMAvionicsID handle, float brightness);
+bool main_queue_pop_out(XPLMAvionicsID handle);
+bool main_queue_set_popup_visible(XPLMAvionicsID handle, bool visible);
+bool main_queue_needs_drawing(XPLMAvionicsID handle);
+bool main_queue_fms_set_entry(XPLMNavFlightPlan plan, int index, XPLMNavRef ref, int altitude);
+bool main_queue_fms_set_lat_lon(XPLMNavFlightPlan plan, int index, float lat, float lon, int alt);
+bool main_queue_fms_clear_entry(XPLMNavFlightPlan plan, int index);
+bool main_queue_fms_set_destination(XPLMNavFlightPlan plan, int index);
+
+// Sets how long the flight loop may spend running commands each frame.
+void main_queue_set_budget_us(unsigned budget_us);
+
+// Runs every pending command regardless of the budget. Main thread only. Modules that own worker
+// threads should call this after joining them, before freeing what the closures refer to.
+void main_queue_flush(void);
+
+void main_queue_init(void);
+void main_queue_fini(void);
+
+#endif /* ifndef _MAIN_QUEUE_H_ */
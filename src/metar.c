@@ -0,0 +1,478 @@
+/*===--------------------------------------------------------------------------------------------===
+ * metar.c
+ *
+ * METAR cache, fetch schedule and decoder.
+ *===--------------------------------------------------------------------------------------------===
+ */
+#include "metar.h"
+#include "profiler.h"
+#include <XPLMProcessing.h>
+#include <XPLMWeather.h>
+#include <math.h>
+#include <string.h>
+
+void log_msg(const char *fmt, ...);
+
+#define CACHE_SIZE          (64)
+// Fetches: this many a second on average, never more than one in a frame.
+#define FETCHES_PER_S       (5.f)
+// Reports are fetched again once they're this old, if something asked for them recently.
+#define MAX_AGE_S           (300.f)
+#define WANTED_S            (60.f)
+
+#define HPA_TO_INHG         (0.0295300f)
+#define M_PER_SM            (1609.344f)
+#define MPS_TO_KTS          (1.943844f)
+#define KMH_TO_KTS          (0.539957f)
+
+typedef struct {
+    uint64_t key;           // 0 for an empty entry.
+    metar_t metar;
+    bool valid;             // Fetched and decoded.
+    bool fetched;
+    float fetched_at;
+    float wanted_at;        // Last metar_get(), which is also what the LRU goes by.
+} entry_t;
+
+static entry_t cache[CACHE_SIZE];
+static XPLMFlightLoopID flight_loop = NULL;
+static float tokens = 0.f;
+static unsigned fetches = 0;
+static unsigned decoded = 0;
+static prof_probe_t fetch_probe = PROF_NO_PROBE;
+
+/*
+ * Decoder.
+ */
+
+static inline bool is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static inline bool is_alnum(char c)
+{
+    return is_digit(c) || (c >= 'A' && c <= 'Z');
+}
+
+// The value of `n` digits at `s`, or -1 if they aren't all digits.
+static int digits(const char *s, int n)
+{
+    int v = 0;
+    for(int i = 0; i < n; ++i)
+    {
+        if(!is_digit(s[i]))
+            return -1;
+        v = v * 10 + (s[i] - '0');
+    }
+    return v;
+}
+
+static bool all_digits(const char *s, int len)
+{
+    return len > 0 && digits(s, len) >= 0;
+}
+
+static inline bool starts_with(const char *s, int len, const char *prefix)
+{
+    int n = (int)strlen(prefix);
+    return len >= n && !memcmp(s, prefix, (size_t)n);
+}
+
+static inline bool ends_with(const char *s, int len, const char *suffix)
+{
+    int n = (int)strlen(suffix);
+    return len >= n && !memcmp(s + len - n, suffix, (size_t)n);
+}
+
+static inline bool token_is(const char *s, int len, const char *word)
+{
+    return len == (int)strlen(word) && !memcmp(s, word, (size_t)len);
+}
+
+// The start of a trend forecast: TEMPO, BECMG, NOSIG, FMhhmm (or FMddhhmm) and PROB30/PROB40.
+static bool is_trend(const char *s, int len)
+{
+    if(token_is(s, len, "TEMPO") || token_is(s, len, "BECMG") || token_is(s, len, "NOSIG"))
+        return true;
+    if(starts_with(s, len, "PROB"))
+        return all_digits(s + 4, len - 4);
+    return (len == 6 || len == 8) && starts_with(s, len, "FM") && all_digits(s + 2, len - 2);
+}
+
+// dddssKT, dddssGggKT, VRBssKT, and the same in MPS or KMH.
+static bool parse_wind(const char *s, int len, metar_t *out)
+{
+    float unit;
+    int unit_len;
+    if(ends_with(s, len, "KT"))
+        unit = 1.f, unit_len = 2;
+    else if(ends_with(s, len, "MPS"))
+        unit = MPS_TO_KTS, unit_len = 3;
+    else if(ends_with(s, len, "KMH"))
+        unit = KMH_TO_KTS, unit_len = 3;
+    else
+        return false;
+    len -= unit_len;
+    if(len < 5)
+        return false;
+
+    int dir = starts_with(s, len, "VRB") ? -2 : digits(s, 3);
+    if(dir == -1)
+        return false;
+    const char *gust = memchr(s + 3, 'G', (size_t)(len - 3));
+    int speed_len = (int)((gust ? gust : s + len) - (s + 3));
+    int gust_len = gust ? (int)(s + len - gust - 1) : 0;
+    if(speed_len < 2 || speed_len > 3 || (gust && (gust_len < 2 || gust_len > 3)))
+        return false;
+    int speed = digits(s + 3, speed_len);
+    int gusts = gust ? digits(gust + 1, gust_len) : 0;
+    if(speed < 0 || gusts < 0)
+        return false;
+
+    out->wind_dir = dir >= 0 ? (float)dir : NAN;
+    out->wind_kts = (float)speed * unit;
+    out->gust_kts = (float)gusts * unit;
+    return true;
+}
+
+// Statute miles: 10SM, 1/2SM, M1/4SM, P6SM. `whole` is the 1 of "1 1/2SM", or 0.
+static bool parse_vis_sm(const char *s, int len, int whole, metar_t *out)
+{
+    if(!ends_with(s, len, "SM"))
+        return false;
+    len -= 2;
+    if(len > 0 && (s[0] == 'M' || s[0] == 'P'))
+        s += 1, len -= 1;
+    const char *slash = memchr(s, '/', (size_t)len);
+    if(!slash)
+    {
+        if(!all_digits(s, len) || len > 2)
+            return false;
+        out->visibility_sm = (float)digits(s, len);
+        return true;
+    }
+    int num_len = (int)(slash - s), den_len = len - num_len - 1;
+    if(num_len < 1 || num_len > 2 || den_len < 1 || den_len > 2)
+        return false;
+    int num = digits(s, num_len), den = digits(slash + 1, den_len);
+    if(num < 0 || den <= 0)
+        return false;
+    out->visibility_sm = (float)whole + (float)num / (float)den;
+    return true;
+}
+
+// FEWnnn, SCTnnn, BKNnnn, OVCnnn (maybe followed by CB or TCU), VVnnn, and the clear-sky codes.
+static bool parse_sky(const char *s, int len, metar_t *out)
+{
+    if(token_is(s, len, "CLR") || token_is(s, len, "SKC") || token_is(s, len, "NSC")
+       || token_is(s, len, "NCD"))
+        return true;
+
+    int cover_len = starts_with(s, len, "VV") ? 2 : 3;
+    bool ceiling = cover_len == 2 || starts_with(s, len, "BKN") || starts_with(s, len, "OVC");
+    if(!ceiling && !starts_with(s, len, "FEW") && !starts_with(s, len, "SCT"))
+        return false;
+    if(len < cover_len + 3)
+        return false;
+    int height = digits(s + cover_len, 3);
+    if(height < 0)
+        return cover_len == 2 || s[cover_len] == '/';  // VV/// or a layer of unknown height.
+    if(ceiling)
+        out->ceiling_ft = fminf(out->ceiling_ft, (float)height * 100.f);
+    return true;
+}
+
+// [M]tt/[M]dd, with the dew point sometimes missing.
+static bool parse_temps(const char *s, int len, metar_t *out)
+{
+    const char *slash = memchr(s, '/', (size_t)len);
+    if(!slash || slash == s)
+        return false;
+    float values[2] = {NAN, NAN};
+    const char *part[2] = {s, slash + 1};
+    int part_len[2] = {(int)(slash - s), (int)(s + len - slash - 1)};
+    for(int i = 0; i < 2; ++i)
+    {
+        const char *p = part[i];
+        int n = part_len[i];
+        bool minus = n > 0 && p[0] == 'M';
+        if(minus)
+            p += 1, n -= 1;
+        if(n == 0 && i == 1)
+            break;
+        if(n != 2 || !all_digits(p, 2))
+            return false;
+        values[i] = (float)digits(p, 2) * (minus ? -1.f : 1.f);
+    }
+    out->temp_c = values[0];
+    out->dewpoint_c = values[1];
+    return true;
+}
+
+static metar_cat_t categorise(const metar_t *m, bool sky_reported)
+{
+    if(isnan(m->visibility_sm) && !sky_reported)
+        return METAR_CAT_UNKNOWN;
+    float vis = isnan(m->visibility_sm) ? INFINITY : m->visibility_sm;
+    float ceiling = m->ceiling_ft;
+    if(ceiling < 500.f || vis < 1.f)
+        return METAR_CAT_LIFR;
+    if(ceiling < 1000.f || vis < 3.f)
+        return METAR_CAT_IFR;
+    if(ceiling <= 3000.f || vis <= 5.f)
+        return METAR_CAT_MVFR;
+    return METAR_CAT_VFR;
+}
+
+bool metar_parse(const char *raw, metar_t *out)
+{
+    *out = (metar_t){
+        .day = -1, .hour = -1, .minute = -1,
+        .wind_dir = NAN, .wind_kts = NAN, .gust_kts = 0.f,
+        .visibility_sm = NAN, .ceiling_ft = INFINITY, .altimeter_inhg = NAN,
+        .temp_c = NAN, .dewpoint_c = NAN,
+        .category = METAR_CAT_UNKNOWN,
+    };
+
+    bool sky_reported = false;
+    int whole_sm = 0;       // A lone whole number, maybe the start of "1 1/2SM".
+    const char *p = raw;
+    while(*p)
+    {
+        while(*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t')
+            p += 1;
+        if(!*p)
+            break;
+        const char *s = p;
+        while(*p && *p != ' ' && *p != '\n' && *p != '\r' && *p != '\t')
+            p += 1;
+        int len = (int)(p - s);
+        int pending_whole = whole_sm;
+        whole_sm = 0;
+
+        // Only the observation counts: forecast clouds and visibility would overwrite it.
+        if(token_is(s, len, "RMK") || (out->station[0] && is_trend(s, len)))
+            break;
+        if(!out->station[0])
+        {
+            if(token_is(s, len, "METAR") || token_is(s, len, "SPECI"))
+                continue;
+            if(len < 3 || len >= (int)sizeof(out->station))
+                return false;
+            for(int i = 0; i < len; ++i)
+            {
+                if(!is_alnum(s[i]))
+                    return false;
+            }
+            memcpy(out->station, s, (size_t)len);
+            continue;
+        }
+
+        if(len == 7 && s[6] == 'Z' && all_digits(s, 6))
+        {
+            out->day = (int8_t)digits(s, 2);
+            out->hour = (int8_t)digits(s + 2, 2);
+            out->minute = (int8_t)digits(s + 4, 2);
+            continue;
+        }
+        if(isnan(out->wind_kts) && parse_wind(s, len, out))
+            continue;
+        if(token_is(s, len, "CAVOK"))
+        {
+            out->visibility_sm = 10.f;
+            sky_reported = true;
+            continue;
+        }
+        if(parse_vis_sm(s, len, pending_whole, out))
+            continue;
+        if(len <= 2 && all_digits(s, len) && isnan(out->visibility_sm))
+        {
+            whole_sm = digits(s, len);
+            continue;
+        }
+        if(len == 4 && all_digits(s, 4) && isnan(out->visibility_sm))
+        {
+            int metres = digits(s, 4);
+            out->visibility_sm = metres >= 9999 ? 10.f : (float)metres / M_PER_SM;
+            continue;
+        }
+        if(parse_sky(s, len, out))
+        {
+            sky_reported = true;
+            continue;
+        }
+        if(len == 5 && (s[0] == 'A' || s[0] == 'Q') && all_digits(s + 1, 4))
+        {
+            int v = digits(s + 1, 4);
+            out->altimeter_inhg = s[0] == 'A' ? (float)v / 100.f : (float)v * HPA_TO_INHG;
+            continue;
+        }
+        // Variable wind sectors, RVR, present weather and the like aren't decoded.
+        parse_temps(s, len, out);
+    }
+    if(!out->station[0])
+        return false;
+    out->category = categorise(out, sky_reported);
+    return true;
+}
+
+/*
+ * Cache.
+ */
+
+// Identifiers of up to 7 characters, packed so lookups compare one word.
+static uint64_t station_key(const char *icao)
+{
+    uint64_t key = 0;
+    int i = 0;
+    for(; icao[i]; ++i)
+    {
+        if(i >= 7)
+            return 0;
+        char c = icao[i];
+        if(c >= 'a' && c <= 'z')
+            c = (char)(c - 'a' + 'A');
+        key = (key << 8) | (uint8_t)c;
+    }
+    return i ? key | (1ull << 63) : 0;
+}
+
+static void key_to_id(uint64_t key, char *out)
+{
+    char tmp[8];
+    int n = 0;
+    for(key &= ~(1ull << 63); key; key >>= 8)
+        tmp[n++] = (char)(key & 0xff);
+    for(int i = 0; i < n; ++i)
+        out[i] = tmp[n - 1 - i];
+    out[n] = '\0';
+}
+
+const metar_t *metar_get(const char *icao)
+{
+    uint64_t key = station_key(icao);
+    if(!key)
+        return NULL;
+    float now = XPLMGetElapsedTime();
+    entry_t *victim = &cache[0];
+    for(int i = 0; i < CACHE_SIZE; ++i)
+    {
+        entry_t *e = &cache[i];
+        if(e->key == key)
+        {
+            e->wanted_at = now;
+            return e->valid ? &e->metar : NULL;
+        }
+        if(!e->key || (victim->key && e->wanted_at < victim->wanted_at))
+            victim = e;
+    }
+
+    // Queue it for the fetch loop, in place of the entry nobody has wanted for longest.
+    *victim = (entry_t){.key = key, .wanted_at = now};
+    return NULL;
+}
+
+static void fetch(entry_t *e, float now)
+{
+    char id[8];
+    key_to_id(e->key, id);
+    XPLMFixedString150_t raw;
+    memset(&raw, 0, sizeof(raw));
+    XPLMGetMETARForAirport(id, &raw);
+    raw.buffer[sizeof(raw.buffer) - 1] = '\0';
+    fetches += 1;
+
+    metar_t metar;
+    bool ok = metar_parse(raw.buffer, &metar);
+    decoded += ok;
+    e->fetched = true;
+    e->fetched_at = now;
+    // A failed refetch keeps the report we had.
+    if(ok)
+    {
+        e->metar = metar;
+        e->valid = true;
+    }
+}
+
+// First fetches for the most recently wanted airports, then refreshes of the stalest reports
+// something still wants.
+static entry_t *next_fetch(float now)
+{
+    entry_t *best = NULL;
+    for(int i = 0; i < CACHE_SIZE; ++i)
+    {
+        entry_t *e = &cache[i];
+        if(e->key && !e->fetched && (!best || e->wanted_at > best->wanted_at))
+            best = e;
+    }
+    if(best)
+        return best;
+    for(int i = 0; i < CACHE_SIZE; ++i)
+    {
+        entry_t *e = &cache[i];
+        if(!e->key || now - e->wanted_at > WANTED_S || now - e->fetched_at < MAX_AGE_S)
+            continue;
+        if(!best || e->fetched_at < best->fetched_at)
+            best = e;
+    }
+    return best;
+}
+
+static float metar_flight_loop(float since_call, float since_loop, int counter, void *refcon)
+{
+    (void)since_loop;
+    (void)counter;
+    (void)refcon;
+    tokens = fminf(tokens + since_call * FETCHES_PER_S, 1.f);
+    if(tokens < 1.f)
+        return -1.f;
+
+    float now = XPLMGetElapsedTime();
+    entry_t *e = next_fetch(now);
+    if(e)
+    {
+        PROF_SCOPE(fetch_probe);
+        fetch(e, now);
+        tokens -= 1.f;
+    }
+    return -1.f;
+}
+
+void metar_get_stats(metar_stats_t *out)
+{
+    memset(out, 0, sizeof(*out));
+    out->fetches = fetches;
+    out->decoded = decoded;
+    for(int i = 0; i < CACHE_SIZE; ++i)
+    {
+        out->cached += cache[i].key != 0;
+        out->queued += cache[i].key && !cache[i].fetched;
+    }
+}
+
+void metar_init(void)
+{
+    memset(cache, 0, sizeof(cache));
+    tokens = 0.f;
+    fetches = 0;
+    decoded = 0;
+    fetch_probe = profiler_probe("metar/fetch");
+
+    XPLMCreateFlightLoop_t fl = (XPLMCreateFlightLoop_t){
+        .structSize = sizeof(XPLMCreateFlightLoop_t),
+        .phase = xplm_FlightLoop_Phase_AfterFlightModel,
+        .callbackFunc = metar_flight_loop,
+        .refcon = NULL
+    };
+    flight_loop = XPLMCreateFlightLoop(&fl);
+    XPLMScheduleFlightLoop(flight_loop, -1.f, 1);
+}
+
+void metar_fini(void)
+{
+    if(flight_loop)
+        XPLMDestroyFlightLoop(flight_loop);
+    flight_loop = NULL;
+}
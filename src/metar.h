@@ -0,0 +1,62 @@
+/*===--------------------------------------------------------------------------------------------===
+ * metar.h
+ *
+ * Decoded METARs for airports, from XPLMGetMETARForAirport.
+ *
+ * That call isn't meant to be made every frame and returns raw text, so pages never make it
+ * themselves. metar_get() only reads a small LRU cache of decoded reports, keyed by identifier;
+ * asking for an airport that isn't cached (or whose report has gone stale) queues it, and a flight
+ * loop fetches and decodes queued reports a few a second. Decoding happens once per fetch, so the
+ * draw callbacks reading the cache never touch the text.
+ *
+ * Everything runs on the main thread.
+ *===--------------------------------------------------------------------------------------------===
+*/
+#ifndef _METAR_H_
+#define _METAR_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum {
+    METAR_CAT_UNKNOWN,
+    METAR_CAT_VFR,
+    METAR_CAT_MVFR,
+    METAR_CAT_IFR,
+    METAR_CAT_LIFR,
+} metar_cat_t;
+
+typedef struct {
+    char station[8];
+    int8_t day, hour, minute;   // Observation time, UTC. -1 if missing.
+    float wind_dir;             // Degrees true. NAN if variable or missing.
+    float wind_kts;             // NAN if missing.
+    float gust_kts;             // 0 without gusts.
+    float visibility_sm;        // NAN if missing. CAVOK and 9999 read as 10.
+    float ceiling_ft;           // Lowest broken, overcast or obscured layer, AGL. INFINITY if none.
+    float altimeter_inhg;       // NAN if missing. QNH is converted.
+    float temp_c, dewpoint_c;   // NAN if missing.
+    metar_cat_t category;
+} metar_t;
+
+typedef struct {
+    unsigned fetches;           // Calls to XPLMGetMETARForAirport since init.
+    unsigned decoded;           // Of which decoded.
+    unsigned cached;            // Entries in the cache.
+    unsigned queued;            // Entries waiting for a first fetch.
+} metar_stats_t;
+
+// Decodes a raw METAR without allocating. Returns false if it has no station, which is what the
+// SDK returns outside real-weather mode.
+bool metar_parse(const char *raw, metar_t *out);
+
+// The decoded report for `icao`, or NULL if there isn't one yet. Queues a fetch if the report
+// isn't cached or is getting old.
+const metar_t *metar_get(const char *icao);
+
+void metar_get_stats(metar_stats_t *out);
+
+void metar_init(void);
+void metar_fini(void);
+
+#endif /* ifndef _METAR_H_ */
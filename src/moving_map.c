@@ -0,0 +1,914 @@
+/*===--------------------------------------------------------------------------------------------===
+ * moving_map.c
+ *
+ * Tile-cached moving map: worker-built static tiles, composited under a live overlay.
+ *===--------------------------------------------------------------------------------------------===
+ */
+#include "moving_map.h"
+#include "SystemGL.h"
+#include "arena.h"
+#include "draw_sched.h"
+#include "fms_mirror.h"
+#include "geo.h"
+#include "geo_batch.h"
+#include "main_queue.h"
+#include "metar.h"
+#include "navdata.h"
+#include "ownship.h"
+#include "profiler.h"
+#include "raster.h"
+#include "symbols.h"
+#include "terrain.h"
+#include "vector.h"
+#include "weather.h"
+#include <XPLMDataAccess.h>
+#include <XPLMGraphics.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+void log_msg(const char *fmt, ...);
+
+#ifndef GL_CLAMP_TO_EDGE
+#define GL_CLAMP_TO_EDGE    (0x812F)
+#endif
+
+#define TILE_SIZE           (256)
+#define TILE_BYTES          (TILE_SIZE * TILE_SIZE * 4)
+#define TILE_MEMORY         (8 * 1024 * 1024)
+#define TILE_SLOTS          (TILE_MEMORY / TILE_BYTES)
+// Symbols and labels centred this far outside a tile can still reach into it.
+#define TILE_MARGIN         (48)
+// Tiles built ahead of time around the visible ones.
+#define TILE_PREFETCH       (1)
+#define STAGING_COUNT       (4)
+#define JOB_CAPACITY        (64)
+#define PROJECT_BATCH       (64)
+// Airports flagged with their METAR flight category, comfortably fewer than the METAR cache holds.
+#define METAR_FLAGS         (24)
+// TCAS targets. Index 0 is the user's aircraft.
+#define TRAFFIC_MAX         (64)
+#define PROXIMATE_NM        (6.f)
+#define PROXIMATE_FT        (1200.f)
+#define TREND_FPM           (500.f)
+
+// Mercator stretches distances by 1/cos(lat). Tiles are drawn at the scale of a latitude band,
+// quantized in steps of this ratio, so the displayed range is off by at most half a step and
+// tiles stay valid until the aircraft crosses into the next band.
+#define SCALE_BAND_RATIO    (1.02)
+#define MAX_LAT             (85.05113)
+
+static const float ranges_nm[] = {2.5f, 5.f, 10.f, 20.f, 40.f, 80.f, 160.f, 320.f};
+#define RANGE_COUNT         ((int)(sizeof(ranges_nm) / sizeof(ranges_nm[0])))
+#define DEFAULT_RANGE       (4)
+
+typedef struct {
+    const navdata_t *nd;
+    double scale;           // Pixels per Mercator nm.
+    int range;
+    map_style_t style;
+    int32_t tx, ty;
+} tile_key_t;
+
+typedef enum {
+    TILE_FREE,
+    TILE_PENDING,
+    TILE_READY,
+} tile_state_t;
+
+typedef struct {
+    tile_key_t key;
+    tile_state_t state;
+    atomic_uint gen;            // Bumped whenever the slot is given a new key.
+    atomic_uint failed_gen;     // Set by the worker when it couldn't deliver generation `gen`.
+    int texture;
+    bool texture_allocated;
+    uint64_t last_used;
+} tile_t;
+
+typedef struct {
+    tile_key_t key;
+    int slot;
+    unsigned gen;
+} job_t;
+
+typedef struct {
+    int slot;
+    unsigned gen;
+    int staging;
+} upload_t;
+
+static tile_t tiles[TILE_SLOTS];
+static uint64_t frame = 0;
+static int range = DEFAULT_RANGE;
+static map_style_t style = MAP_STYLE_ALL;
+static int sched_slot = -1;
+static vec_path_t rose = VEC_NO_PATH;
+static float rose_radius = 0.f;
+static unsigned evicted = 0;
+static unsigned generation = 1;     // Bumped whenever map_draw() would draw something else.
+
+static XPLMDataRef traffic_count_ref = NULL;
+static XPLMDataRef traffic_lat_ref = NULL;
+static XPLMDataRef traffic_lon_ref = NULL;
+static XPLMDataRef traffic_ele_ref = NULL;
+static XPLMDataRef traffic_vs_ref = NULL;
+
+// Shared with the worker, under `lock`.
+static pthread_mutex_t lock;
+static pthread_cond_t wake;
+static job_t jobs[JOB_CAPACITY];
+static int job_head = 0, job_count = 0;
+static uint8_t *staging[STAGING_COUNT];
+static bool staging_busy[STAGING_COUNT];
+static bool quit = false;
+
+static pthread_t worker;
+static bool worker_running = false;
+static atomic_uint built;
+static atomic_uint_fast64_t build_ns;
+
+static prof_probe_t composite_probe = PROF_NO_PROBE;
+static prof_probe_t build_probe = PROF_NO_PROBE;
+static prof_probe_t upload_probe = PROF_NO_PROBE;
+
+static bool key_equal(const tile_key_t *a, const tile_key_t *b)
+{
+    return a->nd == b->nd && a->scale == b->scale && a->range == b->range
+        && a->style == b->style && a->tx == b->tx && a->ty == b->ty;
+}
+
+/*
+ * Tile building, on the worker.
+ */
+
+typedef struct {
+    int types;
+    int label_types;
+} layers_t;
+
+static layers_t layers_for(map_style_t s, float range_nm)
+{
+    layers_t l = {xplm_Nav_Airport, range_nm <= 80.f ? xplm_Nav_Airport : 0};
+    if(s != MAP_STYLE_AIRPORTS)
+    {
+        l.types |= xplm_Nav_VOR;
+        if(range_nm <= 160.f)
+            l.types |= xplm_Nav_NDB | xplm_Nav_DME;
+        if(range_nm <= 80.f)
+            l.label_types |= xplm_Nav_VOR;
+        if(range_nm <= 40.f)
+            l.label_types |= xplm_Nav_NDB;
+    }
+    if(s == MAP_STYLE_ALL && range_nm <= 20.f)
+    {
+        l.types |= xplm_Nav_Fix;
+        if(range_nm <= 10.f)
+            l.label_types |= xplm_Nav_Fix;
+    }
+    return l;
+}
+
+static const raster_color_t color_airport = {0.35f, 0.8f, 1.f, 1.f};
+static const raster_color_t color_vor = {0.45f, 0.95f, 0.55f, 1.f};
+static const raster_color_t color_ndb = {1.f, 0.65f, 0.25f, 0.9f};
+static const raster_color_t color_fix = {0.75f, 0.75f, 0.8f, 0.8f};
+
+static void draw_symbol(raster_t *img, int type, float x, float y, const char *label, bool labelled)
+{
+    raster_color_t color = color_fix;
+    sym_id_t id;
+    switch(type) {
+    case xplm_Nav_Airport:
+        color = color_airport;
+        id = SYM_AIRPORT;
+        break;
+    case xplm_Nav_VOR:
+        color = color_vor;
+        id = SYM_VOR;
+        break;
+    case xplm_Nav_DME:
+        // Around a VOR this makes the usual VOR/DME box.
+        color = color_vor;
+        id = SYM_DME;
+        break;
+    case xplm_Nav_NDB:
+        color = color_ndb;
+        id = SYM_NDB;
+        break;
+    case xplm_Nav_Fix:
+        id = SYM_FIX;
+        break;
+    default:
+        return;
+    }
+    sym_raster(img, id, x, y, 1.f, color);
+    if(labelled)
+        raster_text(img, (int)(x + 8.f), (int)(y - 3.f), label, color);
+}
+
+static void build_tile(const tile_key_t *key, uint8_t *pixels)
+{
+    raster_t img = {TILE_SIZE, TILE_SIZE, pixels};
+    raster_clear(&img, (raster_color_t){0.f, 0.f, 0.f, 0.f});
+
+    const navdata_t *nd = key->nd;
+    layers_t layers = layers_for(key->style, ranges_nm[key->range]);
+    double nm_per_px = 1.0 / key->scale;
+
+    // Geographic bounds of the tile and its margin.
+    double lon_c = ((key->tx + 0.5) * TILE_SIZE * nm_per_px) / EARTH_RADIUS_NM * RAD2DEG;
+    double half_lon = ((TILE_SIZE / 2 + TILE_MARGIN) * nm_per_px) / EARTH_RADIUS_NM * RAD2DEG;
+    double y_lo = ((double)key->ty * TILE_SIZE - TILE_MARGIN) * nm_per_px / EARTH_RADIUS_NM;
+    double y_hi = ((double)(key->ty + 1) * TILE_SIZE + TILE_MARGIN) * nm_per_px / EARTH_RADIUS_NM;
+    double lat_lo = atan(sinh(y_lo)) * RAD2DEG, lat_hi = atan(sinh(y_hi)) * RAD2DEG;
+
+    int row_lo = (int)floor(lat_lo + 90.0), row_hi = (int)floor(lat_hi + 90.0);
+    int col_lo = (int)floor(lon_c - half_lon + 180.0);
+    int col_hi = (int)floor(lon_c + half_lon + 180.0);
+    if(row_lo < 0)
+        row_lo = 0;
+    if(row_hi > NAV_CELLS_LAT - 1)
+        row_hi = NAV_CELLS_LAT - 1;
+    if(col_hi - col_lo >= NAV_CELLS_LON)
+        col_hi = col_lo + NAV_CELLS_LON - 1;
+
+    float xs[PROJECT_BATCH], ys[PROJECT_BATCH];
+    float origin_y = (float)key->ty * TILE_SIZE;
+    float scale = (float)key->scale;
+    for(int row = row_lo; row <= row_hi; ++row)
+    {
+        for(int c = col_lo; c <= col_hi; ++c)
+        {
+            int col = ((c % NAV_CELLS_LON) + NAV_CELLS_LON) % NAV_CELLS_LON;
+            int cell = row * NAV_CELLS_LON + col;
+            uint32_t end = nd->cell_start[cell + 1];
+            for(uint32_t base = nd->cell_start[cell]; base < end; base += PROJECT_BATCH)
+            {
+                uint32_t n = end - base < PROJECT_BATCH ? end - base : PROJECT_BATCH;
+                geo_batch_project_mercator(0.0, lon_c, nd->lat + base, nd->lon + base, xs, ys, n);
+                for(uint32_t k = 0; k < n; ++k)
+                {
+                    int type = nd->type[base + k];
+                    if(!(type & layers.types))
+                        continue;
+                    float x = xs[k] * scale + TILE_SIZE / 2;
+                    float y = ys[k] * scale - origin_y;
+                    if(x < -TILE_MARGIN || x > TILE_SIZE + TILE_MARGIN
+                       || y < -TILE_MARGIN || y > TILE_SIZE + TILE_MARGIN)
+                        continue;
+                    draw_symbol(&img, type, x, y, navdata_id(nd, base + k),
+                                (type & layers.label_types) != 0);
+                }
+            }
+        }
+    }
+}
+
+static void release_staging(int index)
+{
+    pthread_mutex_lock(&lock);
+    staging_busy[index] = false;
+    pthread_cond_signal(&wake);
+    pthread_mutex_unlock(&lock);
+}
+
+// Main thread, from the main queue: the staging buffer becomes the tile's texture.
+static void upload_tile(void *payload)
+{
+    const upload_t *up = payload;
+    tile_t *tile = &tiles[up->slot];
+    if(atomic_load(&tile->gen) == up->gen && tile->state == TILE_PENDING)
+    {
+        PROF_SCOPE(upload_probe);
+        if(!tile->texture)
+            XPLMGenerateTextureNumbers(&tile->texture, 1);
+        XPLMBindTexture2d(tile->texture, 0);
+        if(!tile->texture_allocated)
+        {
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, TILE_SIZE, TILE_SIZE, 0, GL_RGBA,
+                         GL_UNSIGNED_BYTE, staging[up->staging]);
+            tile->texture_allocated = true;
+        }
+        else
+        {
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, TILE_SIZE, TILE_SIZE, GL_RGBA, GL_UNSIGNED_BYTE,
+                            staging[up->staging]);
+        }
+        tile->state = TILE_READY;
+        generation += 1;
+        draw_sched_invalidate(sched_slot);
+    }
+    release_staging(up->staging);
+}
+
+static void *worker_main(void *arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&lock);
+    for(;;)
+    {
+        int buffer = -1;
+        for(int i = 0; i < STAGING_COUNT && buffer < 0; ++i)
+        {
+            if(!staging_busy[i])
+                buffer = i;
+        }
+        if(quit)
+            break;
+        if(!job_count || buffer < 0)
+        {
+            pthread_cond_wait(&wake, &lock);
+            continue;
+        }
+
+        job_t job = jobs[job_head];
+        job_head = (job_head + 1) % JOB_CAPACITY;
+        job_count -= 1;
+        staging_busy[buffer] = true;
+        pthread_mutex_unlock(&lock);
+
+        tile_t *tile = &tiles[job.slot];
+        bool delivered = false;
+        if(atomic_load(&tile->gen) == job.gen)
+        {
+            PROF_SCOPE(build_probe);
+            uint64_t start = clock_now_ns();
+            build_tile(&job.key, staging[buffer]);
+            atomic_fetch_add(&build_ns, clock_now_ns() - start);
+            atomic_fetch_add(&built, 1);
+
+            upload_t up = {job.slot, job.gen, buffer};
+            delivered = main_queue_post(upload_tile, &up, sizeof(up));
+            if(!delivered)
+                atomic_store(&tile->failed_gen, job.gen);
+        }
+
+        pthread_mutex_lock(&lock);
+        if(!delivered)
+            staging_busy[buffer] = false;
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+/*
+ * Cache and compositing, on the main thread.
+ */
+
+static bool push_job(const job_t *job)
+{
+    pthread_mutex_lock(&lock);
+    bool ok = job_count < JOB_CAPACITY;
+    if(ok)
+    {
+        jobs[(job_head + job_count) % JOB_CAPACITY] = *job;
+        job_count += 1;
+        pthread_cond_signal(&wake);
+    }
+    pthread_mutex_unlock(&lock);
+    return ok;
+}
+
+// Finds the tile for `key`, or starts building it. Returns NULL if it isn't ready yet.
+static tile_t *request_tile(const tile_key_t *key)
+{
+    int victim = -1;
+    for(int i = 0; i < TILE_SLOTS; ++i)
+    {
+        tile_t *tile = &tiles[i];
+        if(tile->state != TILE_FREE && key_equal(&tile->key, key))
+        {
+            tile->last_used = frame;
+            if(tile->state == TILE_PENDING
+               && atomic_load(&tile->failed_gen) == atomic_load(&tile->gen))
+            {
+                // The worker couldn't hand it over; try again.
+                job_t job = {*key, i, atomic_load(&tile->gen)};
+                atomic_store(&tile->failed_gen, 0);
+                if(!push_job(&job))
+                    tile->state = TILE_FREE;
+            }
+            return tile->state == TILE_READY ? tile : NULL;
+        }
+        // Least recently used, never one that's wanted this frame. Free slots come first.
+        if(tile->last_used == frame)
+            continue;
+        const tile_t *best = victim < 0 ? NULL : &tiles[victim];
+        if(!best || (best->state != TILE_FREE
+                     && (tile->state == TILE_FREE || tile->last_used < best->last_used)))
+            victim = i;
+    }
+    if(victim < 0)
+        return NULL;
+
+    tile_t *tile = &tiles[victim];
+    if(tile->state != TILE_FREE)
+        evicted += 1;
+    tile->key = *key;
+    tile->state = TILE_PENDING;
+    tile->last_used = frame;
+    unsigned gen = atomic_fetch_add(&tile->gen, 1) + 1;
+    // Generation 0 is never handed out, so a zeroed failed_gen means nothing failed.
+    if(gen == 0)
+        gen = atomic_fetch_add(&tile->gen, 1) + 1;
+    job_t job = {*key, victim, gen};
+    if(!push_job(&job))
+        tile->state = TILE_FREE;
+    return NULL;
+}
+
+static void draw_tile(const tile_t *tile, float x, float y)
+{
+    XPLMBindTexture2d(tile->texture, 0);
+    glBegin(GL_QUADS);
+    glTexCoord2f(0.f, 0.f);
+    glVertex2f(x, y);
+    glTexCoord2f(0.f, 1.f);
+    glVertex2f(x, y + TILE_SIZE);
+    glTexCoord2f(1.f, 1.f);
+    glVertex2f(x + TILE_SIZE, y + TILE_SIZE);
+    glTexCoord2f(1.f, 0.f);
+    glVertex2f(x + TILE_SIZE, y);
+    glEnd();
+}
+
+typedef struct {
+    double scale;               // Pixels per Mercator nm.
+    double px_per_nm;           // Pixels per real nm at ownship.
+    double own_x, own_y;        // Ownship on the Mercator plane, in pixels.
+    double view_x, view_y;      // Plane position of the screen centre, snapped to whole pixels.
+    double own_lon;
+    float cx, cy;               // Screen centre.
+} view_t;
+
+// The projection of the last map_draw(), for map_to_screen().
+static view_t last_view;
+static int last_width = 0, last_height = 0;     // 0 until the first map_draw().
+static float last_course = 0.f;
+
+static view_t make_view(const ownship_t *own, int width, int height)
+{
+    view_t v;
+    double lat = fmax(fmin(own->lat, MAX_LAT), -MAX_LAT);
+    double cos_lat = cos(lat * DEG2RAD);
+    long band = lround(-log(cos_lat) / log(SCALE_BAND_RATIO));
+    double px_per_nm = (height * 0.5) / ranges_nm[range];
+    v.scale = px_per_nm * pow(SCALE_BAND_RATIO, (double)-band);
+    v.px_per_nm = v.scale / cos_lat;
+    v.own_x = geo_wrap_lon(own->lon) * DEG2RAD * EARTH_RADIUS_NM * v.scale;
+    v.own_y = atanh(sin(lat * DEG2RAD)) * EARTH_RADIUS_NM * v.scale;
+    v.view_x = floor(v.own_x + 0.5);
+    v.view_y = floor(v.own_y + 0.5);
+    v.own_lon = own->lon;
+    v.cx = (float)(width / 2);
+    v.cy = (float)(height / 2);
+    return v;
+}
+
+static void composite_tiles(const view_t *v, const navdata_t *nd, int width, int height)
+{
+    tile_key_t key = {nd, v->scale, range, style, 0, 0};
+    int tx_lo = (int)floor((v->view_x - v->cx) / TILE_SIZE);
+    int tx_hi = (int)floor((v->view_x - v->cx + width - 1) / TILE_SIZE);
+    int ty_lo = (int)floor((v->view_y - v->cy) / TILE_SIZE);
+    int ty_hi = (int)floor((v->view_y - v->cy + height - 1) / TILE_SIZE);
+
+    // Tiles are premultiplied.
+    XPLMSetGraphicsState(0, 1, 0, 0, 1, 0, 0);
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    glColor4f(1.f, 1.f, 1.f, 1.f);
+    for(key.ty = ty_lo; key.ty <= ty_hi; ++key.ty)
+    {
+        for(key.tx = tx_lo; key.tx <= tx_hi; ++key.tx)
+        {
+            const tile_t *tile = request_tile(&key);
+            if(tile)
+                draw_tile(tile, (float)(v->cx + key.tx * TILE_SIZE - v->view_x),
+                          (float)(v->cy + key.ty * TILE_SIZE - v->view_y));
+        }
+    }
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    // Then the ring around them, so panning doesn't show empty tiles.
+    for(key.ty = ty_lo - TILE_PREFETCH; key.ty <= ty_hi + TILE_PREFETCH; ++key.ty)
+    {
+        for(key.tx = tx_lo - TILE_PREFETCH; key.tx <= tx_hi + TILE_PREFETCH; ++key.tx)
+        {
+            if(key.tx < tx_lo || key.tx > tx_hi || key.ty < ty_lo || key.ty > ty_hi)
+                request_tile(&key);
+        }
+    }
+}
+
+// Flight plan legs as great circles, the active one in magenta.
+static void draw_route(const view_t *v, const ownship_t *own)
+{
+    const fms_plan_t *plan = fms_mirror_plan(xplm_Fpl_Pilot_Primary);
+    if(!plan || plan->count < 2)
+        return;
+
+    // Enough segments per leg that a curve never strays a pixel from the true great circle.
+    float seg_nm = ranges_nm[range] / 8.f;
+    int points = 0;
+    int steps[FMS_MAX_ENTRIES];
+    for(int i = 1; i < plan->count; ++i)
+    {
+        int n = (int)(plan->entries[i].leg_nm / seg_nm) + 1;
+        steps[i] = n > 32 ? 32 : n;
+        points += steps[i] + 1;
+    }
+
+    arena_t *arena = frame_arena();
+    float *t = ARENA_NEW_ARRAY(arena, float, 33);
+    float *lat = ARENA_NEW_ARRAY(arena, float, points);
+    float *lon = ARENA_NEW_ARRAY(arena, float, points);
+    float *x = ARENA_NEW_ARRAY(arena, float, points);
+    float *y = ARENA_NEW_ARRAY(arena, float, points);
+    if(!t || !lat || !lon || !x || !y)
+        return;
+
+    int at = 0;
+    for(int i = 1; i < plan->count; ++i)
+    {
+        const fms_entry_t *from = &plan->entries[i - 1], *to = &plan->entries[i];
+        for(int k = 0; k <= steps[i]; ++k)
+            t[k] = (float)k / (float)steps[i];
+        geo_batch_interpolate(from->lat, from->lon, to->lat, to->lon, t, lat + at, lon + at,
+                              (size_t)steps[i] + 1);
+        at += steps[i] + 1;
+    }
+    geo_batch_project_mercator(0.0, own->lon, lat, lon, x, y, (size_t)points);
+
+    float dx = (float)(v->cx + v->own_x - v->view_x), dy = (float)(v->cy - v->view_y);
+    float scale = (float)v->scale;
+    for(int k = 0; k < points; ++k)
+    {
+        x[k] = x[k] * scale + dx;
+        y[k] = y[k] * scale + dy;
+    }
+
+    static const float magenta[4] = {1.f, 0.f, 1.f, 1.f}, white_line[4] = {1.f, 1.f, 1.f, 1.f};
+    float *xy = ARENA_NEW_ARRAY(arena, float, 2 * points);
+    if(!xy)
+        return;
+    for(int k = 0; k < points; ++k)
+    {
+        xy[2 * k] = x[k];
+        xy[2 * k + 1] = y[k];
+    }
+    at = 0;
+    for(int i = 1; i < plan->count; ++i)
+    {
+        vec_polyline(xy + 2 * at, steps[i] + 1, false, 2.f,
+                     i == plan->displayed ? magenta : white_line);
+        at += steps[i] + 1;
+    }
+    // Labels go on top.
+    vec_flush();
+
+    float white[3] = {1.f, 1.f, 1.f};
+    at = 0;
+    for(int i = 0; i < plan->count; ++i)
+    {
+        // Each entry is the first point of its outbound leg, or the last point of the route.
+        int k = i + 1 < plan->count ? at : at - 1;
+        if(i + 1 < plan->count)
+            at += steps[i + 1] + 1;
+        if(x[k] < 0.f || x[k] > 2.f * v->cx || y[k] < 0.f || y[k] > 2.f * v->cy)
+            continue;
+        XPLMDrawString(white, (int)x[k] + 6, (int)y[k] - 4, (char *)plan->entries[i].id, NULL,
+                       xplmFont_Basic);
+        sym_add(SYM_WAYPOINT, x[k], y[k], 0.f, 1.f, i == plan->displayed ? magenta : white_line);
+    }
+    sym_flush();
+}
+
+// TCAS traffic: a hollow diamond, filled when proximate, with an arrow when climbing or
+// descending.
+static void draw_traffic(const view_t *v, const ownship_t *own)
+{
+    static const float cyan[4] = {0.f, 1.f, 1.f, 1.f}, white[4] = {1.f, 1.f, 1.f, 1.f};
+    if(!traffic_count_ref || !traffic_lat_ref || !traffic_lon_ref || !traffic_ele_ref)
+        return;
+    int count = XPLMGetDatai(traffic_count_ref);
+    count = count > TRAFFIC_MAX ? TRAFFIC_MAX : count;
+    if(count < 2)
+        return;
+
+    float lat[TRAFFIC_MAX], lon[TRAFFIC_MAX], ele[TRAFFIC_MAX], vs[TRAFFIC_MAX];
+    XPLMGetDatavf(traffic_lat_ref, lat, 0, count);
+    XPLMGetDatavf(traffic_lon_ref, lon, 0, count);
+    XPLMGetDatavf(traffic_ele_ref, ele, 0, count);
+    if(!traffic_vs_ref || XPLMGetDatavf(traffic_vs_ref, vs, 0, count) < count)
+        memset(vs, 0, sizeof(vs));
+
+    for(int i = 1; i < count; ++i)
+    {
+        float x, y;
+        map_to_screen(lat[i], lon[i], &x, &y);
+        if(x < -8.f || x > 2.f * v->cx + 8.f || y < -8.f || y > 2.f * v->cy + 8.f)
+            continue;
+        float dist_nm = (float)geo_distance_nm(own->lat, own->lon, lat[i], lon[i]);
+        float rel_ft = (ele[i] - (float)own->elev_m) * (float)M_TO_FT;
+        bool near = dist_nm < PROXIMATE_NM && fabsf(rel_ft) < PROXIMATE_FT;
+        sym_add(near ? SYM_TRAFFIC_NEAR : SYM_TRAFFIC, x, y, 0.f, 1.f, near ? white : cyan);
+        if(vs[i] > TREND_FPM)
+            sym_add(SYM_ARROW_UP, x + 11.f, y, 0.f, 1.f, near ? white : cyan);
+        else if(vs[i] < -TREND_FPM)
+            sym_add(SYM_ARROW_DOWN, x + 11.f, y, 0.f, 1.f, near ? white : cyan);
+    }
+    sym_flush();
+}
+
+// A ring in the flight category's colour around the nearest airports with a METAR. Asking for
+// them is also what gets them fetched.
+static void draw_metar_flags(const view_t *v, const navdata_t *nd, const ownship_t *own)
+{
+    static const float colors[][3] = {
+        [METAR_CAT_VFR] = {0.f, 0.8f, 0.f},
+        [METAR_CAT_MVFR] = {0.2f, 0.4f, 1.f},
+        [METAR_CAT_IFR] = {1.f, 0.f, 0.f},
+        [METAR_CAT_LIFR] = {1.f, 0.f, 1.f},
+    };
+    nav_hit_t hits[METAR_FLAGS];
+    int count = navdata_nearest(nd, own->lat, own->lon, xplm_Nav_Airport, METAR_FLAGS,
+                                ranges_nm[range] * 1.5f, hits);
+
+    for(int i = 0; i < count; ++i)
+    {
+        const metar_t *metar = metar_get(navdata_id(nd, hits[i].index));
+        if(!metar || metar->category == METAR_CAT_UNKNOWN)
+            continue;
+        float x, y;
+        map_to_screen(nd->lat[hits[i].index], nd->lon[hits[i].index], &x, &y);
+        if(x < 0.f || x > 2.f * v->cx || y < 0.f || y > 2.f * v->cy)
+            continue;
+        const float *rgb = colors[metar->category];
+        vec_circle(x, y, 9.f, 2.f, (const float[4]){rgb[0], rgb[1], rgb[2], 1.f});
+    }
+    vec_flush();
+}
+
+// The range ring, with ticks every 10 degrees. Kept as a vector path, rebuilt only when its
+// radius changes.
+static void draw_rose(float x, float y, float radius)
+{
+    static const float grey[4] = {0.7f, 0.7f, 0.7f, 0.8f};
+    if(rose == VEC_NO_PATH || fabsf(radius - rose_radius) >= 0.5f)
+    {
+        vec_path_free(rose);
+        vec_path_begin();
+        vec_circle(0.f, 0.f, radius, 1.5f, grey);
+        for(int deg = 0; deg < 360; deg += 10)
+        {
+            float s = sinf((float)deg * (float)DEG2RAD), c = cosf((float)deg * (float)DEG2RAD);
+            float inner = radius - (deg % 30 ? 5.f : 10.f);
+            vec_line(inner * s, inner * c, radius * s, radius * c, 1.5f, grey);
+        }
+        rose = vec_path_end();
+        rose_radius = radius;
+    }
+    vec_path_draw(rose, x, y, 0.f);
+    vec_flush();
+}
+
+// What the ownship symbol points at: track once it's moving, heading before.
+static float own_course(const ownship_t *own)
+{
+    return own->groundspeed_kts >= 30.f ? own->track : own->heading;
+}
+
+static void draw_ownship(const view_t *v, const ownship_t *own)
+{
+    float x = (float)(v->cx + v->own_x - v->view_x), y = (float)(v->cy + v->own_y - v->view_y);
+
+    float ring = (float)(v->px_per_nm * ranges_nm[range] * 0.5);
+    draw_rose(x, y, ring);
+    XPLMSetGraphicsState(0, 0, 0, 0, 1, 0, 0);
+
+    float crs = own_course(own) * (float)DEG2RAD;
+    float s = sinf(crs), c = cosf(crs);
+    // Nose, then the two wing tips, rotated from north-up.
+    const float shape[3][2] = {{0.f, 10.f}, {-6.f, -6.f}, {6.f, -6.f}};
+    glColor4f(1.f, 1.f, 1.f, 1.f);
+    glBegin(GL_TRIANGLES);
+    for(int i = 0; i < 3; ++i)
+        glVertex2f(x + shape[i][0] * c + shape[i][1] * s, y - shape[i][0] * s + shape[i][1] * c);
+    glEnd();
+
+    float grey[3] = {0.7f, 0.7f, 0.7f};
+    char *text = arena_printf(frame_arena(), "%g", ranges_nm[range] * 0.5f);
+    XPLMDrawString(grey, (int)x + 3, (int)(y + ring) + 3, text, NULL, xplmFont_Basic);
+}
+
+void map_draw(int width, int height)
+{
+    PROF_SCOPE(composite_probe);
+    const ownship_t *own = ownship_get();
+    if(!own->valid)
+        return;
+    frame += 1;
+
+    view_t v = make_view(own, width, height);
+    last_view = v;
+    last_width = width;
+    last_height = height;
+    last_course = own_course(own);
+    terrain_draw();
+    weather_draw();
+    const navdata_t *nd = navdata_get();
+    if(nd && worker_running)
+        composite_tiles(&v, nd, width, height);
+    if(nd)
+        draw_metar_flags(&v, nd, own);
+    draw_route(&v, own);
+    draw_traffic(&v, own);
+    draw_ownship(&v, own);
+}
+
+void map_to_screen(double lat, double lon, float *x, float *y)
+{
+    const view_t *v = &last_view;
+    lat = fmax(fmin(lat, MAX_LAT), -MAX_LAT);
+    double dx = geo_wrap_lon(lon - v->own_lon) * DEG2RAD * EARTH_RADIUS_NM * v->scale;
+    double py = atanh(sin(lat * DEG2RAD)) * EARTH_RADIUS_NM * v->scale;
+    *x = (float)(v->cx + v->own_x - v->view_x + dx);
+    *y = (float)(v->cy + py - v->view_y);
+}
+
+unsigned map_generation(void)
+{
+    const ownship_t *own = ownship_get();
+    if(!last_width || !own->valid)
+        return generation;
+
+    // Half a pixel of movement or a degree of turn shows; less doesn't.
+    view_t v = make_view(own, last_width, last_height);
+    float turn = fabsf(own_course(own) - last_course);
+    if(v.scale != last_view.scale || fabs(v.own_x - last_view.own_x) >= 0.5
+       || fabs(v.own_y - last_view.own_y) >= 0.5 || fminf(turn, 360.f - turn) >= 1.f)
+    {
+        generation += 1;
+    }
+    // Traffic moves on its own whenever there is any (the first target is ownship).
+    else if(traffic_count_ref && XPLMGetDatai(traffic_count_ref) >= 2)
+    {
+        generation += 1;
+    }
+    return generation;
+}
+
+void map_invalidate(void)
+{
+    generation += 1;
+    draw_sched_invalidate(sched_slot);
+}
+
+void map_zoom(int steps)
+{
+    int next = range + steps;
+    range = next < 0 ? 0 : (next >= RANGE_COUNT ? RANGE_COUNT - 1 : next);
+    generation += 1;
+    draw_sched_invalidate(sched_slot);
+}
+
+float map_range_nm(void)
+{
+    return ranges_nm[range];
+}
+
+void map_set_style(map_style_t s)
+{
+    if(s < 0 || s >= MAP_STYLE_COUNT)
+        return;
+    style = s;
+    generation += 1;
+    draw_sched_invalidate(sched_slot);
+}
+
+map_style_t map_style(void)
+{
+    return style;
+}
+
+void map_get_stats(map_stats_t *out)
+{
+    memset(out, 0, sizeof(*out));
+    for(int i = 0; i < TILE_SLOTS; ++i)
+    {
+        if(tiles[i].state == TILE_READY)
+            out->resident += 1;
+        else if(tiles[i].state == TILE_PENDING)
+            out->pending += 1;
+    }
+    out->built = atomic_load(&built);
+    out->evicted = evicted;
+    out->build_ms = out->built ? (float)(atomic_load(&build_ns) / out->built) / 1e6f : 0.f;
+}
+
+void map_init(int slot)
+{
+    sched_slot = slot;
+    frame = 0;
+    range = DEFAULT_RANGE;
+    style = MAP_STYLE_ALL;
+    evicted = 0;
+    generation = 1;
+    last_width = last_height = 0;
+    atomic_store(&built, 0);
+    atomic_store(&build_ns, 0);
+    for(int i = 0; i < TILE_SLOTS; ++i)
+    {
+        tiles[i].state = TILE_FREE;
+        tiles[i].texture = 0;
+        tiles[i].texture_allocated = false;
+        tiles[i].last_used = 0;
+        atomic_store(&tiles[i].gen, 0);
+        atomic_store(&tiles[i].failed_gen, 0);
+    }
+    composite_probe = profiler_probe("map/composite");
+    build_probe = profiler_probe("map/tile build");
+    upload_probe = profiler_probe("map/tile upload");
+
+    traffic_count_ref = XPLMFindDataRef("sim/cockpit2/tcas/indicators/tcas_num_acf");
+    traffic_lat_ref = XPLMFindDataRef("sim/cockpit2/tcas/targets/position/lat");
+    traffic_lon_ref = XPLMFindDataRef("sim/cockpit2/tcas/targets/position/lon");
+    traffic_ele_ref = XPLMFindDataRef("sim/cockpit2/tcas/targets/position/ele");
+    traffic_vs_ref = XPLMFindDataRef("sim/cockpit2/tcas/targets/position/vertical_speed");
+
+    // The lock goes first: release_staging() and push_job() take it whether or not the worker
+    // made it.
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&wake, NULL);
+    job_head = job_count = 0;
+    quit = false;
+    worker_running = false;
+
+    // Staging buffers are allocated once, up front, so neither thread allocates while drawing.
+    for(int i = 0; i < STAGING_COUNT; ++i)
+    {
+        staging[i] = malloc(TILE_BYTES);
+        staging_busy[i] = false;
+        if(!staging[i])
+        {
+            log_msg("moving map: cannot allocate tile staging buffers, tiles are disabled");
+            goto fail;
+        }
+    }
+
+    worker_running = pthread_create(&worker, NULL, worker_main, NULL) == 0;
+    if(worker_running)
+        return;
+    log_msg("moving map: cannot start the tile worker, tiles are disabled");
+
+fail:
+    for(int i = 0; i < STAGING_COUNT; ++i)
+    {
+        free(staging[i]);
+        staging[i] = NULL;
+    }
+}
+
+void map_fini(void)
+{
+    if(worker_running)
+    {
+        pthread_mutex_lock(&lock);
+        quit = true;
+        pthread_cond_broadcast(&wake);
+        pthread_mutex_unlock(&lock);
+        pthread_join(worker, NULL);
+        worker_running = false;
+
+        // Uploads already posted refer to the staging buffers.
+        main_queue_flush();
+    }
+    pthread_cond_destroy(&wake);
+    pthread_mutex_destroy(&lock);
+
+    for(int i = 0; i < TILE_SLOTS; ++i)
+    {
+        if(tiles[i].texture)
+        {
+            GLuint texture = (GLuint)tiles[i].texture;
+            glDeleteTextures(1, &texture);
+        }
+        tiles[i].texture = 0;
+        tiles[i].texture_allocated = false;
+        tiles[i].state = TILE_FREE;
+    }
+    vec_path_free(rose);
+    rose = VEC_NO_PATH;
+    for(int i = 0; i < STAGING_COUNT; ++i)
+    {
+        free(staging[i]);
+        staging[i] = NULL;
+    }
+}
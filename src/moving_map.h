@@ -0,0 +1,64 @@
+/*===--------------------------------------------------------------------------------------------===
+ * moving_map.h
+ *
+ * North-up moving map for the custom device: navaids and airports around ownship, with the
+ * pilot's flight plan on top.
+ *
+ * Redrawing thousands of symbols and labels every frame is far too slow, so the static content
+ * is pre-rendered into square tiles on a worker thread (with raster.h) and uploaded as textures.
+ * Tiles live on a Mercator plane and are keyed by range, style, latitude scale band and tile
+ * cell, so they stay valid as the aircraft moves: each frame only composites the few tiles in
+ * view. The texture cache is LRU with a fixed memory cap, and the tiles just outside the screen
+ * are built ahead of time. What changes every frame (ownship, route, range ring) is drawn
+ * directly on top.
+ *
+ * Everything except the worker runs on the main thread.
+ *===--------------------------------------------------------------------------------------------===
+*/
+#ifndef _MOVING_MAP_H_
+#define _MOVING_MAP_H_
+
+typedef enum {
+    MAP_STYLE_ALL,          // Airports, VORs, NDBs, DMEs, and fixes at short range.
+    MAP_STYLE_NAVAIDS,      // Airports, VORs, NDBs and DMEs.
+    MAP_STYLE_AIRPORTS,
+    MAP_STYLE_COUNT
+} map_style_t;
+
+typedef struct {
+    int resident;           // Tiles with an up-to-date texture.
+    int pending;            // Tiles queued or being built.
+    unsigned built;         // Tiles built since init.
+    unsigned evicted;
+    float build_ms;         // Smoothed worker time per tile.
+} map_stats_t;
+
+// Draws the map over the whole screen, ownship in the centre. Call from the device's draw
+// callback.
+void map_draw(int width, int height);
+
+// Screen position of a point in the projection of the last map_draw(). Longitudes are taken
+// relative to ownship, so points across the antimeridian land next to it.
+void map_to_screen(double lat, double lon, float *x, float *y);
+
+// Changes whenever map_draw() would draw something different from last time: ownship moved or
+// turned enough to show, traffic, tiles arriving, range, style, map_invalidate(). For hosts that
+// cache what the map drew. Cheap enough to poll every frame.
+unsigned map_generation(void);
+
+// Asks for a redraw, for layers drawn under the map that changed on their own.
+void map_invalidate(void);
+
+// Range is the distance from ownship to the top of the screen. `steps` > 0 zooms out.
+void map_zoom(int steps);
+float map_range_nm(void);
+void map_set_style(map_style_t style);
+map_style_t map_style(void);
+
+void map_get_stats(map_stats_t *out);
+
+// `sched_slot` is the draw_sched slot of the device hosting the map, redrawn as tiles arrive.
+void map_init(int sched_slot);
+void map_fini(void);
+
+#endif /* ifndef _MOVING_MAP_H_ */
@@ -0,0 +1,440 @@
+/*===--------------------------------------------------------------------------------------------===
+ * navcache.c
+ *
+ * Versioned, memory-mapped navdata cache.
+ *===--------------------------------------------------------------------------------------------===
+ */
+#include "navcache.h"
+#include <XPLMNavigation.h>
+#include <XPLMUtilities.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#if IBM
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+void log_msg(const char *fmt, ...);
+
+#define NAVCACHE_MAGIC      "XPAVNAV\0"
+#define NAVCACHE_FORMAT     (3)
+// The header is padded so the block that follows keeps the alignment navdata.c gave its arrays.
+#define NAVCACHE_HEADER     (256)
+// Navaids checked against the sim when a cache is loaded.
+#define NAVCACHE_SPOT_CHECKS (16)
+
+#define FNV64_OFFSET        (14695981039346656037ull)
+#define FNV64_PRIME         (1099511628211ull)
+
+typedef enum {
+    ARR_LAT,
+    ARR_LON,
+    ARR_ELEV,
+    ARR_FREQ,
+    ARR_REF,
+    ARR_ID,
+    ARR_TYPE,
+    ARR_STRINGS,
+    ARR_CELLS,
+    ARR_BY_ID,
+    ARR_ID_START,
+    ARR_COUNT
+} nav_array_t;
+
+typedef struct {
+    char magic[8];
+    uint32_t format;
+    uint32_t header_size;
+    navcache_key_t key;
+    uint32_t count;
+    uint32_t strings_size;
+    uint64_t block_size;
+    uint64_t offsets[ARR_COUNT];    // From the start of the block.
+} navcache_header_t;
+
+_Static_assert(sizeof(navcache_header_t) <= NAVCACHE_HEADER, "navcache header too large");
+
+static void nav_file_path(char *out, size_t size, const char *dir)
+{
+    char root[512];
+    const char *sep = XPLMGetDirectorySeparator();
+    XPLMGetSystemPath(root);
+    snprintf(out, size, "%s%s%searth_nav.dat", root, dir, sep);
+}
+
+// The cycle is on the second line of earth_nav.dat: "1200 Version - data cycle 2310, build ...".
+static int32_t read_cycle(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if(!f)
+        return 0;
+    char head[512];
+    size_t len = fread(head, 1, sizeof(head) - 1, f);
+    fclose(f);
+    head[len] = '\0';
+
+    const char *cycle = strstr(head, "data cycle ");
+    return cycle ? (int32_t)atoi(cycle + strlen("data cycle ")) : 0;
+}
+
+static uint64_t hash_bytes(uint64_t h, const void *data, size_t size)
+{
+    const uint8_t *p = data;
+    for(size_t i = 0; i < size; ++i)
+        h = (h ^ p[i]) * FNV64_PRIME;
+    return h;
+}
+
+// Folds in a file's path, size and modification time; a missing file counts too.
+static uint64_t hash_file(uint64_t h, const char *path)
+{
+    struct stat st;
+    int64_t stamp[2] = {-1, -1};
+    if(stat(path, &st) == 0)
+    {
+        stamp[0] = (int64_t)st.st_size;
+        stamp[1] = (int64_t)st.st_mtime;
+    }
+    h = hash_bytes(h, path, strlen(path));
+    return hash_bytes(h, stamp, sizeof(stamp));
+}
+
+// Airports, and the XPLMNavRefs after them, come from the global apt.dat and every enabled custom
+// scenery pack's, in scenery_packs.ini order.
+static uint64_t scenery_hash(void)
+{
+    char root[512], path[1024];
+    const char *sep = XPLMGetDirectorySeparator();
+    XPLMGetSystemPath(root);
+
+    uint64_t h = FNV64_OFFSET;
+    snprintf(path, sizeof(path), "%sGlobal Scenery%sGlobal Airports%sEarth nav data%sapt.dat",
+             root, sep, sep, sep);
+    h = hash_file(h, path);
+    snprintf(path, sizeof(path), "%sCustom Scenery%sscenery_packs.ini", root, sep);
+    h = hash_file(h, path);
+
+    FILE *f = fopen(path, "rb");
+    if(!f)
+        return h;
+    char line[768];
+    while(fgets(line, sizeof(line), f))
+    {
+        static const char prefix[] = "SCENERY_PACK ";
+        if(strncmp(line, prefix, sizeof(prefix) - 1))
+            continue;
+        char *pack = line + sizeof(prefix) - 1;
+        pack[strcspn(pack, "\r\n")] = '\0';
+        // "*GLOBAL_AIRPORTS*" and the like stand for the global scenery, already counted.
+        if(!pack[0] || pack[0] == '*')
+            continue;
+        // Pack paths are relative to the X-Plane folder, unless they're absolute.
+        bool absolute = pack[0] == '/' || pack[0] == '\\' || (pack[0] && pack[1] == ':');
+        int len = snprintf(path, sizeof(path), "%s%sEarth nav data%sapt.dat",
+                           absolute ? "" : root, pack, sep);
+        // scenery_packs.ini itself is in the key, so a pack we can't stat still counts once.
+        if(len < 0 || (size_t)len >= sizeof(path))
+        {
+            log_msg("navcache: scenery pack path too long, not checked: %s", pack);
+            continue;
+        }
+        h = hash_file(h, path);
+    }
+    fclose(f);
+    return h;
+}
+
+void navcache_key(navcache_key_t *key)
+{
+    memset(key, 0, sizeof(*key));
+    XPLMGetVersions(&key->xp_version, &key->xplm_version, NULL);
+    key->scenery_hash = scenery_hash();
+
+    // Custom Data overrides the default navdata when it's there, same as in the sim.
+    char path[1024];
+    struct stat st;
+    nav_file_path(path, sizeof(path), "Custom Data");
+    if(stat(path, &st) != 0)
+    {
+        char dir[64];
+        snprintf(dir, sizeof(dir), "Resources%sdefault data", XPLMGetDirectorySeparator());
+        nav_file_path(path, sizeof(path), dir);
+        if(stat(path, &st) != 0)
+            return;
+    }
+    key->airac_cycle = read_cycle(path);
+    key->nav_file_size = (int64_t)st.st_size;
+    key->nav_file_mtime = (int64_t)st.st_mtime;
+}
+
+void navcache_path(char *out, size_t size)
+{
+    char root[512];
+    XPLMGetSystemPath(root);
+    snprintf(out, size, "%sOutput%savionics_navdata.bin", root, XPLMGetDirectorySeparator());
+}
+
+static bool key_equal(const navcache_key_t *a, const navcache_key_t *b)
+{
+    return a->xp_version == b->xp_version
+        && a->xplm_version == b->xplm_version
+        && a->airac_cycle == b->airac_cycle
+        && a->nav_file_size == b->nav_file_size
+        && a->nav_file_mtime == b->nav_file_mtime
+        && a->scenery_hash == b->scenery_hash;
+}
+
+static void *map_file(const char *path, size_t *size)
+{
+#if IBM
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, NULL);
+    if(file == INVALID_HANDLE_VALUE)
+        return NULL;
+    LARGE_INTEGER file_size;
+    if(!GetFileSizeEx(file, &file_size) || file_size.QuadPart < NAVCACHE_HEADER)
+    {
+        CloseHandle(file);
+        return NULL;
+    }
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if(!mapping)
+        return NULL;
+    // The view keeps the mapping alive, so both handles can go now.
+    void *base = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    *size = (size_t)file_size.QuadPart;
+    return base;
+#else
+    int fd = open(path, O_RDONLY);
+    if(fd < 0)
+        return NULL;
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size < NAVCACHE_HEADER)
+    {
+        close(fd);
+        return NULL;
+    }
+    void *base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(base == MAP_FAILED)
+        return NULL;
+    *size = (size_t)st.st_size;
+    return base;
+#endif
+}
+
+static void unmap_file(void *base, size_t size)
+{
+#if IBM
+    (void)size;
+    UnmapViewOfFile(base);
+#else
+    munmap(base, size);
+#endif
+}
+
+static bool header_valid(const navcache_header_t *h, size_t file_size, const navcache_key_t *key)
+{
+    if(memcmp(h->magic, NAVCACHE_MAGIC, sizeof(h->magic)) || h->format != NAVCACHE_FORMAT
+       || h->header_size != NAVCACHE_HEADER || !key_equal(&h->key, key))
+        return false;
+    if(h->block_size != file_size - NAVCACHE_HEADER)
+        return false;
+
+    // Every array has to fit in the block. What's in them is checked by tables_valid().
+    const uint64_t sizes[ARR_COUNT] = {
+        [ARR_LAT] = sizeof(float) * (uint64_t)h->count,
+        [ARR_LON] = sizeof(float) * (uint64_t)h->count,
+        [ARR_ELEV] = sizeof(float) * (uint64_t)h->count,
+        [ARR_FREQ] = sizeof(int32_t) * (uint64_t)h->count,
+        [ARR_REF] = sizeof(int32_t) * (uint64_t)h->count,
+        [ARR_ID] = sizeof(uint32_t) * (uint64_t)h->count,
+        [ARR_TYPE] = sizeof(uint16_t) * (uint64_t)h->count,
+        [ARR_STRINGS] = h->strings_size,
+        [ARR_CELLS] = sizeof(uint32_t) * (uint64_t)(NAV_CELLS + 1),
+        [ARR_BY_ID] = sizeof(uint32_t) * (uint64_t)h->count,
+        [ARR_ID_START] = sizeof(uint32_t) * (uint64_t)(NAV_ID_BUCKETS + 1),
+    };
+    for(int i = 0; i < ARR_COUNT; ++i)
+    {
+        if(h->offsets[i] > h->block_size || sizes[i] > h->block_size - h->offsets[i])
+            return false;
+        if(h->offsets[i] % sizeof(uint32_t))
+            return false;
+    }
+    return true;
+}
+
+// Offsets start at 0, never decrease and end at `count`.
+static bool starts_valid(const uint32_t *start, uint32_t entries, uint32_t count)
+{
+    if(start[0] != 0 || start[entries] != count)
+        return false;
+    for(uint32_t i = 0; i < entries; ++i)
+    {
+        if(start[i] > start[i + 1])
+            return false;
+    }
+    return true;
+}
+
+// The values read from the arrays have to stay in bounds too, so a damaged file with a sound
+// header can't send queries out of them: every index and identifier offset is checked once here.
+static bool tables_valid(const navdata_t *nd)
+{
+    if(!starts_valid(nd->cell_start, NAV_CELLS, nd->count)
+       || !starts_valid(nd->id_start, NAV_ID_BUCKETS, nd->count))
+        return false;
+    // With the pool ending in a NUL, every identifier starting inside it ends inside it.
+    if(nd->count && (!nd->strings_size || nd->strings[nd->strings_size - 1] != '\0'))
+        return false;
+    for(uint32_t i = 0; i < nd->count; ++i)
+    {
+        if(nd->by_id[i] >= nd->count || nd->id_off[i] >= nd->strings_size)
+            return false;
+    }
+    return true;
+}
+
+// Whatever the key missed (scenery changed without touching a file we stat), navaids spread over
+// the whole cache have to still be what the sim has under the same refs.
+static bool refs_match(const navdata_t *nd)
+{
+    if(!nd->count)
+        return true;
+    uint32_t checks = nd->count < NAVCACHE_SPOT_CHECKS ? nd->count : NAVCACHE_SPOT_CHECKS;
+    for(uint32_t k = 0; k < checks; ++k)
+    {
+        uint32_t i = (uint32_t)((uint64_t)k * (nd->count - 1) / (checks > 1 ? checks - 1 : 1));
+        XPLMNavType type = xplm_Nav_Unknown;
+        float lat = 0.f, lon = 0.f;
+        char id[32] = "";
+        XPLMGetNavAidInfo(nd->ref[i], &type, &lat, &lon, NULL, NULL, NULL, id, NULL, NULL);
+        if((uint16_t)type != nd->type[i] || lat != nd->lat[i] || lon != nd->lon[i]
+           || strcmp(id, navdata_id(nd, i)))
+            return false;
+    }
+    return true;
+}
+
+navdata_t *navcache_load(const char *path, const navcache_key_t *key)
+{
+    size_t size = 0;
+    uint8_t *base = map_file(path, &size);
+    if(!base)
+        return NULL;
+
+    const navcache_header_t *h = (const navcache_header_t *)base;
+    if(!header_valid(h, size, key))
+    {
+        log_msg("navcache: %s is stale or damaged, ignoring it", path);
+        unmap_file(base, size);
+        return NULL;
+    }
+
+    uint8_t *block = base + NAVCACHE_HEADER;
+    navdata_t *nd = calloc(1, sizeof(navdata_t));
+    if(!nd)
+    {
+        unmap_file(base, size);
+        return NULL;
+    }
+    *nd = (navdata_t){
+        .count = h->count,
+        .strings_size = h->strings_size,
+        .lat = (const float *)(block + h->offsets[ARR_LAT]),
+        .lon = (const float *)(block + h->offsets[ARR_LON]),
+        .elev_ft = (const float *)(block + h->offsets[ARR_ELEV]),
+        .freq = (const int32_t *)(block + h->offsets[ARR_FREQ]),
+        .ref = (const int32_t *)(block + h->offsets[ARR_REF]),
+        .id_off = (const uint32_t *)(block + h->offsets[ARR_ID]),
+        .type = (const uint16_t *)(block + h->offsets[ARR_TYPE]),
+        .strings = (const char *)(block + h->offsets[ARR_STRINGS]),
+        .cell_start = (const uint32_t *)(block + h->offsets[ARR_CELLS]),
+        .by_id = (const uint32_t *)(block + h->offsets[ARR_BY_ID]),
+        .id_start = (const uint32_t *)(block + h->offsets[ARR_ID_START]),
+        .block = block,
+        .block_size = (size_t)h->block_size,
+        .mapped = true,
+    };
+    if(!tables_valid(nd))
+    {
+        log_msg("navcache: %s has inconsistent lookup tables, ignoring it", path);
+        navcache_release(nd);
+        return NULL;
+    }
+    if(!refs_match(nd))
+    {
+        log_msg("navcache: %s doesn't match the sim's navaids, ignoring it", path);
+        navcache_release(nd);
+        return NULL;
+    }
+    return nd;
+}
+
+static uint64_t offset_of(const navdata_t *nd, const void *array)
+{
+    return (uint64_t)((const uint8_t *)array - (const uint8_t *)nd->block);
+}
+
+bool navcache_save(const char *path, const navcache_key_t *key, const navdata_t *nd)
+{
+    navcache_header_t h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, NAVCACHE_MAGIC, sizeof(h.magic));
+    h.format = NAVCACHE_FORMAT;
+    h.header_size = NAVCACHE_HEADER;
+    h.key = *key;
+    h.count = nd->count;
+    h.strings_size = nd->strings_size;
+    h.block_size = nd->block_size;
+    h.offsets[ARR_LAT] = offset_of(nd, nd->lat);
+    h.offsets[ARR_LON] = offset_of(nd, nd->lon);
+    h.offsets[ARR_ELEV] = offset_of(nd, nd->elev_ft);
+    h.offsets[ARR_FREQ] = offset_of(nd, nd->freq);
+    h.offsets[ARR_REF] = offset_of(nd, nd->ref);
+    h.offsets[ARR_ID] = offset_of(nd, nd->id_off);
+    h.offsets[ARR_TYPE] = offset_of(nd, nd->type);
+    h.offsets[ARR_STRINGS] = offset_of(nd, nd->strings);
+    h.offsets[ARR_CELLS] = offset_of(nd, nd->cell_start);
+    h.offsets[ARR_BY_ID] = offset_of(nd, nd->by_id);
+    h.offsets[ARR_ID_START] = offset_of(nd, nd->id_start);
+
+    uint8_t header[NAVCACHE_HEADER] = {0};
+    memcpy(header, &h, sizeof(h));
+
+    // Write next to the real file and swap it in, so a crash never leaves a half-written cache.
+    char tmp_path[1024];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE *f = fopen(tmp_path, "wb");
+    if(!f)
+        return false;
+    bool ok = fwrite(header, 1, sizeof(header), f) == sizeof(header)
+        && fwrite(nd->block, 1, nd->block_size, f) == nd->block_size;
+    ok = (fclose(f) == 0) && ok;
+
+#if IBM
+    ok = ok && MoveFileExA(tmp_path, path, MOVEFILE_REPLACE_EXISTING);
+#else
+    ok = ok && rename(tmp_path, path) == 0;
+#endif
+    if(!ok)
+        remove(tmp_path);
+    return ok;
+}
+
+void navcache_release(navdata_t *nd)
+{
+    if(!nd || !nd->mapped)
+        return;
+    unmap_file((uint8_t *)nd->block - NAVCACHE_HEADER, nd->block_size + NAVCACHE_HEADER);
+    free(nd);
+}
@@ -0,0 +1,45 @@
+/*===--------------------------------------------------------------------------------------------===
+ * navcache.h
+ *
+ * On-disk copy of the navdata index, so we only walk the sim's navaid list once per navdata set.
+ *
+ * The file is a fixed header followed by the index block exactly as navdata.c lays it out in
+ * memory. Loading maps the file read-only and points the navdata_t arrays straight into it, so
+ * there is nothing to parse: pages are faulted in the first time a query touches them.
+ *
+ * A cache is only used if it was written by the same sim and plugin API version, for the same
+ * AIRAC cycle and earth_nav.dat, and the same apt.dat files (global, and custom scenery in
+ * scenery_packs.ini order). XPLMNavRefs are stored too, and they are only stable for a given
+ * navdata and scenery set, which is why all of those are part of the key. On top of that, a few
+ * navaids spread over the cache are checked against the sim under their refs when it's loaded.
+ *===--------------------------------------------------------------------------------------------===
+*/
+#ifndef _NAVCACHE_H_
+#define _NAVCACHE_H_
+
+#include "navdata.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct {
+    int32_t xp_version;
+    int32_t xplm_version;
+    int32_t airac_cycle;        // 0 if earth_nav.dat doesn't say.
+    int64_t nav_file_size;
+    int64_t nav_file_mtime;
+    uint64_t scenery_hash;      // apt.dat files and scenery_packs.ini: paths, sizes and mtimes.
+} navcache_key_t;
+
+// Both go through the XPLM, so they must be called from the main thread.
+void navcache_key(navcache_key_t *key);
+void navcache_path(char *out, size_t size);
+
+// Maps the cache at `path` if it matches `key` and the sim's navaids, or returns NULL. Main thread
+// only too. Release with navcache_release().
+navdata_t *navcache_load(const char *path, const navcache_key_t *key);
+// Writes `nd` to `path`, replacing any existing cache only once the new one is complete. Doesn't
+// log or call the XPLM, so it can run on the thread that built `nd`.
+bool navcache_save(const char *path, const navcache_key_t *key, const navdata_t *nd);
+void navcache_release(navdata_t *nd);
+
+#endif /* ifndef _NAVCACHE_H_ */
@@ -0,0 +1,730 @@
+/*===--------------------------------------------------------------------------------------------===
+ * navdata.c
+ *
+ * Navaid database scan, index build, and spatial queries.
+ *===--------------------------------------------------------------------------------------------===
+ */
+#include "navdata.h"
+#include "navcache.h"
+#include "clock.h"
+#include "geo.h"
+#include "geo_batch.h"
+#include <XPLMProcessing.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#if IBM
+#include <malloc.h>
+#endif
+
+void log_msg(const char *fmt, ...);
+
+#define SCAN_BUDGET_NS      (2000000ull)
+#define SCAN_CLOCK_STRIDE   (64)
+#define BLOCK_ALIGN         (64)
+// Cell contents are contiguous, so their distances are worked out this many at a time.
+#define DIST_BATCH          (64)
+
+// Everything gathered by the scan, in database order. Only touched by the main thread during the
+// scan, then handed over to the builder thread.
+typedef struct {
+    uint32_t count;
+    uint32_t capacity;
+    float *lat;
+    float *lon;
+    float *elev_ft;
+    int32_t *freq;
+    int32_t *ref;
+    uint32_t *id_off;
+    uint16_t *type;
+
+    char *strings;
+    uint32_t strings_size;
+    uint32_t strings_capacity;
+
+    // Open-addressed set of offsets into `strings`, used to intern identifiers.
+    uint32_t *intern;
+    uint32_t intern_capacity;
+    uint32_t intern_count;
+} staging_t;
+
+static staging_t *staging = NULL;
+static XPLMNavRef scan_ref = XPLM_NAV_NOT_FOUND;
+static uint64_t scan_start_ns = 0;
+static XPLMFlightLoopID flight_loop = NULL;
+
+static navcache_key_t cache_key;
+static char cache_path[1024];
+
+static pthread_t builder;
+static bool builder_running = false;
+static atomic_bool builder_done = false;
+// What the builder thread did, for the main thread to log: XPLMDebugString is main thread only.
+static struct {
+    bool built;
+    bool saved;
+    uint64_t build_ns;
+    size_t block_size;
+} build_result;
+static _Atomic(navdata_t *) published = NULL;
+
+#define INTERN_EMPTY (UINT32_MAX)
+
+static uint32_t hash_str(const char *str)
+{
+    uint32_t h = 2166136261u;
+    for(; *str; ++str)
+        h = (h ^ (uint8_t)*str) * 16777619u;
+    return h;
+}
+
+static bool grow(void **ptr, size_t elem, uint32_t capacity)
+{
+    void *p = realloc(*ptr, elem * capacity);
+    if(!p)
+        return false;
+    *ptr = p;
+    return true;
+}
+
+static bool intern_rehash(staging_t *st, uint32_t capacity)
+{
+    uint32_t *table = malloc(sizeof(uint32_t) * capacity);
+    if(!table)
+        return false;
+    memset(table, 0xff, sizeof(uint32_t) * capacity);
+    for(uint32_t i = 0; i < st->intern_capacity; ++i)
+    {
+        uint32_t off = st->intern[i];
+        if(off == INTERN_EMPTY)
+            continue;
+        uint32_t slot = hash_str(st->strings + off) & (capacity - 1);
+        while(table[slot] != INTERN_EMPTY)
+            slot = (slot + 1) & (capacity - 1);
+        table[slot] = off;
+    }
+    free(st->intern);
+    st->intern = table;
+    st->intern_capacity = capacity;
+    return true;
+}
+
+static uint32_t intern(staging_t *st, const char *id)
+{
+    if((st->intern_count + 1) * 10 > st->intern_capacity * 7
+       && !intern_rehash(st, st->intern_capacity ? st->intern_capacity * 2 : 4096))
+        return 0;
+
+    uint32_t slot = hash_str(id) & (st->intern_capacity - 1);
+    while(st->intern[slot] != INTERN_EMPTY)
+    {
+        if(!strcmp(st->strings + st->intern[slot], id))
+            return st->intern[slot];
+        slot = (slot + 1) & (st->intern_capacity - 1);
+    }
+
+    uint32_t len = (uint32_t)strlen(id) + 1;
+    if(st->strings_size + len > st->strings_capacity)
+    {
+        uint32_t capacity = st->strings_capacity ? st->strings_capacity * 2 : 64 * 1024;
+        if(!grow((void **)&st->strings, 1, capacity))
+            return 0;
+        st->strings_capacity = capacity;
+    }
+    uint32_t off = st->strings_size;
+    memcpy(st->strings + off, id, len);
+    st->strings_size += len;
+    st->intern[slot] = off;
+    st->intern_count += 1;
+    return off;
+}
+
+static bool staging_reserve(staging_t *st)
+{
+    if(st->count < st->capacity)
+        return true;
+    uint32_t capacity = st->capacity ? st->capacity * 2 : 16 * 1024;
+    if(!grow((void **)&st->lat, sizeof(float), capacity)
+       || !grow((void **)&st->lon, sizeof(float), capacity)
+       || !grow((void **)&st->elev_ft, sizeof(float), capacity)
+       || !grow((void **)&st->freq, sizeof(int32_t), capacity)
+       || !grow((void **)&st->ref, sizeof(int32_t), capacity)
+       || !grow((void **)&st->id_off, sizeof(uint32_t), capacity)
+       || !grow((void **)&st->type, sizeof(uint16_t), capacity))
+        return false;
+    st->capacity = capacity;
+    return true;
+}
+
+static void staging_free(staging_t *st)
+{
+    if(!st)
+        return;
+    free(st->lat);
+    free(st->lon);
+    free(st->elev_ft);
+    free(st->freq);
+    free(st->ref);
+    free(st->id_off);
+    free(st->type);
+    free(st->strings);
+    free(st->intern);
+    free(st);
+}
+
+static size_t align_up(size_t v)
+{
+    return (v + BLOCK_ALIGN - 1) & ~(size_t)(BLOCK_ALIGN - 1);
+}
+
+// The MSVC runtime has no C11 aligned_alloc(), and what it has must be freed with its own call.
+static void *block_alloc(size_t size)
+{
+#if IBM
+    return _aligned_malloc(size, BLOCK_ALIGN);
+#else
+    return aligned_alloc(BLOCK_ALIGN, size);
+#endif
+}
+
+static void block_free(void *block)
+{
+#if IBM
+    _aligned_free(block);
+#else
+    free(block);
+#endif
+}
+
+typedef struct {
+    const char *id;
+    uint32_t index;
+} id_sort_t;
+
+static int compare_ids(const void *a, const void *b)
+{
+    const id_sort_t *lhs = a;
+    const id_sort_t *rhs = b;
+    int c = strcmp(lhs->id, rhs->id);
+    if(c)
+        return c;
+    return lhs->index < rhs->index ? -1 : lhs->index > rhs->index;
+}
+
+// Packs the staged navaids, sorted by cell, into one block.
+static navdata_t *build_index(staging_t *st)
+{
+    uint32_t n = st->count;
+    size_t off_lat = 0;
+    size_t off_lon = align_up(off_lat + sizeof(float) * n);
+    size_t off_elev = align_up(off_lon + sizeof(float) * n);
+    size_t off_freq = align_up(off_elev + sizeof(float) * n);
+    size_t off_ref = align_up(off_freq + sizeof(int32_t) * n);
+    size_t off_id = align_up(off_ref + sizeof(int32_t) * n);
+    size_t off_type = align_up(off_id + sizeof(uint32_t) * n);
+    size_t off_cells = align_up(off_type + sizeof(uint16_t) * n);
+    size_t off_by_id = align_up(off_cells + sizeof(uint32_t) * (NAV_CELLS + 1));
+    size_t off_id_start = align_up(off_by_id + sizeof(uint32_t) * n);
+    size_t off_strings = align_up(off_id_start + sizeof(uint32_t) * (NAV_ID_BUCKETS + 1));
+    size_t size = align_up(off_strings + st->strings_size);
+
+    navdata_t *nd = calloc(1, sizeof(navdata_t));
+    uint8_t *block = block_alloc(size);
+    uint32_t *cell_of = malloc(sizeof(uint32_t) * (n ? n : 1));
+    if(!nd || !block || !cell_of)
+    {
+        free(nd);
+        block_free(block);
+        free(cell_of);
+        return NULL;
+    }
+
+    float *lat = (float *)(block + off_lat);
+    float *lon = (float *)(block + off_lon);
+    float *elev = (float *)(block + off_elev);
+    int32_t *freq = (int32_t *)(block + off_freq);
+    int32_t *ref = (int32_t *)(block + off_ref);
+    uint32_t *id_off = (uint32_t *)(block + off_id);
+    uint16_t *type = (uint16_t *)(block + off_type);
+    uint32_t *cell_start = (uint32_t *)(block + off_cells);
+    uint32_t *by_id = (uint32_t *)(block + off_by_id);
+    uint32_t *id_start = (uint32_t *)(block + off_id_start);
+    char *strings = (char *)(block + off_strings);
+
+    // Counting sort by cell: count, prefix-sum, then scatter.
+    memset(cell_start, 0, sizeof(uint32_t) * (NAV_CELLS + 1));
+    for(uint32_t i = 0; i < n; ++i)
+    {
+        cell_of[i] = (uint32_t)navdata_cell(st->lat[i], st->lon[i]);
+        cell_start[cell_of[i] + 1] += 1;
+    }
+    for(int c = 0; c < NAV_CELLS; ++c)
+        cell_start[c + 1] += cell_start[c];
+
+    uint32_t *cursor = malloc(sizeof(uint32_t) * NAV_CELLS);
+    if(!cursor)
+    {
+        free(nd);
+        block_free(block);
+        free(cell_of);
+        return NULL;
+    }
+    memcpy(cursor, cell_start, sizeof(uint32_t) * NAV_CELLS);
+    for(uint32_t i = 0; i < n; ++i)
+    {
+        uint32_t dst = cursor[cell_of[i]]++;
+        lat[dst] = st->lat[i];
+        lon[dst] = st->lon[i];
+        elev[dst] = st->elev_ft[i];
+        freq[dst] = st->freq[i];
+        ref[dst] = st->ref[i];
+        id_off[dst] = st->id_off[i];
+        type[dst] = st->type[i];
+    }
+    free(cursor);
+    free(cell_of);
+
+    // Identifier order, over the final (cell-sorted) indices.
+    id_sort_t *order = malloc(sizeof(id_sort_t) * (n ? n : 1));
+    if(!order)
+    {
+        free(nd);
+        block_free(block);
+        return NULL;
+    }
+    for(uint32_t i = 0; i < n; ++i)
+        order[i] = (id_sort_t){st->strings + id_off[i], i};
+    qsort(order, n, sizeof(id_sort_t), compare_ids);
+
+    // Lay the strings out in that same order too, so a binary search over by_id reads memory
+    // front to back instead of all over the string pool.
+    uint32_t strings_size = 0;
+    uint32_t last_off = UINT32_MAX;
+    int bucket = 0;
+    id_start[0] = 0;
+    for(uint32_t k = 0; k < n; ++k)
+    {
+        uint32_t i = order[k].index;
+        if(id_off[i] != last_off)
+        {
+            last_off = id_off[i];
+            size_t len = strlen(order[k].id) + 1;
+            memcpy(strings + strings_size, order[k].id, len);
+            strings_size += (uint32_t)len;
+        }
+        id_off[i] = strings_size - (uint32_t)strlen(order[k].id) - 1;
+        by_id[k] = i;
+
+        for(int b = navdata_id_bucket(order[k].id); bucket < b; ++bucket)
+            id_start[bucket + 1] = k;
+    }
+    for(; bucket < NAV_ID_BUCKETS; ++bucket)
+        id_start[bucket + 1] = n;
+    free(order);
+
+    *nd = (navdata_t){
+        .count = n,
+        .strings_size = strings_size,
+        .lat = lat,
+        .lon = lon,
+        .elev_ft = elev,
+        .freq = freq,
+        .ref = ref,
+        .id_off = id_off,
+        .type = type,
+        .strings = strings,
+        .cell_start = cell_start,
+        .by_id = by_id,
+        .id_start = id_start,
+        .block = block,
+        .block_size = size,
+    };
+    return nd;
+}
+
+static void *builder_main(void *arg)
+{
+    staging_t *st = arg;
+    uint64_t start = clock_now_ns();
+    navdata_t *nd = build_index(st);
+    staging_free(st);
+    if(nd)
+    {
+        build_result.built = true;
+        build_result.build_ns = clock_now_ns() - start;
+        build_result.block_size = nd->block_size;
+        atomic_store_explicit(&published, nd, memory_order_release);
+
+        // The index is usable already; the cache is only for the next start.
+        build_result.saved = navcache_save(cache_path, &cache_key, nd);
+    }
+    atomic_store_explicit(&builder_done, true, memory_order_release);
+    return NULL;
+}
+
+// Main thread, once the builder is done.
+static void log_build_result(void)
+{
+    if(!build_result.built)
+    {
+        log_msg("navdata: could not allocate the index");
+        return;
+    }
+    log_msg("navdata: index built in %.1f ms (%zu KB)", (double)build_result.build_ns / 1e6,
+            build_result.block_size / 1024);
+    if(build_result.saved)
+        log_msg("navdata: saved cache to %s", cache_path);
+    else
+        log_msg("navdata: failed to write the cache to %s", cache_path);
+}
+
+static void navdata_free(navdata_t *nd)
+{
+    if(!nd)
+        return;
+    if(nd->mapped)
+    {
+        navcache_release(nd);
+        return;
+    }
+    block_free(nd->block);
+    free(nd);
+}
+
+static float scan_flight_loop(float since_call, float since_loop, int counter, void *refcon)
+{
+    (void)since_call;
+    (void)since_loop;
+    (void)counter;
+    (void)refcon;
+
+    // Waiting for the builder thread, to join it and report from here.
+    if(builder_running)
+    {
+        if(!atomic_load_explicit(&builder_done, memory_order_acquire))
+            return 0.5f;
+        pthread_join(builder, NULL);
+        builder_running = false;
+        log_build_result();
+        return 0.f;
+    }
+    if(!staging)
+        return 0.f;
+
+    uint64_t deadline = clock_now_ns() + SCAN_BUDGET_NS;
+    int visited = 0;
+    char id[32];
+    while(scan_ref != XPLM_NAV_NOT_FOUND)
+    {
+        if(!staging_reserve(staging))
+        {
+            log_msg("navdata: out of memory after %u navaids", staging->count);
+            scan_ref = XPLM_NAV_NOT_FOUND;
+            break;
+        }
+
+        XPLMNavType type = xplm_Nav_Unknown;
+        float lat = 0.f, lon = 0.f, height = 0.f;
+        int freq = 0;
+        id[0] = '\0';
+        XPLMGetNavAidInfo(scan_ref, &type, &lat, &lon, &height, &freq, NULL, id, NULL, NULL);
+
+        uint32_t i = staging->count++;
+        staging->lat[i] = lat;
+        staging->lon[i] = lon;
+        staging->elev_ft[i] = height;
+        staging->freq[i] = freq;
+        staging->ref[i] = scan_ref;
+        staging->id_off[i] = intern(staging, id);
+        staging->type[i] = (uint16_t)type;
+
+        scan_ref = XPLMGetNextNavAid(scan_ref);
+        if((++visited % SCAN_CLOCK_STRIDE) == 0 && clock_now_ns() >= deadline)
+            return -1.f;
+    }
+
+    log_msg("navdata: scanned %u navaids in %.1f s", staging->count,
+            (double)(clock_now_ns() - scan_start_ns) / 1e9);
+    staging_t *st = staging;
+    staging = NULL;
+    if(pthread_create(&builder, NULL, builder_main, st) == 0)
+    {
+        builder_running = true;
+        return 0.5f;
+    }
+    builder_main(st);
+    log_build_result();
+    return 0.f;
+}
+
+const navdata_t *navdata_get(void)
+{
+    return atomic_load_explicit(&published, memory_order_acquire);
+}
+
+typedef struct {
+    const navdata_t *nd;
+    double lat, lon;
+    double cos_lat;
+    int type_mask;
+    float limit_nm;
+    navdata_filter_f filter;
+    void *ctx;
+} query_t;
+
+static inline uint32_t batch_distances(const query_t *q, uint32_t base, uint32_t end,
+                                       float *dist)
+{
+    uint32_t n = end - base < DIST_BATCH ? end - base : DIST_BATCH;
+    geo_batch_distance_nm(q->lat, q->lon, q->nd->lat + base, q->nd->lon + base, dist, n);
+    return n;
+}
+
+// Max-heap on distance, so the farthest of the current best candidates is at the top.
+static void heap_push(nav_hit_t *heap, int *size, int cap, nav_hit_t hit)
+{
+    if(*size == cap)
+    {
+        if(hit.dist_nm >= heap[0].dist_nm)
+            return;
+        // Replace the root and sift down.
+        int i = 0;
+        for(;;)
+        {
+            int l = 2 * i + 1, r = l + 1, m = i;
+            float dm = hit.dist_nm;
+            if(l < *size && heap[l].dist_nm > dm) { m = l; dm = heap[l].dist_nm; }
+            if(r < *size && heap[r].dist_nm > dm) { m = r; }
+            if(m == i)
+                break;
+            heap[i] = heap[m];
+            i = m;
+        }
+        heap[i] = hit;
+        return;
+    }
+    int i = (*size)++;
+    while(i > 0 && heap[(i - 1) / 2].dist_nm < hit.dist_nm)
+    {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = hit;
+}
+
+static void visit_cell(const query_t *q, int row, int col, nav_hit_t *heap, int *size, int cap)
+{
+    if(row < 0 || row >= NAV_CELLS_LAT)
+        return;
+    col = ((col % NAV_CELLS_LON) + NAV_CELLS_LON) % NAV_CELLS_LON;
+    int cell = row * NAV_CELLS_LON + col;
+    const navdata_t *nd = q->nd;
+    float dist[DIST_BATCH];
+    uint32_t end = nd->cell_start[cell + 1];
+    for(uint32_t base = nd->cell_start[cell]; base < end; base += DIST_BATCH)
+    {
+        uint32_t n = batch_distances(q, base, end, dist);
+        for(uint32_t k = 0; k < n; ++k)
+        {
+            uint32_t i = base + k;
+            if(!(nd->type[i] & q->type_mask) || dist[k] > q->limit_nm)
+                continue;
+            if(q->filter && !q->filter(nd, i, q->ctx))
+                continue;
+            heap_push(heap, size, cap, (nav_hit_t){i, dist[k]});
+        }
+    }
+}
+
+// Lower bound on the distance from the query point to anything outside the block of cells within
+// `ring` of its own cell.
+static float outside_bound_nm(const query_t *q, int row0, int col0, int ring)
+{
+    double lat_lo = (double)(row0 - ring) - 90.0;
+    double lat_hi = (double)(row0 + ring + 1) - 90.0;
+    double lon_lo = (double)(col0 - ring) - 180.0;
+    double lon_hi = (double)(col0 + ring + 1) - 180.0;
+
+    double d_lat = 1e9;
+    if(lat_lo > -90.0)
+        d_lat = q->lat - lat_lo;
+    if(lat_hi < 90.0 && lat_hi - q->lat < d_lat)
+        d_lat = lat_hi - q->lat;
+    d_lat *= NM_PER_DEG_LAT;
+
+    // Distance from the point to the bounding meridians (great circles).
+    double d_lon = 1e9;
+    if(lon_hi - lon_lo < 360.0)
+    {
+        double dlon = fmin(q->lon - lon_lo, lon_hi - q->lon);
+        dlon = fmin(dlon, 90.0);
+        d_lon = asin(q->cos_lat * sin(dlon * DEG2RAD)) * EARTH_RADIUS_NM;
+    }
+    return (float)fmin(d_lat, d_lon);
+}
+
+static int search(const query_t *q, nav_hit_t *heap, int cap)
+{
+    int size = 0;
+    int row0 = (int)floor(q->lat + 90.0);
+    int col0 = (int)floor(q->lon + 180.0);
+    row0 = row0 < 0 ? 0 : row0 >= NAV_CELLS_LAT ? NAV_CELLS_LAT - 1 : row0;
+
+    for(int ring = 0; ring < NAV_CELLS_LON / 2; ++ring)
+    {
+        for(int dy = -ring; dy <= ring; ++dy)
+        {
+            if(dy == -ring || dy == ring)
+            {
+                for(int dx = -ring; dx <= ring; ++dx)
+                    visit_cell(q, row0 + dy, col0 + dx, heap, &size, cap);
+            }
+            else
+            {
+                visit_cell(q, row0 + dy, col0 - ring, heap, &size, cap);
+                visit_cell(q, row0 + dy, col0 + ring, heap, &size, cap);
+            }
+        }
+
+        float bound = outside_bound_nm(q, row0, col0, ring);
+        if(bound > q->limit_nm)
+            break;
+        if(size == cap && bound >= heap[0].dist_nm)
+            break;
+    }
+    return size;
+}
+
+int navdata_nearest(const navdata_t *nd, double lat, double lon, int type_mask, int n,
+                    float max_nm, nav_hit_t *out)
+{
+    return navdata_nearest_if(nd, lat, lon, type_mask, n, max_nm, NULL, NULL, out);
+}
+
+int navdata_nearest_if(const navdata_t *nd, double lat, double lon, int type_mask, int n,
+                       float max_nm, navdata_filter_f filter, void *ctx, nav_hit_t *out)
+{
+    if(!nd || n <= 0)
+        return 0;
+    if(n > NAV_MAX_NEAREST)
+        n = NAV_MAX_NEAREST;
+
+    query_t q = {nd, lat, geo_wrap_lon(lon), cos(lat * DEG2RAD), type_mask, max_nm, filter, ctx};
+    nav_hit_t heap[NAV_MAX_NEAREST];
+    int size = search(&q, heap, n);
+
+    // Pop the heap from the back to get the hits sorted closest first.
+    for(int count = size; count > 0; --count)
+    {
+        out[count - 1] = heap[0];
+        nav_hit_t last = heap[count - 1];
+        int i = 0;
+        int remaining = count - 1;
+        for(;;)
+        {
+            int l = 2 * i + 1, r = l + 1, m = i;
+            float dm = last.dist_nm;
+            if(l < remaining && heap[l].dist_nm > dm) { m = l; dm = heap[l].dist_nm; }
+            if(r < remaining && heap[r].dist_nm > dm) { m = r; }
+            if(m == i)
+                break;
+            heap[i] = heap[m];
+            i = m;
+        }
+        heap[i] = last;
+    }
+    return size;
+}
+
+int navdata_within(const navdata_t *nd, double lat, double lon, float radius_nm, int type_mask,
+                   nav_hit_t *out, int max_out)
+{
+    if(!nd)
+        return 0;
+    lon = geo_wrap_lon(lon);
+    query_t q = {nd, lat, lon, cos(lat * DEG2RAD), type_mask, radius_nm, NULL, NULL};
+
+    // Cells spanned by the radius; widen in longitude with latitude, up to the whole parallel.
+    double dlat = radius_nm / NM_PER_DEG_LAT;
+    double coslat = fmax(cos(fmin(fabs(lat) + dlat, 90.0) * DEG2RAD), 1e-6);
+    double dlon = fmin(dlat / coslat, 180.0);
+    int row_lo = (int)floor(lat - dlat + 90.0), row_hi = (int)floor(lat + dlat + 90.0);
+    int col_lo = (int)floor(lon - dlon + 180.0), col_hi = (int)floor(lon + dlon + 180.0);
+    if(col_hi - col_lo >= NAV_CELLS_LON)
+        col_hi = col_lo + NAV_CELLS_LON - 1;
+
+    int found = 0;
+    float dist[DIST_BATCH];
+    for(int row = row_lo; row <= row_hi; ++row)
+    {
+        if(row < 0 || row >= NAV_CELLS_LAT)
+            continue;
+        for(int c = col_lo; c <= col_hi; ++c)
+        {
+            int col = ((c % NAV_CELLS_LON) + NAV_CELLS_LON) % NAV_CELLS_LON;
+            int cell = row * NAV_CELLS_LON + col;
+            uint32_t end = nd->cell_start[cell + 1];
+            for(uint32_t base = nd->cell_start[cell]; base < end; base += DIST_BATCH)
+            {
+                uint32_t n = batch_distances(&q, base, end, dist);
+                for(uint32_t k = 0; k < n; ++k)
+                {
+                    if(!(nd->type[base + k] & type_mask) || dist[k] > radius_nm)
+                        continue;
+                    if(found < max_out)
+                        out[found] = (nav_hit_t){base + k, dist[k]};
+                    found += 1;
+                }
+            }
+        }
+    }
+    return found;
+}
+
+void navdata_init(void)
+{
+    uint64_t start = clock_now_ns();
+    navcache_key(&cache_key);
+    navcache_path(cache_path, sizeof(cache_path));
+    navdata_t *cached = navcache_load(cache_path, &cache_key);
+    if(cached)
+    {
+        log_msg("navdata: mapped %u navaids (cycle %d) from cache in %.2f ms", cached->count,
+                cache_key.airac_cycle, (double)(clock_now_ns() - start) / 1e6);
+        atomic_store_explicit(&published, cached, memory_order_release);
+        return;
+    }
+
+    staging = calloc(1, sizeof(staging_t));
+    if(!staging)
+        return;
+    intern(staging, "");
+    scan_ref = XPLMGetFirstNavAid();
+    scan_start_ns = start;
+
+    XPLMCreateFlightLoop_t fl = (XPLMCreateFlightLoop_t){
+        .structSize = sizeof(XPLMCreateFlightLoop_t),
+        .phase = xplm_FlightLoop_Phase_BeforeFlightModel,
+        .callbackFunc = scan_flight_loop,
+        .refcon = NULL
+    };
+    flight_loop = XPLMCreateFlightLoop(&fl);
+    XPLMScheduleFlightLoop(flight_loop, -1.f, 1);
+}
+
+void navdata_fini(void)
+{
+    if(flight_loop)
+        XPLMDestroyFlightLoop(flight_loop);
+    flight_loop = NULL;
+    if(builder_running)
+        pthread_join(builder, NULL);
+    builder_running = false;
+    atomic_store(&builder_done, false);
+    memset(&build_result, 0, sizeof(build_result));
+
+    staging_free(staging);
+    staging = NULL;
+    navdata_free(atomic_exchange(&published, NULL));
+}
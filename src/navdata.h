@@ -0,0 +1,124 @@
+/*===--------------------------------------------------------------------------------------------===
+ * navdata.h
+ *
+ * In-memory copy of X-Plane's navaid database with a spatial index.
+ *
+ * XPLMFindNavAid is a linear search inside the sim, which is far too slow to call every second
+ * for nearest lists. Instead, we walk the navaid list once with XPLMGetFirstNavAid() and
+ * XPLMGetNextNavAid(), spread over several frames so we never stall the sim, then hand the
+ * result to a worker thread that packs it into a structure-of-arrays store, sorted by 1x1 degree
+ * cell. Queries look at the cells around the query point, ring by ring, and stop as soon as no
+ * closer navaid can exist further out.
+ *
+ * The packed block is also saved to disk (see navcache.h), and later starts map it back in
+ * instead of scanning, so the index is ready on the first frame.
+ *
+ * Once published, an index is immutable, so it can be read from any thread until navdata_fini().
+ *===--------------------------------------------------------------------------------------------===
+*/
+#ifndef _NAVDATA_H_
+#define _NAVDATA_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <XPLMNavigation.h>
+
+#define NAV_CELLS_LAT   (180)
+#define NAV_CELLS_LON   (360)
+#define NAV_CELLS       (NAV_CELLS_LAT * NAV_CELLS_LON)
+#define NAV_MAX_NEAREST (64)
+// Identifiers are bucketed by their first two characters, see navdata_id_bucket().
+#define NAV_ID_CODES    (40)
+#define NAV_ID_BUCKETS  (NAV_ID_CODES * NAV_ID_CODES)
+
+typedef struct {
+    uint32_t count;
+    uint32_t strings_size;
+    // One entry per navaid, sorted by cell.
+    const float *lat;
+    const float *lon;
+    const float *elev_ft;
+    const int32_t *freq;
+    const int32_t *ref;         // XPLMNavRef, to fetch names and other details on demand.
+    const uint32_t *id_off;     // Offset of the navaid's identifier in `strings`.
+    const uint16_t *type;       // XPLMNavType bit.
+    const char *strings;        // Interned, NUL-terminated identifiers.
+    // Navaids in cell c are [cell_start[c], cell_start[c+1]).
+    const uint32_t *cell_start;
+    // Every navaid index, ordered by identifier, for identifier search (see navsearch.h).
+    const uint32_t *by_id;
+    // by_id positions of identifiers in bucket b are [id_start[b], id_start[b+1]).
+    const uint32_t *id_start;
+
+    void *block;                // Storage backing all the arrays above.
+    size_t block_size;
+    bool mapped;                // Block is a read-only view of the on-disk cache.
+} navdata_t;
+
+typedef struct {
+    uint32_t index;
+    float dist_nm;
+} nav_hit_t;
+
+// The published index, or NULL while it is still being built.
+const navdata_t *navdata_get(void);
+
+static inline const char *navdata_id(const navdata_t *nd, uint32_t index)
+{
+    return nd->strings + nd->id_off[index];
+}
+
+// Maps a character to a small code that sorts the same way strcmp() does: end of string, then
+// digits, then letters, with everything else lumped in between.
+static inline int navdata_id_code(char c)
+{
+    unsigned char u = (unsigned char)c;
+    if(!u)
+        return 0;
+    if(u < '0')
+        return 1;
+    if(u <= '9')
+        return 2 + (u - '0');
+    if(u < 'A')
+        return 12;
+    if(u <= 'Z')
+        return 13 + (u - 'A');
+    return 39;
+}
+
+static inline int navdata_id_bucket(const char *id)
+{
+    int first = navdata_id_code(id[0]);
+    return first * NAV_ID_CODES + (first ? navdata_id_code(id[1]) : 0);
+}
+
+static inline int navdata_cell(float lat, float lon)
+{
+    int row = (int)(lat + 90.f);
+    int col = (int)(lon + 180.f);
+    row = row < 0 ? 0 : row >= NAV_CELLS_LAT ? NAV_CELLS_LAT - 1 : row;
+    col = col < 0 ? 0 : col >= NAV_CELLS_LON ? NAV_CELLS_LON - 1 : col;
+    return row * NAV_CELLS_LON + col;
+}
+
+// Up to `n` (at most NAV_MAX_NEAREST) navaids matching `type_mask`, within `max_nm`, closest first.
+int navdata_nearest(const navdata_t *nd, double lat, double lon, int type_mask, int n,
+                    float max_nm, nav_hit_t *out);
+
+// Extra test a navaid must pass to be returned by navdata_nearest_if().
+typedef bool (*navdata_filter_f)(const navdata_t *nd, uint32_t index, void *ctx);
+
+// Same as navdata_nearest(), but only for navaids that `filter` accepts.
+int navdata_nearest_if(const navdata_t *nd, double lat, double lon, int type_mask, int n,
+                       float max_nm, navdata_filter_f filter, void *ctx, nav_hit_t *out);
+
+// Navaids matching `type_mask` within `radius_nm`, in no particular order. Returns how many were
+// found, which can be more than `max_out`; only `max_out` are written.
+int navdata_within(const navdata_t *nd, double lat, double lon, float radius_nm, int type_mask,
+                   nav_hit_t *out, int max_out);
+
+void navdata_init(void);
+void navdata_fini(void);
+
+#endif /* ifndef _NAVDATA_H_ */
@@ -0,0 +1,272 @@
+/*===--------------------------------------------------------------------------------------------===
+ * navsearch.c
+ *
+ * Prefix and single-typo identifier search over the navdata index.
+ *===--------------------------------------------------------------------------------------------===
+ */
+#include "navsearch.h"
+#include "geo.h"
+#include <ctype.h>
+#include <string.h>
+
+static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+
+// Above this many prefix matches (one or two typed characters), scanning them all costs more than
+// searching outward from the aircraft for the closest few.
+#define PREFIX_SCAN_LIMIT   (2048)
+// Not worth suggesting anything further than this when the query is that vague.
+#define PREFIX_NEAREST_NM   (2000.f)
+
+typedef struct {
+    const navdata_t *nd;
+    double lat, lon;
+    double cos_lat;
+    int type_mask;
+
+    // Kept sorted, best first. `rank` is a cheap flat-earth distance, only used for ordering.
+    nav_match_t best[NAVSEARCH_MAX_RESULTS];
+    float rank[NAVSEARCH_MAX_RESULTS];
+    int count;
+    int cap;
+} search_t;
+
+static float flat_distance_sq(const search_t *s, uint32_t i)
+{
+    float dlat = s->nd->lat[i] - (float)s->lat;
+    float dlon = s->nd->lon[i] - (float)s->lon;
+    if(dlon > 180.f)
+        dlon -= 360.f;
+    else if(dlon < -180.f)
+        dlon += 360.f;
+    dlon *= (float)s->cos_lat;
+    return dlat * dlat + dlon * dlon;
+}
+
+static bool ranks_before(uint8_t edits, bool exact, float rank, const nav_match_t *m, float m_rank)
+{
+    if(edits != m->edits)
+        return edits < m->edits;
+    if(exact != m->exact)
+        return exact;
+    return rank < m_rank;
+}
+
+static void consider(search_t *s, uint32_t i, uint8_t edits, bool exact)
+{
+    if(!(s->nd->type[i] & s->type_mask))
+        return;
+    float rank = flat_distance_sq(s, i);
+    if(s->count == s->cap
+       && !ranks_before(edits, exact, rank, &s->best[s->count - 1], s->rank[s->count - 1]))
+        return;
+
+    // Different edits can spell the same identifier twice.
+    for(int k = 0; k < s->count; ++k)
+    {
+        if(s->best[k].index == i)
+            return;
+    }
+
+    int pos = s->count < s->cap ? s->count++ : s->count - 1;
+    while(pos > 0 && ranks_before(edits, exact, rank, &s->best[pos - 1], s->rank[pos - 1]))
+    {
+        s->best[pos] = s->best[pos - 1];
+        s->rank[pos] = s->rank[pos - 1];
+        pos -= 1;
+    }
+    s->best[pos] = (nav_match_t){i, 0.f, edits, exact};
+    s->rank[pos] = rank;
+}
+
+// First position in [lo, hi) of the identifier order whose first `len` characters (all of them
+// if len is 0) compare greater than (`upper`) or not less than (`!upper`) `key`.
+static uint32_t bound(const navdata_t *nd, const char *key, size_t len, bool upper,
+                      uint32_t lo, uint32_t hi)
+{
+    while(lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+        const char *id = navdata_id(nd, nd->by_id[mid]);
+        int c = len ? strncmp(id, key, len) : strcmp(id, key);
+        if(upper ? c <= 0 : c < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// by_id range of identifiers starting with the first `len` characters of `key`, narrowed with
+// the two-character buckets so the binary search stays within a few hundred neighbours.
+static void prefix_range(const navdata_t *nd, const char *key, size_t len, uint32_t *lo,
+                         uint32_t *hi)
+{
+    uint32_t start, end;
+    if(len == 1)
+    {
+        int first = navdata_id_code(key[0]);
+        start = nd->id_start[first * NAV_ID_CODES];
+        end = nd->id_start[(first + 1) * NAV_ID_CODES];
+    }
+    else
+    {
+        int bucket = navdata_id_bucket(key);
+        start = nd->id_start[bucket];
+        end = nd->id_start[bucket + 1];
+    }
+    *lo = bound(nd, key, len, false, start, end);
+    *hi = bound(nd, key, len, true, *lo, end);
+}
+
+// Looks up one typo candidate. Past the second character, every candidate shares its first `pos`
+// characters with the query, so the search can start from that (much smaller) range instead.
+static void find_exact(search_t *s, const char *id, size_t pos, uint32_t lo, uint32_t hi)
+{
+    const navdata_t *nd = s->nd;
+    if(pos < 2)
+    {
+        int bucket = navdata_id_bucket(id);
+        lo = nd->id_start[bucket];
+        hi = nd->id_start[bucket + 1];
+    }
+    for(uint32_t k = bound(nd, id, 0, false, lo, hi); k < hi; ++k)
+    {
+        if(strcmp(navdata_id(nd, nd->by_id[k]), id))
+            break;
+        consider(s, nd->by_id[k], 1, false);
+    }
+}
+
+static void find_typos(search_t *s, const char *query, size_t len)
+{
+    char variant[NAVSEARCH_MAX_QUERY + 2];
+
+    for(size_t pos = 0; pos < len; ++pos)
+    {
+        uint32_t lo = 0, hi = 0;
+        if(pos >= 2)
+        {
+            prefix_range(s->nd, query, pos, &lo, &hi);
+            if(lo == hi)
+                break;
+        }
+
+        // Substitutions.
+        memcpy(variant, query, len + 1);
+        for(const char *c = alphabet; *c; ++c)
+        {
+            if(*c == query[pos])
+                continue;
+            variant[pos] = *c;
+            find_exact(s, variant, pos, lo, hi);
+        }
+
+        // Deletions.
+        memcpy(variant, query, pos);
+        memcpy(variant + pos, query + pos + 1, len - pos);
+        find_exact(s, variant, pos, lo, hi);
+
+        // Insertions. Inserting at the end gives a prefix match, which we already have.
+        memcpy(variant + pos + 1, query + pos, len - pos + 1);
+        for(const char *c = alphabet; *c; ++c)
+        {
+            variant[pos] = *c;
+            find_exact(s, variant, pos, lo, hi);
+        }
+
+        // Swapped neighbours.
+        if(pos + 1 < len && query[pos] != query[pos + 1])
+        {
+            memcpy(variant, query, len + 1);
+            variant[pos] = query[pos + 1];
+            variant[pos + 1] = query[pos];
+            find_exact(s, variant, pos, lo, hi);
+        }
+    }
+}
+
+typedef struct {
+    const char *key;
+    size_t len;
+} prefix_t;
+
+static bool has_prefix(const navdata_t *nd, uint32_t index, void *ctx)
+{
+    const prefix_t *prefix = ctx;
+    return !strncmp(navdata_id(nd, index), prefix->key, prefix->len);
+}
+
+int navsearch_find(const navdata_t *nd, const char *query, double lat, double lon,
+                   int type_mask, nav_match_t *out, int max_out)
+{
+    if(!nd || !query || max_out <= 0)
+        return 0;
+    size_t len = strlen(query);
+    if(!len || len > NAVSEARCH_MAX_QUERY)
+        return 0;
+
+    char key[NAVSEARCH_MAX_QUERY + 1];
+    for(size_t i = 0; i <= len; ++i)
+        key[i] = (char)toupper((unsigned char)query[i]);
+
+    search_t s = {
+        .nd = nd,
+        .lat = lat,
+        .lon = geo_wrap_lon(lon),
+        .cos_lat = cos(lat * DEG2RAD),
+        .type_mask = type_mask,
+        .count = 0,
+        .cap = max_out < NAVSEARCH_MAX_RESULTS ? max_out : NAVSEARCH_MAX_RESULTS,
+    };
+
+    uint32_t lo, hi;
+    prefix_range(nd, key, len, &lo, &hi);
+    if(hi - lo <= PREFIX_SCAN_LIMIT)
+    {
+        for(uint32_t k = lo; k < hi; ++k)
+        {
+            uint32_t i = nd->by_id[k];
+            consider(&s, i, 0, navdata_id(nd, i)[len] == '\0');
+        }
+    }
+    else
+    {
+        // Exact matches rank first wherever they are, and there are only ever a handful.
+        uint32_t exact_hi = bound(nd, key, 0, true, lo, hi);
+        for(uint32_t k = lo; k < exact_hi; ++k)
+            consider(&s, nd->by_id[k], 0, true);
+
+        prefix_t prefix = {key, len};
+        nav_hit_t hits[NAVSEARCH_MAX_RESULTS];
+        int count = navdata_nearest_if(nd, lat, lon, type_mask, s.cap, PREFIX_NEAREST_NM,
+                                       has_prefix, &prefix, hits);
+        for(int k = 0; k < count; ++k)
+            consider(&s, hits[k].index, 0, navdata_id(nd, hits[k].index)[len] == '\0');
+    }
+
+    // Single characters have too many neighbours for typo matching to mean anything.
+    if(s.count < s.cap && len > 1)
+        find_typos(&s, key, len);
+
+    // Real distances for what we kept; the order only changes if two were nearly tied.
+    for(int k = 0; k < s.count; ++k)
+    {
+        uint32_t i = s.best[k].index;
+        s.best[k].dist_nm = (float)geo_distance_nm(lat, lon, nd->lat[i], nd->lon[i]);
+    }
+    for(int k = 1; k < s.count; ++k)
+    {
+        nav_match_t m = s.best[k];
+        int pos = k;
+        while(pos > 0 && ranks_before(m.edits, m.exact, m.dist_nm, &s.best[pos - 1],
+                                      s.best[pos - 1].dist_nm))
+        {
+            s.best[pos] = s.best[pos - 1];
+            pos -= 1;
+        }
+        s.best[pos] = m;
+    }
+
+    memcpy(out, s.best, sizeof(nav_match_t) * (size_t)s.count);
+    return s.count;
+}
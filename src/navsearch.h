@@ -0,0 +1,35 @@
+/*===--------------------------------------------------------------------------------------------===
+ * navsearch.h
+ *
+ * Type-ahead identifier lookup for scratchpad entry.
+ *
+ * Works off navdata's identifier-sorted index: every identifier starting with the query is a
+ * contiguous range of it, found with two binary searches. If that doesn't fill the result list,
+ * we try every string one edit (substitution, insertion, deletion or swap of neighbouring
+ * characters) away from the query, and look each one up exactly, which catches most typos.
+ *
+ * Results are ranked prefix matches first, exact identifiers first among those, then by distance
+ * from the given position.
+ *===--------------------------------------------------------------------------------------------===
+*/
+#ifndef _NAVSEARCH_H_
+#define _NAVSEARCH_H_
+
+#include "navdata.h"
+
+#define NAVSEARCH_MAX_QUERY     (8)
+#define NAVSEARCH_MAX_RESULTS   (16)
+
+typedef struct {
+    uint32_t index;
+    float dist_nm;
+    uint8_t edits;              // 0 for a prefix match, 1 for a typo match.
+    bool exact;                 // Whole identifier matches the query.
+} nav_match_t;
+
+// Up to `max_out` (at most NAVSEARCH_MAX_RESULTS) navaids of `type_mask` matching `query`, best
+// first. The query is case-insensitive; longer ones than NAVSEARCH_MAX_QUERY match nothing.
+int navsearch_find(const navdata_t *nd, const char *query, double lat, double lon,
+                   int type_mask, nav_match_t *out, int max_out);
+
+#endif /* ifndef _NAVSEARCH_H_ */
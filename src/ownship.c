@@ -0,0 +1,86 @@
+/*===--------------------------------------------------------------------------------------------===
+ * ownship.c
+ *
+ * Per-frame snapshot of the user aircraft's state.
+ *===--------------------------------------------------------------------------------------------===
+ */
+#include "ownship.h"
+#include "geo.h"
+#include <XPLMDataAccess.h>
+#include <XPLMProcessing.h>
+#include <stddef.h>
+
+static XPLMDataRef lat_ref = NULL;
+static XPLMDataRef lon_ref = NULL;
+static XPLMDataRef elev_ref = NULL;
+static XPLMDataRef psi_ref = NULL;
+static XPLMDataRef vx_ref = NULL;
+static XPLMDataRef vz_ref = NULL;
+static XPLMDataRef gs_ref = NULL;
+static XPLMDataRef tas_ref = NULL;
+static XPLMFlightLoopID flight_loop = NULL;
+static ownship_t state;
+
+static void update(void)
+{
+    state.lat = XPLMGetDatad(lat_ref);
+    state.lon = XPLMGetDatad(lon_ref);
+    state.elev_m = XPLMGetDatad(elev_ref);
+    state.heading = XPLMGetDataf(psi_ref);
+    state.groundspeed_kts = XPLMGetDataf(gs_ref) * MS_TO_KTS;
+    state.tas_kts = XPLMGetDataf(tas_ref) * MS_TO_KTS;
+
+    // Local +x is east and +z is south, so the track is atan2(east, north).
+    float vx = XPLMGetDataf(vx_ref);
+    float vz = XPLMGetDataf(vz_ref);
+    state.track = state.groundspeed_kts > 2.f
+        ? (float)geo_wrap_360(atan2(vx, -vz) * RAD2DEG)
+        : state.heading;
+    state.valid = true;
+}
+
+static float ownship_flight_loop(float since_call, float since_loop, int counter, void *refcon)
+{
+    (void)since_call;
+    (void)since_loop;
+    (void)counter;
+    (void)refcon;
+
+    update();
+    return -1.f;
+}
+
+const ownship_t *ownship_get(void)
+{
+    return &state;
+}
+
+void ownship_init(void)
+{
+    lat_ref = XPLMFindDataRef("sim/flightmodel/position/latitude");
+    lon_ref = XPLMFindDataRef("sim/flightmodel/position/longitude");
+    elev_ref = XPLMFindDataRef("sim/flightmodel/position/elevation");
+    psi_ref = XPLMFindDataRef("sim/flightmodel/position/true_psi");
+    vx_ref = XPLMFindDataRef("sim/flightmodel/position/local_vx");
+    vz_ref = XPLMFindDataRef("sim/flightmodel/position/local_vz");
+    gs_ref = XPLMFindDataRef("sim/flightmodel/position/groundspeed");
+    tas_ref = XPLMFindDataRef("sim/flightmodel/position/true_airspeed");
+    update();
+
+    XPLMCreateFlightLoop_t fl = (XPLMCreateFlightLoop_t){
+        .structSize = sizeof(XPLMCreateFlightLoop_t),
+        .phase = xplm_FlightLoop_Phase_AfterFlightModel,
+        .callbackFunc = ownship_flight_loop,
+        .refcon = NULL
+    };
+    flight_loop = XPLMCreateFlightLoop(&fl);
+    XPLMScheduleFlightLoop(flight_loop, -1.f, 1);
+}
+
+void ownship_fini(void)
+{
+    if(flight_loop)
+        XPLMDestroyFlightLoop(flight_loop);
+    flight_loop = NULL;
+    state.valid = false;
+}
@@ -0,0 +1,30 @@
+/*===--------------------------------------------------------------------------------------------===
+ * ownship.h
+ *
+ * The user aircraft's position and motion, read once per frame from datarefs so every page and
+ * subsystem works from the same snapshot.
+ *===--------------------------------------------------------------------------------------------===
+*/
+#ifndef _OWNSHIP_H_
+#define _OWNSHIP_H_
+
+#include <stdbool.h>
+
+typedef struct {
+    double lat;
+    double lon;
+    double elev_m;          // MSL.
+    float heading;          // True, degrees.
+    float track;            // True ground track, degrees.
+    float groundspeed_kts;
+    float tas_kts;
+    bool valid;
+} ownship_t;
+
+// The snapshot taken at the start of the current frame.
+const ownship_t *ownship_get(void);
+
+void ownship_init(void);
+void ownship_fini(void);
+
+#endif /* ifndef _OWNSHIP_H_ */
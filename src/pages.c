@@ -0,0 +1,290 @@
+/*===--------------------------------------------------------------------------------------------===
+ * pages.c
+ *
+ * Per-page framebuffer textures, refreshed on invalidation, and the blit of the page shown.
+ *===--------------------------------------------------------------------------------------------===
+ */
+#include "pages.h"
+#include "clock.h"
+#include "draw_sched.h"
+#include "gl_procs.h"
+#include "profiler.h"
+#include <XPLMGraphics.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+void log_msg(const char *fmt, ...);
+
+#define MAX_PAGES           (8)
+
+#ifndef GL_CLAMP_TO_EDGE
+#define GL_CLAMP_TO_EDGE    (0x812F)
+#endif
+
+typedef struct {
+    char name[32];
+    page_draw_f draw;
+    void *refcon;
+    int texture;
+    GLuint fbo;
+    bool valid;             // The texture holds the page.
+    bool dirty;             // Its inputs changed since.
+    bool live;              // Always out of date.
+    uint64_t rendered_ns;
+} page_t;
+
+struct pages_s {
+    char name[64];
+    int width, height;
+    int sched_slot;
+    uint64_t background_ns;     // Between refreshes of a hidden page.
+    page_t pages[MAX_PAGES];
+    int count;
+    int shown;
+    enum { SETUP_NOT_YET, SETUP_OK, SETUP_FAILED } setup;
+    pages_stats_t stats;
+    uint64_t refresh_ns;        // Total, for the average.
+    prof_probe_t probe;
+};
+
+pages_t *pages_create(const char *name, int width, int height, int sched_slot,
+                      float background_hz)
+{
+    pages_t *pages = calloc(1, sizeof(*pages));
+    if(!pages)
+        return NULL;
+    snprintf(pages->name, sizeof(pages->name), "%s", name);
+    pages->width = width;
+    pages->height = height;
+    pages->sched_slot = sched_slot;
+    pages->background_ns = background_hz > 0.f ? (uint64_t)(1e9f / background_hz) : UINT64_MAX;
+    char probe[96];
+    snprintf(probe, sizeof(probe), "pages/%s", name);
+    pages->probe = profiler_probe(probe);
+    return pages;
+}
+
+void pages_destroy(pages_t *pages)
+{
+    if(!pages)
+        return;
+    for(int i = 0; i < pages->count; ++i)
+    {
+        page_t *page = &pages->pages[i];
+        if(page->fbo)
+            gl_procs.DeleteFramebuffers(1, &page->fbo);
+        if(page->texture)
+        {
+            GLuint tex = (GLuint)page->texture;
+            glDeleteTextures(1, &tex);
+        }
+    }
+    free(pages);
+}
+
+int pages_add(pages_t *pages, const char *name, page_draw_f draw, void *refcon)
+{
+    if(!pages || !draw)
+        return -1;
+    if(pages->count == MAX_PAGES)
+    {
+        log_msg("pages %s: no room left for %s", pages->name, name);
+        return -1;
+    }
+    page_t *page = &pages->pages[pages->count];
+    snprintf(page->name, sizeof(page->name), "%s", name);
+    page->draw = draw;
+    page->refcon = refcon;
+    page->dirty = true;
+    return pages->count++;
+}
+
+void pages_set_live(pages_t *pages, int page, bool live)
+{
+    if(!pages || page < 0 || page >= pages->count)
+        return;
+    pages->pages[page].live = live;
+}
+
+void pages_invalidate(pages_t *pages, int page)
+{
+    if(!pages || page < 0 || page >= pages->count)
+        return;
+    pages->pages[page].dirty = true;
+    if(page == pages->shown)
+        draw_sched_invalidate(pages->sched_slot);
+}
+
+void pages_invalidate_all(pages_t *pages)
+{
+    if(!pages)
+        return;
+    for(int i = 0; i < pages->count; ++i)
+        pages->pages[i].dirty = true;
+    draw_sched_invalidate(pages->sched_slot);
+}
+
+void pages_show(pages_t *pages, int page)
+{
+    if(!pages || page < 0 || page >= pages->count || page == pages->shown)
+        return;
+    pages->shown = page;
+    pages->stats.flips += 1;
+    draw_sched_invalidate(pages->sched_slot);
+}
+
+int pages_shown(const pages_t *pages)
+{
+    return pages ? pages->shown : -1;
+}
+
+int pages_count(const pages_t *pages)
+{
+    return pages ? pages->count : 0;
+}
+
+const char *pages_name(const pages_t *pages, int page)
+{
+    if(!pages || page < 0 || page >= pages->count)
+        return "";
+    return pages->pages[page].name;
+}
+
+static bool setup_page(pages_t *pages, page_t *page)
+{
+    XPLMGenerateTextureNumbers(&page->texture, 1);
+    XPLMBindTexture2d(page->texture, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, pages->width, pages->height, 0, GL_RGBA,
+                 GL_UNSIGNED_BYTE, NULL);
+
+    GLint draw_fb = 0, read_fb = 0;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &draw_fb);
+    glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &read_fb);
+    gl_procs.GenFramebuffers(1, &page->fbo);
+    gl_procs.BindFramebuffer(GL_FRAMEBUFFER, page->fbo);
+    gl_procs.FramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                                  (GLuint)page->texture, 0);
+    GLenum status = gl_procs.CheckFramebufferStatus(GL_FRAMEBUFFER);
+    gl_procs.BindFramebuffer(GL_DRAW_FRAMEBUFFER, (GLuint)draw_fb);
+    gl_procs.BindFramebuffer(GL_READ_FRAMEBUFFER, (GLuint)read_fb);
+    if(status != GL_FRAMEBUFFER_COMPLETE)
+    {
+        log_msg("pages %s: %s framebuffer incomplete (0x%04x)", pages->name, page->name,
+                (unsigned)status);
+        return false;
+    }
+    return true;
+}
+
+// Pages added since the last draw get their texture here.
+static bool setup(pages_t *pages)
+{
+    if(pages->setup == SETUP_NOT_YET)
+    {
+        pages->setup = gl_procs_framebuffer() ? SETUP_OK : SETUP_FAILED;
+        if(pages->setup == SETUP_FAILED)
+            log_msg("pages %s: no framebuffer objects, pages are drawn directly", pages->name);
+    }
+    for(int i = 0; i < pages->count && pages->setup == SETUP_OK; ++i)
+    {
+        if(!pages->pages[i].fbo && !setup_page(pages, &pages->pages[i]))
+            pages->setup = SETUP_FAILED;
+    }
+    return pages->setup == SETUP_OK;
+}
+
+// Renders the page into its texture, and puts the device's framebuffer and viewport back.
+static void render(pages_t *pages, page_t *page)
+{
+    uint64_t start = clock_now_ns();
+    GLint draw_fb = 0, read_fb = 0, viewport[4];
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &draw_fb);
+    glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &read_fb);
+    glGetIntegerv(GL_VIEWPORT, viewport);
+
+    gl_procs.BindFramebuffer(GL_FRAMEBUFFER, page->fbo);
+    glViewport(0, 0, pages->width, pages->height);
+    XPLMSetGraphicsState(0, 0, 0, 0, 1, 1, 0);
+    glClearColor(0.f, 0.f, 0.f, 1.f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    page->draw(pages->width, pages->height, page->refcon);
+
+    gl_procs.BindFramebuffer(GL_DRAW_FRAMEBUFFER, (GLuint)draw_fb);
+    gl_procs.BindFramebuffer(GL_READ_FRAMEBUFFER, (GLuint)read_fb);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+    page->valid = true;
+    page->dirty = page->live;
+    page->rendered_ns = start;
+    pages->refresh_ns += clock_now_ns() - start;
+}
+
+static void blit(const pages_t *pages, const page_t *page)
+{
+    float w = (float)pages->width, h = (float)pages->height;
+    XPLMSetGraphicsState(0, 1, 0, 0, 0, 0, 0);
+    XPLMBindTexture2d(page->texture, 0);
+    glColor4f(1.f, 1.f, 1.f, 1.f);
+    glBegin(GL_QUADS);
+    glTexCoord2f(0.f, 0.f); glVertex2f(0.f, 0.f);
+    glTexCoord2f(0.f, 1.f); glVertex2f(0.f, h);
+    glTexCoord2f(1.f, 1.f); glVertex2f(w, h);
+    glTexCoord2f(1.f, 0.f); glVertex2f(w, 0.f);
+    glEnd();
+}
+
+void pages_draw(pages_t *pages)
+{
+    if(!pages || !pages->count)
+        return;
+    PROF_SCOPE(pages->probe);
+    page_t *shown = &pages->pages[pages->shown];
+    if(!setup(pages))
+    {
+        shown->draw(pages->width, pages->height, shown->refcon);
+        pages->stats.direct += 1;
+        return;
+    }
+
+    // The page shown first, as soon as it changed. Then the hidden page that's waited longest, if
+    // it changed and hasn't been refreshed for long enough.
+    uint64_t now = clock_now_ns();
+    if(shown->dirty || !shown->valid)
+    {
+        render(pages, shown);
+        pages->stats.refreshes += 1;
+    }
+    page_t *due = NULL;
+    for(int i = 0; i < pages->count; ++i)
+    {
+        page_t *page = &pages->pages[i];
+        if(page == shown || (page->valid && !page->dirty))
+            continue;
+        if(page->valid && now - page->rendered_ns < pages->background_ns)
+            continue;
+        if(!due || page->rendered_ns < due->rendered_ns)
+            due = page;
+    }
+    if(due)
+    {
+        render(pages, due);
+        pages->stats.background += 1;
+    }
+
+    blit(pages, shown);
+    pages->stats.blits += 1;
+}
+
+void pages_get_stats(const pages_t *pages, pages_stats_t *out)
+{
+    *out = pages->stats;
+    out->pages = pages->count;
+    unsigned renders = pages->stats.refreshes + pages->stats.background;
+    out->refresh_us = renders ? (float)(pages->refresh_ns / renders) / 1e3f : 0.f;
+}
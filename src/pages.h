@@ -0,0 +1,64 @@
+/*===--------------------------------------------------------------------------------------------===
+ * pages.h
+ *
+ * Page cache for multi-page devices: each page of a device (map, flight plan, systems...) is
+ * rendered into its own texture, and the device's draw callback only blits the one shown.
+ *
+ * A page is only rendered again once its owner says its inputs changed (pages_invalidate()). The
+ * page shown is refreshed on the next draw; hidden pages are refreshed in the background, at most
+ * one per draw and each at most `background_hz`, so they're never more than that stale and
+ * flipping to one (pages_show()) costs a blit, not a rebuild. Nothing is rendered for a page
+ * nobody invalidated, except live pages (pages_set_live()), for content that changes all the
+ * time, like a moving map: rendered on every draw while shown, and at `background_hz` while not.
+ *
+ * Page draw callbacks run from pages_draw(), with a framebuffer of the device screen's size bound
+ * and cleared to black, in the same coordinates as the device's own draw callback. Without
+ * framebuffer objects (gl_procs_framebuffer()), the shown page is drawn directly every time.
+ * Main thread only, with the GL context current for pages_draw() and pages_destroy().
+ *===--------------------------------------------------------------------------------------------===
+*/
+#ifndef _PAGES_H_
+#define _PAGES_H_
+
+#include <stdbool.h>
+
+typedef struct pages_s pages_t;
+
+typedef void (*page_draw_f)(int width, int height, void *refcon);
+
+typedef struct {
+    int pages;
+    unsigned flips;
+    unsigned refreshes;         // Of the page shown.
+    unsigned background;        // Of hidden pages.
+    unsigned blits;
+    unsigned direct;            // Draws of the shown page without a texture.
+    float refresh_us;           // Average CPU time to render a page.
+} pages_stats_t;
+
+// Pages for a `width` x `height` screen. `sched_slot` is the device's draw_sched.h slot, asked
+// for a redraw when the page shown changes or is invalidated.
+pages_t *pages_create(const char *name, int width, int height, int sched_slot,
+                      float background_hz);
+void pages_destroy(pages_t *pages);
+
+// Returns the page's index, or -1.
+int pages_add(pages_t *pages, const char *name, page_draw_f draw, void *refcon);
+
+void pages_set_live(pages_t *pages, int page, bool live);
+
+// The page's inputs changed: it's rendered again before it's next shown.
+void pages_invalidate(pages_t *pages, int page);
+void pages_invalidate_all(pages_t *pages);
+
+void pages_show(pages_t *pages, int page);
+int pages_shown(const pages_t *pages);
+int pages_count(const pages_t *pages);
+const char *pages_name(const pages_t *pages, int page);
+
+// Refreshes what's due and draws the page shown, from the device's draw callback.
+void pages_draw(pages_t *pages);
+
+void pages_get_stats(const pages_t *pages, pages_stats_t *out);
+
+#endif /* ifndef _PAGES_H_ */
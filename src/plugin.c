@@ -18,6 +18,24 @@
 #include <XPLMProcessing.h>
 
 #include "SystemGL.h"
+#include "main_queue.h"
+#include "draw_sched.h"
+#include "power.h"
+#include "profiler.h"
+#include "trace.h"
+#include "arena.h"
+#include "ownship.h"
+#include "navdata.h"
+#include "fms_mirror.h"
+#include "geo_batch.h"
+#include "terrain.h"
+#include "weather.h"
+#include "metar.h"
+#include "winds.h"
+#include "vector.h"
+#include "render_list.h"
+#include "symbols.h"
+#include "gfx.h"
 
 
 #define PLUGIN_SIG  "com.x-plane.avionics"
@@ -83,6 +101,24 @@ PLUGIN_API int XPluginEnable(void)
     menu_item = XPLMAppendMenuItem(plugins_menu, "Avionics Test", NULL, 0);
     menu = XPLMCreateMenu("Avionics Tests", plugins_menu, menu_item, NULL, NULL);
     
+    main_queue_init();
+    frame_arena_init();
+    profiler_init(menu);
+    trace_init(menu);
+    draw_sched_init();
+    power_init();
+    vec_init();
+    rlist_init();
+    sym_init();
+    ownship_init();
+    geo_batch_init();
+    log_msg("geo kernels: %s", geo_batch_isa_name(geo_batch_isa()));
+    navdata_init();
+    fms_mirror_init();
+    winds_init();
+    terrain_init();
+    weather_init();
+    metar_init();
 	stock_overrides_init(menu);
 	custom_device_init(menu);
     return 1;
@@ -90,8 +126,25 @@ PLUGIN_API int XPluginEnable(void)
 
 PLUGIN_API void XPluginDisable(void)
 {
+    main_queue_fini();
 	stock_overrides_fini();
 	custom_device_fini();
+    metar_fini();
+    weather_fini();
+    terrain_fini();
+    winds_fini();
+    fms_mirror_fini();
+    navdata_fini();
+    ownship_fini();
+    gfx_fini();
+    sym_fini();
+    rlist_fini();
+    vec_fini();
+    power_fini();
+    draw_sched_fini();
+    trace_fini();
+    profiler_fini();
+    frame_arena_fini();
     XPLMClearAllMenuItems(menu);
     XPLMDestroyMenu(menu);
 
@@ -0,0 +1,219 @@
+/*===--------------------------------------------------------------------------------------------===
+ * power.c
+ *
+ * Per-frame evaluation of the screen power and brightness model.
+ *===--------------------------------------------------------------------------------------------===
+ */
+#include "power.h"
+#include "draw_sched.h"
+#include "profiler.h"
+#include <XPLMProcessing.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+void log_msg(const char *fmt, ...);
+
+#define MAX_SLOTS           (32)
+// Longest step the warm-up fade takes, so a stutter doesn't skip it.
+#define MAX_STEP_S          (0.1f)
+// Brightness changes smaller than one 8-bit step don't need a redraw.
+#define REDRAW_STEP         (1.f / 255.f)
+
+typedef struct {
+    bool used;
+    char name[64];
+    XPLMAvionicsID handle;
+    int sched_slot;
+    const power_profile_t *profile;
+} slot_t;
+
+static slot_t slots[MAX_SLOTS];
+static int slot_end = 0;            // One past the last slot used.
+
+// The model, one element per slot, so that a frame is one pass over flat arrays. Unused slots
+// are evaluated too, with no bus and nothing to show for it.
+static float in_bus[MAX_SLOTS];
+static float in_rheo[MAX_SLOTS];
+static float bus_on[MAX_SLOTS];
+static float bus_off[MAX_SLOTS];
+static float warm_rate[MAX_SLOTS];  // Per second.
+static float rheo_curve[MAX_SLOTS][POWER_CURVE_POINTS];
+static float cell_curve[MAX_SLOTS][POWER_CURVE_POINTS];
+static float powered[MAX_SLOTS];    // 0 or 1.
+static float warm[MAX_SLOTS];
+static float brightness[MAX_SLOTS];
+static float drawn_brightness[MAX_SLOTS];   // As of the last redraw we asked for.
+
+static float ambient = 1.f;
+static XPLMFlightLoopID flight_loop = NULL;
+static prof_probe_t eval_probe = PROF_NO_PROBE;
+
+static inline float curve(const float *points, float x)
+{
+    x = fminf(fmaxf(x, 0.f), 1.f) * (float)(POWER_CURVE_POINTS - 1);
+    int i = (int)x;
+    if(i > POWER_CURVE_POINTS - 2)
+        i = POWER_CURVE_POINTS - 2;
+    return points[i] + (points[i + 1] - points[i]) * (x - (float)i);
+}
+
+static void evaluate(float dt)
+{
+    const float cell = ambient;
+    for(int i = 0; i < slot_end; ++i)
+    {
+        // A bus ratio of -1 means the device isn't wired into this aircraft: it stays on.
+        float threshold = powered[i] > 0.f ? bus_off[i] : bus_on[i];
+        float on = in_bus[i] < 0.f || in_bus[i] >= threshold ? 1.f : 0.f;
+        warm[i] = on * fminf(warm[i] + dt * warm_rate[i], 1.f);
+        powered[i] = on;
+        brightness[i] = warm[i] * curve(rheo_curve[i], in_rheo[i]) * curve(cell_curve[i], cell);
+    }
+}
+
+static float power_flight_loop(float since_call, float since_loop, int counter, void *refcon)
+{
+    (void)since_loop;
+    (void)counter;
+    (void)refcon;
+    PROF_SCOPE(eval_probe);
+
+    for(int i = 0; i < slot_end; ++i)
+    {
+        if(!slots[i].used)
+            continue;
+        in_bus[i] = XPLMGetAvionicsBusVoltsRatio(slots[i].handle);
+        in_rheo[i] = XPLMGetAvionicsBrightnessRheo(slots[i].handle);
+    }
+    evaluate(fminf(fmaxf(since_call, 0.f), MAX_STEP_S));
+
+    for(int i = 0; i < slot_end; ++i)
+    {
+        if(!slots[i].used || fabsf(brightness[i] - drawn_brightness[i]) < REDRAW_STEP)
+            continue;
+        drawn_brightness[i] = brightness[i];
+        draw_sched_invalidate(slots[i].sched_slot);
+    }
+    return -1.f;
+}
+
+int power_add(const char *name, XPLMAvionicsID handle, int sched_slot,
+              const power_profile_t *profile)
+{
+    if(!handle || !profile)
+        return -1;
+    for(int i = 0; i < MAX_SLOTS; ++i)
+    {
+        slot_t *slot = &slots[i];
+        if(slot->used)
+            continue;
+        memset(slot, 0, sizeof(*slot));
+        slot->used = true;
+        snprintf(slot->name, sizeof(slot->name), "%s", name);
+        slot->handle = handle;
+        slot->sched_slot = sched_slot;
+        slot->profile = profile;
+
+        bus_on[i] = profile->bus_on;
+        bus_off[i] = fminf(profile->bus_off, profile->bus_on);
+        warm_rate[i] = profile->warmup_s > 0.f ? 1.f / profile->warmup_s : 1e9f;
+        memcpy(rheo_curve[i], profile->rheo, sizeof(rheo_curve[i]));
+        memcpy(cell_curve[i], profile->cell, sizeof(cell_curve[i]));
+        // Taken to be running already: only a power loss from here on fades it out and back in.
+        in_bus[i] = -1.f;
+        in_rheo[i] = XPLMGetAvionicsBrightnessRheo(handle);
+        powered[i] = 1.f;
+        warm[i] = 1.f;
+        brightness[i] = drawn_brightness[i] = curve(profile->rheo, in_rheo[i])
+            * curve(profile->cell, ambient);
+        if(i >= slot_end)
+            slot_end = i + 1;
+        return i;
+    }
+    log_msg("power: no room left for %s", name);
+    return -1;
+}
+
+void power_remove(int slot)
+{
+    if(slot < 0 || slot >= MAX_SLOTS)
+        return;
+    slots[slot].used = false;
+    in_bus[slot] = 0.f;
+    brightness[slot] = 0.f;
+    while(slot_end > 0 && !slots[slot_end - 1].used)
+        slot_end -= 1;
+}
+
+float power_brightness_callback(int slot, float rheo, float cell, float bus)
+{
+    ambient = fminf(fmaxf(cell, 0.f), 1.f);
+    if(slot < 0 || slot >= MAX_SLOTS || !slots[slot].used)
+        return rheo;
+    // Fresher than what the flight loop read, for next frame.
+    in_rheo[slot] = rheo;
+    in_bus[slot] = bus;
+    return brightness[slot];
+}
+
+void power_get(int slot, power_state_t *out)
+{
+    if(slot < 0 || slot >= MAX_SLOTS || !slots[slot].used)
+    {
+        *out = (power_state_t){true, 1.f, 1.f};
+        return;
+    }
+    out->on = powered[slot] > 0.f;
+    out->warmup = warm[slot];
+    out->brightness = brightness[slot];
+}
+
+float power_brightness(int slot)
+{
+    power_state_t state;
+    power_get(slot, &state);
+    return state.brightness;
+}
+
+bool power_on(int slot)
+{
+    power_state_t state;
+    power_get(slot, &state);
+    return state.on;
+}
+
+void power_set_rheo(int slot, float rheo)
+{
+    if(slot < 0 || slot >= MAX_SLOTS || !slots[slot].used)
+        return;
+    rheo = fminf(fmaxf(rheo, 0.f), 1.f);
+    XPLMSetAvionicsBrightnessRheo(slots[slot].handle, rheo);
+    in_rheo[slot] = rheo;
+    log_msg("%s: brightness rheostat %.2f", slots[slot].name, rheo);
+}
+
+void power_init(void)
+{
+    memset(slots, 0, sizeof(slots));
+    slot_end = 0;
+    ambient = 1.f;
+    eval_probe = profiler_probe("power/evaluate");
+    XPLMCreateFlightLoop_t fl = (XPLMCreateFlightLoop_t){
+        .structSize = sizeof(XPLMCreateFlightLoop_t),
+        .phase = xplm_FlightLoop_Phase_AfterFlightModel,
+        .callbackFunc = power_flight_loop,
+        .refcon = NULL
+    };
+    flight_loop = XPLMCreateFlightLoop(&fl);
+    XPLMScheduleFlightLoop(flight_loop, -1.f, 1);
+}
+
+void power_fini(void)
+{
+    if(flight_loop)
+        XPLMDestroyFlightLoop(flight_loop);
+    flight_loop = NULL;
+    memset(slots, 0, sizeof(slots));
+    slot_end = 0;
+}
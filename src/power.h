@@ -0,0 +1,63 @@
+/*===--------------------------------------------------------------------------------------------===
+ * power.h
+ *
+ * Screen power and brightness model for every device we own, custom or stock.
+ *
+ * Each device registers with a profile: the bus voltage it powers up at and the lower one it
+ * drops out at, how long its backlight takes to warm up, and two curves: rheostat position to
+ * brightness, and photocell (ambient light) reading to a brightness scale. Once per frame, before
+ * anything draws, the inputs of all devices (bus volts ratio and rheostat, from the SDK) are
+ * gathered and the model is evaluated for all of them in one pass over flat arrays. Brightness
+ * callbacks and drawing code then only read the results.
+ *
+ * The photocell reading is only handed to custom devices' brightness callbacks; the last one seen
+ * stands for every device (there's one sun). Until there's one, it's taken as full daylight. Main
+ * thread only.
+ *===--------------------------------------------------------------------------------------------===
+*/
+#ifndef _POWER_H_
+#define _POWER_H_
+
+#include <stdbool.h>
+#include <XPLMDisplay.h>
+
+// Points of the curves, evenly spaced over [0, 1] and interpolated linearly.
+#define POWER_CURVE_POINTS  (5)
+
+typedef struct {
+    float bus_on;                       // Bus volts ratio the screen powers up at...
+    float bus_off;                      // ...and goes dark below. Lower, so a sagging bus doesn't
+                                        // make it flicker.
+    float warmup_s;                     // From power up to full brightness.
+    float rheo[POWER_CURVE_POINTS];     // Rheostat position to brightness.
+    float cell[POWER_CURVE_POINTS];     // Photocell reading to a scale of the above.
+} power_profile_t;
+
+typedef struct {
+    bool on;
+    float warmup;           // 0 at power up to 1 once warm.
+    float brightness;       // 0 to 1, everything included.
+} power_state_t;
+
+// Registers a device, with a profile that must outlive it. `sched_slot` is its draw_sched.h slot,
+// invalidated when its brightness or power changes, or -1. Returns a slot, or -1.
+int power_add(const char *name, XPLMAvionicsID handle, int sched_slot,
+              const power_profile_t *profile);
+void power_remove(int slot);
+
+// For a custom device's brightness callback: notes the photocell and returns this frame's
+// brightness. Doesn't evaluate anything.
+float power_brightness_callback(int slot, float rheo, float cell, float bus);
+
+// This frame's result, for drawing. Unknown slots are on, at full brightness.
+void power_get(int slot, power_state_t *out);
+float power_brightness(int slot);
+bool power_on(int slot);
+
+// Sets the device's brightness rheostat, clamped to [0, 1].
+void power_set_rheo(int slot, float rheo);
+
+void power_init(void);
+void power_fini(void);
+
+#endif /* ifndef _POWER_H_ */
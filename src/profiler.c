@@ -0,0 +1,515 @@
+/*===--------------------------------------------------------------------------------------------===
+ * profiler.c
+ *
+ * Per-thread callback histograms, and the in-sim window that shows them.
+ *
+ * Durations are bucketed in 64ns units with four sub-buckets per power of two, which keeps the
+ * error on percentiles under ~20% while fitting 64ns to several minutes in 128 buckets.
+ *===--------------------------------------------------------------------------------------------===
+ */
+#include "profiler.h"
+#include "draw_sched.h"
+#include "arena.h"
+#include <XPLMDisplay.h>
+#include <XPLMGraphics.h>
+#include <XPLMProcessing.h>
+#include <XPLMUtilities.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void log_msg(const char *fmt, ...);
+
+#define BUCKETS         (128)
+#define EPOCHS          (4)
+#define EPOCH_SECONDS   (1.f)
+#define UNIT_SHIFT      (6)
+#define NAME_LEN        (64)
+
+#define WINDOW_WIDTH    (560)
+#define WINDOW_HEIGHT   (420)
+#define LINE_HEIGHT     (14)
+
+typedef struct {
+    atomic_uint counts[EPOCHS][BUCKETS];
+    _Atomic uint64_t sum_ns[EPOCHS];
+    _Atomic uint64_t max_ns[EPOCHS];
+    atomic_uint stamp[EPOCHS];
+    _Atomic uint64_t total;
+} probe_hist_t;
+
+typedef struct thread_hist_s {
+    struct thread_hist_s *next;
+    probe_hist_t probes[PROF_MAX_PROBES];
+} thread_hist_t;
+
+static char probe_names[PROF_MAX_PROBES][NAME_LEN];
+static int probe_count = 0;
+
+static _Atomic(thread_hist_t *) threads = NULL;
+static atomic_uint epoch;
+// Bumped every time the profiler is (re)started, so threads know their histograms are stale.
+static atomic_uint generation;
+static atomic_bool running;
+// Threads inside profiler_record(), so profiler_fini() can wait for them before freeing.
+static atomic_uint recorders;
+static _Thread_local thread_hist_t *tls_hist = NULL;
+static _Thread_local unsigned tls_generation = 0;
+
+static XPLMFlightLoopID flight_loop = NULL;
+static XPLMWindowID window = NULL;
+static XPLMCommandRef toggle_cmd = NULL;
+static XPLMCommandRef dump_cmd = NULL;
+static prof_stats_t window_stats[PROF_MAX_PROBES];
+static int window_stats_count = 0;
+
+static inline unsigned bucket_index(uint64_t ns)
+{
+    uint64_t u = ns >> UNIT_SHIFT;
+    if(u < 4)
+        return (unsigned)u;
+    unsigned e = 63u - (unsigned)__builtin_clzll(u);
+    unsigned idx = (e - 1) * 4 + (unsigned)((u >> (e - 2)) & 3);
+    return idx < BUCKETS ? idx : BUCKETS - 1;
+}
+
+static uint64_t bucket_floor_ns(unsigned idx)
+{
+    if(idx < 4)
+        return (uint64_t)idx << UNIT_SHIFT;
+    unsigned e = idx / 4 + 1;
+    uint64_t u = (uint64_t)(4 + idx % 4) << (e - 2);
+    return u << UNIT_SHIFT;
+}
+
+static thread_hist_t *thread_hist(void)
+{
+    unsigned gen = atomic_load_explicit(&generation, memory_order_acquire);
+    if(tls_hist && tls_generation == gen)
+        return tls_hist;
+
+    // First sample on this thread since the profiler started: this is the only allocation the
+    // recording path ever makes.
+    thread_hist_t *hist = calloc(1, sizeof(*hist));
+    if(!hist)
+        return NULL;
+    hist->next = atomic_load_explicit(&threads, memory_order_relaxed);
+    while(!atomic_compare_exchange_weak_explicit(&threads, &hist->next, hist,
+                                                 memory_order_release, memory_order_relaxed))
+        ;
+    tls_hist = hist;
+    tls_generation = gen;
+    return hist;
+}
+
+prof_probe_t profiler_probe(const char *name)
+{
+    for(int i = 0; i < probe_count; ++i)
+    {
+        if(!strcmp(probe_names[i], name))
+            return i;
+    }
+    if(probe_count >= PROF_MAX_PROBES)
+    {
+        log_msg("profiler: too many probes, not tracking %s", name);
+        return PROF_NO_PROBE;
+    }
+    snprintf(probe_names[probe_count], NAME_LEN, "%s", name);
+    return probe_count++;
+}
+
+const char *profiler_probe_name(prof_probe_t probe)
+{
+    if(probe < 0 || probe >= probe_count)
+        return "";
+    return probe_names[probe];
+}
+
+static void record(thread_hist_t *hist, prof_probe_t probe, uint64_t start_ns, uint64_t end_ns)
+{
+    probe_hist_t *p = &hist->probes[probe];
+    unsigned e = atomic_load_explicit(&epoch, memory_order_relaxed);
+    unsigned slot = e % EPOCHS;
+    uint64_t ns = end_ns - start_ns;
+
+    // Only this thread writes to these counters, so plain load/store pairs are enough; the
+    // atomics are there so the window can read them without tearing.
+    if(atomic_load_explicit(&p->stamp[slot], memory_order_relaxed) != e)
+    {
+        for(int i = 0; i < BUCKETS; ++i)
+            atomic_store_explicit(&p->counts[slot][i], 0, memory_order_relaxed);
+        atomic_store_explicit(&p->sum_ns[slot], 0, memory_order_relaxed);
+        atomic_store_explicit(&p->max_ns[slot], 0, memory_order_relaxed);
+        atomic_store_explicit(&p->stamp[slot], e, memory_order_release);
+    }
+
+    atomic_uint *count = &p->counts[slot][bucket_index(ns)];
+    atomic_store_explicit(count, atomic_load_explicit(count, memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+    atomic_store_explicit(&p->sum_ns[slot],
+                          atomic_load_explicit(&p->sum_ns[slot], memory_order_relaxed) + ns,
+                          memory_order_relaxed);
+    if(ns > atomic_load_explicit(&p->max_ns[slot], memory_order_relaxed))
+        atomic_store_explicit(&p->max_ns[slot], ns, memory_order_relaxed);
+    atomic_store_explicit(&p->total, atomic_load_explicit(&p->total, memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+}
+
+void profiler_record(prof_probe_t probe, uint64_t start_ns, uint64_t end_ns)
+{
+    if(probe < 0 || probe >= PROF_MAX_PROBES || !atomic_load_explicit(&running, memory_order_relaxed))
+        return;
+
+    // Announce ourselves before looking at `running` again: either profiler_fini() sees us and
+    // waits, or we see it stopped and touch nothing.
+    atomic_fetch_add(&recorders, 1);
+    if(atomic_load(&running))
+    {
+        thread_hist_t *hist = thread_hist();
+        if(hist)
+            record(hist, probe, start_ns, end_ns);
+    }
+    atomic_fetch_sub_explicit(&recorders, 1, memory_order_release);
+}
+
+// Sums the rolling window of one probe across threads into `counts`.
+static void merge(prof_probe_t probe, uint64_t *counts, uint64_t *sum, uint64_t *max, uint64_t *total)
+{
+    memset(counts, 0, sizeof(uint64_t) * BUCKETS);
+    *sum = *max = *total = 0;
+    unsigned e = atomic_load_explicit(&epoch, memory_order_relaxed);
+
+    for(thread_hist_t *t = atomic_load_explicit(&threads, memory_order_acquire); t; t = t->next)
+    {
+        probe_hist_t *p = &t->probes[probe];
+        *total += atomic_load_explicit(&p->total, memory_order_relaxed);
+        for(int s = 0; s < EPOCHS; ++s)
+        {
+            unsigned stamp = atomic_load_explicit(&p->stamp[s], memory_order_acquire);
+            if(e - stamp >= EPOCHS)
+                continue;
+            for(int i = 0; i < BUCKETS; ++i)
+                counts[i] += atomic_load_explicit(&p->counts[s][i], memory_order_relaxed);
+            *sum += atomic_load_explicit(&p->sum_ns[s], memory_order_relaxed);
+            uint64_t m = atomic_load_explicit(&p->max_ns[s], memory_order_relaxed);
+            if(m > *max)
+                *max = m;
+        }
+    }
+}
+
+static float percentile_us(const uint64_t *counts, uint64_t n, float pct)
+{
+    uint64_t rank = (uint64_t)((float)n * pct);
+    uint64_t seen = 0;
+    for(unsigned i = 0; i < BUCKETS; ++i)
+    {
+        seen += counts[i];
+        if(seen > rank)
+        {
+            // Report the middle of the bucket.
+            uint64_t lo = bucket_floor_ns(i);
+            uint64_t hi = i + 1 < BUCKETS ? bucket_floor_ns(i + 1) : lo * 2;
+            return (float)(lo + hi) / 2000.f;
+        }
+    }
+    return 0.f;
+}
+
+bool profiler_stats(prof_probe_t probe, prof_stats_t *out)
+{
+    if(probe < 0 || probe >= probe_count)
+        return false;
+    uint64_t counts[BUCKETS], sum, max, total;
+    merge(probe, counts, &sum, &max, &total);
+
+    uint64_t n = 0;
+    for(int i = 0; i < BUCKETS; ++i)
+        n += counts[i];
+
+    *out = (prof_stats_t){
+        .name = probe_names[probe],
+        .calls = n,
+        .total_calls = total,
+        .mean_us = n ? (float)sum / (float)n / 1000.f : 0.f,
+        .p50_us = percentile_us(counts, n, 0.5f),
+        .p99_us = percentile_us(counts, n, 0.99f),
+        .max_us = (float)max / 1000.f,
+    };
+    return true;
+}
+
+int profiler_probe_count(void)
+{
+    return probe_count;
+}
+
+bool profiler_dump_csv(const char *summary_path, const char *histogram_path)
+{
+    FILE *summary = fopen(summary_path, "w");
+    FILE *histogram = fopen(histogram_path, "w");
+    if(!summary || !histogram)
+    {
+        if(summary)
+            fclose(summary);
+        if(histogram)
+            fclose(histogram);
+        return false;
+    }
+
+    fprintf(summary, "probe,window_calls,total_calls,mean_us,p50_us,p99_us,max_us\n");
+    fprintf(histogram, "probe,bucket_min_us,bucket_max_us,count\n");
+    for(int i = 0; i < probe_count; ++i)
+    {
+        prof_stats_t stats;
+        profiler_stats(i, &stats);
+        fprintf(summary, "\"%s\",%llu,%llu,%.3f,%.3f,%.3f,%.3f\n", stats.name,
+                (unsigned long long)stats.calls, (unsigned long long)stats.total_calls,
+                stats.mean_us, stats.p50_us, stats.p99_us, stats.max_us);
+
+        uint64_t counts[BUCKETS], sum, max, total;
+        merge(i, counts, &sum, &max, &total);
+        for(unsigned b = 0; b < BUCKETS; ++b)
+        {
+            if(!counts[b])
+                continue;
+            uint64_t lo = bucket_floor_ns(b);
+            uint64_t hi = b + 1 < BUCKETS ? bucket_floor_ns(b + 1) : lo * 2;
+            fprintf(histogram, "\"%s\",%.3f,%.3f,%llu\n", probe_names[i],
+                    (float)lo / 1000.f, (float)hi / 1000.f, (unsigned long long)counts[b]);
+        }
+    }
+    fclose(summary);
+    fclose(histogram);
+    return true;
+}
+
+static void refresh_window_stats(void)
+{
+    window_stats_count = 0;
+    for(int i = 0; i < probe_count; ++i)
+    {
+        if(profiler_stats(i, &window_stats[window_stats_count]) && window_stats[window_stats_count].total_calls)
+            window_stats_count += 1;
+    }
+}
+
+static float profiler_flight_loop(float since_call, float since_loop, int counter, void *refcon)
+{
+    (void)since_call;
+    (void)since_loop;
+    (void)counter;
+    (void)refcon;
+
+    atomic_fetch_add_explicit(&epoch, 1, memory_order_relaxed);
+    if(window && XPLMGetWindowIsVisible(window))
+        refresh_window_stats();
+    return EPOCH_SECONDS;
+}
+
+static void draw_window(XPLMWindowID id, void *refcon)
+{
+    (void)refcon;
+    int left, top, right, bottom;
+    XPLMGetWindowGeometry(id, &left, &top, &right, &bottom);
+    XPLMSetGraphicsState(0, 0, 0, 0, 1, 0, 0);
+
+    float white[3] = {1.f, 1.f, 1.f};
+    float grey[3] = {0.7f, 0.7f, 0.7f};
+    float amber[3] = {1.f, 0.75f, 0.f};
+    char line[160];
+    int x = left + 10;
+    int y = top - 20;
+
+    snprintf(line, sizeof(line), "draw budget: %.2f ms", (float)draw_sched_budget_us() / 1000.f);
+    XPLMDrawString(grey, x, y, line, NULL, xplmFont_Proportional);
+    y -= LINE_HEIGHT;
+
+    for(int i = 0; i < alloc_stats_count(); ++i)
+    {
+        alloc_stats_t mem;
+        if(!alloc_stats(i, &mem))
+            continue;
+        snprintf(line, sizeof(line), "%s: %zu/%zu kB, peak %zu kB, %u failed", mem.name,
+                 mem.used / 1024, mem.size / 1024, mem.peak / 1024, mem.failures);
+        XPLMDrawString(mem.failures ? amber : grey, x, y, line, NULL, xplmFont_Proportional);
+        y -= LINE_HEIGHT;
+    }
+    y -= LINE_HEIGHT;
+
+    snprintf(line, sizeof(line), "%-36s %8s %8s %8s %8s", "callback", "calls", "p50 us", "p99 us", "max us");
+    XPLMDrawString(grey, x, y, line, NULL, xplmFont_Basic);
+    y -= LINE_HEIGHT;
+
+    for(int i = 0; i < window_stats_count && y > bottom + LINE_HEIGHT; ++i)
+    {
+        const prof_stats_t *s = &window_stats[i];
+        snprintf(line, sizeof(line), "%-36.36s %8llu %8.1f %8.1f %8.1f", s->name,
+                 (unsigned long long)s->calls, s->p50_us, s->p99_us, s->max_us);
+        XPLMDrawString(s->p99_us > 1000.f ? amber : white, x, y, line, NULL, xplmFont_Basic);
+        y -= LINE_HEIGHT;
+    }
+}
+
+static int window_click(XPLMWindowID id, int x, int y, XPLMMouseStatus mouse, void *refcon)
+{
+    (void)id;
+    (void)x;
+    (void)y;
+    (void)mouse;
+    (void)refcon;
+    return 1;
+}
+
+static void window_key(XPLMWindowID id, char key, XPLMKeyFlags flags, char vkey, void *refcon, int losing)
+{
+    (void)id;
+    (void)key;
+    (void)flags;
+    (void)vkey;
+    (void)refcon;
+    (void)losing;
+}
+
+static XPLMCursorStatus window_cursor(XPLMWindowID id, int x, int y, void *refcon)
+{
+    (void)id;
+    (void)x;
+    (void)y;
+    (void)refcon;
+    return xplm_CursorDefault;
+}
+
+static int window_wheel(XPLMWindowID id, int x, int y, int wheel, int clicks, void *refcon)
+{
+    (void)id;
+    (void)x;
+    (void)y;
+    (void)wheel;
+    (void)clicks;
+    (void)refcon;
+    return 1;
+}
+
+static void create_window(void)
+{
+    int left, top, right, bottom;
+    XPLMGetScreenBoundsGlobal(&left, &top, &right, &bottom);
+
+    XPLMCreateWindow_t params = (XPLMCreateWindow_t){
+        .structSize = sizeof(XPLMCreateWindow_t),
+        .left = left + 50,
+        .top = top - 150,
+        .right = left + 50 + WINDOW_WIDTH,
+        .bottom = top - 150 - WINDOW_HEIGHT,
+        .visible = 0,
+        .drawWindowFunc = draw_window,
+        .handleMouseClickFunc = window_click,
+        .handleKeyFunc = window_key,
+        .handleCursorFunc = window_cursor,
+        .handleMouseWheelFunc = window_wheel,
+        .refcon = NULL,
+        .decorateAsFloatingWindow = xplm_WindowDecorationRoundRectangle,
+        .layer = xplm_WindowLayerFloatingWindows,
+        .handleRightClickFunc = window_click,
+    };
+    window = XPLMCreateWindowEx(&params);
+    XPLMSetWindowPositioningMode(window, xplm_WindowPositionFree, -1);
+    XPLMSetWindowResizingLimits(window, 300, 200, 1200, 1200);
+    XPLMSetWindowTitle(window, "Avionics Profiler");
+}
+
+static int handle_toggle(XPLMCommandRef cmd, XPLMCommandPhase phase, void *refcon)
+{
+    (void)cmd;
+    (void)refcon;
+
+    if(phase != xplm_CommandBegin)
+        return 1;
+    if(!window)
+        create_window();
+    int visible = !XPLMGetWindowIsVisible(window);
+    if(visible)
+        refresh_window_stats();
+    XPLMSetWindowIsVisible(window, visible);
+    return 1;
+}
+
+static int handle_dump(XPLMCommandRef cmd, XPLMCommandPhase phase, void *refcon)
+{
+    (void)cmd;
+    (void)refcon;
+
+    if(phase != xplm_CommandBegin)
+        return 1;
+
+    char root[512];
+    char summary[600];
+    char histogram[600];
+    const char *sep = XPLMGetDirectorySeparator();
+    XPLMGetSystemPath(root);
+    snprintf(summary, sizeof(summary), "%sOutput%savionics_profile.csv", root, sep);
+    snprintf(histogram, sizeof(histogram), "%sOutput%savionics_histograms.csv", root, sep);
+
+    if(profiler_dump_csv(summary, histogram))
+        log_msg("profiler: wrote %s and %s", summary, histogram);
+    else
+        log_msg("profiler: cannot write %s", summary);
+    return 1;
+}
+
+void profiler_init(XPLMMenuID menu)
+{
+    probe_count = 0;
+    atomic_store(&epoch, 0);
+    atomic_fetch_add(&generation, 1);
+    atomic_store(&running, true);
+
+    XPLMCreateFlightLoop_t fl = (XPLMCreateFlightLoop_t){
+        .structSize = sizeof(XPLMCreateFlightLoop_t),
+        .phase = xplm_FlightLoop_Phase_BeforeFlightModel,
+        .callbackFunc = profiler_flight_loop,
+        .refcon = NULL
+    };
+    flight_loop = XPLMCreateFlightLoop(&fl);
+    XPLMScheduleFlightLoop(flight_loop, EPOCH_SECONDS, 1);
+
+    toggle_cmd = XPLMCreateCommand("laminar/avionics_test/toggle_profiler", "Toggle Avionics Profiler");
+    XPLMRegisterCommandHandler(toggle_cmd, handle_toggle, 1, NULL);
+    dump_cmd = XPLMCreateCommand("laminar/avionics_test/dump_profile", "Dump Avionics Profile to CSV");
+    XPLMRegisterCommandHandler(dump_cmd, handle_dump, 1, NULL);
+
+    if(menu)
+    {
+        XPLMAppendMenuItemWithCommand(menu, "Toggle Profiler", toggle_cmd);
+        XPLMAppendMenuItemWithCommand(menu, "Dump Profile to CSV", dump_cmd);
+    }
+}
+
+void profiler_fini(void)
+{
+    atomic_store(&running, false);
+    XPLMUnregisterCommandHandler(toggle_cmd, handle_toggle, 1, NULL);
+    XPLMUnregisterCommandHandler(dump_cmd, handle_dump, 1, NULL);
+    if(window)
+        XPLMDestroyWindow(window);
+    window = NULL;
+    if(flight_loop)
+        XPLMDestroyFlightLoop(flight_loop);
+    flight_loop = NULL;
+
+    // Threads that recorded samples will allocate fresh histograms when they see the new
+    // generation; everything recorded so far can go, once nobody is still writing to it.
+    while(atomic_load_explicit(&recorders, memory_order_acquire))
+        ;
+    atomic_fetch_add(&generation, 1);
+    thread_hist_t *t = atomic_exchange(&threads, NULL);
+    while(t)
+    {
+        thread_hist_t *next = t->next;
+        free(t);
+        t = next;
+    }
+    window_stats_count = 0;
+}
@@ -0,0 +1,88 @@
+/*===--------------------------------------------------------------------------------------------===
+ * profiler.h
+ *
+ * Lightweight callback instrumentation.
+ *
+ * Each instrumented piece of code is a "probe", registered once by name from the main thread.
+ * PROF_SCOPE(probe) times the enclosing block and records the duration into a histogram owned by
+ * the calling thread, so recording is an atomic add and a few relaxed stores, and never takes a
+ * lock or allocates (after the thread's first sample). Histograms are kept per one-second epoch, and
+ * the profiler window merges the last few epochs to show rolling p50/p99/max per probe. When
+ * tracing is on, the same scopes also feed the timeline recorder in trace.h.
+ *===--------------------------------------------------------------------------------------------===
+*/
+#ifndef _PROFILER_H_
+#define _PROFILER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <XPLMMenus.h>
+#include "clock.h"
+#include "trace.h"
+
+#define PROF_MAX_PROBES (128)
+#define PROF_NO_PROBE   (-1)
+
+typedef int prof_probe_t;
+
+typedef struct {
+    prof_probe_t probe;
+    uint64_t start;
+} prof_scope_t;
+
+typedef struct {
+    const char *name;
+    uint64_t calls;         // Calls inside the rolling window.
+    uint64_t total_calls;   // Calls since the profiler was started.
+    float mean_us;
+    float p50_us;
+    float p99_us;
+    float max_us;
+} prof_stats_t;
+
+// Registers a probe, or returns the existing one with the same name. Main thread only.
+prof_probe_t profiler_probe(const char *name);
+const char *profiler_probe_name(prof_probe_t probe);
+
+void profiler_record(prof_probe_t probe, uint64_t start_ns, uint64_t end_ns);
+
+static inline prof_scope_t profiler_begin(prof_probe_t probe)
+{
+    uint64_t now = clock_now_ns();
+    if(trace_enabled())
+        trace_event(probe, TRACE_BEGIN, now);
+    return (prof_scope_t){.probe = probe, .start = now};
+}
+
+static inline void profiler_end(prof_scope_t *scope)
+{
+    uint64_t now = clock_now_ns();
+    if(trace_enabled())
+        trace_event(scope->probe, TRACE_END, now);
+    profiler_record(scope->probe, scope->start, now);
+}
+
+#define PROF_CONCAT_(a, b) a##b
+#define PROF_CONCAT(a, b) PROF_CONCAT_(a, b)
+
+#if defined(__GNUC__)
+// Times the rest of the enclosing block, including early returns.
+#define PROF_SCOPE(probe) \
+    prof_scope_t PROF_CONCAT(prof_scope_, __LINE__) __attribute__((cleanup(profiler_end))) \
+        = profiler_begin(probe)
+#else
+#define PROF_SCOPE(probe) (void)(probe)
+#endif
+
+// Merges the rolling-window histograms of every thread for one probe.
+bool profiler_stats(prof_probe_t probe, prof_stats_t *out);
+int profiler_probe_count(void);
+
+// Writes summary statistics and raw histograms as CSV. Returns false if the files can't be opened.
+bool profiler_dump_csv(const char *summary_path, const char *histogram_path);
+
+void profiler_init(XPLMMenuID menu);
+// Waits for threads still inside profiler_record() before freeing their histograms.
+void profiler_fini(void);
+
+#endif /* ifndef _PROFILER_H_ */
@@ -0,0 +1,413 @@
+/*===--------------------------------------------------------------------------------------------===
+ * raster.c
+ *
+ * Coverage-based CPU rasterizer and 5x7 bitmap font.
+ *===--------------------------------------------------------------------------------------------===
+ */
+#include "raster.h"
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define RASTER_HAVE_SSE2 1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#define RASTER_HAVE_NEON 1
+#include <arm_neon.h>
+#endif
+
+// Rows top to bottom, bit 4 is the leftmost column.
+static const uint8_t font_digits[10][RASTER_FONT_H] = {
+    {0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E},
+    {0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E},
+    {0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F},
+    {0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E},
+    {0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02},
+    {0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E},
+    {0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E},
+    {0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08},
+    {0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E},
+    {0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C},
+};
+
+static const uint8_t font_letters[26][RASTER_FONT_H] = {
+    {0x0E, 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11},
+    {0x1E, 0x11, 0x11, 0x1E, 0x11, 0x11, 0x1E},
+    {0x0E, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0E},
+    {0x1C, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1C},
+    {0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x1F},
+    {0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x10},
+    {0x0E, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0F},
+    {0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11},
+    {0x0E, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E},
+    {0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0C},
+    {0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11},
+    {0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1F},
+    {0x11, 0x1B, 0x15, 0x15, 0x11, 0x11, 0x11},
+    {0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11},
+    {0x0E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E},
+    {0x1E, 0x11, 0x11, 0x1E, 0x10, 0x10, 0x10},
+    {0x0E, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0D},
+    {0x1E, 0x11, 0x11, 0x1E, 0x14, 0x12, 0x11},
+    {0x0F, 0x10, 0x10, 0x0E, 0x01, 0x01, 0x1E},
+    {0x1F, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04},
+    {0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E},
+    {0x11, 0x11, 0x11, 0x11, 0x11, 0x0A, 0x04},
+    {0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0A},
+    {0x11, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x11},
+    {0x11, 0x11, 0x11, 0x0A, 0x04, 0x04, 0x04},
+    {0x1F, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1F},
+};
+
+static const uint8_t glyph_dash[RASTER_FONT_H] = {0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00};
+static const uint8_t glyph_dot[RASTER_FONT_H] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C};
+static const uint8_t glyph_slash[RASTER_FONT_H] = {0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00};
+static const uint8_t glyph_colon[RASTER_FONT_H] = {0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00};
+static const uint8_t glyph_comma[RASTER_FONT_H] = {0x00, 0x00, 0x00, 0x00, 0x0C, 0x04, 0x08};
+
+static const uint8_t *glyph(char c)
+{
+    if(c >= '0' && c <= '9')
+        return font_digits[c - '0'];
+    if(c >= 'A' && c <= 'Z')
+        return font_letters[c - 'A'];
+    if(c >= 'a' && c <= 'z')
+        return font_letters[c - 'a'];
+    switch(c) {
+    case '-': return glyph_dash;
+    case '.': return glyph_dot;
+    case '/': return glyph_slash;
+    case ':': return glyph_colon;
+    case ',': return glyph_comma;
+    default: return NULL;
+    }
+}
+
+static inline uint8_t to_byte(float v)
+{
+    return (uint8_t)(v * 255.f + 0.5f);
+}
+
+// Blends `color` over one pixel with the given coverage. Coordinates must be in the image.
+static inline void blend(raster_t *img, int x, int y, raster_color_t color, float coverage)
+{
+    float a = color.a * coverage;
+    float keep = 1.f - a;
+    uint8_t *p = img->pixels + 4 * ((size_t)y * (size_t)img->width + (size_t)x);
+    p[0] = to_byte(color.r * a + (p[0] / 255.f) * keep);
+    p[1] = to_byte(color.g * a + (p[1] / 255.f) * keep);
+    p[2] = to_byte(color.b * a + (p[2] / 255.f) * keep);
+    p[3] = to_byte(a + (p[3] / 255.f) * keep);
+}
+
+static inline float clamp01(float v)
+{
+    return v < 0.f ? 0.f : (v > 1.f ? 1.f : v);
+}
+
+// Pixel bounds of [lo, hi] clipped to the image, along one axis.
+static inline void span(float lo, float hi, int size, int *out_lo, int *out_hi)
+{
+    *out_lo = (int)floorf(lo);
+    *out_hi = (int)ceilf(hi);
+    if(*out_lo < 0)
+        *out_lo = 0;
+    if(*out_hi > size - 1)
+        *out_hi = size - 1;
+}
+
+void raster_clear(raster_t *img, raster_color_t color)
+{
+    uint8_t px[4] = {
+        to_byte(color.r * color.a), to_byte(color.g * color.a), to_byte(color.b * color.a),
+        to_byte(color.a)
+    };
+    size_t count = (size_t)img->width * (size_t)img->height;
+    for(size_t i = 0; i < count; ++i)
+    {
+        img->pixels[4 * i + 0] = px[0];
+        img->pixels[4 * i + 1] = px[1];
+        img->pixels[4 * i + 2] = px[2];
+        img->pixels[4 * i + 3] = px[3];
+    }
+}
+
+// x / 255, rounded, for x up to 255 * 255.
+static inline uint32_t div255(uint32_t x)
+{
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+// Blends a premultiplied colour over `count` pixels at full coverage. The vector paths compute
+// exactly what the scalar one does, so images don't depend on the CPU that drew them.
+static void blend_span(uint8_t *p, int count, const uint8_t src[4])
+{
+    uint32_t packed;
+    memcpy(&packed, src, 4);
+    if(src[3] == 255)
+    {
+        for(int i = 0; i < count; ++i)
+            memcpy(p + 4 * i, &packed, 4);
+        return;
+    }
+
+    uint32_t keep = 255u - src[3];
+    int i = 0;
+#if RASTER_HAVE_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i k = _mm_set1_epi16((short)keep);
+    const __m128i half = _mm_set1_epi16(128);
+    const __m128i color = _mm_set1_epi32((int)packed);
+    for(; i + 4 <= count; i += 4)
+    {
+        __m128i d = _mm_loadu_si128((const __m128i *)(p + 4 * i));
+        __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), k), half);
+        __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), k), half);
+        lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+        hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+        _mm_storeu_si128((__m128i *)(p + 4 * i),
+                         _mm_adds_epu8(_mm_packus_epi16(lo, hi), color));
+    }
+#elif RASTER_HAVE_NEON
+    const uint8x8_t k = vdup_n_u8((uint8_t)keep);
+    const uint16x8_t half = vdupq_n_u16(128);
+    const uint8x16_t color = vreinterpretq_u8_u32(vdupq_n_u32(packed));
+    for(; i + 4 <= count; i += 4)
+    {
+        uint8x16_t d = vld1q_u8(p + 4 * i);
+        uint16x8_t lo = vaddq_u16(vmull_u8(vget_low_u8(d), k), half);
+        uint16x8_t hi = vaddq_u16(vmull_u8(vget_high_u8(d), k), half);
+        uint8x8_t lo8 = vshrn_n_u16(vaddq_u16(lo, vshrq_n_u16(lo, 8)), 8);
+        uint8x8_t hi8 = vshrn_n_u16(vaddq_u16(hi, vshrq_n_u16(hi, 8)), 8);
+        vst1q_u8(p + 4 * i, vqaddq_u8(vcombine_u8(lo8, hi8), color));
+    }
+#endif
+    for(; i < count; ++i)
+    {
+        uint8_t *d = p + 4 * i;
+        for(int c = 0; c < 4; ++c)
+        {
+            uint32_t v = src[c] + div255(d[c] * keep);
+            d[c] = (uint8_t)(v > 255 ? 255 : v);
+        }
+    }
+}
+
+// How much of the pixel [i, i + 1) lies within [lo, hi].
+static inline float overlap(int i, float lo, float hi)
+{
+    return clamp01(fminf(hi, (float)i + 1.f) - fmaxf(lo, (float)i));
+}
+
+void raster_rect(raster_t *img, float x0, float y0, float x1, float y1, raster_color_t color)
+{
+    float lx = fminf(x0, x1), hx = fmaxf(x0, x1);
+    float ly = fminf(y0, y1), hy = fmaxf(y0, y1);
+    int xa, xb, ya, yb;
+    span(lx, hx - 1.f, img->width, &xa, &xb);
+    span(ly, hy - 1.f, img->height, &ya, &yb);
+    if(xa > xb || ya > yb)
+        return;
+
+    // Columns the rectangle covers completely, [ia, ib].
+    int ia = (int)ceilf(lx), ib = (int)floorf(hx) - 1;
+    ia = ia < xa ? xa : ia;
+    ib = ib > xb ? xb : ib;
+
+    float a = clamp01(color.a);
+    uint8_t src[4] = {to_byte(color.r * a), to_byte(color.g * a), to_byte(color.b * a), to_byte(a)};
+    for(int y = ya; y <= yb; ++y)
+    {
+        float cy = overlap(y, ly, hy);
+        if(cy <= 0.f)
+            continue;
+        uint8_t *row = img->pixels + 4 * (size_t)y * (size_t)img->width;
+        if(cy < 1.f || ia > ib)
+        {
+            for(int x = xa; x <= xb; ++x)
+            {
+                float coverage = cy * overlap(x, lx, hx);
+                if(coverage > 0.f)
+                    blend(img, x, y, color, coverage);
+            }
+            continue;
+        }
+        for(int x = xa; x < ia; ++x)
+            blend(img, x, y, color, overlap(x, lx, hx));
+        blend_span(row + 4 * (size_t)ia, ib - ia + 1, src);
+        for(int x = ib + 1; x <= xb; ++x)
+        {
+            float coverage = overlap(x, lx, hx);
+            if(coverage > 0.f)
+                blend(img, x, y, color, coverage);
+        }
+    }
+}
+
+// Solves lo <= a * x <= hi for x, narrowing [*x_lo, *x_hi]. Returns false if nothing's left.
+static inline bool narrow(float a, float lo, float hi, float *x_lo, float *x_hi)
+{
+    if(fabsf(a) < 1e-6f)
+        return lo <= 0.f && hi >= 0.f;
+    float p = lo / a, q = hi / a;
+    *x_lo = fmaxf(*x_lo, fminf(p, q));
+    *x_hi = fminf(*x_hi, fmaxf(p, q));
+    return *x_lo <= *x_hi;
+}
+
+// The x interval where the row at height `py` comes within `r` of the segment from the origin to
+// (dx, dy): the union of the two end caps and the band between them, which is one interval
+// because the shape is convex. Returns false if the row misses it.
+static bool capsule_row(float dx, float dy, float len, float r, float py, float *lo, float *hi)
+{
+    *lo = INFINITY;
+    *hi = -INFINITY;
+    const float ends[2][2] = {{0.f, 0.f}, {dx, dy}};
+    for(int i = 0; i < 2; ++i)
+    {
+        float ey = py - ends[i][1];
+        if(fabsf(ey) >= r)
+            continue;
+        float w = sqrtf(r * r - ey * ey);
+        *lo = fminf(*lo, ends[i][0] - w);
+        *hi = fmaxf(*hi, ends[i][0] + w);
+    }
+
+    // Along the segment: 0 <= p.d <= len^2. Across it: |d x p| <= r * len.
+    float band_lo = -INFINITY, band_hi = INFINITY;
+    if(len > 1e-3f
+       && narrow(dx, -py * dy, len * len - py * dy, &band_lo, &band_hi)
+       && narrow(-dy, -r * len - dx * py, r * len - dx * py, &band_lo, &band_hi))
+    {
+        *lo = fminf(*lo, band_lo);
+        *hi = fmaxf(*hi, band_hi);
+    }
+    return *lo <= *hi;
+}
+
+void raster_line(raster_t *img, float x0, float y0, float x1, float y1, float width,
+                 raster_color_t color)
+{
+    float half = width * 0.5f;
+    int xa, xb, ya, yb;
+    span(fminf(x0, x1) - half - 1.f, fmaxf(x0, x1) + half + 1.f, img->width, &xa, &xb);
+    span(fminf(y0, y1) - half - 1.f, fmaxf(y0, y1) + half + 1.f, img->height, &ya, &yb);
+
+    float dx = x1 - x0, dy = y1 - y0;
+    float len_sq = dx * dx + dy * dy;
+    float inv_len_sq = len_sq > 1e-6f ? 1.f / len_sq : 0.f;
+    float reach = half + 0.5f;
+    for(int y = ya; y <= yb; ++y)
+    {
+        float py = (float)y + 0.5f - y0;
+        // Only visit the part of the row the stroke can reach, not its whole bounding box.
+        float lo, hi;
+        if(!capsule_row(dx, dy, sqrtf(len_sq), reach, py, &lo, &hi))
+            continue;
+        int row_a = (int)floorf(x0 + lo - 0.5f) - 1, row_b = (int)ceilf(x0 + hi - 0.5f) + 1;
+        row_a = row_a < xa ? xa : row_a;
+        row_b = row_b > xb ? xb : row_b;
+        for(int x = row_a; x <= row_b; ++x)
+        {
+            float px = (float)x + 0.5f - x0;
+            float t = clamp01((px * dx + py * dy) * inv_len_sq);
+            float ex = px - t * dx, ey = py - t * dy;
+            float coverage = clamp01(half + 0.5f - sqrtf(ex * ex + ey * ey));
+            if(coverage > 0.f)
+                blend(img, x, y, color, coverage);
+        }
+    }
+}
+
+void raster_ring(raster_t *img, float cx, float cy, float r, float width, raster_color_t color)
+{
+    float half = width * 0.5f;
+    float reach = r + half + 1.f;
+    int xa, xb, ya, yb;
+    span(cx - reach, cx + reach, img->width, &xa, &xb);
+    span(cy - reach, cy + reach, img->height, &ya, &yb);
+    for(int y = ya; y <= yb; ++y)
+    {
+        float py = (float)y + 0.5f - cy;
+        for(int x = xa; x <= xb; ++x)
+        {
+            float px = (float)x + 0.5f - cx;
+            float d = fabsf(sqrtf(px * px + py * py) - r);
+            float coverage = clamp01(half + 0.5f - d);
+            if(coverage > 0.f)
+                blend(img, x, y, color, coverage);
+        }
+    }
+}
+
+void raster_disc(raster_t *img, float cx, float cy, float r, raster_color_t color)
+{
+    float reach = r + 1.f;
+    int xa, xb, ya, yb;
+    span(cx - reach, cx + reach, img->width, &xa, &xb);
+    span(cy - reach, cy + reach, img->height, &ya, &yb);
+    for(int y = ya; y <= yb; ++y)
+    {
+        float py = (float)y + 0.5f - cy;
+        for(int x = xa; x <= xb; ++x)
+        {
+            float px = (float)x + 0.5f - cx;
+            float coverage = clamp01(r + 0.5f - sqrtf(px * px + py * py));
+            if(coverage > 0.f)
+                blend(img, x, y, color, coverage);
+        }
+    }
+}
+
+int raster_text(raster_t *img, int x, int y, const char *text, raster_color_t color)
+{
+    int start = x;
+    for(const char *c = text; *c; ++c, x += RASTER_FONT_ADVANCE)
+    {
+        const uint8_t *rows = glyph(*c);
+        if(!rows)
+            continue;
+        for(int row = 0; row < RASTER_FONT_H; ++row)
+        {
+            int py = y + RASTER_FONT_H - 1 - row;
+            if(py < 0 || py >= img->height)
+                continue;
+            for(int col = 0; col < RASTER_FONT_W; ++col)
+            {
+                int px = x + col;
+                if(px < 0 || px >= img->width || !(rows[row] & (0x10 >> col)))
+                    continue;
+                blend(img, px, py, color, 1.f);
+            }
+        }
+    }
+    return x - start;
+}
+
+int raster_text_width(const char *text)
+{
+    int count = 0;
+    while(text[count])
+        count += 1;
+    return count * RASTER_FONT_ADVANCE;
+}
+
+bool raster_write_ppm(const raster_t *img, const char *path)
+{
+    FILE *f = fopen(path, "wb");
+    if(!f)
+        return false;
+    fprintf(f, "P6\n%d %d\n255\n", img->width, img->height);
+    bool ok = true;
+    // PPM rows run top to bottom.
+    for(int y = img->height - 1; y >= 0 && ok; --y)
+    {
+        const uint8_t *row = img->pixels + 4 * (size_t)y * (size_t)img->width;
+        for(int x = 0; x < img->width && ok; ++x)
+            ok = fwrite(row + 4 * x, 1, 3, f) == 3;
+    }
+    return fclose(f) == 0 && ok;
+}
@@ -0,0 +1,56 @@
+/*===--------------------------------------------------------------------------------------------===
+ * raster.h
+ *
+ * Small CPU rasterizer for content drawn off the main thread and uploaded as textures later.
+ *
+ * Images are 8-bit RGBA, premultiplied, with row 0 at the bottom so pixel coordinates match the
+ * y-up coordinates avionics draw callbacks use. Shapes are anti-aliased by coverage (distance to
+ * the shape's edge), which is plenty for map symbols a few pixels across. Text uses a built-in
+ * 5x7 font covering A-Z, 0-9 and a little punctuation; lowercase is drawn as uppercase.
+ *
+ * Nothing here allocates or touches the XPLM API, so it's safe from any thread, and usable outside
+ * the plugin (see gfx_soft.c).
+ *===--------------------------------------------------------------------------------------------===
+*/
+#ifndef _RASTER_H_
+#define _RASTER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define RASTER_FONT_W       (5)
+#define RASTER_FONT_H       (7)
+#define RASTER_FONT_ADVANCE (6)
+
+typedef struct {
+    int width, height;
+    uint8_t *pixels;    // width * height * 4 bytes.
+} raster_t;
+
+// Straight (not premultiplied) colour, 0 to 1.
+typedef struct {
+    float r, g, b, a;
+} raster_color_t;
+
+void raster_clear(raster_t *img, raster_color_t color);
+
+// Fills the rectangle between (x0, y0) and (x1, y1). Edges that fall between pixels are
+// anti-aliased by the area covered; whole rows are filled a vector register at a time.
+void raster_rect(raster_t *img, float x0, float y0, float x1, float y1, raster_color_t color);
+
+// Line of the given width with round caps.
+void raster_line(raster_t *img, float x0, float y0, float x1, float y1, float width,
+                 raster_color_t color);
+// Circle outline of radius r, centred on the outline.
+void raster_ring(raster_t *img, float cx, float cy, float r, float width, raster_color_t color);
+void raster_disc(raster_t *img, float cx, float cy, float r, raster_color_t color);
+
+// Draws text with its bottom-left corner at (x, y). Returns the width drawn, in pixels.
+int raster_text(raster_t *img, int x, int y, const char *text, raster_color_t color);
+int raster_text_width(const char *text);
+
+// Writes the image as a binary PPM, composited over black. Returns false if the file can't be
+// written.
+bool raster_write_ppm(const raster_t *img, const char *path);
+
+#endif /* ifndef _RASTER_H_ */
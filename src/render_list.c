@@ -0,0 +1,238 @@
+/*===--------------------------------------------------------------------------------------------===
+ * render_list.c
+ *
+ * Per-frame command list shared by all devices' gfx drawing.
+ *===--------------------------------------------------------------------------------------------===
+ */
+#include "render_list.h"
+#include "arena.h"
+#include "clock.h"
+#include "draw_sched.h"
+#include "profiler.h"
+#include "vector.h"
+#include <XPLMProcessing.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void log_msg(const char *fmt, ...);
+
+#define MAX_LISTS           (64)
+// Commands in one frame's batch, for every list together. Allocated once, never grown: past this,
+// commands are dropped and counted.
+#define MAX_CMDS            (4096)
+
+typedef enum {
+    CMD_GEOMETRY,           // A range of the retained vertex batch.
+    CMD_TEXT,
+} cmd_type_t;
+
+typedef struct {
+    cmd_type_t type;
+    int first, count;
+    int x, y;
+    const char *text;       // In the frame arena.
+    float color[4];
+    gfx_font_t font;
+} cmd_t;
+
+typedef struct {
+    bool used;
+    char name[64];
+    int sched_slot;
+    rlist_prepare_f prepare;
+    void *refcon;
+    int first_cmd, cmd_count;
+    int cycle;              // Frame the commands were recorded for; -1 if none.
+} list_t;
+
+static list_t lists[MAX_LISTS];
+static cmd_t *cmds = NULL;
+static int cmd_count = 0;
+
+static bool recording = false;
+static int geometry_start = 0;  // vec_queued() when the pending geometry range began.
+static int batch_cycle = -1;
+
+static rlist_stats_t stats;
+static prof_probe_t prepare_probe = PROF_NO_PROBE;
+
+static cmd_t *push_cmd(cmd_type_t type)
+{
+    if(!cmds || cmd_count == MAX_CMDS)
+    {
+        stats.dropped += 1;
+        return NULL;
+    }
+    cmd_t *cmd = &cmds[cmd_count++];
+    memset(cmd, 0, sizeof(*cmd));
+    cmd->type = type;
+    return cmd;
+}
+
+// Turns what's been queued since the last command into a geometry range.
+static void close_geometry(void)
+{
+    int queued = vec_queued();
+    if(queued == geometry_start)
+        return;
+    cmd_t *cmd = push_cmd(CMD_GEOMETRY);
+    if(cmd)
+    {
+        cmd->first = geometry_start;
+        cmd->count = queued - geometry_start;
+    }
+    geometry_start = queued;
+}
+
+static void record(list_t *list, int cycle)
+{
+    unsigned dropped = stats.dropped;
+    list->first_cmd = cmd_count;
+    recording = true;
+    list->prepare(list->refcon);
+    close_geometry();
+    recording = false;
+    list->cmd_count = cmd_count - list->first_cmd;
+    // A list that didn't fit would replay incomplete; it draws directly instead.
+    list->cycle = stats.dropped == dropped ? cycle : -1;
+}
+
+static void prepare_batch(int cycle)
+{
+    PROF_SCOPE(prepare_probe);
+    uint64_t start = clock_now_ns();
+    // Anything queued to be drawn directly goes now, so the batch starts at vertex 0.
+    vec_flush();
+    cmd_count = 0;
+    geometry_start = 0;
+
+    unsigned prepared = 0;
+    for(int i = 0; i < MAX_LISTS; ++i)
+    {
+        list_t *list = &lists[i];
+        if(!list->used)
+            continue;
+        if(list->sched_slot >= 0 && !draw_sched_expected(list->sched_slot))
+            continue;
+        record(list, cycle);
+        prepared += 1;
+    }
+    stats.vertices = (unsigned)vec_retain();
+    stats.batches += 1;
+    stats.prepared = prepared;
+    stats.commands = (unsigned)cmd_count;
+    stats.prepare_us = (float)(clock_now_ns() - start) / 1000.f;
+    batch_cycle = cycle;
+}
+
+int rlist_add(const char *name, int sched_slot, rlist_prepare_f prepare, void *refcon)
+{
+    if(!prepare)
+        return RLIST_NONE;
+    for(int i = 0; i < MAX_LISTS; ++i)
+    {
+        list_t *list = &lists[i];
+        if(list->used)
+            continue;
+        memset(list, 0, sizeof(*list));
+        list->used = true;
+        snprintf(list->name, sizeof(list->name), "%s", name);
+        list->sched_slot = sched_slot;
+        list->prepare = prepare;
+        list->refcon = refcon;
+        list->cycle = -1;
+        return i;
+    }
+    log_msg("render list: no room left for %s", name);
+    return RLIST_NONE;
+}
+
+void rlist_remove(int list)
+{
+    if(list < 0 || list >= MAX_LISTS)
+        return;
+    lists[list].used = false;
+}
+
+void rlist_draw(int index)
+{
+    if(index < 0 || index >= MAX_LISTS || !lists[index].used)
+        return;
+    list_t *list = &lists[index];
+    if(!gfx_can_record() || !cmds)
+    {
+        list->prepare(list->refcon);
+        stats.direct += 1;
+        return;
+    }
+
+    int cycle = XPLMGetCycleNumber();
+    if(cycle != batch_cycle)
+        prepare_batch(cycle);
+    if(list->cycle != cycle)
+    {
+        list->prepare(list->refcon);
+        stats.direct += 1;
+        return;
+    }
+
+    for(int i = list->first_cmd; i < list->first_cmd + list->cmd_count; ++i)
+    {
+        const cmd_t *cmd = &cmds[i];
+        if(cmd->type == CMD_GEOMETRY)
+            vec_draw_retained(cmd->first, cmd->count);
+        else
+            gfx_text(cmd->x, cmd->y, cmd->text, cmd->color, cmd->font);
+    }
+    stats.replays += 1;
+}
+
+bool rlist_recording(void)
+{
+    return recording;
+}
+
+void rlist_text(int x, int y, const char *text, const float color[4], gfx_font_t font)
+{
+    close_geometry();
+    // Callers' strings are often from the frame arena already, but needn't be.
+    char *copy = arena_printf(frame_arena(), "%s", text);
+    cmd_t *cmd = copy ? push_cmd(CMD_TEXT) : NULL;
+    if(!cmd)
+        return;
+    cmd->x = x;
+    cmd->y = y;
+    cmd->text = copy;
+    memcpy(cmd->color, color, sizeof(cmd->color));
+    cmd->font = font;
+}
+
+void rlist_get_stats(rlist_stats_t *out)
+{
+    *out = stats;
+    out->lists = 0;
+    for(int i = 0; i < MAX_LISTS; ++i)
+        out->lists += lists[i].used;
+}
+
+void rlist_init(void)
+{
+    memset(lists, 0, sizeof(lists));
+    memset(&stats, 0, sizeof(stats));
+    cmds = calloc(MAX_CMDS, sizeof(cmd_t));
+    if(!cmds)
+        log_msg("render list: cannot allocate the command list, lists draw directly");
+    cmd_count = 0;
+    batch_cycle = -1;
+    recording = false;
+    prepare_probe = profiler_probe("render list/prepare");
+}
+
+void rlist_fini(void)
+{
+    free(cmds);
+    cmds = NULL;
+    cmd_count = 0;
+    memset(lists, 0, sizeof(lists));
+}
@@ -0,0 +1,61 @@
+/*===--------------------------------------------------------------------------------------------===
+ * render_list.h
+ *
+ * One draw pass for the gfx.h drawing of all our devices.
+ *
+ * Every device screen and overlay used to tessellate, upload and set up its own strokes and
+ * rectangles in its own callback, so with six displays all of that was paid six times a frame.
+ * Instead, each device registers a list with a prepare callback that issues its gfx_* calls.
+ * The first time any list is drawn in a frame, every list expected to draw this frame (see
+ * draw_sched_expected()) is prepared in one go: the gfx calls are recorded into one command list,
+ * all geometry lands in one vertex batch and is uploaded once (vec_retain()). After that,
+ * rlist_draw() from each device's callback only replays its slice: a vertex range drawn from the
+ * retained buffer, and its text.
+ *
+ * A list that draws without having been prepared (a device shown for the first time, or drawn
+ * when it wasn't asked to be) just runs its prepare callback directly, as before. Prepare
+ * callbacks only use gfx.h, and mustn't depend on which callback they're called from. With the
+ * software gfx back end, there is nothing to share and every list draws directly. Main thread
+ * only.
+ *===--------------------------------------------------------------------------------------------===
+*/
+#ifndef _RENDER_LIST_H_
+#define _RENDER_LIST_H_
+
+#include "gfx.h"
+#include <stdbool.h>
+
+#define RLIST_NONE      (-1)
+
+typedef void (*rlist_prepare_f)(void *refcon);
+
+typedef struct {
+    int lists;              // Registered.
+    unsigned batches;       // Frames prepared.
+    unsigned prepared;      // Lists in the last batch.
+    unsigned commands;      // Geometry ranges and text in the last batch.
+    unsigned vertices;      // Uploaded with the last batch.
+    unsigned replays;       // Draws from a batch, since init.
+    unsigned direct;        // Draws that weren't prepared ahead, since init.
+    unsigned dropped;       // Commands that didn't fit in the batch, since init.
+    float prepare_us;       // Last batch, including the upload.
+} rlist_stats_t;
+
+// Registers drawing for `name`. `sched_slot` is the device's draw_sched.h slot, which tells
+// whether it's expected to draw each frame; with -1 it's prepared every frame.
+int rlist_add(const char *name, int sched_slot, rlist_prepare_f prepare, void *refcon);
+void rlist_remove(int list);
+
+// Draws the list, from its device's draw callback.
+void rlist_draw(int list);
+
+// For gfx back ends: whether gfx calls are being recorded, and recording text.
+bool rlist_recording(void);
+void rlist_text(int x, int y, const char *text, const float color[4], gfx_font_t font);
+
+void rlist_get_stats(rlist_stats_t *out);
+
+void rlist_init(void);
+void rlist_fini(void);
+
+#endif /* ifndef _RENDER_LIST_H_ */
@@ -0,0 +1,98 @@
+/*===--------------------------------------------------------------------------------------------===
+ * screens.c
+ *
+ * Device drawing shared by the plugin and the headless renderer.
+ *===--------------------------------------------------------------------------------------------===
+ */
+#include "screens.h"
+#include "gfx.h"
+#include <math.h>
+
+// How much of the ambient light's hue shows on a screen, at most.
+#define SCREEN_TINT     (0.2f)
+
+// The nearest list takes a third of the width, the rest is a column of the flight plan summary,
+// the touch text and the buttons. Only heights and margins are fixed, so it still fits at 2x.
+const layout_node_t screen_layout_nodes[SCREEN_NODE_COUNT] = {
+    [SCREEN_ROOT] = {.parent = -1, .kind = LAYOUT_ROW, .padding = 10.f, .gap = 10.f},
+    [SCREEN_MAIN] = {.parent = SCREEN_ROOT, .kind = LAYOUT_COLUMN, .flex = 2.f, .gap = 10.f},
+    [SCREEN_PROGRESS] = {.parent = SCREEN_MAIN, .height = 60.f, .margin = 10.f},
+    [SCREEN_TOUCH] = {.parent = SCREEN_MAIN, .flex = 1.f, .margin = 10.f},
+    [SCREEN_BUTTONS] = {.parent = SCREEN_MAIN, .kind = LAYOUT_ROW, .height = 40.f, .margin = 10.f,
+                        .gap = 10.f},
+    [SCREEN_BUTTON_1] = {.parent = SCREEN_BUTTONS, .flex = 1.f, .hit = true},
+    [SCREEN_BUTTON_2] = {.parent = SCREEN_BUTTONS, .flex = 1.f, .hit = true},
+    [SCREEN_NEAREST] = {.parent = SCREEN_ROOT, .flex = 1.f},
+};
+
+void screen_bezel(int width, int height, int border)
+{
+    static const float frame[4] = {0.8f, 0.8f, 0.8f, 1.f};
+    static const float black[4] = {0.f, 0.f, 0.f, 1.f};
+    gfx_rect(0.f, 0.f, (float)width, (float)height, frame);
+    gfx_rect((float)border, (float)border, (float)(width - 2 * border),
+             (float)(height - 2 * border), black);
+}
+
+void screen_dim(float brightness, const float ambient[3])
+{
+    float rgb[3] = {brightness, brightness, brightness};
+    // Screens give off their own light, so the ambient light only tints them, by its hue.
+    float peak = ambient ? fmaxf(fmaxf(ambient[0], ambient[1]), ambient[2]) : 0.f;
+    for(int c = 0; c < 3 && peak > 0.f; ++c)
+        rgb[c] *= 1.f - SCREEN_TINT * (1.f - ambient[c] / peak);
+    // Nothing to do at full brightness in white light.
+    if(rgb[0] < 0.998f || rgb[1] < 0.998f || rgb[2] < 0.998f)
+        gfx_modulate(rgb);
+}
+
+void screen_button(const screen_button_t *btn, bool hover)
+{
+    static const float grey[4] = {0.4f, 0.4f, 0.4f, 1.f}, teal[4] = {0.4f, 0.6f, 0.6f, 1.f};
+    gfx_rect((float)btn->x, (float)btn->y, (float)btn->w, (float)btn->h,
+             btn->right_clicked ? teal : grey);
+    if(!btn->clicked && !hover)
+        return;
+
+    static const float magenta[4] = {1.f, 0.f, 1.f, 1.f}, white[4] = {1.f, 1.f, 1.f, 1.f};
+    const float outline[] = {
+        btn->x, btn->y,
+        btn->x, btn->y + btn->h,
+        btn->x + btn->w, btn->y + btn->h,
+        btn->x + btn->w, btn->y,
+    };
+    gfx_polyline(outline, 4, true, 2.f, btn->clicked ? magenta : white);
+}
+
+int screen_line(const layout_rect_t *panel, int line)
+{
+    return panel->y + panel->h - SCREEN_LINE * (line + 1);
+}
+
+int screen_lines(const layout_rect_t *panel)
+{
+    return panel->h / SCREEN_LINE;
+}
+
+void screen_cursor(int x, int y, const float color[4])
+{
+    const float box[] = {
+        x - 3, y - 3,
+        x - 3, y + 3,
+        x + 3, y + 3,
+        x + 3, y - 3,
+    };
+    gfx_polyline(box, 4, true, 1.5f, color);
+    gfx_line(x, y - 12, x, y - 3, 1.5f, color);
+    gfx_line(x, y + 12, x, y + 3, 1.5f, color);
+    gfx_line(x - 15, y, x - 3, y, 1.5f, color);
+    gfx_line(x + 15, y, x + 3, y, 1.5f, color);
+}
+
+void screen_overlay(bool before)
+{
+    static const float magenta[4] = {1.f, 0.f, 1.f, 1.f}, cyan[4] = {0.f, 1.f, 1.f, 1.f};
+    float x = before ? 0.f : 100.f;
+    float y = before ? 100.f : 0.f;
+    gfx_rect(x, y, 100.f, 100.f, before ? magenta : cyan);
+}
@@ -0,0 +1,54 @@
+/*===--------------------------------------------------------------------------------------------===
+ * screens.h
+ *
+ * The test devices' bezel, buttons, cursor and stock overlay, drawn only through gfx.h so the
+ * headless renderer (bench/render_bench.c) produces exactly what the plugin draws. The custom
+ * device's screen layout (layout.h) is here for the same reason.
+ *===--------------------------------------------------------------------------------------------===
+*/
+#ifndef _SCREENS_H_
+#define _SCREENS_H_
+
+#include "layout.h"
+#include <stdbool.h>
+
+// Nodes of screen_layout_nodes.
+enum {
+    SCREEN_ROOT,
+    SCREEN_MAIN,                // Left column.
+    SCREEN_PROGRESS,            // Flight plan summary, top left.
+    SCREEN_TOUCH,               // Touch locations.
+    SCREEN_BUTTONS,             // Row of buttons, bottom left.
+    SCREEN_BUTTON_1,
+    SCREEN_BUTTON_2,
+    SCREEN_NEAREST,             // Nearest list, down the right.
+    SCREEN_NODE_COUNT
+};
+
+// Text line pitch in the panels, in pixels: the fonts don't scale.
+#define SCREEN_LINE     (13)
+
+extern const layout_node_t screen_layout_nodes[SCREEN_NODE_COUNT];
+
+typedef struct {
+    int x, y, w, h;
+    bool clicked;
+    bool right_clicked;
+} screen_button_t;
+
+// The bezel frame, unlit, with the screen area cut out in black. Light it with gfx_modulate().
+void screen_bezel(int width, int height, int border);
+// The post-pass over a device screen, after everything else is drawn: `brightness` (power.h's,
+// warm-up included) and a hint of the ambient light's hue, in one gfx_modulate(). `ambient` is
+// the light's colour, as handed to bezel callbacks; NULL for white.
+void screen_dim(float brightness, const float ambient[3]);
+void screen_button(const screen_button_t *btn, bool hover);
+// Baseline of a panel's text line, from 0 at the top.
+int screen_line(const layout_rect_t *panel, int line);
+// Lines of text a panel holds.
+int screen_lines(const layout_rect_t *panel);
+void screen_cursor(int x, int y, const float color[4]);
+// The square drawn over stock devices, before or after X-Plane draws them.
+void screen_overlay(bool before);
+
+#endif /* ifndef _SCREENS_H_ */
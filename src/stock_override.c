@@ -11,12 +11,23 @@
 #include <XPLMGraphics.h>
 #include <XPLMMenus.h>
 #include <XPLMUtilities.h>
+#include <ctype.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <string.h>
 #define _USE_MATH_DEFINES
 #include <math.h>
 #include "SystemGL.h"
+#include "draw_sched.h"
+#include "gfx.h"
+#include "profiler.h"
+#include "render_list.h"
+#include "arena.h"
+#include "navsearch.h"
+#include "ownship.h"
+#include "power.h"
+#include "screens.h"
 
 void log_msg(const char *fmt, ...);
 const char *click_type(int mouse);
@@ -31,6 +42,17 @@ static XPLMAvionicsID gns430_2 = NULL;
 static XPLMAvionicsID cdu_1 = NULL;
 static XPLMCommandRef show_popout = NULL;
 
+// CDU scratchpad, and the identifiers matching it so far, listed over the CDU's screen from
+// CDU_LIST_Y up, best first at the top.
+#define CDU_SEARCH_TYPES    (xplm_Nav_Airport | xplm_Nav_NDB | xplm_Nav_VOR | xplm_Nav_Fix)
+#define CDU_MATCHES         (8)
+#define CDU_LIST_X          (12)
+#define CDU_LIST_Y          (60)
+#define CDU_LINE_H          (16)
+static char scratchpad[NAVSEARCH_MAX_QUERY + 1] = "";
+static nav_match_t cdu_matches[CDU_MATCHES];
+static int cdu_match_count = 0;
+
 static XPLMMenuID devices_menu = NULL;
 static int devices_menu_item = -1;
 
@@ -99,6 +121,110 @@ static const char *device_names[] = {
 
 static const int device_count = sizeof(device_ids) / sizeof(device_ids[0]);
 
+// Draw scheduler slot for each device we draw into, indexed by device ID.
+static int sched_slots[sizeof(device_ids) / sizeof(device_ids[0])];
+// Render lists for each device's overlays, drawn before and after the stock screen.
+static int overlay_lists[sizeof(device_ids) / sizeof(device_ids[0])][2];
+// Power model slot for each device we register, indexed by device ID.
+static int power_slots[sizeof(device_ids) / sizeof(device_ids[0])];
+
+// The GNS and CDU screens on a 28 V bus: up at 19 V, down below 17 V, half a second to light up.
+static const power_profile_t stock_power = {
+    .bus_on = 19.f / 28.f,
+    .bus_off = 17.f / 28.f,
+    .warmup_s = 0.5f,
+    .rheo = {0.02f, 0.1f, 0.3f, 0.6f, 1.f},
+    .cell = {0.5f, 0.7f, 0.9f, 1.f, 1.f},
+};
+
+// Profiler probes for each device and callback we register.
+typedef enum {
+    CB_DRAW_BEFORE,
+    CB_DRAW_AFTER,
+    CB_KEYBOARD,
+    CB_BEZEL_CLICK,
+    CB_BEZEL_RIGHT_CLICK,
+    CB_BEZEL_SCROLL,
+    CB_SCREEN_CLICK,
+    CB_SCREEN_CURSOR,
+    CB_COUNT
+} stock_cb_t;
+
+static const char *cb_names[CB_COUNT] = {
+    "draw before",
+    "draw after",
+    "keyboard",
+    "bezel click",
+    "bezel right click",
+    "bezel scroll",
+    "screen click",
+    "screen cursor",
+};
+
+static prof_probe_t probes[sizeof(device_ids) / sizeof(device_ids[0])][CB_COUNT];
+static prof_probe_t popout_probe = PROF_NO_PROBE;
+
+static draw_prio_t device_priority(XPLMDeviceID id)
+{
+    switch(id) {
+    case xplm_device_G1000_PFD_1:
+    case xplm_device_G1000_PFD_2:
+    case xplm_device_Primus_PFD_1:
+    case xplm_device_Primus_PFD_2:
+        return DRAW_PRIO_CRITICAL;
+    case xplm_device_G1000_MFD:
+    case xplm_device_Primus_MFD_1:
+    case xplm_device_Primus_MFD_2:
+    case xplm_device_Primus_MFD_3:
+        return DRAW_PRIO_NORMAL;
+    case xplm_device_Primus_RMU_1:
+    case xplm_device_Primus_RMU_2:
+        return DRAW_PRIO_LOW;
+    default:
+        return DRAW_PRIO_HIGH;
+    }
+}
+
+static void cdu_search(void)
+{
+    const navdata_t *nd = navdata_get();
+    if(!nd)
+        return;
+    const ownship_t *own = ownship_get();
+
+    cdu_match_count = navsearch_find(nd, scratchpad, own->lat, own->lon, CDU_SEARCH_TYPES,
+                                     cdu_matches, CDU_MATCHES);
+}
+
+// Keeps the scratchpad in step with what's typed on the CDU.
+static void cdu_key(char key, char vkey)
+{
+    size_t len = strlen(scratchpad);
+    switch((unsigned char)vkey)
+    {
+    case XPLM_VK_BACK:
+        if(!len)
+            return;
+        scratchpad[len - 1] = '\0';
+        break;
+    case XPLM_VK_DELETE:
+    case XPLM_VK_CLEAR:
+    case XPLM_VK_ESCAPE:
+        scratchpad[0] = '\0';
+        break;
+    default:
+        if(!isalnum((unsigned char)key) || len >= NAVSEARCH_MAX_QUERY)
+            return;
+        scratchpad[len] = (char)toupper((unsigned char)key);
+        scratchpad[len + 1] = '\0';
+        break;
+    }
+
+    cdu_match_count = 0;
+    if(scratchpad[0])
+        cdu_search();
+}
+
 static int stock_keyboard(
 	char key,
 	XPLMKeyFlags flags,
@@ -107,13 +233,13 @@ static int stock_keyboard(
 	int losing
 )
 {
-	(void)flags;
-	(void)vkey;
-	(void)refcon;
 	(void)losing;
     XPLMDeviceID id = (XPLMDeviceID)(intptr_t)refcon;
+	PROF_SCOPE(probes[id][CB_KEYBOARD]);
 
 	log_msg("%s: key %c (0x%02x) pressed", device_str[id], key, (int)key);
+	if(id == xplm_device_CDU739_1 && (flags & xplm_DownFlag))
+		cdu_key(key, vkey);
 	
 	// Return 1 only if you want to intercept the key press, and don't want X-Plane's device
 	// to receive it.
@@ -123,27 +249,32 @@ static int stock_keyboard(
 static int stock_bezel_click(int x, int y, int mouse, void *refcon)
 {
     XPLMDeviceID id = (XPLMDeviceID)(intptr_t)refcon;
+	PROF_SCOPE(probes[id][CB_BEZEL_CLICK]);
 	log_msg("%s: bezel click %s at (%d, %d)", device_str[id], click_type(mouse), x, y);
 	// Return 1 only if you want to intercept the key click, and don't want X-Plane's device
 	// to receive it.    
 	return 0;
 }
 
+// Right-dragging up the bezel turns the rheostat up, from off at its bottom edge to full at its
+// top. Stock bezels come in different sizes: the height is the device's popup window's.
 static int stock_bezel_right_click(int x, int y, int mouse, void *refcon)
 {
     XPLMDeviceID id = (XPLMDeviceID)(intptr_t)refcon;
-    if(mouse != xplm_MouseUp)
-    {
-        float brt = (float)y / 200.f;
-        XPLMSetAvionicsBrightnessRheo(gns530_1, brt);
-        log_msg("brightness: %.2f", XPLMGetAvionicsBrightnessRheo(gns530_1));
-    }
+    PROF_SCOPE(probes[id][CB_BEZEL_RIGHT_CLICK]);
+    if(mouse == xplm_MouseUp)
+        return 1;
+    int top = 0, bottom = 0;
+    XPLMGetAvionicsGeometry(XPLMGetAvionicsHandle(id), NULL, &top, NULL, &bottom);
+    if(top > bottom)
+        power_set_rheo(power_slots[id], (float)y / (float)(top - bottom));
     return 1;
 }
 
 static int stock_bezel_scroll(int x, int y, int wheel, int clicks, void *refcon)
 {
     XPLMDeviceID id = (XPLMDeviceID)(intptr_t)refcon;
+    PROF_SCOPE(probes[id][CB_BEZEL_SCROLL]);
     log_msg("%s: bezel scroll %d (%d) at (%d, %d)", device_str[id], wheel, clicks, x, y);
     
     return 0;
@@ -152,6 +283,7 @@ static int stock_bezel_scroll(int x, int y, int wheel, int clicks, void *refcon)
 static int stock_screen_click(int x, int y, XPLMMouseStatus mouse, void *refcon)
 {
     XPLMDeviceID id = (XPLMDeviceID)(intptr_t)refcon;
+	PROF_SCOPE(probes[id][CB_SCREEN_CLICK]);
 	log_msg("%s: screen touch %s at (%d, %d)", device_str[id], click_type(mouse), x, y);
 	if(id == xplm_device_GNS530_1)
 	{
@@ -167,19 +299,59 @@ static int stock_screen_click(int x, int y, XPLMMouseStatus mouse, void *refcon)
 
 static XPLMCursorStatus stock_screen_cursor(int x, int y, void *refcon) {
     XPLMDeviceID id = (XPLMDeviceID)(intptr_t)refcon;
+    PROF_SCOPE(probes[id][CB_SCREEN_CURSOR]);
     log_msg("%s: screen cursor at (%d, %d)", device_str[id], x, y);
     bool in_rect = x > 0 && x < 100 && y > 100 && y < 200;
     
     return in_rect ? xplm_CursorHidden : xplm_CursorArrow;
 }
 
-static int stock_draw(XPLMDeviceID id, int before, void *refcon)
+// The type-ahead candidates for the scratchpad, with their distance; typo matches are marked.
+static void draw_cdu_matches(void)
 {
-	(void)refcon;
-	
-	int x = before ? 0 : 100;
-	int y = before ? 100 : 0;
+    static const float green[4] = {0.f, 1.f, 0.f, 1.f}, white[4] = {1.f, 1.f, 1.f, 1.f};
+    const navdata_t *nd = navdata_get();
+    if(!nd || !scratchpad[0])
+        return;
+    int y = CDU_LIST_Y + cdu_match_count * CDU_LINE_H;
+    gfx_text(CDU_LIST_X, y, arena_printf(frame_arena(), "> %s", scratchpad), white,
+             GFX_FONT_BASIC);
+    for(int i = 0; i < cdu_match_count; ++i)
+    {
+        const nav_match_t *m = &cdu_matches[i];
+        y -= CDU_LINE_H;
+        char *text = arena_printf(frame_arena(), "%-6s%s %6.1f NM", navdata_id(nd, m->index),
+                                  m->edits ? "?" : " ", m->dist_nm);
+        gfx_text(CDU_LIST_X, y, text, green, GFX_FONT_BASIC);
+    }
+}
+
+// Overlays are prepared together, for every device, the first time one is drawn in a frame.
+static void prepare_overlay(void *refcon)
+{
+	XPLMDeviceID id = (XPLMDeviceID)((intptr_t)refcon >> 1);
+	bool before = (intptr_t)refcon & 1;
+	gfx_begin(0, 0);
+	if(id == xplm_device_CDU739_1)
+	{
+		if(!before)
+			draw_cdu_matches();
+		gfx_end();
+		return;
+	}
+	screen_overlay(before);
 	
+	if(!before && id == xplm_device_GNS530_1 && clicked)
+	{
+		char *text = arena_printf(frame_arena(), "touch location: %d,%d", click_x, click_y);
+		const float color[4] = {1.f, 0.f, 1.f, 1.f};
+		gfx_text(0, 300, text, color, GFX_FONT_PROPORTIONAL);
+	}
+	gfx_end();
+}
+
+static int draw_overlay(XPLMDeviceID id, int before)
+{
 #if XPLM411
     auto gtex = XPLMGetTexture(xplm_Tex_Radar_Pilot);           // This is the pilot side radar, if the airplane has it installed. If the acf doesn't have it, this returns 0.
     if (gtex > 0 && id == xplm_device_GNS530_1 && !before)      // Let's draw the radar onto the 530!
@@ -197,32 +369,33 @@ static int stock_draw(XPLMDeviceID id, int before, void *refcon)
     }
 #endif
 
-    XPLMSetGraphicsState(0, 0, 0, 0, 0, 0, 0);
-
-	glBegin(GL_QUADS);
-	if(before)
-		glColor3f(1.f, 0.f, 1.f);
-	else
-		glColor3f(0.f, 1.f, 1.f);
-    glVertex2f(x, 		y);
-    glVertex2f(x, 		y+100);
-    glVertex2f(x+100, 	y+100);
-    glVertex2f(x+100, 	y);
-	glEnd();
-	
-	if(!before && id == xplm_device_GNS530_1 && clicked)
-	{
-		char buffer[128];
-		snprintf(buffer, sizeof(buffer), "touch location: %d,%d", click_x, click_y);
-		float color[3] = {1.f, 0.f, 1.f};
-		XPLMDrawString(color, 0, 300, buffer, NULL, xplmFont_Proportional);
-	}
+	rlist_draw(overlay_lists[id][before ? 1 : 0]);
 	
 	// If you return 1 in a `before` callback, X-Plane will go ahead and render
 	// the stock device's screen;
 	return !before || id != xplm_device_GNS430_2;
 }
 
+static int stock_draw(XPLMDeviceID id, int before, void *refcon)
+{
+	(void)refcon;
+	PROF_SCOPE(probes[id][before ? CB_DRAW_BEFORE : CB_DRAW_AFTER]);
+	
+	uint64_t start = draw_sched_begin(sched_slots[id]);
+	// Nothing goes over a screen without power; X-Plane's own goes dark on its own.
+	int result = power_on(power_slots[id]) ? draw_overlay(id, before) : 1;
+	// Over X-Plane's screen and the overlay both: the rheostat, photocell and warm-up apply to
+	// the stock screen as they do to ours. There's no ambient hue to tint it with here.
+	if(!before && power_on(power_slots[id]))
+	{
+		gfx_begin(0, 0);
+		screen_dim(power_brightness(power_slots[id]), NULL);
+		gfx_end();
+	}
+	draw_sched_end(sched_slots[id], start);
+	return result;
+}
+
 static XPLMAvionicsID register_device(XPLMDeviceID id, XPLMAvionicsCallback_f draw)
 {
 	XPLMCustomizeAvionics_t av = (XPLMCustomizeAvionics_t) {
@@ -238,15 +411,38 @@ static XPLMAvionicsID register_device(XPLMDeviceID id, XPLMAvionicsCallback_f dr
 		.keyboardCallback = stock_keyboard,
 		.refcon = (void *)(intptr_t)id
 	};
+	
+	for(int i = 0; i < CB_COUNT; ++i)
+	{
+		char name[64];
+		snprintf(name, sizeof(name), "%s/%s", device_names[id], cb_names[i]);
+		probes[id][i] = profiler_probe(name);
+	}
 
-	char debug_str[128];
 	if(draw)
 	{
         log_msg("Drawing overrides for stock device %s", device_str[id]);
 	} else {
 		log_msg("Non-drawing overrides for stock device %s", device_str[id]);
 	}
-	return XPLMRegisterAvionicsCallbacksEx(&av);
+	XPLMAvionicsID handle = XPLMRegisterAvionicsCallbacksEx(&av);
+	
+	// X-Plane draws stock devices every frame, so these can't be deferred, but the scheduler
+	// still needs to know what they cost.
+	if(draw)
+	{
+		sched_slots[id] = draw_sched_add(device_names[id], handle, device_priority(id), 0.f, false);
+		for(int before = 0; before < 2; ++before)
+		{
+			char name[64];
+			snprintf(name, sizeof(name), "%s/%s", device_names[id],
+			         cb_names[before ? CB_DRAW_BEFORE : CB_DRAW_AFTER]);
+			overlay_lists[id][before] = rlist_add(name, sched_slots[id], prepare_overlay,
+			                                      (void *)(((intptr_t)id << 1) | before));
+		}
+	}
+	power_slots[id] = power_add(device_names[id], handle, sched_slots[id], &stock_power);
+	return handle;
 }
 
 
@@ -280,6 +476,7 @@ static void create_menus(XPLMMenuID parent)
 static int handle_530_popup(XPLMCommandRef cmd, XPLMCommandPhase phase, void *refcon)
 {
 	(void)cmd;
+	PROF_SCOPE(popout_probe);
 	
     if(phase != xplm_CommandBegin)
         return 1;
@@ -290,9 +487,21 @@ static int handle_530_popup(XPLMCommandRef cmd, XPLMCommandPhase phase, void *re
 
 void stock_overrides_init(XPLMMenuID menu)
 {
+	for(int i = 0; i < device_count; ++i)
+	{
+		sched_slots[i] = -1;
+		overlay_lists[i][0] = overlay_lists[i][1] = RLIST_NONE;
+		power_slots[i] = -1;
+		for(int j = 0; j < CB_COUNT; ++j)
+			probes[i][j] = PROF_NO_PROBE;
+	}
+	popout_probe = profiler_probe("command/show_530_popout");
+	scratchpad[0] = '\0';
+	cdu_match_count = 0;
+	
 	gns530_1 = register_device(xplm_device_GNS530_1, stock_draw);
 	gns430_2 = register_device(xplm_device_GNS430_2, stock_draw);
-	cdu_1 = register_device(xplm_device_CDU739_1, NULL);
+	cdu_1 = register_device(xplm_device_CDU739_1, stock_draw);
     
     create_menus(menu);
     
@@ -314,4 +523,15 @@ void stock_overrides_fini()
 	XPLMUnregisterAvionicsCallbacks(gns530_1);
 	XPLMUnregisterAvionicsCallbacks(gns430_2);
 	XPLMUnregisterAvionicsCallbacks(cdu_1);
+	
+	for(int i = 0; i < device_count; ++i)
+	{
+		draw_sched_remove(sched_slots[i]);
+		sched_slots[i] = -1;
+		rlist_remove(overlay_lists[i][0]);
+		rlist_remove(overlay_lists[i][1]);
+		overlay_lists[i][0] = overlay_lists[i][1] = RLIST_NONE;
+		power_remove(power_slots[i]);
+		power_slots[i] = -1;
+	}
 }
@@ -0,0 +1,483 @@
+/*===--------------------------------------------------------------------------------------------===
+ * stream.c
+ *
+ * Changed-tile frame stream over a Unix domain socket, server side.
+ *===--------------------------------------------------------------------------------------------===
+ */
+#include "stream.h"
+#include "clock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if !IBM
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define STREAM_SSE2 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define STREAM_NEON 1
+#endif
+
+void log_msg(const char *fmt, ...);
+
+#if defined(MSG_NOSIGNAL)
+#define SEND_FLAGS          (MSG_NOSIGNAL)
+#else
+#define SEND_FLAGS          (0)     // SO_NOSIGPIPE is set on each socket instead.
+#endif
+
+typedef struct {
+    int fd;                 // -1 when the slot is free.
+    uint8_t *out;           // Message being sent.
+    size_t out_len, out_sent, out_cap;
+    uint8_t *owed;          // Per tile, changed since the subscriber was last sent it.
+    bool any_owed;
+} client_t;
+
+struct stream_s {
+    char path[108];
+    int listen_fd;
+    int width, height;
+    int tiles_x, tiles_y, tile_count;
+    uint8_t *frame;         // Newest frame, width * 4 bytes a row.
+    bool have_frame;
+    uint32_t frame_number;
+    uint64_t time_ns;
+
+    // The newest frame's tiles, encoded when first sent and shared by subscribers.
+    uint8_t *encoded;       // STREAM_TILE_MAX bytes per tile.
+    uint16_t *encoded_bytes;
+    uint8_t *encoded_valid;
+
+    client_t clients[STREAM_MAX_CLIENTS];
+    uint64_t tiles_changed;
+    uint64_t bytes_sent;
+    uint64_t diff_ns;
+};
+
+#if !IBM
+static void tile_rect(const stream_t *st, int tile, int *x, int *y, int *w, int *h)
+{
+    *x = (tile % st->tiles_x) * STREAM_TILE;
+    *y = (tile / st->tiles_x) * STREAM_TILE;
+    *w = st->width - *x < STREAM_TILE ? st->width - *x : STREAM_TILE;
+    *h = st->height - *y < STREAM_TILE ? st->height - *y : STREAM_TILE;
+}
+
+// Compares a full-width tile row by row, 64 bytes at a time.
+static bool tile_equal(const uint8_t *a, size_t a_stride, const uint8_t *b, size_t b_stride,
+                       int h)
+{
+#if STREAM_SSE2
+    __m128i diff = _mm_setzero_si128();
+    for(int y = 0; y < h; ++y, a += a_stride, b += b_stride)
+    {
+        for(int i = 0; i < STREAM_TILE * 4; i += 16)
+        {
+            __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+            __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+            diff = _mm_or_si128(diff, _mm_xor_si128(va, vb));
+        }
+    }
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(diff, _mm_setzero_si128())) == 0xffff;
+#elif STREAM_NEON
+    uint8x16_t diff = vdupq_n_u8(0);
+    for(int y = 0; y < h; ++y, a += a_stride, b += b_stride)
+    {
+        for(int i = 0; i < STREAM_TILE * 4; i += 16)
+            diff = vorrq_u8(diff, veorq_u8(vld1q_u8(a + i), vld1q_u8(b + i)));
+    }
+    uint64x2_t wide = vreinterpretq_u64_u8(diff);
+    return (vgetq_lane_u64(wide, 0) | vgetq_lane_u64(wide, 1)) == 0;
+#else
+    for(int y = 0; y < h; ++y, a += a_stride, b += b_stride)
+    {
+        if(memcmp(a, b, STREAM_TILE * 4))
+            return false;
+    }
+    return true;
+#endif
+}
+
+static bool rect_equal(const uint8_t *a, size_t a_stride, const uint8_t *b, size_t b_stride,
+                       int w, int h)
+{
+    if(w == STREAM_TILE)
+        return tile_equal(a, a_stride, b, b_stride, h);
+    for(int y = 0; y < h; ++y, a += a_stride, b += b_stride)
+    {
+        if(memcmp(a, b, (size_t)w * 4))
+            return false;
+    }
+    return true;
+}
+
+static uint32_t load_px(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+// Run-length encodes a tile of the current frame, as described in stream.h.
+static int encode_tile(const stream_t *st, int tile, uint8_t *out)
+{
+    int x0, y0, w, h;
+    tile_rect(st, tile, &x0, &y0, &w, &h);
+    uint32_t px[STREAM_TILE * STREAM_TILE];
+    int n = 0;
+    for(int y = 0; y < h; ++y)
+    {
+        const uint8_t *row = st->frame + ((size_t)(y0 + y) * st->width + x0) * 4;
+        for(int x = 0; x < w; ++x)
+            px[n++] = load_px(row + x * 4);
+    }
+
+    uint8_t *p = out;
+    int i = 0, literal = -1;    // Where the pending literal run starts.
+    while(i < n)
+    {
+        int run = 1;
+        while(i + run < n && run < 129 && px[i + run] == px[i])
+            run += 1;
+        if(run >= 2)
+        {
+            if(literal >= 0)
+            {
+                *p++ = (uint8_t)(i - literal - 1);
+                memcpy(p, &px[literal], (size_t)(i - literal) * 4);
+                p += (i - literal) * 4;
+                literal = -1;
+            }
+            *p++ = (uint8_t)(run + 126);
+            memcpy(p, &px[i], 4);
+            p += 4;
+            i += run;
+            continue;
+        }
+        if(literal < 0)
+            literal = i;
+        i += 1;
+        if(i - literal == 128)
+        {
+            *p++ = 127;
+            memcpy(p, &px[literal], 128 * 4);
+            p += 128 * 4;
+            literal = -1;
+        }
+    }
+    if(literal >= 0)
+    {
+        *p++ = (uint8_t)(n - literal - 1);
+        memcpy(p, &px[literal], (size_t)(n - literal) * 4);
+        p += (n - literal) * 4;
+    }
+    return (int)(p - out);
+}
+
+static void drop_client(client_t *c, const char *why)
+{
+    log_msg("stream: subscriber %d %s", c->fd, why);
+    close(c->fd);
+    c->fd = -1;
+    c->out_len = c->out_sent = 0;
+}
+
+static bool reserve(client_t *c, size_t bytes)
+{
+    if(bytes <= c->out_cap)
+        return true;
+    size_t cap = c->out_cap ? c->out_cap : 4096;
+    while(cap < bytes)
+        cap *= 2;
+    uint8_t *out = realloc(c->out, cap);
+    if(!out)
+        return false;
+    c->out = out;
+    c->out_cap = cap;
+    return true;
+}
+
+// Sends as much of the pending message as the socket takes. Returns false if the client is gone.
+static bool flush_client(stream_t *st, client_t *c)
+{
+    while(c->out_sent < c->out_len)
+    {
+        ssize_t sent = send(c->fd, c->out + c->out_sent, c->out_len - c->out_sent, SEND_FLAGS);
+        if(sent < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+                return true;
+            drop_client(c, "disconnected");
+            return false;
+        }
+        c->out_sent += (size_t)sent;
+        st->bytes_sent += (uint64_t)sent;
+    }
+    c->out_len = c->out_sent = 0;
+    return true;
+}
+
+// Queues everything the client is owed, as of the newest frame.
+static bool queue_frame(stream_t *st, client_t *c)
+{
+    int tiles = 0;
+    for(int t = 0; t < st->tile_count; ++t)
+        tiles += c->owed[t];
+    size_t per_tile = sizeof(stream_tile_t) + STREAM_TILE_MAX;
+    if(!reserve(c, sizeof(stream_frame_t) + (size_t)tiles * per_tile))
+        return false;
+
+    stream_frame_t msg = {st->frame_number, (uint32_t)tiles, st->time_ns};
+    memcpy(c->out, &msg, sizeof(msg));
+    size_t len = sizeof(msg);
+    for(int t = 0; t < st->tile_count; ++t)
+    {
+        if(!c->owed[t])
+            continue;
+        uint8_t *enc = st->encoded + (size_t)t * STREAM_TILE_MAX;
+        if(!st->encoded_valid[t])
+        {
+            st->encoded_bytes[t] = (uint16_t)encode_tile(st, t, enc);
+            st->encoded_valid[t] = 1;
+        }
+        stream_tile_t rec = {
+            (uint16_t)(t % st->tiles_x), (uint16_t)(t / st->tiles_x), st->encoded_bytes[t], 0
+        };
+        memcpy(c->out + len, &rec, sizeof(rec));
+        len += sizeof(rec);
+        memcpy(c->out + len, enc, rec.bytes);
+        len += rec.bytes;
+    }
+    memset(c->owed, 0, (size_t)st->tile_count);
+    c->any_owed = false;
+    c->out_len = len;
+    c->out_sent = 0;
+    return true;
+}
+
+static void accept_clients(stream_t *st)
+{
+    for(;;)
+    {
+        int fd = accept(st->listen_fd, NULL, NULL);
+        if(fd < 0)
+            return;
+        client_t *c = NULL;
+        for(int i = 0; i < STREAM_MAX_CLIENTS && !c; ++i)
+        {
+            if(st->clients[i].fd < 0)
+                c = &st->clients[i];
+        }
+        if(!c)
+        {
+            log_msg("stream: %s: too many subscribers", st->path);
+            close(fd);
+            continue;
+        }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+#if defined(SO_NOSIGPIPE)
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+        if(!reserve(c, sizeof(stream_hello_t)))
+        {
+            close(fd);
+            continue;
+        }
+        c->fd = fd;
+        memset(c->owed, 1, (size_t)st->tile_count);
+        c->any_owed = true;
+
+        stream_hello_t hello = {
+            STREAM_MAGIC, STREAM_VERSION, (uint16_t)st->width, (uint16_t)st->height, STREAM_TILE, 0
+        };
+        memcpy(c->out, &hello, sizeof(hello));
+        c->out_len = sizeof(hello);
+        c->out_sent = 0;
+        log_msg("stream: subscriber %d connected to %s", fd, st->path);
+    }
+}
+#endif
+
+stream_t *stream_open(const char *device_id, int width, int height)
+{
+#if IBM
+    (void)device_id;
+    (void)width;
+    (void)height;
+    log_msg("stream: socket streams are not available on Windows");
+    return NULL;
+#else
+    if(width <= 0 || height <= 0 || width > UINT16_MAX || height > UINT16_MAX)
+        return NULL;
+    stream_t *st = calloc(1, sizeof(*st));
+    if(!st)
+        return NULL;
+    snprintf(st->path, sizeof(st->path), "/tmp/xpav-%s.sock", device_id);
+    st->width = width;
+    st->height = height;
+    st->tiles_x = (width + STREAM_TILE - 1) / STREAM_TILE;
+    st->tiles_y = (height + STREAM_TILE - 1) / STREAM_TILE;
+    st->tile_count = st->tiles_x * st->tiles_y;
+    st->frame = calloc((size_t)width * height, 4);
+    st->encoded = malloc((size_t)st->tile_count * STREAM_TILE_MAX);
+    st->encoded_bytes = calloc((size_t)st->tile_count, sizeof(uint16_t));
+    st->encoded_valid = calloc((size_t)st->tile_count, 1);
+    bool ok = st->frame && st->encoded && st->encoded_bytes && st->encoded_valid;
+    for(int i = 0; i < STREAM_MAX_CLIENTS; ++i)
+    {
+        st->clients[i].fd = -1;
+        st->clients[i].owed = calloc((size_t)st->tile_count, 1);
+        ok = ok && st->clients[i].owed;
+    }
+    st->listen_fd = -1;
+    if(!ok)
+    {
+        log_msg("stream: out of memory");
+        stream_close(st);
+        return NULL;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", st->path);
+    // A socket left behind by a crash would refuse the bind.
+    unlink(st->path);
+    st->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(st->listen_fd < 0
+       || bind(st->listen_fd, (const struct sockaddr *)&addr, sizeof(addr)) != 0
+       || listen(st->listen_fd, STREAM_MAX_CLIENTS) != 0)
+    {
+        log_msg("stream: cannot listen on %s: %s", st->path, strerror(errno));
+        stream_close(st);
+        return NULL;
+    }
+    fcntl(st->listen_fd, F_SETFL, fcntl(st->listen_fd, F_GETFL, 0) | O_NONBLOCK);
+    log_msg("stream: %s, %dx%d, %d tiles", st->path, width, height, st->tile_count);
+    return st;
+#endif
+}
+
+void stream_close(stream_t *st)
+{
+    if(!st)
+        return;
+#if !IBM
+    for(int i = 0; i < STREAM_MAX_CLIENTS; ++i)
+    {
+        if(st->clients[i].fd >= 0)
+            close(st->clients[i].fd);
+        free(st->clients[i].out);
+        free(st->clients[i].owed);
+    }
+    if(st->listen_fd >= 0)
+    {
+        close(st->listen_fd);
+        unlink(st->path);
+    }
+#endif
+    free(st->frame);
+    free(st->encoded);
+    free(st->encoded_bytes);
+    free(st->encoded_valid);
+    free(st);
+}
+
+void stream_submit(stream_t *st, const uint8_t *pixels, int width, int height, int stride,
+                   uint64_t time_ns)
+{
+    if(!st || width <= 0 || height <= 0)
+        return;
+#if IBM
+    (void)pixels;
+    (void)stride;
+    (void)time_ns;
+#else
+    uint64_t start = clock_now_ns();
+    int w = width < st->width ? width : st->width;
+    int h = height < st->height ? height : st->height;
+    size_t row = (size_t)st->width * 4;
+
+    // Copy in only the tiles that changed, noting them for every subscriber.
+    int changed = 0;
+    for(int t = 0; t < st->tile_count; ++t)
+    {
+        int x, y, tw, th;
+        tile_rect(st, t, &x, &y, &tw, &th);
+        // The part of the tile outside a smaller frame stays as it was.
+        tw = x + tw > w ? w - x : tw;
+        th = y + th > h ? h - y : th;
+        if(tw <= 0 || th <= 0)
+            continue;
+        const uint8_t *src = pixels + (size_t)y * stride + (size_t)x * 4;
+        uint8_t *dst = st->frame + (size_t)y * row + (size_t)x * 4;
+        if(st->have_frame && rect_equal(src, (size_t)stride, dst, row, tw, th))
+            continue;
+        for(int r = 0; r < th; ++r)
+            memcpy(dst + r * row, src + (size_t)r * stride, (size_t)tw * 4);
+        changed += 1;
+        st->encoded_valid[t] = 0;
+        for(int i = 0; i < STREAM_MAX_CLIENTS; ++i)
+        {
+            if(st->clients[i].fd >= 0)
+            {
+                st->clients[i].owed[t] = 1;
+                st->clients[i].any_owed = true;
+            }
+        }
+    }
+    st->have_frame = true;
+    st->frame_number += 1;
+    st->time_ns = time_ns;
+    st->tiles_changed += (uint64_t)changed;
+    st->diff_ns += clock_now_ns() - start;
+    stream_poll(st);
+#endif
+}
+
+void stream_poll(stream_t *st)
+{
+    if(!st)
+        return;
+#if !IBM
+    accept_clients(st);
+    for(int i = 0; i < STREAM_MAX_CLIENTS; ++i)
+    {
+        client_t *c = &st->clients[i];
+        if(c->fd < 0 || !flush_client(st, c))
+            continue;
+        // Only one message in flight per subscriber; the next carries whatever's changed since.
+        if(c->out_len || !c->any_owed || !st->have_frame)
+            continue;
+        if(!queue_frame(st, c))
+        {
+            drop_client(c, "dropped, out of memory");
+            continue;
+        }
+        flush_client(st, c);
+    }
+#endif
+}
+
+void stream_get_stats(const stream_t *st, stream_stats_t *out)
+{
+    memset(out, 0, sizeof(*out));
+    if(!st)
+        return;
+    for(int i = 0; i < STREAM_MAX_CLIENTS; ++i)
+        out->clients += st->clients[i].fd >= 0;
+    out->frames = st->frame_number;
+    out->tiles_changed = st->tiles_changed;
+    out->bytes_sent = st->bytes_sent;
+    out->diff_us = st->frame_number ? (float)((double)st->diff_ns / st->frame_number / 1e3) : 0.f;
+}
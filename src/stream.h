@@ -0,0 +1,128 @@
+/*===--------------------------------------------------------------------------------------------===
+ * stream.h
+ *
+ * Device screens streamed over a Unix domain socket as changed tiles, for viewers that want a
+ * byte stream rather than a shared mapping (recorders, remote-display bridges, several readers at
+ * once).
+ *
+ * The plugin listens on "/tmp/xpav-<device ID>.sock". Each frame is compared against the last one
+ * in STREAM_TILE x STREAM_TILE pixel tiles, and only the tiles that changed are sent, run-length
+ * encoded. A subscriber gets a stream_hello_t on connecting, then a stream of messages, each a
+ * stream_frame_t followed by `tiles` records of a stream_tile_t and its `bytes` of encoded pixels.
+ * The first message after connecting holds every tile. A subscriber that can't keep up doesn't
+ * stall the others or queue without bound: while it's still busy with one message, the tiles that
+ * change are only noted, and it gets all of them, as of the newest frame, in its next message.
+ * So any subscriber's screen is always a frame the plugin drew, just perhaps not every one.
+ *
+ * Pixels are 8-bit RGBA, bottom row first (OpenGL's order); tile (0, 0) is at the bottom left, and
+ * tiles on the right and top edges are cropped to the screen. Encoded tiles are a sequence of runs,
+ * each a control byte c then:
+ *
+ *      c < 128     c + 1 literal pixels, 4 bytes each
+ *      c >= 128    one pixel, repeated c - 126 times
+ *
+ * Everything is in the host's byte order; both ends are on the same machine. tools/stream_view.c
+ * is a reference subscriber. The plugin side is main thread only, and never blocks. Not available
+ * on Windows, where stream_open() logs and returns NULL.
+ *===--------------------------------------------------------------------------------------------===
+*/
+#ifndef _STREAM_H_
+#define _STREAM_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define STREAM_MAGIC        (0x53415058u)   // "XPAS", little-endian.
+#define STREAM_VERSION      (1)
+#define STREAM_TILE         (16)
+#define STREAM_MAX_CLIENTS  (8)
+// Worst case for one encoded tile: all literals.
+#define STREAM_TILE_MAX     (STREAM_TILE * STREAM_TILE * 4 + STREAM_TILE * STREAM_TILE / 128)
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint16_t width, height;
+    uint16_t tile;              // STREAM_TILE.
+    uint16_t reserved;
+} stream_hello_t;
+
+typedef struct {
+    uint32_t frame;             // Newest frame this message brings the subscriber up to.
+    uint32_t tiles;             // Tile records that follow.
+    uint64_t time_ns;           // CLOCK_MONOTONIC when the frame was captured.
+} stream_frame_t;
+
+typedef struct {
+    uint16_t x, y;              // Tile column and row.
+    uint16_t bytes;             // Encoded pixels that follow, at most STREAM_TILE_MAX.
+    uint16_t reserved;
+} stream_tile_t;
+
+// Decodes one tile of `width` x `height` pixels into `dst` (`stride` bytes between rows). Returns
+// false if `src` is malformed. For subscribers.
+static inline bool stream_decode_tile(const uint8_t *src, int bytes, uint8_t *dst, int stride,
+                                      int width, int height)
+{
+    const uint8_t *end = src + bytes;
+    int x = 0, y = 0;
+    while(src < end && y < height)
+    {
+        int c = *src++;
+        bool literal = c < 128;
+        int count = literal ? c + 1 : c - 126;
+        if(end - src < (literal ? 4 * count : 4))
+            return false;
+        for(int i = 0; i < count; ++i)
+        {
+            if(y >= height)
+                return false;
+            uint8_t *px = dst + y * stride + x * 4;
+            px[0] = src[0];
+            px[1] = src[1];
+            px[2] = src[2];
+            px[3] = src[3];
+            if(literal)
+                src += 4;
+            if(++x == width)
+            {
+                x = 0;
+                y += 1;
+            }
+        }
+        if(!literal)
+            src += 4;
+    }
+    return src == end && y == height;
+}
+
+/*
+ * Server side, for the plugin.
+ */
+
+typedef struct stream_s stream_t;
+
+typedef struct {
+    int clients;
+    uint64_t frames;            // Submitted.
+    uint64_t tiles_changed;     // Over all frames.
+    uint64_t bytes_sent;        // Over all subscribers, including headers.
+    float diff_us;              // Average time to find a frame's changed tiles.
+} stream_stats_t;
+
+// Starts listening for subscribers to a `width` x `height` screen. Returns NULL (and logs) on
+// failure.
+stream_t *stream_open(const char *device_id, int width, int height);
+// Disconnects everyone and removes the socket.
+void stream_close(stream_t *st);
+
+// Takes a new frame: `stride` bytes between rows, bottom row first. Frames are cropped to the
+// stream's size. Polls, too.
+void stream_submit(stream_t *st, const uint8_t *pixels, int width, int height, int stride,
+                   uint64_t time_ns);
+// Accepts subscribers and sends what they're owed. Call often, whether or not there are new frames.
+void stream_poll(stream_t *st);
+
+void stream_get_stats(const stream_t *st, stream_stats_t *out);
+
+#endif /* ifndef _STREAM_H_ */
@@ -0,0 +1,445 @@
+/*===--------------------------------------------------------------------------------------------===
+ * symbols.c
+ *
+ * Symbol atlas built at first use, and the instanced symbol batcher.
+ *===--------------------------------------------------------------------------------------------===
+ */
+#include "symbols.h"
+#include "gl_procs.h"
+#include "geo.h"
+#include "profiler.h"
+#include "raster.h"
+#include <XPLMGraphics.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+void log_msg(const char *fmt, ...);
+
+#ifndef GL_CLAMP_TO_EDGE
+#define GL_CLAMP_TO_EDGE    (0x812F)
+#endif
+
+// Symbols are drawn in a 32 px box around their centre, rasterised at twice that so they stay
+// sharp when scaled up.
+#define SYM_EXTENT          (16.f)
+#define ATLAS_SCALE         (2)
+#define CELL_SIZE           ((int)(2 * SYM_EXTENT) * ATLAS_SCALE)
+#define ATLAS_CELLS         (4)
+#define ATLAS_SIZE          (CELL_SIZE * ATLAS_CELLS)
+
+_Static_assert(SYM_COUNT <= ATLAS_CELLS * ATLAS_CELLS, "symbol atlas is full");
+
+// Symbol sources, in pixels from the centre, y up:
+//   W w        stroke width for what follows
+//   M x y      start a stroke          L x y   continue it         Z   close it
+//   C x y r    ring                    D x y r disc
+static const char *const sources[SYM_COUNT] = {
+    [SYM_AIRPORT] = "W1.5 C0 0 4.5",
+    [SYM_VOR] = "W1.2 M5 0 L2.5 4.33 L-2.5 4.33 L-5 0 L-2.5 -4.33 L2.5 -4.33 Z D0 0 1",
+    [SYM_DME] = "W1 M-6 -6 L6 -6 L6 6 L-6 6 Z",
+    [SYM_NDB] = "W1 D0 0 2 C0 0 5",
+    [SYM_FIX] = "W1 M-3 -2 L3 -2 L0 3 Z",
+    [SYM_WAYPOINT] = "W1.5 M0 7 L2 2 L7 0 L2 -2 L0 -7 L-2 -2 L-7 0 L-2 2 Z",
+    [SYM_TRAFFIC] = "W1.5 M0 6 L6 0 L0 -6 L-6 0 Z",
+    [SYM_TRAFFIC_NEAR] = "W5 M0 3.5 L3.5 0 L0 -3.5 L-3.5 0 Z",
+    [SYM_ARROW_UP] = "W1.5 M0 -5 L0 5 M-3 2 L0 5 L3 2",
+    [SYM_ARROW_DOWN] = "W1.5 M0 5 L0 -5 M-3 -2 L0 -5 L3 -2",
+};
+
+typedef struct {
+    float x, y;
+    float angle;            // Radians, clockwise.
+    float extent;           // Half the quad's size, in pixels.
+    float u, v;             // Atlas position of the symbol's cell.
+    uint8_t color[4];
+} instance_t;
+
+// Without instancing, each instance is repeated for the six corners of its quad.
+typedef struct {
+    float corner[2];
+    instance_t instance;
+} expanded_t;
+
+static instance_t *queue = NULL;
+static int queue_count = 0;
+static int queue_capacity = 0;
+static expanded_t *expanded = NULL;
+static int expanded_capacity = 0;
+
+static int atlas = 0;
+static enum { GPU_UNTRIED, GPU_INSTANCED, GPU_EXPANDED, GPU_NONE } gpu = GPU_UNTRIED;
+static GLuint program = 0;
+static GLuint corner_vbo = 0;
+static GLuint instance_vbo = 0;
+static GLint cell_uniform = -1;
+
+static unsigned flushes = 0;
+static unsigned last_instances = 0;
+static prof_probe_t flush_probe = PROF_NO_PROBE;
+
+static const char *vertex_src =
+    "#version 120\n"
+    "attribute vec2 a_corner;\n"
+    "attribute vec4 a_place;\n"
+    "attribute vec2 a_cell;\n"
+    "attribute vec4 a_color;\n"
+    "uniform vec2 u_cell;\n"
+    "varying vec2 v_uv;\n"
+    "varying vec4 v_color;\n"
+    "void main() {\n"
+    "    float s = sin(a_place.z), c = cos(a_place.z);\n"
+    "    vec2 p = a_corner * a_place.w;\n"
+    "    vec2 r = vec2(p.x * c + p.y * s, p.y * c - p.x * s);\n"
+    "    v_uv = a_cell + (a_corner * 0.5 + 0.5) * u_cell;\n"
+    "    v_color = vec4(a_color.rgb * a_color.a, a_color.a);\n"
+    "    gl_Position = gl_ModelViewProjectionMatrix * vec4(a_place.xy + r, 0.0, 1.0);\n"
+    "}\n";
+
+static const char *fragment_src =
+    "#version 120\n"
+    "uniform sampler2D u_atlas;\n"
+    "varying vec2 v_uv;\n"
+    "varying vec4 v_color;\n"
+    "void main() {\n"
+    "    gl_FragColor = texture2D(u_atlas, v_uv) * v_color;\n"
+    "}\n";
+
+static const char *const attribs[] = {"a_corner", "a_place", "a_cell", "a_color", NULL};
+
+static const float strip[4][2] = {{-1.f, -1.f}, {1.f, -1.f}, {-1.f, 1.f}, {1.f, 1.f}};
+
+/*
+ * Atlas.
+ */
+
+static float next_number(const char **p)
+{
+    char *end;
+    float v = strtof(*p, &end);
+    *p = end;
+    return v;
+}
+
+static void draw_source(raster_t *img, float cx, float cy, float k, const char *src,
+                        raster_color_t color)
+{
+    float width = 1.f;
+    float x0 = 0.f, y0 = 0.f, px = 0.f, py = 0.f;
+    const char *p = src;
+    while(*p)
+    {
+        char cmd = *p++;
+        switch(cmd)
+        {
+        case 'W':
+            width = next_number(&p);
+            break;
+        case 'M':
+            x0 = px = next_number(&p);
+            y0 = py = next_number(&p);
+            break;
+        case 'L':
+        {
+            float x = next_number(&p), y = next_number(&p);
+            raster_line(img, cx + px * k, cy + py * k, cx + x * k, cy + y * k, width * k, color);
+            px = x;
+            py = y;
+            break;
+        }
+        case 'Z':
+            raster_line(img, cx + px * k, cy + py * k, cx + x0 * k, cy + y0 * k, width * k, color);
+            px = x0;
+            py = y0;
+            break;
+        case 'C':
+        {
+            float x = next_number(&p), y = next_number(&p), r = next_number(&p);
+            raster_ring(img, cx + x * k, cy + y * k, r * k, width * k, color);
+            break;
+        }
+        case 'D':
+        {
+            float x = next_number(&p), y = next_number(&p), r = next_number(&p);
+            raster_disc(img, cx + x * k, cy + y * k, r * k, color);
+            break;
+        }
+        default:
+            break;
+        }
+    }
+}
+
+static bool build_atlas(void)
+{
+    uint8_t *pixels = calloc((size_t)ATLAS_SIZE * ATLAS_SIZE, 4);
+    if(!pixels)
+    {
+        log_msg("symbols: out of memory for the atlas");
+        return false;
+    }
+    raster_t img = {ATLAS_SIZE, ATLAS_SIZE, pixels};
+    for(int i = 0; i < SYM_COUNT; ++i)
+    {
+        float cx = (float)((i % ATLAS_CELLS) * CELL_SIZE) + CELL_SIZE * 0.5f;
+        float cy = (float)((i / ATLAS_CELLS) * CELL_SIZE) + CELL_SIZE * 0.5f;
+        draw_source(&img, cx, cy, (float)ATLAS_SCALE, sources[i],
+                    (raster_color_t){1.f, 1.f, 1.f, 1.f});
+    }
+
+    XPLMGenerateTextureNumbers(&atlas, 1);
+    XPLMBindTexture2d(atlas, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, ATLAS_SIZE, ATLAS_SIZE, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                 pixels);
+    free(pixels);
+    return true;
+}
+
+void sym_raster(raster_t *img, sym_id_t id, float x, float y, float scale, raster_color_t color)
+{
+    if(id >= 0 && id < SYM_COUNT)
+        draw_source(img, x, y, scale, sources[id], color);
+}
+
+/*
+ * Queue.
+ */
+
+void sym_add(sym_id_t id, float x, float y, float rotation_deg, float scale, const float color[4])
+{
+    if(id < 0 || id >= SYM_COUNT)
+        return;
+    if(queue_count == queue_capacity)
+    {
+        int capacity = queue_capacity ? queue_capacity * 2 : 256;
+        instance_t *q = realloc(queue, (size_t)capacity * sizeof(instance_t));
+        if(!q)
+        {
+            log_msg("symbols: out of memory for %d instances", capacity);
+            return;
+        }
+        queue = q;
+        queue_capacity = capacity;
+    }
+
+    instance_t *inst = &queue[queue_count++];
+    inst->x = x;
+    inst->y = y;
+    inst->angle = rotation_deg * (float)DEG2RAD;
+    inst->extent = SYM_EXTENT * scale;
+    inst->u = (float)(id % ATLAS_CELLS) / ATLAS_CELLS;
+    inst->v = (float)(id / ATLAS_CELLS) / ATLAS_CELLS;
+    for(int i = 0; i < 4; ++i)
+    {
+        float c = color[i] < 0.f ? 0.f : (color[i] > 1.f ? 1.f : color[i]);
+        inst->color[i] = (uint8_t)(c * 255.f + 0.5f);
+    }
+}
+
+/*
+ * Drawing.
+ */
+
+static void setup_gpu(void)
+{
+    program = gl_procs_program("symbols", vertex_src, fragment_src, attribs);
+    if(!program)
+    {
+        gpu = GPU_NONE;
+        log_msg("symbols: no shader, drawing in immediate mode");
+        return;
+    }
+    gl_procs.UseProgram(program);
+    gl_procs.Uniform1i(gl_procs.GetUniformLocation(program, "u_atlas"), 0);
+    cell_uniform = gl_procs.GetUniformLocation(program, "u_cell");
+    gl_procs.Uniform2f(cell_uniform, 1.f / ATLAS_CELLS, 1.f / ATLAS_CELLS);
+    gl_procs.UseProgram(0);
+
+    gl_procs.GenBuffers(1, &instance_vbo);
+    if(gl_procs_instancing())
+    {
+        gl_procs.GenBuffers(1, &corner_vbo);
+        gl_procs.BindBuffer(GL_ARRAY_BUFFER, corner_vbo);
+        gl_procs.BufferData(GL_ARRAY_BUFFER, sizeof(strip), strip, GL_STATIC_DRAW);
+        gl_procs.BindBuffer(GL_ARRAY_BUFFER, 0);
+        gpu = GPU_INSTANCED;
+    }
+    else
+    {
+        gpu = GPU_EXPANDED;
+        log_msg("symbols: no instancing, expanding quads on the CPU");
+    }
+}
+
+static void instance_attribs(GLsizei stride, size_t base)
+{
+    gl_procs.VertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, stride,
+                                 (const void *)(base + offsetof(instance_t, x)));
+    gl_procs.VertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride,
+                                 (const void *)(base + offsetof(instance_t, u)));
+    gl_procs.VertexAttribPointer(3, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride,
+                                 (const void *)(base + offsetof(instance_t, color)));
+}
+
+static void draw_instanced(void)
+{
+    gl_procs.BindBuffer(GL_ARRAY_BUFFER, corner_vbo);
+    gl_procs.VertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, NULL);
+    gl_procs.BindBuffer(GL_ARRAY_BUFFER, instance_vbo);
+    gl_procs.BufferData(GL_ARRAY_BUFFER, (ptrdiff_t)queue_count * (ptrdiff_t)sizeof(instance_t),
+                        queue, GL_STREAM_DRAW);
+    instance_attribs(sizeof(instance_t), 0);
+    for(GLuint i = 1; i < 4; ++i)
+        gl_procs.VertexAttribDivisor(i, 1);
+
+    gl_procs.DrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, queue_count);
+
+    // Divisors are sticky, and other code uses these attributes.
+    for(GLuint i = 1; i < 4; ++i)
+        gl_procs.VertexAttribDivisor(i, 0);
+}
+
+static void draw_expanded(void)
+{
+    int count = queue_count * 6;
+    if(count > expanded_capacity)
+    {
+        expanded_t *e = realloc(expanded, (size_t)count * sizeof(expanded_t));
+        if(!e)
+        {
+            log_msg("symbols: out of memory for %d vertices", count);
+            return;
+        }
+        expanded = e;
+        expanded_capacity = count;
+    }
+    static const int order[6] = {0, 1, 2, 2, 1, 3};
+    for(int i = 0; i < queue_count; ++i)
+    {
+        for(int k = 0; k < 6; ++k)
+        {
+            expanded_t *e = &expanded[i * 6 + k];
+            e->corner[0] = strip[order[k]][0];
+            e->corner[1] = strip[order[k]][1];
+            e->instance = queue[i];
+        }
+    }
+
+    gl_procs.BindBuffer(GL_ARRAY_BUFFER, instance_vbo);
+    gl_procs.BufferData(GL_ARRAY_BUFFER, (ptrdiff_t)count * (ptrdiff_t)sizeof(expanded_t),
+                        expanded, GL_STREAM_DRAW);
+    gl_procs.VertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(expanded_t), NULL);
+    instance_attribs(sizeof(expanded_t), offsetof(expanded_t, instance));
+    glDrawArrays(GL_TRIANGLES, 0, count);
+}
+
+static void draw_immediate(void)
+{
+    const float cell = 1.f / ATLAS_CELLS;
+    glBegin(GL_QUADS);
+    for(int i = 0; i < queue_count; ++i)
+    {
+        const instance_t *inst = &queue[i];
+        float s = sinf(inst->angle), c = cosf(inst->angle);
+        float a = inst->color[3] / 255.f;
+        glColor4f(inst->color[0] / 255.f * a, inst->color[1] / 255.f * a,
+                  inst->color[2] / 255.f * a, a);
+        static const int order[4] = {0, 1, 3, 2};
+        for(int k = 0; k < 4; ++k)
+        {
+            float px = strip[order[k]][0] * inst->extent, py = strip[order[k]][1] * inst->extent;
+            glTexCoord2f(inst->u + (strip[order[k]][0] * 0.5f + 0.5f) * cell,
+                         inst->v + (strip[order[k]][1] * 0.5f + 0.5f) * cell);
+            glVertex2f(inst->x + px * c + py * s, inst->y + py * c - px * s);
+        }
+    }
+    glEnd();
+}
+
+void sym_flush(void)
+{
+    if(!queue_count)
+        return;
+    PROF_SCOPE(flush_probe);
+    if(!atlas && !build_atlas())
+    {
+        queue_count = 0;
+        return;
+    }
+    if(gpu == GPU_UNTRIED)
+        setup_gpu();
+
+    // The atlas is premultiplied.
+    XPLMSetGraphicsState(0, 1, 0, 0, 1, 0, 0);
+    XPLMBindTexture2d(atlas, 0);
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    if(gpu == GPU_NONE)
+    {
+        draw_immediate();
+    }
+    else
+    {
+        gl_procs.UseProgram(program);
+        for(GLuint i = 0; i < 4; ++i)
+            gl_procs.EnableVertexAttribArray(i);
+        if(gpu == GPU_INSTANCED)
+            draw_instanced();
+        else
+            draw_expanded();
+        for(GLuint i = 0; i < 4; ++i)
+            gl_procs.DisableVertexAttribArray(i);
+        gl_procs.BindBuffer(GL_ARRAY_BUFFER, 0);
+        gl_procs.UseProgram(0);
+    }
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    flushes += 1;
+    last_instances = (unsigned)queue_count;
+    queue_count = 0;
+}
+
+void sym_get_stats(sym_stats_t *out)
+{
+    memset(out, 0, sizeof(*out));
+    out->flushes = flushes;
+    out->instances = last_instances;
+    out->instanced = gpu == GPU_INSTANCED;
+}
+
+void sym_init(void)
+{
+    queue_count = 0;
+    flushes = 0;
+    last_instances = 0;
+    gpu = GPU_UNTRIED;
+    flush_probe = profiler_probe("symbols/flush");
+}
+
+void sym_fini(void)
+{
+    if(program)
+        gl_procs.DeleteProgram(program);
+    if(corner_vbo)
+        gl_procs.DeleteBuffers(1, &corner_vbo);
+    if(instance_vbo)
+        gl_procs.DeleteBuffers(1, &instance_vbo);
+    program = 0;
+    corner_vbo = instance_vbo = 0;
+    gpu = GPU_UNTRIED;
+    if(atlas)
+    {
+        GLuint tex = (GLuint)atlas;
+        glDeleteTextures(1, &tex);
+    }
+    atlas = 0;
+
+    free(queue);
+    free(expanded);
+    queue = NULL;
+    expanded = NULL;
+    queue_count = queue_capacity = expanded_capacity = 0;
+}
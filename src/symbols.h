@@ -0,0 +1,62 @@
+/*===--------------------------------------------------------------------------------------------===
+ * symbols.h
+ *
+ * Symbol atlas and instanced symbol drawing: navaid, waypoint and traffic symbols by the
+ * thousand, in one draw call.
+ *
+ * Symbols are described as small SVG-like stroke paths. The first time they're needed, they're
+ * rasterised (with raster.h) into one atlas texture, white so each instance can be tinted. Each
+ * frame, callers queue instances (symbol, position, rotation, scale, colour), and sym_flush()
+ * uploads them as one buffer and draws them all with a single instanced call: each instance
+ * expands a shared unit quad in the vertex shader. Where instancing isn't available the quads are
+ * expanded on the CPU instead, still in one call.
+ *
+ * The same sources draw the navaids baked into the moving map's tiles (sym_raster()), so a symbol
+ * looks the same whichever way it's drawn.
+ *
+ * Main thread only, inside draw callbacks, except sym_raster().
+ *===--------------------------------------------------------------------------------------------===
+*/
+#ifndef _SYMBOLS_H_
+#define _SYMBOLS_H_
+
+#include "raster.h"
+#include <stdbool.h>
+
+typedef enum {
+    SYM_AIRPORT,
+    SYM_VOR,
+    SYM_DME,
+    SYM_NDB,
+    SYM_FIX,
+    SYM_WAYPOINT,
+    SYM_TRAFFIC,            // Other traffic: hollow diamond.
+    SYM_TRAFFIC_NEAR,       // Proximate traffic: filled diamond.
+    SYM_ARROW_UP,           // Traffic climbing.
+    SYM_ARROW_DOWN,
+    SYM_COUNT
+} sym_id_t;
+
+typedef struct {
+    unsigned flushes;       // Draw calls since init.
+    unsigned instances;     // Symbols in the last flush.
+    bool instanced;         // Drawing with instancing rather than CPU-expanded quads.
+} sym_stats_t;
+
+// Queues a symbol centred on x, y, rotated clockwise by `rotation_deg`. `scale` 1 is the symbol's
+// native size in pixels. `color` is straight RGBA, 0-1.
+void sym_add(sym_id_t id, float x, float y, float rotation_deg, float scale, const float color[4]);
+
+// Draws everything queued since the last flush, in one call, and empties the queue.
+void sym_flush(void);
+
+void sym_get_stats(sym_stats_t *out);
+
+// Draws a symbol straight into `img`, centred on x, y, in `color`. Touches no GL or shared state,
+// so it's safe from worker threads.
+void sym_raster(raster_t *img, sym_id_t id, float x, float y, float scale, raster_color_t color);
+
+void sym_init(void);
+void sym_fini(void);
+
+#endif /* ifndef _SYMBOLS_H_ */
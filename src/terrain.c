@@ -0,0 +1,514 @@
+/*===--------------------------------------------------------------------------------------------===
+ * terrain.c
+ *
+ * Budgeted terrain probing, height cache and incrementally updated TAWS texture.
+ *===--------------------------------------------------------------------------------------------===
+ */
+#include "terrain.h"
+#include "SystemGL.h"
+#include "clock.h"
+#include "geo.h"
+#include "moving_map.h"
+#include "ownship.h"
+#include "profiler.h"
+#include <XPLMGraphics.h>
+#include <XPLMProcessing.h>
+#include <XPLMScenery.h>
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+void log_msg(const char *fmt, ...);
+
+// Lattice nodes per side. The texture is one texel per node.
+#define GRID                (64)
+#define PROBE_POOL          (4)
+// Per frame: no more probes than this, and no more time (checked every PROBE_CLOCK_STRIDE).
+#define PROBE_BUDGET        (48)
+#define PROBE_BUDGET_NS     (500000ull)
+#define PROBE_CLOCK_STRIDE  (8)
+// Nodes that missed (no scenery loaded there yet) are tried again after this long.
+#define RETRY_S             (5.f)
+
+// Grid steps are powers of two of this many degrees of latitude. Longitude steps are a further
+// power of two wider, closest to 1/cos(lat), so cells stay roughly square.
+#define BASE_STEP_DEG       (1.0 / 1024.0)
+#define MAX_LEVEL           (12)
+#define MAX_LON_SHIFT       (4)
+// The map is about this many ranges wide; we want about this many nodes across it.
+#define SCREEN_RANGES       (2.67)
+#define NODES_ACROSS        (48)
+
+#define CACHE_SETS          (4096)
+#define CACHE_WAYS          (4)
+
+// Colours only change when the aircraft moves by this much.
+#define ALT_STEP_FT         (50.f)
+// The texture is drawn in this many bands of latitude, to follow Mercator's stretch.
+#define DRAW_STRIPS         (16)
+
+typedef struct {
+    uint64_t key;           // 0 for an empty way.
+    float elev_m;
+    uint32_t used;
+} cache_entry_t;
+
+static cache_entry_t cache[CACHE_SETS][CACHE_WAYS];
+static unsigned cache_size = 0;
+static uint32_t tick = 0;
+
+static bool enabled = true;
+static XPLMProbeRef probes[PROBE_POOL];
+static int next_probe = 0;
+static XPLMFlightLoopID flight_loop = NULL;
+
+// The lattice covers nodes [origin_i, origin_i + GRID) x [origin_j, origin_j + GRID). Node (i, j)
+// lives at [i mod GRID][j mod GRID] in the arrays below and in the texture.
+static int level = -1, lon_shift = 0;
+static int32_t origin_i = 0, origin_j = 0;
+static float heights[GRID][GRID];       // Metres MSL, NaN if unknown.
+static float missed_at[GRID][GRID];     // When the last probe of the node missed.
+static uint8_t texels[GRID][GRID][4];
+static bool row_dirty[GRID];
+static float color_alt_ft = NAN;
+
+// Offsets from the lattice's corner, nearest to its centre first, and how far we've gone
+// through them since the lattice last changed.
+static uint16_t order[GRID * GRID];
+static int cursor = 0;
+static float last_retry = 0.f;
+
+static int texture = 0;
+static bool texture_allocated = false;
+
+static unsigned probes_last_frame = 0;
+static unsigned cache_hits = 0;
+static prof_probe_t sample_probe = PROF_NO_PROBE;
+static prof_probe_t draw_probe = PROF_NO_PROBE;
+
+static inline int wrap_index(int32_t v)
+{
+    return ((v % GRID) + GRID) % GRID;
+}
+
+static inline double step_deg(void)
+{
+    return BASE_STEP_DEG * (double)(1 << level);
+}
+
+static inline double node_lat(double i)
+{
+    return i * step_deg();
+}
+
+static inline double node_lon(double j)
+{
+    return geo_wrap_lon(j * step_deg() * (double)(1 << lon_shift));
+}
+
+/*
+ * Height cache: set-associative, least recently used way replaced.
+ */
+
+static uint64_t node_key(int32_t i, int32_t j)
+{
+    // Both fit: |i| < 2^18 and the longitude count is at most 360 * 1024 < 2^19. The count is
+    // rounded up, so coarse steps that don't divide 360 degrees still get distinct keys.
+    int shift = level + lon_shift;
+    int32_t lon_count = (int32_t)((368640 + (1 << shift) - 1) >> shift);
+    assert(lon_count > 0);
+    uint64_t wrapped_j = (uint64_t)(((j % lon_count) + lon_count) % lon_count);
+    return (1ull << 63) | ((uint64_t)level << 56) | ((uint64_t)lon_shift << 52)
+        | ((uint64_t)(i + (1 << 20)) << 24) | wrapped_j;
+}
+
+static cache_entry_t *cache_set(uint64_t key)
+{
+    return cache[(key * 0x9E3779B97F4A7C15ull) >> 52];
+}
+
+static bool cache_get(uint64_t key, float *elev_m)
+{
+    cache_entry_t *set = cache_set(key);
+    for(int w = 0; w < CACHE_WAYS; ++w)
+    {
+        if(set[w].key == key)
+        {
+            set[w].used = tick;
+            *elev_m = set[w].elev_m;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void cache_put(uint64_t key, float elev_m)
+{
+    cache_entry_t *set = cache_set(key);
+    cache_entry_t *victim = &set[0];
+    for(int w = 0; w < CACHE_WAYS; ++w)
+    {
+        if(set[w].key == key || !set[w].key)
+        {
+            victim = &set[w];
+            break;
+        }
+        if(set[w].used < victim->used)
+            victim = &set[w];
+    }
+    if(!victim->key)
+        cache_size += 1;
+    *victim = (cache_entry_t){key, elev_m, tick};
+}
+
+/*
+ * Colours.
+ */
+
+// The usual TAWS bands, relative to the aircraft: solid red well above it, yellow near it,
+// green below it, nothing more than 2000 ft below.
+static void color_texel(int row, int col)
+{
+    uint8_t *t = texels[row][col];
+    float h = heights[row][col];
+    if(isnan(h) || isnan(color_alt_ft))
+    {
+        t[0] = t[1] = t[2] = t[3] = 0;
+        return;
+    }
+    float diff = h * (float)M_TO_FT - color_alt_ft;
+    uint8_t r = 0, g = 0, a = 0;
+    if(diff > 2000.f)
+        r = 255, a = 200;
+    else if(diff > 1000.f)
+        r = g = 255, a = 170;
+    else if(diff > -500.f)
+        r = g = 255, a = 90;
+    else if(diff > -1000.f)
+        g = 255, a = 130;
+    else if(diff > -2000.f)
+        g = 255, a = 60;
+    t[0] = r;
+    t[1] = g;
+    t[2] = 0;
+    t[3] = a;
+}
+
+static void recolor_all(void)
+{
+    for(int row = 0; row < GRID; ++row)
+    {
+        for(int col = 0; col < GRID; ++col)
+            color_texel(row, col);
+        row_dirty[row] = true;
+    }
+}
+
+/*
+ * Sampling.
+ */
+
+static void fill_node(int32_t i, int32_t j)
+{
+    int row = wrap_index(i), col = wrap_index(j);
+    float elev;
+    if(cache_get(node_key(i, j), &elev))
+    {
+        heights[row][col] = elev;
+        cache_hits += 1;
+    }
+    else
+    {
+        heights[row][col] = NAN;
+    }
+    missed_at[row][col] = -RETRY_S;
+    color_texel(row, col);
+    row_dirty[row] = true;
+}
+
+// Moves the lattice to follow the aircraft, keeping whatever nodes are still inside it.
+// Returns whether the lattice moved.
+static bool update_lattice(const ownship_t *own)
+{
+    double target_deg = map_range_nm() * SCREEN_RANGES / NODES_ACROSS / NM_PER_DEG_LAT;
+    int new_level = (int)ceil(log2(target_deg / BASE_STEP_DEG));
+    new_level = new_level < 0 ? 0 : (new_level > MAX_LEVEL ? MAX_LEVEL : new_level);
+    int new_shift = (int)lround(log2(1.0 / fmax(cos(own->lat * DEG2RAD), 0.05)));
+    new_shift = new_shift > MAX_LON_SHIFT ? MAX_LON_SHIFT : new_shift;
+
+    bool reset = new_level != level || new_shift != lon_shift;
+    level = new_level;
+    lon_shift = new_shift;
+    double step = step_deg();
+    int32_t new_i = (int32_t)floor(own->lat / step + 0.5) - GRID / 2;
+    int32_t new_j = (int32_t)floor(geo_wrap_lon(own->lon) / (step * (1 << lon_shift)) + 0.5)
+        - GRID / 2;
+    if(!reset && new_i == origin_i && new_j == origin_j)
+        return false;
+
+    for(int32_t i = new_i; i < new_i + GRID; ++i)
+    {
+        for(int32_t j = new_j; j < new_j + GRID; ++j)
+        {
+            bool kept = !reset && i >= origin_i && i < origin_i + GRID
+                && j >= origin_j && j < origin_j + GRID;
+            if(!kept)
+                fill_node(i, j);
+        }
+    }
+    origin_i = new_i;
+    origin_j = new_j;
+    cursor = 0;
+    return true;
+}
+
+static bool probe_node(int32_t i, int32_t j, float *elev_m)
+{
+    double x, y, z;
+    XPLMWorldToLocal(node_lat(i), node_lon(j), 0.0, &x, &y, &z);
+
+    XPLMProbeInfo_t info = {.structSize = sizeof(XPLMProbeInfo_t)};
+    XPLMProbeRef probe = probes[next_probe];
+    next_probe = (next_probe + 1) % PROBE_POOL;
+    if(XPLMProbeTerrainXYZ(probe, (float)x, (float)y, (float)z, &info) != xplm_ProbeHitTerrain)
+        return false;
+
+    double lat, lon, alt;
+    XPLMLocalToWorld(info.locationX, info.locationY, info.locationZ, &lat, &lon, &alt);
+    *elev_m = (float)alt;
+    return true;
+}
+
+// Returns whether any texel changed.
+static bool sample(float now)
+{
+    // Misses are only worth retrying once in a while, so the cursor restarts from the centre.
+    if(now - last_retry > RETRY_S)
+    {
+        cursor = 0;
+        last_retry = now;
+    }
+
+    uint64_t deadline = clock_now_ns() + PROBE_BUDGET_NS;
+    unsigned count = 0;
+    bool changed = false;
+    while(cursor < GRID * GRID && count < PROBE_BUDGET)
+    {
+        int32_t i = origin_i + order[cursor] / GRID;
+        int32_t j = origin_j + order[cursor] % GRID;
+        int row = wrap_index(i), col = wrap_index(j);
+        cursor += 1;
+        if(!isnan(heights[row][col]) || now - missed_at[row][col] < RETRY_S)
+            continue;
+
+        float elev;
+        if(probe_node(i, j, &elev))
+        {
+            heights[row][col] = elev;
+            cache_put(node_key(i, j), elev);
+            color_texel(row, col);
+            row_dirty[row] = true;
+            changed = true;
+        }
+        else
+        {
+            missed_at[row][col] = now;
+        }
+        count += 1;
+        if(count % PROBE_CLOCK_STRIDE == 0 && clock_now_ns() >= deadline)
+            break;
+    }
+    probes_last_frame = count;
+    return changed;
+}
+
+static float terrain_flight_loop(float since_call, float since_loop, int counter, void *refcon)
+{
+    (void)since_call;
+    (void)since_loop;
+    (void)refcon;
+    probes_last_frame = 0;
+    const ownship_t *own = ownship_get();
+    if(!enabled || !own->valid)
+        return 1.f;
+    PROF_SCOPE(sample_probe);
+    tick = (uint32_t)counter;
+
+    bool changed = update_lattice(own);
+    float alt_ft = roundf((float)(own->elev_m * M_TO_FT) / ALT_STEP_FT) * ALT_STEP_FT;
+    if(alt_ft != color_alt_ft)
+    {
+        color_alt_ft = alt_ft;
+        recolor_all();
+        changed = true;
+    }
+    if(sample(XPLMGetElapsedTime()) || changed)
+        map_invalidate();
+    return -1.f;
+}
+
+/*
+ * Drawing.
+ */
+
+static void upload_dirty_rows(void)
+{
+    XPLMBindTexture2d(texture, 0);
+    if(!texture_allocated)
+    {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, GRID, GRID, 0, GL_RGBA, GL_UNSIGNED_BYTE, texels);
+        texture_allocated = true;
+        memset(row_dirty, 0, sizeof(row_dirty));
+        return;
+    }
+
+    // One upload per run of dirty rows: usually a single row, or a column's worth of them.
+    for(int row = 0; row < GRID;)
+    {
+        if(!row_dirty[row])
+        {
+            row += 1;
+            continue;
+        }
+        int end = row;
+        while(end < GRID && row_dirty[end])
+            row_dirty[end++] = false;
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, row, GRID, end - row, GL_RGBA, GL_UNSIGNED_BYTE,
+                        texels[row]);
+        row = end;
+    }
+}
+
+void terrain_draw(void)
+{
+    if(!enabled || level < 0)
+        return;
+    PROF_SCOPE(draw_probe);
+    if(!texture)
+        XPLMGenerateTextureNumbers(&texture, 1);
+
+    XPLMSetGraphicsState(0, 1, 0, 0, 1, 0, 0);
+    upload_dirty_rows();
+    glColor4f(1.f, 1.f, 1.f, 1.f);
+
+    // Texel centres of the lattice's corner node, in the texture's wrapped coordinates.
+    float u0 = ((float)wrap_index(origin_j) + 0.5f) / GRID;
+    float v0 = ((float)wrap_index(origin_i) + 0.5f) / GRID;
+    float span = (float)(GRID - 1) / GRID;
+    double lon_w = node_lon(origin_j), lon_e = node_lon(origin_j + GRID - 1);
+
+    glBegin(GL_QUADS);
+    for(int s = 0; s < DRAW_STRIPS; ++s)
+    {
+        float f0 = (float)s / DRAW_STRIPS, f1 = (float)(s + 1) / DRAW_STRIPS;
+        double lat0 = node_lat(origin_i + (GRID - 1) * (double)f0);
+        double lat1 = node_lat(origin_i + (GRID - 1) * (double)f1);
+        float x[4], y[4];
+        map_to_screen(lat0, lon_w, &x[0], &y[0]);
+        map_to_screen(lat1, lon_w, &x[1], &y[1]);
+        map_to_screen(lat1, lon_e, &x[2], &y[2]);
+        map_to_screen(lat0, lon_e, &x[3], &y[3]);
+
+        glTexCoord2f(u0, v0 + f0 * span);
+        glVertex2f(x[0], y[0]);
+        glTexCoord2f(u0, v0 + f1 * span);
+        glVertex2f(x[1], y[1]);
+        glTexCoord2f(u0 + span, v0 + f1 * span);
+        glVertex2f(x[2], y[2]);
+        glTexCoord2f(u0 + span, v0 + f0 * span);
+        glVertex2f(x[3], y[3]);
+    }
+    glEnd();
+}
+
+void terrain_set_enabled(bool on)
+{
+    enabled = on;
+}
+
+bool terrain_enabled(void)
+{
+    return enabled;
+}
+
+void terrain_get_stats(terrain_stats_t *out)
+{
+    memset(out, 0, sizeof(*out));
+    out->probes = probes_last_frame;
+    out->cache_hits = cache_hits;
+    out->cache_size = cache_size;
+    if(level < 0)
+        return;
+    int known = 0;
+    for(int row = 0; row < GRID; ++row)
+    {
+        for(int col = 0; col < GRID; ++col)
+            known += !isnan(heights[row][col]);
+    }
+    out->coverage = (float)known / (GRID * GRID);
+}
+
+static int by_distance(const void *a, const void *b)
+{
+    int ia = *(const uint16_t *)a, ib = *(const uint16_t *)b;
+    float c = (GRID - 1) * 0.5f;
+    float dai = ia / GRID - c, daj = ia % GRID - c;
+    float dbi = ib / GRID - c, dbj = ib % GRID - c;
+    float da = dai * dai + daj * daj, db = dbi * dbi + dbj * dbj;
+    return da < db ? -1 : (da > db ? 1 : ia - ib);
+}
+
+void terrain_init(void)
+{
+    memset(cache, 0, sizeof(cache));
+    cache_size = 0;
+    cache_hits = 0;
+    level = -1;
+    lon_shift = 0;
+    color_alt_ft = NAN;
+    cursor = 0;
+    last_retry = 0.f;
+    for(int i = 0; i < GRID * GRID; ++i)
+        order[i] = (uint16_t)i;
+    qsort(order, GRID * GRID, sizeof(order[0]), by_distance);
+
+    for(int i = 0; i < PROBE_POOL; ++i)
+        probes[i] = XPLMCreateProbe(xplm_ProbeY);
+    next_probe = 0;
+    sample_probe = profiler_probe("terrain/sample");
+    draw_probe = profiler_probe("terrain/draw");
+
+    XPLMCreateFlightLoop_t fl = (XPLMCreateFlightLoop_t){
+        .structSize = sizeof(XPLMCreateFlightLoop_t),
+        .phase = xplm_FlightLoop_Phase_AfterFlightModel,
+        .callbackFunc = terrain_flight_loop,
+        .refcon = NULL
+    };
+    flight_loop = XPLMCreateFlightLoop(&fl);
+    XPLMScheduleFlightLoop(flight_loop, -1.f, 1);
+}
+
+void terrain_fini(void)
+{
+    if(flight_loop)
+        XPLMDestroyFlightLoop(flight_loop);
+    flight_loop = NULL;
+    for(int i = 0; i < PROBE_POOL; ++i)
+    {
+        if(probes[i])
+            XPLMDestroyProbe(probes[i]);
+        probes[i] = NULL;
+    }
+    if(texture)
+    {
+        GLuint tex = (GLuint)texture;
+        glDeleteTextures(1, &tex);
+    }
+    texture = 0;
+    texture_allocated = false;
+}
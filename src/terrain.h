@@ -0,0 +1,46 @@
+/*===--------------------------------------------------------------------------------------------===
+ * terrain.h
+ *
+ * TAWS-style terrain display: terrain elevation around ownship, coloured by how far above or
+ * below the aircraft it is, drawn under the moving map.
+ *
+ * Terrain comes from XPLMProbeTerrainXYZ, which costs several microseconds a call, so probing a
+ * whole lattice every frame is out of the question. Instead:
+ *
+ * - The lattice is a geographic grid whose spacing follows the map range. Each frame, the
+ *   sampler probes the grid nodes nearest the aircraft that it doesn't know yet, up to a probe
+ *   count and time budget, with a small pool of probe objects created once at init.
+ * - Samples go into a height cache keyed by grid node, so moving, zooming back to a range used
+ *   before or re-selecting the page reuses what was probed already.
+ * - The display texture is addressed modulo its size, so when the aircraft moves by a grid
+ *   step only the new row or column is filled in and uploaded. It's only recoloured as a whole
+ *   when the aircraft's altitude band changes.
+ *
+ * Probes only hit scenery that's loaded; nodes that miss are drawn empty and retried later.
+ *===--------------------------------------------------------------------------------------------===
+*/
+#ifndef _TERRAIN_H_
+#define _TERRAIN_H_
+
+#include <stdbool.h>
+
+typedef struct {
+    unsigned probes;        // Probes made in the last frame.
+    unsigned cache_hits;    // Lattice nodes filled from the cache since init.
+    unsigned cache_size;    // Entries in the height cache.
+    float coverage;         // Fraction of the lattice with a known height.
+} terrain_stats_t;
+
+void terrain_set_enabled(bool enabled);
+bool terrain_enabled(void);
+
+// Draws the coloured terrain under the map. Called by the moving map, between its projection
+// being set up and its tiles being drawn.
+void terrain_draw(void);
+
+void terrain_get_stats(terrain_stats_t *out);
+
+void terrain_init(void);
+void terrain_fini(void);
+
+#endif /* ifndef _TERRAIN_H_ */
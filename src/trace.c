@@ -0,0 +1,454 @@
+/*===--------------------------------------------------------------------------------------------===
+ * trace.c
+ *
+ * Callback timeline ring buffer and its Chrome JSON / Perfetto exporters.
+ *
+ * Each slot carries the index it was last written for, published after the payload, so the
+ * exporter can tell a complete event from one that is being overwritten while it reads.
+ *===--------------------------------------------------------------------------------------------===
+ */
+#include "trace.h"
+#include "profiler.h"
+#include <XPLMUtilities.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void log_msg(const char *fmt, ...);
+
+// 256k events, 24 bytes each: ~6MB, or about a minute of a busy panel.
+#define TRACE_CAPACITY  (1u << 18)
+#define TRACE_MASK      (TRACE_CAPACITY - 1)
+
+typedef struct {
+    _Atomic uint64_t seq;       // Index + 1 of the event stored here, 0 if never written.
+    _Atomic uint64_t ts_ns;
+    atomic_int probe;
+    _Atomic uint16_t thread;
+    _Atomic uint8_t phase;
+} slot_t;
+
+typedef struct {
+    uint64_t ts_ns;
+    int probe;
+    uint16_t thread;
+    uint8_t phase;
+} event_t;
+
+atomic_bool trace_recording;
+
+static _Atomic(slot_t *) ring = NULL;
+static _Atomic uint64_t head;
+// Threads that have recorded, numbered from 1 in order; also how many there are.
+static atomic_uint next_thread;
+// Threads inside trace_event(), so trace_fini() can wait for them before freeing the ring.
+static atomic_uint writers;
+static _Thread_local uint16_t tls_thread = 0;
+static uint16_t main_thread = 0;
+
+static XPLMCommandRef toggle_cmd = NULL;
+static XPLMCommandRef json_cmd = NULL;
+static XPLMCommandRef perfetto_cmd = NULL;
+
+static inline uint16_t thread_id(void)
+{
+    if(!tls_thread)
+        tls_thread = (uint16_t)(atomic_fetch_add_explicit(&next_thread, 1, memory_order_relaxed) + 1);
+    return tls_thread;
+}
+
+static void record(slot_t *r, int probe, trace_phase_t phase, uint64_t ts_ns)
+{
+    uint64_t idx = atomic_fetch_add_explicit(&head, 1, memory_order_relaxed);
+    slot_t *slot = &r[idx & TRACE_MASK];
+
+    // Invalidate first so a reader never pairs the old sequence number with new data.
+    atomic_store_explicit(&slot->seq, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&slot->ts_ns, ts_ns, memory_order_relaxed);
+    atomic_store_explicit(&slot->probe, probe, memory_order_relaxed);
+    atomic_store_explicit(&slot->thread, thread_id(), memory_order_relaxed);
+    atomic_store_explicit(&slot->phase, (uint8_t)phase, memory_order_relaxed);
+    atomic_store_explicit(&slot->seq, idx + 1, memory_order_release);
+}
+
+void trace_event(int probe, trace_phase_t phase, uint64_t ts_ns)
+{
+    if(probe < 0)
+        return;
+    // Announce ourselves before looking at the ring: either trace_fini() sees us and waits, or we
+    // see it gone.
+    atomic_fetch_add(&writers, 1);
+    slot_t *r = atomic_load(&ring);
+    if(r)
+        record(r, probe, phase, ts_ns);
+    atomic_fetch_sub_explicit(&writers, 1, memory_order_release);
+}
+
+void trace_set_enabled(bool enabled)
+{
+    if(!atomic_load(&ring))
+        return;
+    atomic_store(&trace_recording, enabled);
+    log_msg("tracing %s", enabled ? "enabled" : "disabled");
+}
+
+// Copies the live part of the ring into a flat array, dropping events that were being
+// overwritten, and end events whose begin has already been overwritten. Thread numbers in the
+// events are at most `*threads`; events from threads that started recording since are dropped.
+static event_t *snapshot(size_t *count, unsigned *threads)
+{
+    slot_t *r = atomic_load(&ring);
+    if(!r)
+        return NULL;
+    uint64_t end = atomic_load_explicit(&head, memory_order_acquire);
+    uint64_t start = end > TRACE_CAPACITY ? end - TRACE_CAPACITY : 0;
+    *threads = atomic_load(&next_thread);
+    event_t *events = malloc(sizeof(event_t) * (size_t)(end - start + 1));
+    int *depth = calloc(*threads + 1, sizeof(int));
+    if(!events || !depth)
+    {
+        free(events);
+        free(depth);
+        return NULL;
+    }
+
+    size_t n = 0;
+    for(uint64_t i = start; i < end; ++i)
+    {
+        slot_t *slot = &r[i & TRACE_MASK];
+        if(atomic_load_explicit(&slot->seq, memory_order_acquire) != i + 1)
+            continue;
+        event_t ev = {
+            .ts_ns = atomic_load_explicit(&slot->ts_ns, memory_order_relaxed),
+            .probe = atomic_load_explicit(&slot->probe, memory_order_relaxed),
+            .thread = atomic_load_explicit(&slot->thread, memory_order_relaxed),
+            .phase = atomic_load_explicit(&slot->phase, memory_order_relaxed),
+        };
+        atomic_thread_fence(memory_order_acquire);
+        if(atomic_load_explicit(&slot->seq, memory_order_relaxed) != i + 1)
+            continue;
+
+        if(ev.thread > *threads)
+            continue;
+        int t = ev.thread;
+        if(ev.phase == TRACE_BEGIN)
+        {
+            depth[t] += 1;
+        }
+        else
+        {
+            if(!depth[t])
+                continue;
+            depth[t] -= 1;
+        }
+        events[n++] = ev;
+    }
+    free(depth);
+    *count = n;
+    return events;
+}
+
+static void thread_name(uint16_t thread, char *out, size_t size)
+{
+    if(thread == main_thread)
+        snprintf(out, size, "sim main thread");
+    else
+        snprintf(out, size, "worker %u", (unsigned)thread);
+}
+
+static void write_json_string(FILE *f, const char *str)
+{
+    fputc('"', f);
+    for(; *str; ++str)
+    {
+        if(*str == '"' || *str == '\\')
+            fputc('\\', f);
+        if((unsigned char)*str >= 0x20)
+            fputc(*str, f);
+    }
+    fputc('"', f);
+}
+
+bool trace_write_json(const char *path)
+{
+    size_t count = 0;
+    unsigned threads = 0;
+    event_t *events = snapshot(&count, &threads);
+    if(!events)
+        return false;
+    bool *seen = calloc(threads + 1, sizeof(bool));
+    FILE *f = seen ? fopen(path, "w") : NULL;
+    if(!f)
+    {
+        free(seen);
+        free(events);
+        return false;
+    }
+
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first = true;
+    for(size_t i = 0; i < count; ++i)
+    {
+        const event_t *ev = &events[i];
+        if(!seen[ev->thread])
+        {
+            char name[32];
+            seen[ev->thread] = true;
+            thread_name(ev->thread, name, sizeof(name));
+            fprintf(f, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                    first ? "" : ",\n", (unsigned)ev->thread, name);
+            first = false;
+        }
+        fprintf(f, "%s{\"ph\":\"%c\",\"cat\":\"avionics\",\"name\":", first ? "" : ",\n",
+                ev->phase == TRACE_BEGIN ? 'B' : 'E');
+        write_json_string(f, profiler_probe_name(ev->probe));
+        fprintf(f, ",\"pid\":1,\"tid\":%u,\"ts\":%.3f}", (unsigned)ev->thread, (double)ev->ts_ns / 1000.0);
+        first = false;
+    }
+    fprintf(f, "\n]}\n");
+    fclose(f);
+    free(seen);
+    free(events);
+    return true;
+}
+
+/*
+ * Minimal protobuf encoding of the Perfetto trace format (perfetto/trace/trace.proto):
+ *
+ *   Trace           { repeated TracePacket packet = 1; }
+ *   TracePacket     { uint64 timestamp = 8; uint32 trusted_packet_sequence_id = 10;
+ *                     TrackEvent track_event = 11; uint32 sequence_flags = 13;
+ *                     TrackDescriptor track_descriptor = 60; }
+ *   TrackDescriptor { uint64 uuid = 1; string name = 2; ThreadDescriptor thread = 4; }
+ *   ThreadDescriptor{ int32 pid = 1; int32 tid = 2; string thread_name = 5; }
+ *   TrackEvent      { Type type = 9; uint64 track_uuid = 11; string name = 23; }
+ */
+#define PB_VARINT       (0)
+#define PB_BYTES        (2)
+#define SEQUENCE_ID     (1)
+#define TRACK_UUID_BASE (0xa71000ull)
+#define SEQ_INCREMENTAL_STATE_CLEARED (1)
+#define SLICE_BEGIN     (1)
+#define SLICE_END       (2)
+
+// A field that doesn't fit is not written at all and marks the buffer `overflow`; a message
+// holding one is never written either, so the output stays well-formed, just without it.
+typedef struct {
+    uint8_t data[512];
+    size_t size;
+    bool overflow;
+} pb_buf_t;
+
+static size_t pb_varint_size(uint64_t v)
+{
+    size_t n = 1;
+    for(; v >= 0x80; v >>= 7)
+        n += 1;
+    return n;
+}
+
+// Callers make sure it fits.
+static void pb_varint(pb_buf_t *b, uint64_t v)
+{
+    for(; v >= 0x80; v >>= 7)
+        b->data[b->size++] = (uint8_t)(v | 0x80);
+    b->data[b->size++] = (uint8_t)v;
+}
+
+static bool pb_fits(pb_buf_t *b, size_t size)
+{
+    if(b->size + size > sizeof(b->data))
+        b->overflow = true;
+    return !b->overflow;
+}
+
+static void pb_uint(pb_buf_t *b, unsigned field, uint64_t v)
+{
+    uint64_t tag = ((uint64_t)field << 3) | PB_VARINT;
+    if(!pb_fits(b, pb_varint_size(tag) + pb_varint_size(v)))
+        return;
+    pb_varint(b, tag);
+    pb_varint(b, v);
+}
+
+static void pb_bytes(pb_buf_t *b, unsigned field, const void *data, size_t size)
+{
+    uint64_t tag = ((uint64_t)field << 3) | PB_BYTES;
+    if(!pb_fits(b, pb_varint_size(tag) + pb_varint_size(size) + size))
+        return;
+    pb_varint(b, tag);
+    pb_varint(b, size);
+    memcpy(b->data + b->size, data, size);
+    b->size += size;
+}
+
+static void pb_string(pb_buf_t *b, unsigned field, const char *str)
+{
+    pb_bytes(b, field, str, strlen(str));
+}
+
+static void pb_message(pb_buf_t *b, unsigned field, const pb_buf_t *msg)
+{
+    if(msg->overflow)
+        b->overflow = true;
+    else
+        pb_bytes(b, field, msg->data, msg->size);
+}
+
+static void write_packet(FILE *f, const pb_buf_t *packet)
+{
+    if(packet->overflow)
+        return;
+    pb_buf_t header = {.size = 0};
+    pb_varint(&header, (1u << 3) | PB_BYTES);
+    pb_varint(&header, packet->size);
+    fwrite(header.data, 1, header.size, f);
+    fwrite(packet->data, 1, packet->size, f);
+}
+
+static void write_thread_track(FILE *f, uint16_t thread, bool first)
+{
+    char name[32];
+    thread_name(thread, name, sizeof(name));
+
+    pb_buf_t desc_thread = {.size = 0};
+    pb_uint(&desc_thread, 1, 1);
+    pb_uint(&desc_thread, 2, thread);
+    pb_string(&desc_thread, 5, name);
+
+    pb_buf_t desc = {.size = 0};
+    pb_uint(&desc, 1, TRACK_UUID_BASE + thread);
+    pb_string(&desc, 2, name);
+    pb_message(&desc, 4, &desc_thread);
+
+    pb_buf_t packet = {.size = 0};
+    pb_uint(&packet, 10, SEQUENCE_ID);
+    if(first)
+        pb_uint(&packet, 13, SEQ_INCREMENTAL_STATE_CLEARED);
+    pb_message(&packet, 60, &desc);
+    write_packet(f, &packet);
+}
+
+bool trace_write_perfetto(const char *path)
+{
+    size_t count = 0;
+    unsigned threads = 0;
+    event_t *events = snapshot(&count, &threads);
+    if(!events)
+        return false;
+    bool *seen = calloc(threads + 1, sizeof(bool));
+    FILE *f = seen ? fopen(path, "wb") : NULL;
+    if(!f)
+    {
+        free(seen);
+        free(events);
+        return false;
+    }
+
+    bool first = true;
+    for(size_t i = 0; i < count; ++i)
+    {
+        if(!seen[events[i].thread])
+        {
+            seen[events[i].thread] = true;
+            write_thread_track(f, events[i].thread, first);
+            first = false;
+        }
+    }
+
+    for(size_t i = 0; i < count; ++i)
+    {
+        const event_t *ev = &events[i];
+        pb_buf_t track_event = {.size = 0};
+        pb_uint(&track_event, 9, ev->phase == TRACE_BEGIN ? SLICE_BEGIN : SLICE_END);
+        pb_uint(&track_event, 11, TRACK_UUID_BASE + ev->thread);
+        if(ev->phase == TRACE_BEGIN)
+        {
+            // A name too long for the packet is left out, so the slice still pairs with its end.
+            pb_buf_t named = track_event;
+            pb_string(&named, 23, profiler_probe_name(ev->probe));
+            if(!named.overflow)
+                track_event = named;
+        }
+
+        pb_buf_t packet = {.size = 0};
+        pb_uint(&packet, 8, ev->ts_ns);
+        pb_uint(&packet, 10, SEQUENCE_ID);
+        pb_message(&packet, 11, &track_event);
+        write_packet(f, &packet);
+    }
+    fclose(f);
+    free(seen);
+    free(events);
+    return true;
+}
+
+static void output_path(char *out, size_t size, const char *file)
+{
+    char root[512];
+    XPLMGetSystemPath(root);
+    snprintf(out, size, "%sOutput%s%s", root, XPLMGetDirectorySeparator(), file);
+}
+
+static int handle_toggle(XPLMCommandRef cmd, XPLMCommandPhase phase, void *refcon)
+{
+    (void)cmd;
+    (void)refcon;
+    if(phase == xplm_CommandBegin)
+        trace_set_enabled(!trace_enabled());
+    return 1;
+}
+
+static int handle_dump(XPLMCommandRef cmd, XPLMCommandPhase phase, void *refcon)
+{
+    (void)cmd;
+    if(phase != xplm_CommandBegin)
+        return 1;
+
+    bool perfetto = refcon != NULL;
+    char path[600];
+    output_path(path, sizeof(path), perfetto ? "avionics_trace.perfetto-trace" : "avionics_trace.json");
+    bool ok = perfetto ? trace_write_perfetto(path) : trace_write_json(path);
+    if(ok)
+        log_msg("trace written to %s", path);
+    else
+        log_msg("cannot write trace to %s", path);
+    return 1;
+}
+
+void trace_init(XPLMMenuID menu)
+{
+    atomic_store(&ring, calloc(TRACE_CAPACITY, sizeof(slot_t)));
+    if(!atomic_load(&ring))
+        log_msg("cannot allocate trace buffer, tracing is unavailable");
+    atomic_store(&head, 0);
+    atomic_store(&trace_recording, false);
+    main_thread = thread_id();
+
+    toggle_cmd = XPLMCreateCommand("laminar/avionics_test/toggle_trace", "Toggle Avionics Callback Tracing");
+    XPLMRegisterCommandHandler(toggle_cmd, handle_toggle, 1, NULL);
+    json_cmd = XPLMCreateCommand("laminar/avionics_test/dump_trace_json", "Write Avionics Trace (Chrome JSON)");
+    XPLMRegisterCommandHandler(json_cmd, handle_dump, 1, NULL);
+    perfetto_cmd = XPLMCreateCommand("laminar/avionics_test/dump_trace_perfetto", "Write Avionics Trace (Perfetto)");
+    XPLMRegisterCommandHandler(perfetto_cmd, handle_dump, 1, (void *)1);
+
+    if(menu)
+    {
+        XPLMAppendMenuItemWithCommand(menu, "Toggle Tracing", toggle_cmd);
+        XPLMAppendMenuItemWithCommand(menu, "Write Trace (Chrome JSON)", json_cmd);
+        XPLMAppendMenuItemWithCommand(menu, "Write Trace (Perfetto)", perfetto_cmd);
+    }
+}
+
+void trace_fini(void)
+{
+    atomic_store(&trace_recording, false);
+    XPLMUnregisterCommandHandler(toggle_cmd, handle_toggle, 1, NULL);
+    XPLMUnregisterCommandHandler(json_cmd, handle_dump, 1, NULL);
+    XPLMUnregisterCommandHandler(perfetto_cmd, handle_dump, 1, (void *)1);
+    slot_t *r = atomic_exchange(&ring, NULL);
+    while(atomic_load_explicit(&writers, memory_order_acquire))
+        ;
+    free(r);
+}
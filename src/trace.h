@@ -0,0 +1,43 @@
+/*===--------------------------------------------------------------------------------------------===
+ * trace.h
+ *
+ * Callback timeline recording, exported as Chrome trace JSON or a Perfetto protobuf trace.
+ *
+ * When tracing is on, every PROF_SCOPE (see profiler.h) also records a begin and an end event
+ * into a ring buffer that is allocated once when the plugin starts. Recording is a few atomic
+ * increments and stores, so tracing can stay on in normal sessions; the ring simply keeps the
+ * most recent events. Dumping happens on the main thread, on command.
+ *===--------------------------------------------------------------------------------------------===
+*/
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <XPLMMenus.h>
+
+typedef enum {
+    TRACE_BEGIN,
+    TRACE_END,
+} trace_phase_t;
+
+extern atomic_bool trace_recording;
+
+static inline bool trace_enabled(void)
+{
+    return atomic_load_explicit(&trace_recording, memory_order_relaxed);
+}
+
+// `probe` is a profiler probe, which gives the event its name.
+void trace_event(int probe, trace_phase_t phase, uint64_t ts_ns);
+
+void trace_set_enabled(bool enabled);
+
+bool trace_write_json(const char *path);
+bool trace_write_perfetto(const char *path);
+
+void trace_init(XPLMMenuID menu);
+void trace_fini(void);
+
+#endif /* ifndef _TRACE_H_ */
@@ -0,0 +1,586 @@
+/*===--------------------------------------------------------------------------------------------===
+ * vector.c
+ *
+ * Stroke tessellation, path cache and the batched, shader anti-aliased draw.
+ *===--------------------------------------------------------------------------------------------===
+ */
+#include "vector.h"
+#include "gl_procs.h"
+#include "geo.h"
+#include "profiler.h"
+#include <XPLMGraphics.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+void log_msg(const char *fmt, ...);
+
+#define MAX_PATHS           (64)
+// Quads reach this far past the stroke's edge, for the anti-aliased fringe.
+#define AA_MARGIN           (1.f)
+// Arcs are split finely enough to stay within this of the true curve.
+#define ARC_TOLERANCE       (0.25f)
+#define ARC_MIN_SEGMENTS    (4)
+// Vertices the queue is sized for up front, on top of every recorded path once.
+#define BATCH_VERTICES      (8192)
+
+typedef struct {
+    float x, y;
+    // The pixel relative to its segment: along it from the start, across it from the centre line.
+    float along, across;
+    float length;
+    float half_width;
+    // Where a polyline joins the segment before and after it, the pixels past the bisector of the
+    // joint belong to the other segment: kept only if along + k * across is >= 0 at the start and
+    // < length at the end. The flags say whether each end is joined at all.
+    float k_start, k_end;
+    float clip_start, clip_end;
+    uint8_t color[4];
+} vertex_t;
+
+typedef struct {
+    vertex_t *v;
+    int count;
+    int capacity;
+} vbuf_t;
+
+static vbuf_t batch = {NULL, 0, 0};
+// The last batch handed to vec_retain(), kept for vec_draw_retained().
+static vbuf_t retained = {NULL, 0, 0};
+static vbuf_t paths[MAX_PATHS];
+static bool path_used[MAX_PATHS];
+static vbuf_t recording = {NULL, 0, 0};
+static bool is_recording = false;
+
+static enum { SHADER_UNTRIED, SHADER_OK, SHADER_FAILED } shader_state = SHADER_UNTRIED;
+static GLuint program = 0;
+static GLuint vbo = 0;
+static GLuint retained_vbo = 0;
+
+static unsigned flushes = 0;
+static unsigned last_vertices = 0;
+static unsigned retains = 0;
+static unsigned grows = 0;
+static int path_vertices = 0;
+static prof_probe_t flush_probe = PROF_NO_PROBE;
+
+static const char *vertex_src =
+    "#version 120\n"
+    "attribute vec2 a_pos;\n"
+    "attribute vec4 a_local;\n"
+    "attribute vec4 a_clip;\n"
+    "attribute vec4 a_color;\n"
+    "varying vec4 v_local;\n"
+    "varying vec4 v_clip;\n"
+    "varying vec4 v_color;\n"
+    "void main() {\n"
+    "    v_local = a_local;\n"
+    "    v_clip = a_clip;\n"
+    "    v_color = a_color;\n"
+    "    gl_Position = gl_ModelViewProjectionMatrix * vec4(a_pos, 0.0, 1.0);\n"
+    "}\n";
+
+// Distance to the segment from (0, 0) to (length, 0), minus the half width, is the signed
+// distance to the stroke's edge; half a pixel either side of it fades from covered to empty.
+// Pixels on the far side of a joint are left to the neighbouring segment, so translucent
+// polylines aren't blended twice where the capsules overlap.
+static const char *fragment_src =
+    "#version 120\n"
+    "varying vec4 v_local;\n"
+    "varying vec4 v_clip;\n"
+    "varying vec4 v_color;\n"
+    "void main() {\n"
+    "    float past = v_local.x - clamp(v_local.x, 0.0, v_local.z);\n"
+    "    float dist = length(vec2(past, v_local.y));\n"
+    "    float cover = clamp(v_local.w + 0.5 - dist, 0.0, 1.0);\n"
+    "    float u_start = v_local.x + v_clip.x * v_local.y;\n"
+    "    float u_end = v_local.x + v_clip.y * v_local.y - v_local.z;\n"
+    "    cover *= 1.0 - v_clip.z * (1.0 - step(0.0, u_start));\n"
+    "    cover *= 1.0 - v_clip.w * step(0.0, u_end);\n"
+    "    gl_FragColor = vec4(v_color.rgb, v_color.a * cover);\n"
+    "}\n";
+
+static const char *const attribs[] = {"a_pos", "a_local", "a_clip", "a_color", NULL};
+
+/*
+ * Tessellation.
+ */
+
+static vbuf_t *target(void)
+{
+    return is_recording ? &recording : &batch;
+}
+
+static bool ensure_capacity(vbuf_t *buf, int needed)
+{
+    if(needed <= buf->capacity)
+        return true;
+    int capacity = buf->capacity ? buf->capacity : 1024;
+    while(capacity < needed)
+        capacity *= 2;
+    vertex_t *v = realloc(buf->v, (size_t)capacity * sizeof(vertex_t));
+    if(!v)
+    {
+        log_msg("vector: out of memory for %d vertices", capacity);
+        return false;
+    }
+    buf->v = v;
+    buf->capacity = capacity;
+    return true;
+}
+
+// The queue and the retained batch swap storage, so they're sized together, outside drawing:
+// at init and whenever a path is recorded.
+static void size_batches(void)
+{
+    int needed = BATCH_VERTICES + path_vertices;
+    ensure_capacity(&batch, needed);
+    ensure_capacity(&retained, needed);
+}
+
+static vertex_t *reserve(vbuf_t *buf, int count)
+{
+    if(buf->count + count > buf->capacity)
+    {
+        // Only a frame busier than the sizing above gets here.
+        if(!ensure_capacity(buf, buf->count + count))
+            return NULL;
+        if(buf != &recording)
+            grows += 1;
+    }
+    vertex_t *out = buf->v + buf->count;
+    buf->count += count;
+    return out;
+}
+
+static void pack_color(const float color[4], uint8_t out[4])
+{
+    for(int i = 0; i < 4; ++i)
+    {
+        float c = color[i] < 0.f ? 0.f : (color[i] > 1.f ? 1.f : color[i]);
+        out[i] = (uint8_t)(c * 255.f + 0.5f);
+    }
+}
+
+// Two triangles covering the segment's capsule and its fringe. Returns the index of the first
+// vertex, or -1.
+static int push_segment(float x0, float y0, float x1, float y1, float half_width,
+                        const uint8_t color[4])
+{
+    vbuf_t *buf = target();
+    vertex_t *v = reserve(buf, 6);
+    if(!v)
+        return -1;
+    float dx = x1 - x0, dy = y1 - y0;
+    float length = sqrtf(dx * dx + dy * dy);
+    if(length > 1e-4f)
+        dx /= length, dy /= length;
+    else
+        dx = 1.f, dy = 0.f, length = 0.f;
+    float nx = -dy, ny = dx;
+    float e = half_width + AA_MARGIN;
+
+    // Corners: start/end along the segment, right/left across it.
+    const float along[4] = {-e, length + e, length + e, -e};
+    const float across[4] = {-e, -e, e, e};
+    const int order[6] = {0, 1, 2, 0, 2, 3};
+    for(int i = 0; i < 6; ++i)
+    {
+        int c = order[i];
+        v[i] = (vertex_t){
+            .x = x0 + dx * along[c] + nx * across[c],
+            .y = y0 + dy * along[c] + ny * across[c],
+            .along = along[c],
+            .across = across[c],
+            .length = length,
+            .half_width = half_width,
+            .color = {color[0], color[1], color[2], color[3]},
+        };
+    }
+    return (int)(v - buf->v);
+}
+
+/*
+ * Joined strokes: segments are pushed as they come, and each joint clips the two segments
+ * meeting there at its bisector, once the second one is known.
+ */
+
+typedef struct {
+    float half_width;
+    uint8_t color[4];
+    int first, last;                // First vertex of the first and last segments, or -1.
+    float x, y;                     // End of the stroke so far.
+} stroke_t;
+
+static void stroke_begin(stroke_t *st, float x, float y, float width, const uint8_t color[4])
+{
+    st->half_width = width * 0.5f;
+    memcpy(st->color, color, 4);
+    st->first = st->last = -1;
+    st->x = x;
+    st->y = y;
+}
+
+static bool segment_dir(const vertex_t *v, float *dx, float *dy)
+{
+    // Vertex 1 is at (length + e, -e) and vertex 0 at (-e, -e): their difference is along it.
+    if(v[0].length <= 1e-4f)
+        return false;
+    float ux = v[1].x - v[0].x, uy = v[1].y - v[0].y;
+    float n = sqrtf(ux * ux + uy * uy);
+    *dx = ux / n;
+    *dy = uy / n;
+    return true;
+}
+
+static void join(int a, int b)
+{
+    vertex_t *va = target()->v + a, *vb = target()->v + b;
+    float ax, ay, bx, by;
+    if(!segment_dir(va, &ax, &ay) || !segment_dir(vb, &bx, &by))
+        return;
+    // With c the cosine of the turn, the bisector is along + k * across = 0 about the joint, where
+    // k is the tangent of half the turn. A U-turn has no bisector to speak of.
+    float c = ax * bx + ay * by;
+    float s = -ay * bx + ax * by;
+    if(1.f + c < 1e-3f)
+        return;
+    float k = s / (1.f + c);
+    for(int i = 0; i < 6; ++i)
+    {
+        va[i].k_end = k;
+        va[i].clip_end = 1.f;
+        vb[i].k_start = -k;
+        vb[i].clip_start = 1.f;
+    }
+}
+
+static void stroke_to(stroke_t *st, float x, float y)
+{
+    int seg = push_segment(st->x, st->y, x, y, st->half_width, st->color);
+    if(seg >= 0 && st->last >= 0)
+        join(st->last, seg);
+    if(st->first < 0)
+        st->first = seg;
+    st->last = seg;
+    st->x = x;
+    st->y = y;
+}
+
+static void stroke_close(stroke_t *st)
+{
+    if(st->first >= 0 && st->last >= 0 && st->first != st->last)
+        join(st->last, st->first);
+}
+
+void vec_line(float x0, float y0, float x1, float y1, float width, const float color[4])
+{
+    uint8_t c[4];
+    pack_color(color, c);
+    push_segment(x0, y0, x1, y1, width * 0.5f, c);
+}
+
+void vec_polyline(const float *xy, int count, bool closed, float width, const float color[4])
+{
+    if(count < 2)
+        return;
+    uint8_t c[4];
+    pack_color(color, c);
+    stroke_t st;
+    stroke_begin(&st, xy[0], xy[1], width, c);
+    for(int i = 1; i < count; ++i)
+        stroke_to(&st, xy[2 * i], xy[2 * i + 1]);
+    if(closed && count > 2)
+    {
+        stroke_to(&st, xy[0], xy[1]);
+        stroke_close(&st);
+    }
+}
+
+void vec_arc(float cx, float cy, float radius, float from_deg, float sweep_deg, float width,
+             const float color[4])
+{
+    if(radius <= 0.f || sweep_deg == 0.f)
+        return;
+    uint8_t c[4];
+    pack_color(color, c);
+    float sweep = fminf(fabsf(sweep_deg), 360.f) * (float)DEG2RAD;
+    float step = radius > ARC_TOLERANCE ? 2.f * acosf(1.f - ARC_TOLERANCE / radius) : sweep;
+    int segments = (int)ceilf(sweep / fmaxf(step, 1e-3f));
+    segments = segments < ARC_MIN_SEGMENTS ? ARC_MIN_SEGMENTS : segments;
+
+    float a = from_deg * (float)DEG2RAD;
+    float da = (sweep_deg < 0.f ? -sweep : sweep) / (float)segments;
+    stroke_t st;
+    stroke_begin(&st, cx + radius * sinf(a), cy + radius * cosf(a), width, c);
+    for(int i = 1; i <= segments; ++i)
+        stroke_to(&st, cx + radius * sinf(a + da * i), cy + radius * cosf(a + da * i));
+    if(fabsf(sweep_deg) >= 360.f)
+        stroke_close(&st);
+}
+
+void vec_circle(float cx, float cy, float radius, float width, const float color[4])
+{
+    vec_arc(cx, cy, radius, 0.f, 360.f, width, color);
+}
+
+// A segment along the rectangle's middle whose half width is more than the distance to any of
+// its pixels, so the quad is exactly the rectangle and every pixel in it is fully covered.
+void vec_rect(float x, float y, float w, float h, const float color[4])
+{
+    if(w <= 0.f || h <= 0.f)
+        return;
+    vertex_t *v = reserve(target(), 6);
+    if(!v)
+        return;
+    uint8_t c[4];
+    pack_color(color, c);
+    const float half = h * 0.5f;
+    const float along[4] = {0.f, w, w, 0.f};
+    const float across[4] = {-half, -half, half, half};
+    const int order[6] = {0, 1, 2, 0, 2, 3};
+    for(int i = 0; i < 6; ++i)
+    {
+        int k = order[i];
+        v[i] = (vertex_t){
+            .x = x + along[k],
+            .y = y + half + across[k],
+            .along = along[k],
+            .across = across[k],
+            .length = w,
+            .half_width = half + 1.f,
+            .color = {c[0], c[1], c[2], c[3]},
+        };
+    }
+}
+
+/*
+ * Paths.
+ */
+
+void vec_path_begin(void)
+{
+    recording.count = 0;
+    is_recording = true;
+}
+
+vec_path_t vec_path_end(void)
+{
+    is_recording = false;
+    for(int i = 0; i < MAX_PATHS; ++i)
+    {
+        if(path_used[i])
+            continue;
+        // The path keeps the recording's storage, trimmed; recording starts afresh next time.
+        vertex_t *v = realloc(recording.v, (size_t)(recording.count ? recording.count : 1)
+                              * sizeof(vertex_t));
+        paths[i] = (vbuf_t){v ? v : recording.v, recording.count, recording.count};
+        path_used[i] = true;
+        recording = (vbuf_t){NULL, 0, 0};
+        path_vertices += paths[i].count;
+        size_batches();
+        return i;
+    }
+    log_msg("vector: too many paths");
+    return VEC_NO_PATH;
+}
+
+void vec_path_draw(vec_path_t path, float x, float y, float rotation_deg)
+{
+    if(path < 0 || path >= MAX_PATHS || !path_used[path])
+        return;
+    const vbuf_t *src = &paths[path];
+    vertex_t *v = reserve(&batch, src->count);
+    if(!v)
+        return;
+
+    // Local coordinates are relative to each segment, so they don't change with the transform.
+    float a = rotation_deg * (float)DEG2RAD;
+    float s = sinf(a), c = cosf(a);
+    for(int i = 0; i < src->count; ++i)
+    {
+        v[i] = src->v[i];
+        v[i].x = x + src->v[i].x * c + src->v[i].y * s;
+        v[i].y = y - src->v[i].x * s + src->v[i].y * c;
+    }
+}
+
+void vec_path_free(vec_path_t path)
+{
+    if(path < 0 || path >= MAX_PATHS || !path_used[path])
+        return;
+    path_vertices -= paths[path].count;
+    free(paths[path].v);
+    paths[path] = (vbuf_t){NULL, 0, 0};
+    path_used[path] = false;
+}
+
+/*
+ * Drawing.
+ */
+
+static bool ensure_shader(void)
+{
+    if(shader_state == SHADER_UNTRIED)
+    {
+        program = gl_procs_program("vector", vertex_src, fragment_src, attribs);
+        if(program)
+            gl_procs.GenBuffers(1, &vbo);
+        shader_state = program && vbo ? SHADER_OK : SHADER_FAILED;
+        if(shader_state == SHADER_FAILED)
+            log_msg("vector: no shader, strokes won't be anti-aliased");
+    }
+    return shader_state == SHADER_OK;
+}
+
+static void draw_fallback(const vbuf_t *buf, int first, int count)
+{
+    glBegin(GL_TRIANGLES);
+    for(int i = first; i < first + count; ++i)
+    {
+        const vertex_t *v = &buf->v[i];
+        glColor4ub(v->color[0], v->color[1], v->color[2], v->color[3]);
+        glVertex2f(v->x, v->y);
+    }
+    glEnd();
+}
+
+// Draws vertices from `buffer`, which already holds them.
+static void draw_buffer(GLuint buffer, int first, int count)
+{
+    gl_procs.BindBuffer(GL_ARRAY_BUFFER, buffer);
+    gl_procs.UseProgram(program);
+    for(GLuint i = 0; i < 4; ++i)
+        gl_procs.EnableVertexAttribArray(i);
+    const GLsizei stride = sizeof(vertex_t);
+    gl_procs.VertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, stride,
+                                 (const void *)offsetof(vertex_t, x));
+    gl_procs.VertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, stride,
+                                 (const void *)offsetof(vertex_t, along));
+    gl_procs.VertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, stride,
+                                 (const void *)offsetof(vertex_t, k_start));
+    gl_procs.VertexAttribPointer(3, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride,
+                                 (const void *)offsetof(vertex_t, color));
+
+    glDrawArrays(GL_TRIANGLES, first, count);
+
+    for(GLuint i = 0; i < 4; ++i)
+        gl_procs.DisableVertexAttribArray(i);
+    gl_procs.UseProgram(0);
+    gl_procs.BindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+static void upload(GLuint buffer, const vbuf_t *buf)
+{
+    gl_procs.BindBuffer(GL_ARRAY_BUFFER, buffer);
+    gl_procs.BufferData(GL_ARRAY_BUFFER, (ptrdiff_t)buf->count * (ptrdiff_t)sizeof(vertex_t),
+                        buf->v, GL_STREAM_DRAW);
+    gl_procs.BindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void vec_flush(void)
+{
+    if(!batch.count)
+        return;
+    PROF_SCOPE(flush_probe);
+    XPLMSetGraphicsState(0, 0, 0, 0, 1, 0, 0);
+
+    if(!ensure_shader())
+    {
+        draw_fallback(&batch, 0, batch.count);
+    }
+    else
+    {
+        upload(vbo, &batch);
+        draw_buffer(vbo, 0, batch.count);
+    }
+
+    flushes += 1;
+    last_vertices = (unsigned)batch.count;
+    batch.count = 0;
+}
+
+int vec_queued(void)
+{
+    return batch.count;
+}
+
+int vec_retain(void)
+{
+    // The queue takes over the old retained storage, so neither is reallocated from frame to frame.
+    vbuf_t old = retained;
+    retained = batch;
+    batch = (vbuf_t){old.v, 0, old.capacity};
+
+    if(retained.count && ensure_shader())
+    {
+        if(!retained_vbo)
+            gl_procs.GenBuffers(1, &retained_vbo);
+        upload(retained_vbo, &retained);
+    }
+    retains += 1;
+    return retained.count;
+}
+
+void vec_draw_retained(int first, int count)
+{
+    if(first < 0 || count <= 0 || first + count > retained.count)
+        return;
+    PROF_SCOPE(flush_probe);
+    XPLMSetGraphicsState(0, 0, 0, 0, 1, 0, 0);
+    if(shader_state == SHADER_OK && retained_vbo)
+        draw_buffer(retained_vbo, first, count);
+    else
+        draw_fallback(&retained, first, count);
+    flushes += 1;
+}
+
+void vec_get_stats(vec_stats_t *out)
+{
+    memset(out, 0, sizeof(*out));
+    out->flushes = flushes;
+    out->vertices = last_vertices;
+    out->retains = retains;
+    out->retained = (unsigned)retained.count;
+    out->grows = grows;
+    out->shader = shader_state == SHADER_OK;
+    for(int i = 0; i < MAX_PATHS; ++i)
+        out->paths += path_used[i];
+}
+
+void vec_init(void)
+{
+    batch.count = 0;
+    is_recording = false;
+    flushes = 0;
+    last_vertices = 0;
+    retains = 0;
+    grows = 0;
+    shader_state = SHADER_UNTRIED;
+    flush_probe = profiler_probe("vector/flush");
+    size_batches();
+}
+
+void vec_fini(void)
+{
+    if(program)
+        gl_procs.DeleteProgram(program);
+    if(vbo)
+        gl_procs.DeleteBuffers(1, &vbo);
+    if(retained_vbo)
+        gl_procs.DeleteBuffers(1, &retained_vbo);
+    program = 0;
+    vbo = 0;
+    retained_vbo = 0;
+    shader_state = SHADER_UNTRIED;
+
+    for(int i = 0; i < MAX_PATHS; ++i)
+        vec_path_free(i);
+    path_vertices = 0;
+    free(batch.v);
+    free(retained.v);
+    free(recording.v);
+    batch = (vbuf_t){NULL, 0, 0};
+    retained = (vbuf_t){NULL, 0, 0};
+    recording = (vbuf_t){NULL, 0, 0};
+}
@@ -0,0 +1,78 @@
+/*===--------------------------------------------------------------------------------------------===
+ * vector.h
+ *
+ * Anti-aliased 2D strokes (lines, polylines, arcs, circles) at any width, batched.
+ *
+ * glLineWidth() is deprecated, capped at 1 on many drivers and aliased everywhere, and a compass
+ * rose in immediate mode is hundreds of glVertex calls. Instead, each stroke segment is expanded
+ * on the CPU into a screen-space quad a little larger than the stroke, and everything queued
+ * goes to the GPU in one buffer and one draw call at vec_flush(). A fragment shader computes each
+ * pixel's distance to its segment (a capsule, so caps and joins come out round) and turns it
+ * into coverage, which is the anti-aliasing. Segments of one polyline, arc or circle are clipped
+ * to each other at the joints, so translucent strokes aren't blended twice there.
+ *
+ * Static symbology can be recorded once as a path (vec_path_begin() .. vec_path_end()) and
+ * re-queued each frame at any position and rotation, without tessellating it again.
+ *
+ * A whole batch can also be kept on the GPU (vec_retain()) and drawn a range at a time from
+ * several callbacks, which is how render_list.h shares one upload between devices.
+ *
+ * Coordinates are in the current GL projection's units, which in avionics callbacks are pixels.
+ * Main thread only, inside draw callbacks. Without GLSL, strokes are drawn unsmoothed.
+ *===--------------------------------------------------------------------------------------------===
+*/
+#ifndef _VECTOR_H_
+#define _VECTOR_H_
+
+#include <stdbool.h>
+
+#define VEC_NO_PATH     (-1)
+
+typedef int vec_path_t;
+
+typedef struct {
+    unsigned flushes;       // Draw calls since init.
+    unsigned vertices;      // Vertices in the last flush.
+    unsigned retains;       // Batches retained since init.
+    unsigned retained;      // Vertices in the retained batch.
+    unsigned grows;         // Times the queue outgrew its up-front size while drawing.
+    int paths;              // Recorded paths alive.
+    bool shader;            // Drawing with the anti-aliasing shader.
+} vec_stats_t;
+
+// `color` is straight RGBA, 0-1.
+void vec_line(float x0, float y0, float x1, float y1, float width, const float color[4]);
+// `xy` holds `count` points as x, y pairs. `closed` joins the last point back to the first.
+void vec_polyline(const float *xy, int count, bool closed, float width, const float color[4]);
+// Angles in degrees clockwise from north (up), like headings. Sweeps clockwise from `from_deg`.
+void vec_arc(float cx, float cy, float radius, float from_deg, float sweep_deg, float width,
+             const float color[4]);
+void vec_circle(float cx, float cy, float radius, float width, const float color[4]);
+// A filled, axis-aligned rectangle, not smoothed. Queued with the strokes so it batches with them.
+void vec_rect(float x, float y, float w, float h, const float color[4]);
+
+// Draws everything queued since the last flush, in one call, and empties the queue.
+void vec_flush(void);
+
+// Vertices queued since the last flush or retain.
+int vec_queued(void);
+// Uploads everything queued without drawing it, replacing the last retained batch, and empties
+// the queue. Returns the vertices retained.
+int vec_retain(void);
+// Draws `count` vertices of the retained batch from `first`, as counted by vec_queued() while
+// it was being queued.
+void vec_draw_retained(int first, int count);
+
+// Between these, strokes go into a new path rather than the queue.
+void vec_path_begin(void);
+vec_path_t vec_path_end(void);
+// Queues a recorded path, rotated clockwise by `rotation_deg` about its origin, then moved to x, y.
+void vec_path_draw(vec_path_t path, float x, float y, float rotation_deg);
+void vec_path_free(vec_path_t path);
+
+void vec_get_stats(vec_stats_t *out);
+
+void vec_init(void);
+void vec_fini(void);
+
+#endif /* ifndef _VECTOR_H_ */
@@ -0,0 +1,557 @@
+/*===--------------------------------------------------------------------------------------------===
+ * weather.c
+ *
+ * Throttled weather sampling grid, sample cache and interpolated radar texture.
+ *===--------------------------------------------------------------------------------------------===
+ */
+#include "weather.h"
+#include "SystemGL.h"
+#include "geo.h"
+#include "moving_map.h"
+#include "ownship.h"
+#include "profiler.h"
+#include <XPLMGraphics.h>
+#include <XPLMProcessing.h>
+#include <XPLMWeather.h>
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+void log_msg(const char *fmt, ...);
+
+#ifndef GL_CLAMP_TO_EDGE
+#define GL_CLAMP_TO_EDGE    (0x812F)
+#endif
+
+// Grid nodes per side, and texels per side of the interpolated picture.
+#define GRID                (16)
+#define TEX_SIZE            (64)
+// Weather calls: at most this many a second, and never two less than WX_MIN_FRAMES frames apart,
+// so no frame rate makes it a per-frame call. The grid (GRID * GRID * 2 nodes) takes a couple of
+// minutes to fill, nearest nodes first.
+#define WX_CALLS_PER_S      (4.f)
+#define WX_MIN_FRAMES       (10)
+// Samples older than this are taken again, oldest first, once the grid is complete. Longer than a
+// full pass over the grid takes at WX_CALLS_PER_S, so refreshing never starves new nodes.
+#define WX_MAX_AGE_S        (180.f)
+// The picture is rebuilt from the samples at most this often.
+#define REBUILD_S           (0.25f)
+
+// Like the terrain lattice, steps are powers of two of this many degrees of latitude, and
+// longitude steps a further power of two wider away from the equator.
+#define BASE_STEP_DEG       (1.0 / 64.0)
+#define MAX_LEVEL           (8)
+#define MAX_LON_SHIFT       (4)
+#define SCREEN_RANGES       (2.67)
+// Altitude planes are this far apart. The aircraft is always between two of them.
+#define ALT_STEP_FT         (4000.0)
+#define MAX_ALT_PLANE       (12)
+
+#define CACHE_SETS          (1024)
+#define CACHE_WAYS          (4)
+
+#define DRAW_STRIPS         (8)
+
+typedef struct {
+    uint64_t key;           // 0 for an empty way.
+    weather_sample_t sample;
+    float taken;            // Elapsed sim time.
+    uint32_t used;
+} cache_entry_t;
+
+static cache_entry_t cache[CACHE_SETS][CACHE_WAYS];
+static unsigned cache_size = 0;
+static uint32_t tick = 0;
+
+static bool enabled = false;
+static XPLMFlightLoopID flight_loop = NULL;
+static float tokens = 0.f;
+static int frames_since_call = 0;
+static unsigned calls = 0;
+
+// The grid covers nodes [origin_i, origin_i + GRID) x [origin_j, origin_j + GRID), on altitude
+// planes `plane` and `plane + 1`, `plane_t` of the way from one to the other.
+static int level = -1, lon_shift = 0;
+static int32_t origin_i = 0, origin_j = 0;
+static int plane = 0;
+static float plane_t = 0.f;
+
+// Offsets from the grid's corner, nearest to its centre first.
+static uint16_t order[GRID * GRID];
+
+static uint8_t texels[TEX_SIZE][TEX_SIZE][4];
+static bool picture_dirty = false;
+static float last_rebuild = -REBUILD_S;
+static int texture = 0;
+static bool texture_allocated = false;
+static bool texture_dirty = false;
+// The grid the picture was last built for, which is what weather_draw() places.
+static int32_t drawn_i = 0, drawn_j = 0;
+static int drawn_level = -1, drawn_shift = 0;
+
+static prof_probe_t sample_probe = PROF_NO_PROBE;
+static prof_probe_t draw_probe = PROF_NO_PROBE;
+
+static inline double lat_step(int lvl)
+{
+    return BASE_STEP_DEG * (double)(1 << lvl);
+}
+
+static inline double lon_step(int lvl, int shift)
+{
+    return lat_step(lvl) * (double)(1 << shift);
+}
+
+/*
+ * Sample cache: set-associative, least recently used way replaced.
+ */
+
+static uint64_t node_key(int32_t i, int32_t j, int k)
+{
+    // Nodes around the parallel: 360 degrees over the step, rounded up so coarse steps that don't
+    // divide it still get distinct keys.
+    int shift = level + lon_shift;
+    int32_t lon_count = (int32_t)((23040 + (1 << shift) - 1) >> shift);
+    assert(lon_count > 0);
+    uint64_t wrapped_j = (uint64_t)(((j % lon_count) + lon_count) % lon_count);
+    return (1ull << 63) | ((uint64_t)level << 48) | ((uint64_t)lon_shift << 44)
+        | ((uint64_t)k << 36) | ((uint64_t)(i + (1 << 14)) << 16) | wrapped_j;
+}
+
+static cache_entry_t *cache_find(uint64_t key)
+{
+    cache_entry_t *set = cache[(key * 0x9E3779B97F4A7C15ull) >> 54];
+    for(int w = 0; w < CACHE_WAYS; ++w)
+    {
+        if(set[w].key == key)
+        {
+            set[w].used = tick;
+            return &set[w];
+        }
+    }
+    return NULL;
+}
+
+static void cache_put(uint64_t key, const weather_sample_t *sample, float now)
+{
+    cache_entry_t *set = cache[(key * 0x9E3779B97F4A7C15ull) >> 54];
+    cache_entry_t *victim = &set[0];
+    for(int w = 0; w < CACHE_WAYS; ++w)
+    {
+        if(set[w].key == key || !set[w].key)
+        {
+            victim = &set[w];
+            break;
+        }
+        if(set[w].used < victim->used)
+            victim = &set[w];
+    }
+    if(!victim->key)
+        cache_size += 1;
+    *victim = (cache_entry_t){key, *sample, now, tick};
+}
+
+/*
+ * Sampling.
+ */
+
+static void update_grid(const ownship_t *own)
+{
+    double target_deg = map_range_nm() * SCREEN_RANGES / (GRID - 1) / NM_PER_DEG_LAT;
+    int new_level = (int)ceil(log2(target_deg / BASE_STEP_DEG));
+    new_level = new_level < 0 ? 0 : (new_level > MAX_LEVEL ? MAX_LEVEL : new_level);
+    int new_shift = (int)lround(log2(1.0 / fmax(cos(own->lat * DEG2RAD), 0.05)));
+    new_shift = new_shift > MAX_LON_SHIFT ? MAX_LON_SHIFT : new_shift;
+
+    int32_t new_i = (int32_t)floor(own->lat / lat_step(new_level) + 0.5) - GRID / 2;
+    int32_t new_j = (int32_t)floor(geo_wrap_lon(own->lon) / lon_step(new_level, new_shift) + 0.5)
+        - GRID / 2;
+    double alt = fmax(own->elev_m * M_TO_FT / ALT_STEP_FT, 0.0);
+    int new_plane = (int)fmin(floor(alt), MAX_ALT_PLANE - 1);
+    float new_t = (float)fmin(alt - new_plane, 1.0);
+
+    if(new_level != level || new_shift != lon_shift || new_i != origin_i || new_j != origin_j
+       || new_plane != plane || fabsf(new_t - plane_t) > 0.05f)
+    {
+        level = new_level;
+        lon_shift = new_shift;
+        origin_i = new_i;
+        origin_j = new_j;
+        plane = new_plane;
+        plane_t = new_t;
+        picture_dirty = true;
+    }
+}
+
+// The node most in need of a sample: the nearest one never sampled, or failing that the oldest
+// one past its age. Returns false if the whole grid is fresh.
+static bool next_node(float now, int32_t *out_i, int32_t *out_j, int *out_k)
+{
+    float oldest = now - WX_MAX_AGE_S;
+    bool found = false;
+    // The plane nearest the aircraft first.
+    int planes[2] = {plane, plane + 1};
+    if(plane_t > 0.5f)
+        planes[0] = plane + 1, planes[1] = plane;
+
+    for(int n = 0; n < GRID * GRID; ++n)
+    {
+        int32_t i = origin_i + order[n] / GRID;
+        int32_t j = origin_j + order[n] % GRID;
+        for(int p = 0; p < 2; ++p)
+        {
+            const cache_entry_t *e = cache_find(node_key(i, j, planes[p]));
+            if(!e || e->taken < oldest)
+            {
+                *out_i = i;
+                *out_j = j;
+                *out_k = planes[p];
+                if(!e)
+                    return true;
+                oldest = e->taken;
+                found = true;
+            }
+        }
+    }
+    return found;
+}
+
+static void take_sample(int32_t i, int32_t j, int k, float now)
+{
+    XPLMWeatherInfo_t info = {.structSize = sizeof(XPLMWeatherInfo_t)};
+    double lat = i * lat_step(level);
+    double lon = geo_wrap_lon(j * lon_step(level, lon_shift));
+    XPLMGetWeatherAtLocation(lat, lon, k * ALT_STEP_FT / M_TO_FT, &info);
+    calls += 1;
+
+    weather_sample_t sample = {
+        .precip = fminf(fmaxf(info.precip_rate_alt, 0.f), 1.f),
+        .turbulence = fminf(fmaxf(info.turbulence_alt, 0.f), 1.f),
+        .wind_dir = info.wind_dir_alt,
+        .wind_kts = info.wind_spd_alt * (float)MS_TO_KTS,
+    };
+    cache_put(node_key(i, j, k), &sample, now);
+    picture_dirty = true;
+}
+
+/*
+ * Interpolation.
+ */
+
+// The sample at a node, between the two altitude planes. Returns false if neither is cached.
+static bool node_sample(int32_t i, int32_t j, int k, float t, weather_sample_t *out)
+{
+    const cache_entry_t *lo = cache_find(node_key(i, j, k));
+    const cache_entry_t *hi = cache_find(node_key(i, j, k + 1));
+    if(!lo || !hi)
+    {
+        if(!lo && !hi)
+            return false;
+        *out = (lo ? lo : hi)->sample;
+        return true;
+    }
+    out->precip = lo->sample.precip + t * (hi->sample.precip - lo->sample.precip);
+    out->turbulence = lo->sample.turbulence + t * (hi->sample.turbulence - lo->sample.turbulence);
+    // Wind as a vector, so directions either side of north don't average to south.
+    float lx = lo->sample.wind_kts * sinf(lo->sample.wind_dir * (float)DEG2RAD);
+    float ly = lo->sample.wind_kts * cosf(lo->sample.wind_dir * (float)DEG2RAD);
+    float hx = hi->sample.wind_kts * sinf(hi->sample.wind_dir * (float)DEG2RAD);
+    float hy = hi->sample.wind_kts * cosf(hi->sample.wind_dir * (float)DEG2RAD);
+    float x = lx + t * (hx - lx), y = ly + t * (hy - ly);
+    out->wind_kts = sqrtf(x * x + y * y);
+    out->wind_dir = (float)geo_wrap_360(atan2f(x, y) * RAD2DEG);
+    return true;
+}
+
+bool weather_at(double lat, double lon, double alt_m, weather_sample_t *out)
+{
+    if(level < 0)
+        return false;
+    double fi = lat / lat_step(level);
+    double fj = geo_wrap_lon(lon) / lon_step(level, lon_shift);
+    int32_t i = (int32_t)floor(fi), j = (int32_t)floor(fj);
+    double alt = fmax(alt_m * M_TO_FT / ALT_STEP_FT, 0.0);
+    int k = (int)fmin(floor(alt), MAX_ALT_PLANE - 1);
+    float t = (float)fmin(alt - k, 1.0);
+    float wi = (float)(fi - i), wj = (float)(fj - j);
+
+    // Bilinear over whichever corners are known, wind again as a vector.
+    float weight = 0.f, precip = 0.f, turb = 0.f, wx = 0.f, wy = 0.f;
+    for(int c = 0; c < 4; ++c)
+    {
+        weather_sample_t s;
+        if(!node_sample(i + (c >> 1), j + (c & 1), k, t, &s))
+            continue;
+        float w = ((c >> 1) ? wi : 1.f - wi) * ((c & 1) ? wj : 1.f - wj);
+        weight += w;
+        precip += w * s.precip;
+        turb += w * s.turbulence;
+        wx += w * s.wind_kts * sinf(s.wind_dir * (float)DEG2RAD);
+        wy += w * s.wind_kts * cosf(s.wind_dir * (float)DEG2RAD);
+    }
+    if(weight <= 1e-6f)
+        return false;
+    out->precip = precip / weight;
+    out->turbulence = turb / weight;
+    out->wind_kts = sqrtf(wx * wx + wy * wy) / weight;
+    out->wind_dir = (float)geo_wrap_360(atan2f(wx, wy) * RAD2DEG);
+    return true;
+}
+
+/*
+ * Picture.
+ */
+
+// Radar colours: green, yellow, red and magenta for increasing rain; magenta speckle where it's
+// turbulent whatever the rain.
+static void color_texel(uint8_t *t, float precip, float turb)
+{
+    uint8_t r = 0, g = 0, b = 0, a = 0;
+    if(turb > 0.5f)
+        r = 255, b = 255, a = 150;
+    else if(precip > 0.75f)
+        r = 255, b = 255, a = 140;
+    else if(precip > 0.5f)
+        r = 255, a = 140;
+    else if(precip > 0.25f)
+        r = 255, g = 255, a = 130;
+    else if(precip > 0.05f)
+        g = 200, a = 110;
+    t[0] = r;
+    t[1] = g;
+    t[2] = b;
+    t[3] = a;
+}
+
+static void rebuild_picture(void)
+{
+    float precip[GRID][GRID], turb[GRID][GRID];
+    bool known[GRID][GRID];
+    for(int r = 0; r < GRID; ++r)
+    {
+        for(int c = 0; c < GRID; ++c)
+        {
+            weather_sample_t s;
+            known[r][c] = node_sample(origin_i + r, origin_j + c, plane, plane_t, &s);
+            precip[r][c] = known[r][c] ? s.precip : 0.f;
+            turb[r][c] = known[r][c] ? s.turbulence : 0.f;
+        }
+    }
+
+    // Texel centres run from the first node to the last.
+    const float nodes_per_texel = (float)(GRID - 1) / (TEX_SIZE - 1);
+    for(int tr = 0; tr < TEX_SIZE; ++tr)
+    {
+        float fr = tr * nodes_per_texel;
+        int r = (int)fminf(fr, GRID - 2);
+        float wr = fr - r;
+        for(int tc = 0; tc < TEX_SIZE; ++tc)
+        {
+            float fc = tc * nodes_per_texel;
+            int c = (int)fminf(fc, GRID - 2);
+            float wc = fc - c;
+            float weight = 0.f, p = 0.f, tu = 0.f;
+            for(int n = 0; n < 4; ++n)
+            {
+                int nr = r + (n >> 1), nc = c + (n & 1);
+                if(!known[nr][nc])
+                    continue;
+                float w = ((n >> 1) ? wr : 1.f - wr) * ((n & 1) ? wc : 1.f - wc);
+                weight += w;
+                p += w * precip[nr][nc];
+                tu += w * turb[nr][nc];
+            }
+            if(weight > 0.25f)
+                color_texel(texels[tr][tc], p / weight, tu / weight);
+            else
+                memset(texels[tr][tc], 0, 4);
+        }
+    }
+    drawn_i = origin_i;
+    drawn_j = origin_j;
+    drawn_level = level;
+    drawn_shift = lon_shift;
+    texture_dirty = true;
+}
+
+static float weather_flight_loop(float since_call, float since_loop, int counter, void *refcon)
+{
+    (void)since_loop;
+    (void)refcon;
+    const ownship_t *own = ownship_get();
+    if(!enabled || !own->valid)
+        return 1.f;
+    PROF_SCOPE(sample_probe);
+    tick = (uint32_t)counter;
+    float now = XPLMGetElapsedTime();
+
+    update_grid(own);
+    tokens = fminf(tokens + since_call * WX_CALLS_PER_S, 1.f);
+    frames_since_call += 1;
+    int32_t i, j;
+    int k;
+    if(tokens >= 1.f && frames_since_call >= WX_MIN_FRAMES && next_node(now, &i, &j, &k))
+    {
+        take_sample(i, j, k, now);
+        tokens -= 1.f;
+        frames_since_call = 0;
+    }
+
+    if(picture_dirty && now - last_rebuild >= REBUILD_S)
+    {
+        rebuild_picture();
+        picture_dirty = false;
+        last_rebuild = now;
+        map_invalidate();
+    }
+    return -1.f;
+}
+
+/*
+ * Drawing.
+ */
+
+void weather_draw(void)
+{
+    if(!enabled || drawn_level < 0)
+        return;
+    PROF_SCOPE(draw_probe);
+    if(!texture)
+        XPLMGenerateTextureNumbers(&texture, 1);
+
+    XPLMSetGraphicsState(0, 1, 0, 0, 1, 0, 0);
+    XPLMBindTexture2d(texture, 0);
+    if(!texture_allocated)
+    {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, TEX_SIZE, TEX_SIZE, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                     texels);
+        texture_allocated = true;
+        texture_dirty = false;
+    }
+    else if(texture_dirty)
+    {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, TEX_SIZE, TEX_SIZE, GL_RGBA, GL_UNSIGNED_BYTE,
+                        texels);
+        texture_dirty = false;
+    }
+    glColor4f(1.f, 1.f, 1.f, 1.f);
+
+    // Texel centres sit on the grid's first and last nodes.
+    const float t0 = 0.5f / TEX_SIZE, t1 = 1.f - t0;
+    double lat_s = drawn_i * lat_step(drawn_level);
+    double lat_n = (drawn_i + GRID - 1) * lat_step(drawn_level);
+    double lon_w = geo_wrap_lon(drawn_j * lon_step(drawn_level, drawn_shift));
+    double lon_e = geo_wrap_lon((drawn_j + GRID - 1) * lon_step(drawn_level, drawn_shift));
+
+    glBegin(GL_QUADS);
+    for(int s = 0; s < DRAW_STRIPS; ++s)
+    {
+        float f0 = (float)s / DRAW_STRIPS, f1 = (float)(s + 1) / DRAW_STRIPS;
+        float x[4], y[4];
+        map_to_screen(lat_s + (lat_n - lat_s) * f0, lon_w, &x[0], &y[0]);
+        map_to_screen(lat_s + (lat_n - lat_s) * f1, lon_w, &x[1], &y[1]);
+        map_to_screen(lat_s + (lat_n - lat_s) * f1, lon_e, &x[2], &y[2]);
+        map_to_screen(lat_s + (lat_n - lat_s) * f0, lon_e, &x[3], &y[3]);
+
+        glTexCoord2f(t0, t0 + (t1 - t0) * f0);
+        glVertex2f(x[0], y[0]);
+        glTexCoord2f(t0, t0 + (t1 - t0) * f1);
+        glVertex2f(x[1], y[1]);
+        glTexCoord2f(t1, t0 + (t1 - t0) * f1);
+        glVertex2f(x[2], y[2]);
+        glTexCoord2f(t1, t0 + (t1 - t0) * f0);
+        glVertex2f(x[3], y[3]);
+    }
+    glEnd();
+}
+
+void weather_set_enabled(bool on)
+{
+    enabled = on;
+}
+
+bool weather_enabled(void)
+{
+    return enabled;
+}
+
+void weather_get_stats(weather_stats_t *out)
+{
+    memset(out, 0, sizeof(*out));
+    out->calls = calls;
+    out->cached = cache_size;
+    if(level < 0)
+        return;
+
+    float now = XPLMGetElapsedTime();
+    int sampled = 0;
+    for(int n = 0; n < GRID * GRID; ++n)
+    {
+        for(int k = plane; k <= plane + 1; ++k)
+        {
+            const cache_entry_t *e = cache_find(node_key(origin_i + n / GRID, origin_j + n % GRID,
+                                                         k));
+            if(!e)
+                continue;
+            sampled += 1;
+            out->oldest_s = fmaxf(out->oldest_s, now - e->taken);
+        }
+    }
+    out->coverage = (float)sampled / (2 * GRID * GRID);
+}
+
+static int by_distance(const void *a, const void *b)
+{
+    int ia = *(const uint16_t *)a, ib = *(const uint16_t *)b;
+    float c = (GRID - 1) * 0.5f;
+    float dai = ia / GRID - c, daj = ia % GRID - c;
+    float dbi = ib / GRID - c, dbj = ib % GRID - c;
+    float da = dai * dai + daj * daj, db = dbi * dbi + dbj * dbj;
+    return da < db ? -1 : (da > db ? 1 : ia - ib);
+}
+
+void weather_init(void)
+{
+    memset(cache, 0, sizeof(cache));
+    cache_size = 0;
+    calls = 0;
+    tokens = 0.f;
+    frames_since_call = 0;
+    level = -1;
+    drawn_level = -1;
+    picture_dirty = false;
+    for(int i = 0; i < GRID * GRID; ++i)
+        order[i] = (uint16_t)i;
+    qsort(order, GRID * GRID, sizeof(order[0]), by_distance);
+
+    sample_probe = profiler_probe("weather/sample");
+    draw_probe = profiler_probe("weather/draw");
+
+    XPLMCreateFlightLoop_t fl = (XPLMCreateFlightLoop_t){
+        .structSize = sizeof(XPLMCreateFlightLoop_t),
+        .phase = xplm_FlightLoop_Phase_AfterFlightModel,
+        .callbackFunc = weather_flight_loop,
+        .refcon = NULL
+    };
+    flight_loop = XPLMCreateFlightLoop(&fl);
+    XPLMScheduleFlightLoop(flight_loop, -1.f, 1);
+}
+
+void weather_fini(void)
+{
+    if(flight_loop)
+        XPLMDestroyFlightLoop(flight_loop);
+    flight_loop = NULL;
+    if(texture)
+    {
+        GLuint tex = (GLuint)texture;
+        glDeleteTextures(1, &tex);
+    }
+    texture = 0;
+    texture_allocated = false;
+}
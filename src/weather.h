@@ -0,0 +1,49 @@
+/*===--------------------------------------------------------------------------------------------===
+ * weather.h
+ *
+ * Synthetic weather radar: precipitation and turbulence around ownship, from
+ * XPLMGetWeatherAtLocation, drawn under the moving map.
+ *
+ * The SDK says the weather call isn't meant to be made every frame, so it's never made on demand.
+ * A sampler walks a coarse grid around the aircraft (latitude, longitude, and the two altitude
+ * planes either side of the aircraft) at a throttled rate of a few calls a second, nearest nodes
+ * first, and never in two frames close together. Samples are cached with the time they were
+ * taken and re-sampled once they get old. The display texture is interpolated from whatever
+ * samples are cached, so it fills in gradually, from the aircraft outwards, over a couple of
+ * minutes, then stays current at the same rate.
+ *===--------------------------------------------------------------------------------------------===
+*/
+#ifndef _WEATHER_H_
+#define _WEATHER_H_
+
+#include <stdbool.h>
+
+typedef struct {
+    float precip;           // Precipitation rate ratio, 0-1.
+    float turbulence;       // Turbulence ratio, 0-1.
+    float wind_dir;         // Degrees true, from.
+    float wind_kts;
+} weather_sample_t;
+
+typedef struct {
+    unsigned calls;         // Weather calls since init.
+    unsigned cached;        // Samples in the cache.
+    float coverage;         // Fraction of the current grid sampled.
+    float oldest_s;         // Age of the oldest sample in the current grid.
+} weather_stats_t;
+
+void weather_set_enabled(bool enabled);
+bool weather_enabled(void);
+
+// Interpolated from cached samples only. Returns false if there are none near the point.
+bool weather_at(double lat, double lon, double alt_m, weather_sample_t *out);
+
+// Draws the radar picture under the map. Called by the moving map, after terrain.
+void weather_draw(void);
+
+void weather_get_stats(weather_stats_t *out);
+
+void weather_init(void);
+void weather_fini(void);
+
+#endif /* ifndef _WEATHER_H_ */
@@ -0,0 +1,303 @@
+/*===--------------------------------------------------------------------------------------------===
+ * winds.c
+ *
+ * Per-waypoint wind profiles along the flight plan, fetched in the background.
+ *===--------------------------------------------------------------------------------------------===
+ */
+#include "winds.h"
+#include "fms_mirror.h"
+#include "geo.h"
+#include "profiler.h"
+#include <XPLMProcessing.h>
+#include <XPLMWeather.h>
+#include <string.h>
+
+void log_msg(const char *fmt, ...);
+
+#define WIND_LAYERS         (13)
+// One waypoint fetched per interval.
+#define FETCH_INTERVAL_S    (0.5f)
+// Profiles ahead of the aircraft are fetched again once they're this old.
+#define MAX_AGE_S           (600.f)
+// ETEs are integrated in steps of at most this much.
+#define ETE_STEP_NM         (25.f)
+
+// The wind as the vector the air moves along, so layers and waypoints interpolate cleanly.
+typedef struct {
+    float alt_ft;
+    float east_kts;
+    float north_kts;
+} layer_t;
+
+typedef struct {
+    bool fetched;
+    float fetched_at;
+    int count;              // Layers, sorted by altitude.
+    layer_t layers[WIND_LAYERS];
+} profile_t;
+
+// One per entry of the pilot's plan, kept in step with it by plan_changed().
+static profile_t profiles[FMS_MAX_ENTRIES];
+static int profile_count = 0;
+static XPLMFlightLoopID flight_loop = NULL;
+static unsigned fetches = 0;
+static prof_probe_t fetch_probe = PROF_NO_PROBE;
+
+static void plan_changed(XPLMNavFlightPlan plan, fms_event_t event, int index, void *refcon)
+{
+    (void)refcon;
+    if(plan != xplm_Fpl_Pilot_Primary || index < 0)
+        return;
+
+    switch(event)
+    {
+    case FMS_EVENT_INSERT:
+        if(profile_count >= FMS_MAX_ENTRIES || index > profile_count)
+            return;
+        memmove(&profiles[index + 1], &profiles[index],
+                (size_t)(profile_count - index) * sizeof(profile_t));
+        profiles[index] = (profile_t){0};
+        profile_count += 1;
+        break;
+    case FMS_EVENT_DELETE:
+        if(index >= profile_count)
+            return;
+        memmove(&profiles[index], &profiles[index + 1],
+                (size_t)(profile_count - index - 1) * sizeof(profile_t));
+        profile_count -= 1;
+        break;
+    case FMS_EVENT_MODIFY:
+        if(index < profile_count)
+            profiles[index] = (profile_t){0};
+        break;
+    case FMS_EVENT_ACTIVE:
+        break;
+    }
+}
+
+static void fetch(const fms_entry_t *entry, profile_t *profile, float now)
+{
+    XPLMWeatherInfo_t info = {.structSize = sizeof(XPLMWeatherInfo_t)};
+    XPLMGetWeatherAtLocation(entry->lat, entry->lon, entry->altitude / M_TO_FT, &info);
+    fetches += 1;
+
+    // Insertion sort by altitude, skipping layers that aren't defined.
+    profile->count = 0;
+    for(int i = 0; i < WIND_LAYERS; ++i)
+    {
+        const XPLMWeatherInfoWinds_t *w = &info.wind_layers[i];
+        if(!isfinite(w->alt_msl) || w->alt_msl < -500.f || !isfinite(w->speed) || w->speed < 0.f
+           || !isfinite(w->direction))
+            continue;
+        float kts = w->speed * (float)MS_TO_KTS;
+        float to = (w->direction + 180.f) * (float)DEG2RAD;
+        layer_t layer = {w->alt_msl * (float)M_TO_FT, kts * sinf(to), kts * cosf(to)};
+        int at = profile->count;
+        while(at > 0 && profile->layers[at - 1].alt_ft > layer.alt_ft)
+        {
+            profile->layers[at] = profile->layers[at - 1];
+            at -= 1;
+        }
+        profile->layers[at] = layer;
+        profile->count += 1;
+    }
+    profile->fetched = true;
+    profile->fetched_at = now;
+}
+
+// Nearest waypoints ahead without a profile first, then the ones behind, then stale ones ahead.
+static int next_fetch(const fms_plan_t *plan, float now)
+{
+    int active = plan->displayed >= 0 && plan->displayed < profile_count ? plan->displayed : 0;
+    for(int i = active; i < profile_count; ++i)
+    {
+        if(!profiles[i].fetched)
+            return i;
+    }
+    for(int i = active - 1; i >= 0; --i)
+    {
+        if(!profiles[i].fetched)
+            return i;
+    }
+    int stalest = -1;
+    for(int i = active; i < profile_count; ++i)
+    {
+        if(now - profiles[i].fetched_at < MAX_AGE_S)
+            continue;
+        if(stalest < 0 || profiles[i].fetched_at < profiles[stalest].fetched_at)
+            stalest = i;
+    }
+    return stalest;
+}
+
+static float winds_flight_loop(float since_call, float since_loop, int counter, void *refcon)
+{
+    (void)since_call;
+    (void)since_loop;
+    (void)counter;
+    (void)refcon;
+    const fms_plan_t *plan = fms_mirror_plan(xplm_Fpl_Pilot_Primary);
+    // Only if we somehow missed events: start over.
+    if(plan->count != profile_count)
+    {
+        memset(profiles, 0, sizeof(profiles));
+        profile_count = plan->count;
+    }
+
+    float now = XPLMGetElapsedTime();
+    int index = next_fetch(plan, now);
+    if(index >= 0)
+    {
+        PROF_SCOPE(fetch_probe);
+        fetch(&plan->entries[index], &profiles[index], now);
+    }
+    return FETCH_INTERVAL_S;
+}
+
+/*
+ * Queries.
+ */
+
+static bool profile_at(const profile_t *profile, float alt_ft, float *east, float *north)
+{
+    if(!profile->fetched || !profile->count)
+        return false;
+    const layer_t *l = profile->layers;
+    int n = profile->count;
+    if(alt_ft <= l[0].alt_ft || n == 1)
+    {
+        *east = l[0].east_kts;
+        *north = l[0].north_kts;
+        return true;
+    }
+    if(alt_ft >= l[n - 1].alt_ft)
+    {
+        *east = l[n - 1].east_kts;
+        *north = l[n - 1].north_kts;
+        return true;
+    }
+    int i = 1;
+    while(l[i].alt_ft < alt_ft)
+        i += 1;
+    float span = l[i].alt_ft - l[i - 1].alt_ft;
+    float t = span > 0.f ? (alt_ft - l[i - 1].alt_ft) / span : 0.f;
+    *east = l[i - 1].east_kts + t * (l[i].east_kts - l[i - 1].east_kts);
+    *north = l[i - 1].north_kts + t * (l[i].north_kts - l[i - 1].north_kts);
+    return true;
+}
+
+// The wind vector between the waypoints either side of `along_nm`, weighted by distance.
+static bool vector_at(const fms_plan_t *plan, float along_nm, float alt_ft, float *east,
+                      float *north)
+{
+    int count = plan->count < profile_count ? plan->count : profile_count;
+    if(!count)
+        return false;
+    int lo = 0, hi = count - 1;
+    while(lo + 1 < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if(plan->entries[mid].cum_nm <= along_nm)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    float e0, n0, e1, n1;
+    bool has0 = profile_at(&profiles[lo], alt_ft, &e0, &n0);
+    bool has1 = profile_at(&profiles[hi], alt_ft, &e1, &n1);
+    if(!has0 && !has1)
+        return false;
+    if(!has0 || !has1)
+    {
+        *east = has0 ? e0 : e1;
+        *north = has0 ? n0 : n1;
+        return true;
+    }
+    float span = plan->entries[hi].cum_nm - plan->entries[lo].cum_nm;
+    float t = span > 0.f ? (along_nm - plan->entries[lo].cum_nm) / span : 0.f;
+    t = t < 0.f ? 0.f : (t > 1.f ? 1.f : t);
+    *east = e0 + t * (e1 - e0);
+    *north = n0 + t * (n1 - n0);
+    return true;
+}
+
+bool winds_at(float along_nm, float alt_ft, wind_t *out)
+{
+    float east, north;
+    if(!vector_at(fms_mirror_plan(xplm_Fpl_Pilot_Primary), along_nm, alt_ft, &east, &north))
+        return false;
+    out->kts = sqrtf(east * east + north * north);
+    out->dir = (float)geo_wrap_360(atan2f(east, north) * RAD2DEG + 180.0);
+    return true;
+}
+
+float winds_ete_s(float from_nm, float to_nm, float alt_ft, float tas_kts)
+{
+    const fms_plan_t *plan = fms_mirror_plan(xplm_Fpl_Pilot_Primary);
+    if(plan->count < 2 || tas_kts <= 0.f || to_nm <= from_nm)
+        return NAN;
+
+    float ete = 0.f;
+    bool any = false;
+    for(int i = 1; i < plan->count; ++i)
+    {
+        const fms_entry_t *to = &plan->entries[i];
+        float start = fmaxf(from_nm, plan->entries[i - 1].cum_nm);
+        float end = fminf(to_nm, to->cum_nm);
+        if(end <= start)
+            continue;
+        float crs = to->course * (float)DEG2RAD;
+        float sc = sinf(crs), cc = cosf(crs);
+        int steps = (int)ceilf((end - start) / ETE_STEP_NM);
+        float step = (end - start) / (float)steps;
+        for(int k = 0; k < steps; ++k)
+        {
+            float east = 0.f, north = 0.f;
+            any |= vector_at(plan, start + (k + 0.5f) * step, alt_ft, &east, &north);
+            // Wind triangle: the crosswind is flown off, the rest adds to the ground speed.
+            float tail = east * sc + north * cc;
+            float cross = east * cc - north * sc;
+            float gs = sqrtf(fmaxf(tas_kts * tas_kts - cross * cross, 0.f)) + tail;
+            ete += step / fmaxf(gs, 1.f) * 3600.f;
+        }
+    }
+    return any ? ete : NAN;
+}
+
+void winds_get_stats(winds_stats_t *out)
+{
+    memset(out, 0, sizeof(*out));
+    out->fetches = fetches;
+    for(int i = 0; i < profile_count; ++i)
+    {
+        out->profiles += profiles[i].fetched;
+        out->pending += !profiles[i].fetched;
+    }
+}
+
+void winds_init(void)
+{
+    memset(profiles, 0, sizeof(profiles));
+    profile_count = 0;
+    fetches = 0;
+    fetch_probe = profiler_probe("winds/fetch");
+    fms_mirror_listen(plan_changed, NULL);
+
+    XPLMCreateFlightLoop_t fl = (XPLMCreateFlightLoop_t){
+        .structSize = sizeof(XPLMCreateFlightLoop_t),
+        .phase = xplm_FlightLoop_Phase_AfterFlightModel,
+        .callbackFunc = winds_flight_loop,
+        .refcon = NULL
+    };
+    flight_loop = XPLMCreateFlightLoop(&fl);
+    XPLMScheduleFlightLoop(flight_loop, FETCH_INTERVAL_S, 1);
+}
+
+void winds_fini(void)
+{
+    if(flight_loop)
+        XPLMDestroyFlightLoop(flight_loop);
+    flight_loop = NULL;
+    fms_mirror_unlisten(plan_changed, NULL);
+}
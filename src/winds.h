@@ -0,0 +1,45 @@
+/*===--------------------------------------------------------------------------------------------===
+ * winds.h
+ *
+ * Winds aloft along the pilot's flight plan, for ETA and fuel predictions.
+ *
+ * Predictions are recomputed constantly, but each weather call is costly and isn't meant to be made
+ * every frame. So the service keeps the wind profile (every layer XPLMWeatherInfo_t reports) at
+ * each waypoint, fetched in the background a couple of waypoints a second, nearest ahead of the
+ * aircraft first, and refreshed every few minutes. It follows the plan through the FMS mirror's
+ * change events, so profiles stay with their waypoints as the plan is edited. Queries interpolate
+ * the cached profiles in altitude and along track, and never call the weather API.
+ *
+ * Everything runs on the main thread.
+ *===--------------------------------------------------------------------------------------------===
+*/
+#ifndef _WINDS_H_
+#define _WINDS_H_
+
+#include <stdbool.h>
+
+typedef struct {
+    float dir;              // Degrees true, from.
+    float kts;
+} wind_t;
+
+typedef struct {
+    unsigned fetches;       // Weather calls since init.
+    int profiles;           // Waypoints with a profile.
+    int pending;            // Waypoints waiting for their first one.
+} winds_stats_t;
+
+// The wind `along_nm` from the start of the plan (see fms_entry_t::cum_nm), at `alt_ft` MSL.
+// Returns false if no waypoint near there has a profile yet.
+bool winds_at(float along_nm, float alt_ft, wind_t *out);
+
+// Time to fly the plan from `from_nm` to `to_nm` along track at `tas_kts` and `alt_ft`, with the
+// cached winds. Returns NAN if there are none.
+float winds_ete_s(float from_nm, float to_nm, float alt_ft, float tas_kts);
+
+void winds_get_stats(winds_stats_t *out);
+
+void winds_init(void);
+void winds_fini(void);
+
+#endif /* ifndef _WINDS_H_ */
@@ -0,0 +1,175 @@
+/*===--------------------------------------------------------------------------------------------===
+ * export_view.c
+ *
+ * Reference viewer for the plugin's shared memory screen export (src/export.h). Maps a device's
+ * segment read-only, follows its frames for a while, reporting frame rate, latency and torn reads,
+ * and writes the last frame it saw as a PPM image. Frames are read in place from the mapping: no
+ * copies and no system calls per frame, other than the final snapshot.
+ *
+ *     export_view [device_id] [seconds] [out.ppm]
+ *===--------------------------------------------------------------------------------------------===
+*/
+#include "export.h"
+#include "clock.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+static const export_header_t *map_segment(const char *device_id, size_t *size)
+{
+    char name[EXPORT_NAME_MAX + 1];
+    snprintf(name, sizeof(name), "/xpav-%s", device_id);
+    int fd = shm_open(name, O_RDONLY, 0);
+    if(fd < 0)
+    {
+        fprintf(stderr, "%s: not exported (press X on the device)\n", name);
+        return NULL;
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(export_header_t))
+    {
+        close(fd);
+        fprintf(stderr, "%s: too small\n", name);
+        return NULL;
+    }
+    void *mem = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mem == MAP_FAILED)
+    {
+        fprintf(stderr, "%s: cannot map\n", name);
+        return NULL;
+    }
+    *size = (size_t)st.st_size;
+    return mem;
+}
+
+// Something to do with every pixel of a frame, standing in for uploading it to a texture.
+static uint32_t checksum(const uint8_t *pixels, size_t bytes)
+{
+    uint32_t sum = 0;
+    for(size_t i = 0; i < bytes; i += 64)
+        sum = sum * 31u + pixels[i];
+    return sum;
+}
+
+static void write_ppm(const char *path, const uint8_t *pixels, uint32_t width, uint32_t height)
+{
+    FILE *f = fopen(path, "wb");
+    if(!f)
+    {
+        fprintf(stderr, "cannot write %s\n", path);
+        return;
+    }
+    fprintf(f, "P6\n%u %u\n255\n", width, height);
+    for(uint32_t y = height; y-- > 0;)
+    {
+        for(uint32_t x = 0; x < width; ++x)
+            fwrite(pixels + 4 * ((size_t)y * width + x), 1, 3, f);
+    }
+    fclose(f);
+    printf("wrote %s\n", path);
+}
+
+// Reads the newest frame, in place, or into `copy` if given. Returns its frame number, or 0 if
+// it changed under us (or there's none yet).
+static uint64_t read_latest(const export_header_t *hdr, uint8_t *copy, export_slot_t *info,
+                            uint32_t *sum)
+{
+    uint64_t frame = atomic_load_explicit(&hdr->latest, memory_order_acquire);
+    if(!frame)
+        return 0;
+    uint32_t index = (uint32_t)(frame % hdr->slot_count);
+    const export_slot_t *slot = &hdr->slots[index];
+    uint32_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    if(seq & 1)
+        return 0;
+
+    info->width = slot->width;
+    info->height = slot->height;
+    info->frame = slot->frame;
+    info->time_ns = slot->time_ns;
+    const uint8_t *pixels = export_pixels(hdr, index);
+    size_t bytes = (size_t)info->width * info->height * 4;
+    *sum = checksum(pixels, bytes);
+    if(copy)
+        memcpy(copy, pixels, bytes);
+
+    atomic_thread_fence(memory_order_acquire);
+    if(atomic_load_explicit(&slot->seq, memory_order_relaxed) != seq || info->frame != frame)
+        return 0;
+    return frame;
+}
+
+int main(int argc, char **argv)
+{
+    const char *device_id = argc > 1 ? argv[1] : "TEST_AVIONICS";
+    double seconds = argc > 2 ? atof(argv[2]) : 5.0;
+    const char *out = argc > 3 ? argv[3] : NULL;
+
+    size_t size = 0;
+    const export_header_t *hdr = map_segment(device_id, &size);
+    if(!hdr)
+        return 1;
+    if(hdr->magic != EXPORT_MAGIC || hdr->version != EXPORT_VERSION)
+    {
+        fprintf(stderr, "%s: not an export segment, or a different version\n", device_id);
+        return 1;
+    }
+    printf("%s: up to %ux%u, %u slots\n", device_id, hdr->max_width, hdr->max_height,
+           hdr->slot_count);
+
+    uint64_t last = 0, frames = 0, skipped = 0, torn = 0, latency_ns = 0;
+    uint32_t sum = 0;
+    uint64_t end = clock_now_ns() + (uint64_t)(seconds * 1e9);
+    while(clock_now_ns() < end && atomic_load_explicit(&hdr->alive, memory_order_acquire))
+    {
+        if(atomic_load_explicit(&hdr->latest, memory_order_acquire) == last)
+        {
+            nanosleep(&(struct timespec){0, 1000000}, NULL);
+            continue;
+        }
+        export_slot_t info;
+        uint32_t frame_sum;
+        uint64_t frame = read_latest(hdr, NULL, &info, &frame_sum);
+        if(!frame)
+        {
+            torn += 1;
+            continue;
+        }
+        if(last && frame > last + 1)
+            skipped += frame - last - 1;
+        last = frame;
+        frames += 1;
+        sum ^= frame_sum;
+        latency_ns += clock_now_ns() - info.time_ns;
+    }
+
+    printf("%llu frames (%.1f/s), %llu skipped, %llu torn, %.2f ms capture to view, sum %08x\n",
+           (unsigned long long)frames, (double)frames / seconds, (unsigned long long)skipped,
+           (unsigned long long)torn, frames ? (double)latency_ns / (double)frames / 1e6 : 0.0,
+           sum);
+
+    if(out)
+    {
+        uint8_t *snapshot = malloc((size_t)hdr->max_width * hdr->max_height * 4);
+        export_slot_t info;
+        uint32_t frame_sum;
+        for(int tries = 0; snapshot && tries < 100; ++tries)
+        {
+            if(read_latest(hdr, snapshot, &info, &frame_sum))
+            {
+                write_ppm(out, snapshot, info.width, info.height);
+                break;
+            }
+            nanosleep(&(struct timespec){0, 1000000}, NULL);
+        }
+        free(snapshot);
+    }
+    munmap((void *)hdr, size);
+    return 0;
+}
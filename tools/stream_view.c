@@ -0,0 +1,166 @@
+/*===--------------------------------------------------------------------------------------------===
+ * stream_view.c
+ *
+ * Reference subscriber for the plugin's socket screen stream (src/stream.h). Connects to a
+ * device's socket, applies the changed tiles it's sent to its own copy of the screen for a while,
+ * reporting messages, tiles and bytes a second and latency, and writes the screen as a PPM image.
+ * The first message, the whole screen, is counted apart from the changes that follow.
+ *
+ *     stream_view [device_id] [seconds] [out.ppm]
+ *===--------------------------------------------------------------------------------------------===
+*/
+#include "stream.h"
+#include "clock.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static int connect_device(const char *device_id)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "/tmp/xpav-%s.sock", device_id);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0 || connect(fd, (const struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        fprintf(stderr, "%s: not streaming (press S on the device)\n", addr.sun_path);
+        if(fd >= 0)
+            close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool read_full(int fd, void *buf, size_t bytes)
+{
+    uint8_t *p = buf;
+    while(bytes)
+    {
+        ssize_t got = recv(fd, p, bytes, 0);
+        if(got < 0 && errno == EINTR)
+            continue;
+        if(got <= 0)
+            return false;
+        p += got;
+        bytes -= (size_t)got;
+    }
+    return true;
+}
+
+static void write_ppm(const char *path, const uint8_t *pixels, int width, int height)
+{
+    FILE *f = fopen(path, "wb");
+    if(!f)
+    {
+        fprintf(stderr, "cannot write %s\n", path);
+        return;
+    }
+    fprintf(f, "P6\n%d %d\n255\n", width, height);
+    for(int y = height; y-- > 0;)
+    {
+        for(int x = 0; x < width; ++x)
+            fwrite(pixels + 4 * ((size_t)y * width + x), 1, 3, f);
+    }
+    fclose(f);
+    printf("wrote %s\n", path);
+}
+
+int main(int argc, char **argv)
+{
+    const char *device_id = argc > 1 ? argv[1] : "TEST_AVIONICS";
+    double seconds = argc > 2 ? atof(argv[2]) : 5.0;
+    const char *out = argc > 3 ? argv[3] : NULL;
+
+    int fd = connect_device(device_id);
+    if(fd < 0)
+        return 1;
+    stream_hello_t hello;
+    if(!read_full(fd, &hello, sizeof(hello)) || hello.magic != STREAM_MAGIC
+       || hello.version != STREAM_VERSION || hello.tile != STREAM_TILE)
+    {
+        fprintf(stderr, "%s: not a screen stream, or a different version\n", device_id);
+        close(fd);
+        return 1;
+    }
+    int width = hello.width, height = hello.height;
+    printf("%s: %dx%d, %d px tiles\n", device_id, width, height, hello.tile);
+
+    uint8_t *screen = calloc((size_t)width * height, 4);
+    uint8_t enc[STREAM_TILE_MAX];
+    uint64_t messages = 0, tiles = 0, bytes = sizeof(hello), skipped = 0, latency_ns = 0;
+    uint64_t first_bytes = 0;
+    uint32_t last = 0;
+    int status = 0;
+    uint64_t start = clock_now_ns(), end = start + (uint64_t)(seconds * 1e9);
+    while(screen && clock_now_ns() < end)
+    {
+        struct pollfd pfd = {fd, POLLIN, 0};
+        int wait_ms = (int)((end - clock_now_ns()) / 1000000);
+        if(poll(&pfd, 1, wait_ms > 0 ? wait_ms : 1) <= 0)
+            continue;
+
+        stream_frame_t msg;
+        if(!read_full(fd, &msg, sizeof(msg)))
+        {
+            printf("stream closed\n");
+            break;
+        }
+        bytes += sizeof(msg);
+        for(uint32_t i = 0; i < msg.tiles; ++i)
+        {
+            stream_tile_t rec;
+            if(!read_full(fd, &rec, sizeof(rec)) || rec.bytes > STREAM_TILE_MAX
+               || !read_full(fd, enc, rec.bytes))
+            {
+                fprintf(stderr, "short read\n");
+                status = 1;
+                goto done;
+            }
+            bytes += sizeof(rec) + rec.bytes;
+            int x = rec.x * STREAM_TILE, y = rec.y * STREAM_TILE;
+            if(x >= width || y >= height)
+            {
+                fprintf(stderr, "tile %d,%d is off screen\n", rec.x, rec.y);
+                status = 1;
+                goto done;
+            }
+            int w = width - x < STREAM_TILE ? width - x : STREAM_TILE;
+            int h = height - y < STREAM_TILE ? height - y : STREAM_TILE;
+            uint8_t *dst = screen + ((size_t)y * width + x) * 4;
+            if(!stream_decode_tile(enc, rec.bytes, dst, width * 4, w, h))
+            {
+                fprintf(stderr, "tile %d,%d does not decode\n", rec.x, rec.y);
+                status = 1;
+                goto done;
+            }
+        }
+        if(last && msg.frame > last + 1)
+            skipped += msg.frame - last - 1;
+        last = msg.frame;
+        if(!messages)
+            first_bytes = bytes;
+        messages += 1;
+        tiles += msg.tiles;
+        latency_ns += clock_now_ns() - msg.time_ns;
+    }
+done:;
+    double elapsed = (double)(clock_now_ns() - start) / 1e9;
+    printf("%llu messages (%.1f/s), %llu frames unchanged or merged, %.1f tiles/message, "
+           "%.2f ms capture to view\n",
+           (unsigned long long)messages, (double)messages / elapsed, (unsigned long long)skipped,
+           messages ? (double)tiles / (double)messages : 0.0,
+           messages ? (double)latency_ns / (double)messages / 1e6 : 0.0);
+    printf("%.1f KiB for the first, then %.2f KiB/s\n", (double)first_bytes / 1024.0,
+           (double)(bytes - first_bytes) / elapsed / 1024.0);
+    if(out && screen && messages)
+        write_ppm(out, screen, width, height);
+    free(screen);
+    close(fd);
+    return status;
+}